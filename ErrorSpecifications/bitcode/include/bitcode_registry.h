@@ -0,0 +1,71 @@
+// This file defines the registry of bitcode handles for the BitcodeService.
+// Registration happens on RPC threads while TBB tasks look handles up, so
+// the registry is a concurrent hash map (per-bucket locking) rather than a
+// plain map. Every registration is appended to a local log that is replayed
+// at startup, so handles stay valid across restarts without the client
+// re-registering anything. Entries replayed from the log are validated on
+// their first lookup instead of at startup, which keeps startup instant. The
+// log is rewritten with one line per id after it is replayed, so it does not
+// grow without bound across restarts.
+
+#ifndef ERROR_SPECIFICATIONS_BITCODE_INCLUDE_BITCODE_REGISTRY_H_
+#define ERROR_SPECIFICATIONS_BITCODE_INCLUDE_BITCODE_REGISTRY_H_
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "proto/operations.grpc.pb.h"
+#include "tbb/concurrent_hash_map.h"
+
+namespace error_specifications {
+
+class BitcodeRegistry {
+ public:
+  // Returns true if id is still the handle of the resource at uri.
+  using Validator = std::function<bool(const std::string &id, const Uri &uri)>;
+
+  // Replays log_file, if it exists, and appends new registrations to it.
+  // If log_file is empty, registrations are kept in memory only.
+  BitcodeRegistry(const std::string &log_file, Validator validator);
+
+  // Associates id with uri. Registrations made through this call are
+  // trusted, i.e. never re-validated.
+  void Register(const std::string &id, const Uri &uri);
+
+  // Stores the URI registered for id in out_uri. Returns false if id is
+  // unknown or if it was replayed from the log and no longer validates, in
+  // which case it is forgotten.
+  bool Lookup(const std::string &id, Uri *out_uri);
+
+ private:
+  struct Entry {
+    Uri uri;
+    // False for entries replayed from the log until their first lookup.
+    bool validated;
+  };
+
+  using RegistryTable = tbb::concurrent_hash_map<std::string, Entry>;
+
+  // Replays the log into table_, then compacts it if it held superseded
+  // or unreadable lines.
+  void Load();
+
+  // Rewrites log_file_ with one line per entry of table_. Only called
+  // before the registry is shared.
+  void Compact();
+
+  // Appends a registration to log_file_.
+  void Append(const std::string &id, const Uri &uri);
+
+  std::string log_file_;
+  Validator validator_;
+  RegistryTable table_;
+
+  // Serializes appends to log_file_.
+  std::mutex log_mutex_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_BITCODE_INCLUDE_BITCODE_REGISTRY_H_
@@ -9,6 +9,10 @@
 
 #include "tbb/task.h"
 
+#include "admission_controller.h"
+#include "bitcode_registry.h"
+#include "file_hash_cache.h"
+#include "metrics_service.h"
 #include "operations_service.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
@@ -18,10 +22,32 @@ namespace error_specifications {
 
 constexpr int kChunkSize = 1048576;
 
+// Rough ratio between the in-memory size of a parsed llvm::Module plus the
+// pass results and the size of the bitcode file it was read from. Used to
+// estimate task footprints for admission control.
+constexpr uint64_t kIrBytesPerBitcodeByte = 16;
+
+// Startup configuration of the BitcodeService.
+struct BitcodeServiceOptions {
+  AdmissionOptions admission_options;
+
+  // File in which digests of registered local bitcode files are persisted
+  // across restarts. If empty, digests are cached in memory only.
+  std::string hash_cache_file;
+
+  // Append-only log of bitcode registrations, replayed at startup. If empty,
+  // registrations are lost when the service stops.
+  std::string registry_file;
+};
+
 // Logic and data behind the server's behavior.
 class BitcodeServiceImpl final : public BitcodeService::Service {
-  // A map from the ID to the file location of registered bitcode files.
-  std::unordered_map<std::string, Uri> registered_bitcode_files_;
+  // Digests of local bitcode files, so unchanged files are not re-hashed.
+  FileHashCache hash_cache_;
+
+  // Maps the IDs of registered bitcode files to their locations.
+  // Must be declared after hash_cache_, which validates replayed entries.
+  BitcodeRegistry registry_;
 
   grpc::Status RegisterBitcode(grpc::ServerContext *context,
                                const RegisterBitcodeRequest *request,
@@ -57,13 +83,39 @@ class BitcodeServiceImpl final : public BitcodeService::Service {
   grpc::Status DoRegisterBitcodeFile(const Uri &uri,
                                      std::string *out_bitcode_id);
 
+  // Returns true if id is still the hash of the bitcode at uri. Used to
+  // lazily validate registrations replayed after a restart. Only local
+  // files are checked, which is cheap through hash_cache_.
+  bool IsRegistrationCurrent(const std::string &id, const Uri &uri);
+
  public:
-  // Given a bitcode handle, returns the associated file path.
-  // Returns an empty string if the handle could not be found.
-  grpc::Status GetBitcodeUriForHandle(const Handle &handle, Uri *out_uri) const;
+  BitcodeServiceImpl() : BitcodeServiceImpl(BitcodeServiceOptions()) {}
+  explicit BitcodeServiceImpl(const BitcodeServiceOptions &options)
+      : hash_cache_(options.hash_cache_file),
+        registry_(options.registry_file,
+                  [this](const std::string &id, const Uri &uri) {
+                    return IsRegistrationCurrent(id, uri);
+                  }),
+        admission_controller(&operations_service, options.admission_options) {
+  }
+
+  // Given a bitcode handle, stores the associated URI in out_uri.
+  // Returns INVALID_ARGUMENT if the handle is not registered.
+  grpc::Status GetBitcodeUriForHandle(const Handle &handle, Uri *out_uri);
+
+  // Estimates the memory footprint of a task analyzing the bitcode behind
+  // handle. Returns 0 if the handle or its file cannot be resolved.
+  uint64_t EstimateTaskBytes(const Handle &handle);
 
   // The operations service for managing long-running tasks.
   OperationsServiceImpl operations_service;
+
+  // Bounds how many long-running tasks run at once.
+  // Must be declared after operations_service.
+  AdmissionController admission_controller;
+
+  // Serves the metrics of the process.
+  MetricsServiceImpl metrics_service;
 };
 
 // Handles setting up a task to execute a CalledFunctionsPass related to the
@@ -76,6 +128,8 @@ class GetCalledFunctionsTask : public tbb::task {
   CalledFunctionsRequest request;
   BitcodeServiceImpl *bitcode_service;
   OperationsServiceImpl *operations_service;
+  AdmissionController *admission_controller;
+  AdmissionTicket admission_ticket;
 };
 
 // Handles setting up a task to execute a LocalCalledFunctionsPass related
@@ -88,6 +142,8 @@ class GetLocalCalledFunctionsTask : public tbb::task {
   LocalCalledFunctionsRequest request;
   BitcodeServiceImpl *bitcode_service;
   OperationsServiceImpl *operations_service;
+  AdmissionController *admission_controller;
+  AdmissionTicket admission_ticket;
 };
 
 // Handles setting up a task to execute a FileCalledFunctionsPass related to
@@ -100,6 +156,8 @@ class GetFileCalledFunctionsTask : public tbb::task {
   FileCalledFunctionsRequest request;
   BitcodeServiceImpl *bitcode_service;
   OperationsServiceImpl *operations_service;
+  AdmissionController *admission_controller;
+  AdmissionTicket admission_ticket;
 };
 
 // Handles setting up a task to executed a DefinedFunctionsPass related to the
@@ -112,10 +170,13 @@ class GetDefinedFunctionsTask : public tbb::task {
   DefinedFunctionsRequest request;
   BitcodeServiceImpl *bitcode_service;
   OperationsServiceImpl *operations_service;
+  AdmissionController *admission_controller;
+  AdmissionTicket admission_ticket;
 };
 
 // Start up the BitcodeService.
-void RunBitcodeServer(std::string server_address);
+void RunBitcodeServer(std::string server_address,
+                      const BitcodeServiceOptions &options);
 
 }  // namespace error_specifications.
 
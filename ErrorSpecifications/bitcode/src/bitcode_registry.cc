@@ -0,0 +1,169 @@
+#include "bitcode_registry.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "glog/logging.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+// Each line of the log is "<id>\t<scheme>\t<authority>\t<path>". Later lines
+// for the same id win.
+
+namespace {
+
+// Returns true if the field can be stored in a log line.
+bool IsLoggable(const std::string &field) {
+  return field.find_first_of("\t\n") == std::string::npos;
+}
+
+}  // namespace
+
+BitcodeRegistry::BitcodeRegistry(const std::string &log_file,
+                                 Validator validator)
+    : log_file_(log_file), validator_(std::move(validator)) {
+  if (!log_file_.empty()) Load();
+}
+
+void BitcodeRegistry::Load() {
+  std::ifstream ifs(log_file_);
+  if (!ifs) return;
+
+  std::string line;
+  int num_lines = 0;
+  int num_entries = 0;
+  while (std::getline(ifs, line)) {
+    ++num_lines;
+    std::istringstream fields(line);
+    std::string id, scheme, authority, path;
+    if (!std::getline(fields, id, '\t') ||
+        !std::getline(fields, scheme, '\t') ||
+        !std::getline(fields, authority, '\t') ||
+        !std::getline(fields, path)) {
+      // A line cut short by a crash; skip it.
+      continue;
+    }
+    auto scheme_it = UriSchemes::string_to_scheme.find(scheme);
+    if (id.empty() || scheme_it == UriSchemes::string_to_scheme.end()) {
+      continue;
+    }
+
+    Entry entry;
+    entry.uri.set_scheme(scheme_it->second);
+    entry.uri.set_authority(authority);
+    entry.uri.set_path(path);
+    entry.validated = false;
+
+    RegistryTable::accessor a;
+    table_.insert(a, id);
+    a->second = entry;
+    ++num_entries;
+  }
+  ifs.close();
+  LOG(INFO) << "Replayed " << num_entries << " bitcode registrations from "
+            << log_file_;
+
+  if (num_lines > static_cast<int>(table_.size())) Compact();
+}
+
+void BitcodeRegistry::Compact() {
+  // Write a new log next to the old one and rename it over, so a crash
+  // leaves either the old log or the new one.
+  const std::string tmp_file = log_file_ + ".tmp";
+  {
+    std::ofstream ofs(tmp_file, std::ios::trunc);
+    if (!ofs) {
+      LOG(WARNING) << "Unable to compact bitcode registry " << log_file_;
+      return;
+    }
+    for (const auto &item : table_) {
+      const Uri &uri = item.second.uri;
+      ofs << item.first << "\t"
+          << UriSchemes::scheme_to_string.at(uri.scheme()) << "\t"
+          << uri.authority() << "\t" << uri.path() << "\n";
+    }
+    if (!ofs.flush()) {
+      LOG(WARNING) << "Unable to compact bitcode registry " << log_file_;
+      std::remove(tmp_file.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp_file.c_str(), log_file_.c_str()) != 0) {
+    LOG(WARNING) << "Unable to replace bitcode registry " << log_file_;
+    std::remove(tmp_file.c_str());
+    return;
+  }
+  LOG(INFO) << "Compacted " << log_file_ << " to " << table_.size()
+            << " bitcode registrations";
+}
+
+void BitcodeRegistry::Register(const std::string &id, const Uri &uri) {
+  // Append while holding the accessor so that the log order matches the
+  // order in which concurrent registrations of the same id took effect.
+  RegistryTable::accessor a;
+  const bool inserted = table_.insert(a, id);
+  const bool changed = inserted || !UriCompare()(a->second.uri, uri);
+  a->second.uri = uri;
+  a->second.validated = true;
+  if (changed) Append(id, uri);
+}
+
+bool BitcodeRegistry::Lookup(const std::string &id, Uri *out_uri) {
+  {
+    RegistryTable::const_accessor a;
+    if (!table_.find(a, id)) return false;
+    if (a->second.validated) {
+      *out_uri = a->second.uri;
+      return true;
+    }
+  }
+
+  // First lookup of a replayed entry. Validating may hash the whole file,
+  // so do it without holding the entry, which would block every other
+  // lookup and registration landing in its bucket. Concurrent first
+  // lookups may validate the entry more than once, which is harmless.
+  Uri uri;
+  {
+    RegistryTable::const_accessor a;
+    if (!table_.find(a, id)) return false;
+    uri = a->second.uri;
+  }
+  const bool valid = !validator_ || validator_(id, uri);
+
+  RegistryTable::accessor a;
+  if (!table_.find(a, id)) return false;
+  // Only apply the result if the entry is still the one validated; a
+  // concurrent Register replaces it with a trusted one.
+  if (!a->second.validated && UriCompare()(a->second.uri, uri)) {
+    if (!valid) {
+      LOG(WARNING) << "Forgetting stale bitcode registration " << id << " for "
+                   << a->second.uri;
+      table_.erase(a);
+      return false;
+    }
+    a->second.validated = true;
+  }
+  *out_uri = a->second.uri;
+  return true;
+}
+
+void BitcodeRegistry::Append(const std::string &id, const Uri &uri) {
+  if (log_file_.empty()) return;
+  if (!IsLoggable(uri.authority()) || !IsLoggable(uri.path())) {
+    LOG(WARNING) << "Not persisting registration of " << uri;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(log_mutex_);
+  std::ofstream ofs(log_file_, std::ios::app);
+  if (!ofs) {
+    LOG(WARNING) << "Unable to append to bitcode registry " << log_file_;
+    return;
+  }
+  ofs << id << "\t" << UriSchemes::scheme_to_string.at(uri.scheme()) << "\t"
+      << uri.authority() << "\t" << uri.path() << "\n";
+}
+
+}  // namespace error_specifications
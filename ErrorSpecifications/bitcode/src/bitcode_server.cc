@@ -1,5 +1,6 @@
 #include "bitcode_server.h"
 
+#include <algorithm>
 #include <ctime>
 #include <fstream>
 #include <iostream>
@@ -23,12 +24,14 @@
 #include "defined_functions_pass.h"
 #include "file_called_functions_pass.h"
 #include "local_called_functions_pass.h"
+#include "metrics.h"
 #include "servers.h"
 
 namespace error_specifications {
 
 tbb::task *GetCalledFunctionsTask::execute(void) {
   LOG(INFO) << task_name;
+  AdmissionGuard admission_guard(admission_controller, admission_ticket);
 
   Operation result;
   result.set_name(task_name);
@@ -47,12 +50,18 @@ tbb::task *GetCalledFunctionsTask::execute(void) {
     return NULL;
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  // Map the bitcode into an LLVM MemoryBuffer.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  err = ReadUriIntoBuffer(bitcode_uri, buffer);
+  if (!err.ok()) {
+    LOG(ERROR) << "Unable to read bitcode file.";
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(err.error_code());
+    error_pb_message->set_message(err.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return NULL;
+  }
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic llvm_err;
@@ -72,7 +81,10 @@ tbb::task *GetCalledFunctionsTask::execute(void) {
   CalledFunctionsPass *called_functions_pass = new CalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(called_functions_pass);
-  pass_manager.run(*module);
+  {
+    ScopedPassMetrics pass_metrics("CalledFunctionsPass");
+    pass_manager.run(*module);
+  }
 
   CalledFunctionsResponse response =
       called_functions_pass->GetCalledFunctions();
@@ -89,6 +101,7 @@ tbb::task *GetCalledFunctionsTask::execute(void) {
 
 tbb::task *GetLocalCalledFunctionsTask::execute(void) {
   LOG(INFO) << task_name;
+  AdmissionGuard admission_guard(admission_controller, admission_ticket);
 
   Operation result;
   result.set_name(task_name);
@@ -107,12 +120,18 @@ tbb::task *GetLocalCalledFunctionsTask::execute(void) {
     return NULL;
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  // Map the bitcode into an LLVM MemoryBuffer.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  err = ReadUriIntoBuffer(bitcode_uri, buffer);
+  if (!err.ok()) {
+    LOG(ERROR) << "Unable to read bitcode file.";
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(err.error_code());
+    error_pb_message->set_message(err.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return NULL;
+  }
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic llvm_err;
@@ -133,7 +152,10 @@ tbb::task *GetLocalCalledFunctionsTask::execute(void) {
       new LocalCalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(local_called_functions_pass);
-  pass_manager.run(*module);
+  {
+    ScopedPassMetrics pass_metrics("LocalCalledFunctionsPass");
+    pass_manager.run(*module);
+  }
 
   LocalCalledFunctionsResponse response =
       local_called_functions_pass->GetLocalCalledFunctions();
@@ -150,6 +172,7 @@ tbb::task *GetLocalCalledFunctionsTask::execute(void) {
 
 tbb::task *GetFileCalledFunctionsTask::execute(void) {
   LOG(INFO) << task_name;
+  AdmissionGuard admission_guard(admission_controller, admission_ticket);
 
   Operation result;
   result.set_name(task_name);
@@ -168,12 +191,18 @@ tbb::task *GetFileCalledFunctionsTask::execute(void) {
     return NULL;
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  // Map the bitcode into an LLVM MemoryBuffer.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  err = ReadUriIntoBuffer(bitcode_uri, buffer);
+  if (!err.ok()) {
+    LOG(ERROR) << "Unable to read bitcode file.";
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(err.error_code());
+    error_pb_message->set_message(err.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return NULL;
+  }
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic llvm_err;
@@ -194,7 +223,10 @@ tbb::task *GetFileCalledFunctionsTask::execute(void) {
       new FileCalledFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(file_called_functions_pass);
-  pass_manager.run(*module);
+  {
+    ScopedPassMetrics pass_metrics("FileCalledFunctionsPass");
+    pass_manager.run(*module);
+  }
 
   FileCalledFunctionsResponse response =
       file_called_functions_pass->GetFileCalledFunctions();
@@ -211,6 +243,7 @@ tbb::task *GetFileCalledFunctionsTask::execute(void) {
 
 tbb::task *GetDefinedFunctionsTask::execute(void) {
   LOG(INFO) << task_name;
+  AdmissionGuard admission_guard(admission_controller, admission_ticket);
 
   Operation result;
   result.set_name(task_name);
@@ -229,12 +262,18 @@ tbb::task *GetDefinedFunctionsTask::execute(void) {
     return NULL;
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  // Map the bitcode into an LLVM MemoryBuffer.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  err = ReadUriIntoBuffer(bitcode_uri, buffer);
+  if (!err.ok()) {
+    LOG(ERROR) << "Unable to read bitcode file.";
+    google::rpc::Status *error_pb_message = result.mutable_error();
+    error_pb_message->set_code(err.error_code());
+    error_pb_message->set_message(err.error_message());
+    result.set_done(1);
+    operations_service->UpdateOperation(task_name, result);
+    return NULL;
+  }
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic llvm_err;
@@ -254,7 +293,10 @@ tbb::task *GetDefinedFunctionsTask::execute(void) {
   DefinedFunctionsPass *defined_functions_pass = new DefinedFunctionsPass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(defined_functions_pass);
-  pass_manager.run(*module);
+  {
+    ScopedPassMetrics pass_metrics("DefinedFunctionsPass");
+    pass_manager.run(*module);
+  }
 
   DefinedFunctionsResponse response =
       defined_functions_pass->get_defined_functions();
@@ -289,6 +331,24 @@ grpc::Status BitcodeServiceImpl::RegisterBitcode(
 
 grpc::Status BitcodeServiceImpl::DoRegisterBitcodeFile(
     const Uri &uri, std::string *out_bitcode_id) {
+  // Local files are hashed straight from a memory mapping, and the digest is
+  // reused while the file is unchanged.
+  if (uri.scheme() == Scheme::SCHEME_FILE) {
+    std::string file_path;
+    grpc::Status err = ConvertUriToFilePath(uri, file_path);
+    if (!err.ok()) {
+      return err;
+    }
+    err = hash_cache_.HashFile(file_path, *out_bitcode_id);
+    if (!err.ok()) {
+      const std::string err_msg = "Unable to read bitcode file.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+    }
+    registry_.Register(*out_bitcode_id, uri);
+    return grpc::Status::OK;
+  }
+
   std::string bitcode_data_str;
   grpc::Status read_status = ReadUriIntoString(uri, bitcode_data_str);
   if (!read_status.ok()) {
@@ -304,24 +364,39 @@ grpc::Status BitcodeServiceImpl::DoRegisterBitcodeFile(
     return err;
   }
 
-  registered_bitcode_files_[*out_bitcode_id] = uri;
+  registry_.Register(*out_bitcode_id, uri);
 
   return grpc::Status::OK;
 }
 
+bool BitcodeServiceImpl::IsRegistrationCurrent(const std::string &id,
+                                               const Uri &uri) {
+  if (uri.scheme() != Scheme::SCHEME_FILE) return true;
+  std::string file_path;
+  std::string file_hash;
+  return ConvertUriToFilePath(uri, file_path).ok() &&
+         hash_cache_.HashFile(file_path, file_hash).ok() && file_hash == id;
+}
+
+uint64_t BitcodeServiceImpl::EstimateTaskBytes(const Handle &handle) {
+  Uri bitcode_uri;
+  uint64_t bitcode_size = 0;
+  if (!GetBitcodeUriForHandle(handle, &bitcode_uri).ok() ||
+      !GetUriSize(bitcode_uri, bitcode_size).ok()) {
+    // The task reports the actual error once it runs.
+    return 0;
+  }
+  return bitcode_size * kIrBytesPerBitcodeByte;
+}
+
 grpc::Status BitcodeServiceImpl::GetBitcodeUriForHandle(const Handle &handle,
-                                                        Uri *out_uri) const {
-  std::string ret;
-  Uri registered_uri;
-  if (registered_bitcode_files_.find(handle.id()) ==
-      registered_bitcode_files_.end()) {
+                                                        Uri *out_uri) {
+  if (!registry_.Lookup(handle.id(), out_uri)) {
     const std::string &err_msg = "Handle not registered.";
     LOG(ERROR) << err_msg;
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
-  *out_uri = registered_bitcode_files_.at(handle.id());
-
   return grpc::Status::OK;
 }
 
@@ -338,12 +413,13 @@ grpc::Status BitcodeServiceImpl::Annotate(grpc::ServerContext *context,
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
 
-  std::string bitcode_bytes;
-  ReadUriIntoString(bitcode_uri, bitcode_bytes);
-
-  // Initialize an LLVM MemoryBuffer.
-  std::unique_ptr<llvm::MemoryBuffer> buffer =
-      llvm::MemoryBuffer::getMemBuffer(bitcode_bytes);
+  // Map the bitcode into an LLVM MemoryBuffer.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  err = ReadUriIntoBuffer(bitcode_uri, buffer);
+  if (!err.ok()) {
+    LOG(ERROR) << "Unable to read bitcode file.";
+    return err;
+  }
 
   // Parse IR into an llvm Module.
   llvm::SMDiagnostic llvm_err;
@@ -359,7 +435,10 @@ grpc::Status BitcodeServiceImpl::Annotate(grpc::ServerContext *context,
   AnnotatePass *annotate_pass = new AnnotatePass();
   llvm::legacy::PassManager pass_manager;
   pass_manager.add(annotate_pass);
-  pass_manager.run(*module);
+  {
+    ScopedPassMetrics pass_metrics("AnnotatePass");
+    pass_manager.run(*module);
+  }
 
   // Write out the annotated bitcode file to disk. Only writing to
   // local disk is supported currently.
@@ -407,7 +486,10 @@ grpc::Status BitcodeServiceImpl::GetDefinedFunctions(
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  task->admission_controller = &admission_controller;
+  admission_controller.Submit(task_name,
+                              EstimateTaskBytes(request->bitcode_id()), task,
+                              &task->admission_ticket);
   return grpc::Status::OK;
 }
 
@@ -429,7 +511,10 @@ grpc::Status BitcodeServiceImpl::GetCalledFunctions(
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  task->admission_controller = &admission_controller;
+  admission_controller.Submit(task_name,
+                              EstimateTaskBytes(request->bitcode_id()), task,
+                              &task->admission_ticket);
 
   return grpc::Status::OK;
 }
@@ -451,7 +536,10 @@ grpc::Status BitcodeServiceImpl::GetLocalCalledFunctions(
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  task->admission_controller = &admission_controller;
+  admission_controller.Submit(task_name,
+                              EstimateTaskBytes(request->bitcode_id()), task,
+                              &task->admission_ticket);
 
   return grpc::Status::OK;
 }
@@ -473,7 +561,10 @@ grpc::Status BitcodeServiceImpl::GetFileCalledFunctions(
   task->operations_service = &operations_service;
   task->request = *request;
   task->task_name = task_name;
-  tbb::task::enqueue(*task);
+  task->admission_controller = &admission_controller;
+  admission_controller.Submit(task_name,
+                              EstimateTaskBytes(request->bitcode_id()), task,
+                              &task->admission_ticket);
 
   return grpc::Status::OK;
 }
@@ -484,38 +575,45 @@ grpc::Status BitcodeServiceImpl::DownloadBitcode(
   LOG(INFO) << "DownloadBitcode-" << std::string(request->bitcode_id().id());
 
   Handle request_handle = request->bitcode_id();
-  Uri uri = registered_bitcode_files_.at(request_handle.id());
+  Uri uri;
+  grpc::Status err = GetBitcodeUriForHandle(request_handle, &uri);
+  if (!err.ok()) {
+    return err;
+  }
 
-  std::vector<char> bitcode_bytes;
-  std::string bitcode_data_str;
-  grpc::Status read_status = ReadUriIntoString(uri, bitcode_data_str);
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  grpc::Status read_status = ReadUriIntoBuffer(uri, buffer);
   if (!read_status.ok()) {
     return read_status;
   }
-  bitcode_bytes =
-      std::vector<char>(bitcode_data_str.begin(), bitcode_data_str.end());
 
-  auto chunk_begin = bitcode_bytes.begin();
-  auto chunk_end = bitcode_bytes.begin();
-  auto bytes_end = bitcode_bytes.end();
+  static Counter &downloaded_bytes = MetricRegistry::Get().GetCounter(
+      "bitcode_download_bytes_total", "Bytes of bitcode streamed.");
+  static Histogram &download_seconds = MetricRegistry::Get().GetHistogram(
+      "bitcode_download_seconds", "Time to stream a bitcode file.",
+      Histogram::LatencyBounds());
+  ScopedLatency download_latency(download_seconds);
+
+  // Stream chunks straight out of the mapped buffer.
+  const char *bytes = buffer->getBufferStart();
+  const size_t bytes_size = buffer->getBufferSize();
+  size_t offset = 0;
   do {
-    if (std::distance(chunk_end, bytes_end) < kChunkSize) {
-      chunk_end = bytes_end;
-    } else {
-      std::advance(chunk_end, kChunkSize);
-    }
+    const size_t chunk_size =
+        std::min(static_cast<size_t>(kChunkSize), bytes_size - offset);
     DataChunk chunk;
-    std::vector<char> chunk_bytes(chunk_begin, chunk_end);
-    chunk.set_content(&chunk_bytes[0], chunk_bytes.size());
+    chunk.set_content(bytes + offset, chunk_size);
     writer->Write(chunk);
-    chunk_begin = chunk_end;
-  } while (std::distance(chunk_end, bytes_end) > 0);
+    offset += chunk_size;
+    downloaded_bytes.Increment(chunk_size);
+  } while (offset < bytes_size);
 
   return grpc::Status::OK;
 }
 
-void RunBitcodeServer(std::string server_address) {
-  BitcodeServiceImpl service;
+void RunBitcodeServer(std::string server_address,
+                      const BitcodeServiceOptions &options) {
+  BitcodeServiceImpl service(options);
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
@@ -523,6 +621,7 @@ void RunBitcodeServer(std::string server_address) {
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
   builder.RegisterService(&service.operations_service);
+  builder.RegisterService(&service.metrics_service);
 
   // Finally assemble the server.
   std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
@@ -1,20 +1,60 @@
 #include "bitcode_server.h"
 
+#include <chrono>
 #include <string>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "glog/logging.h"
 
+#include "metrics.h"
 #include "servers.h"
 
 ABSL_FLAG(std::string, listen, "localhost:50051", "The address to listen on.");
+ABSL_FLAG(uint64_t, memory_budget_mb, 0,
+          "Total estimated memory, in MiB, that concurrently running analysis "
+          "tasks may use. Requests beyond the budget are queued. 0 means "
+          "unlimited.");
+ABSL_FLAG(uint64_t, max_concurrent_tasks, 0,
+          "Maximum number of analysis tasks that run at once. 0 means "
+          "unlimited.");
+ABSL_FLAG(std::string, hash_cache_file, "",
+          "File that persists the digests of registered local bitcode files "
+          "so re-registering an unchanged file skips hashing it. If empty, "
+          "digests are only cached for the lifetime of the service.");
+ABSL_FLAG(std::string, registry_file, "",
+          "Append-only log of registered bitcode files. It is replayed at "
+          "startup so handles survive restarts. If empty, registrations are "
+          "lost when the service stops.");
+ABSL_FLAG(std::string, metrics_file, "",
+          "File that the metrics of the service, also served by the "
+          "GetMetrics rpc, are written to in the Prometheus text format "
+          "every --metrics_dump_interval_s seconds and at exit. If empty, "
+          "they are only served by the rpc.");
+ABSL_FLAG(uint64_t, metrics_dump_interval_s, 15,
+          "Seconds between two writes of --metrics_file.");
 
 int main(int argc, char **argv) {
   google::InitGoogleLogging("bitcode-service");
   absl::ParseCommandLine(argc, argv);
+  const std::string metrics_file = absl::GetFlag(FLAGS_metrics_file);
+  if (!metrics_file.empty()) {
+    error_specifications::MetricRegistry::Get().DumpPeriodically(
+        metrics_file,
+        std::chrono::seconds(absl::GetFlag(FLAGS_metrics_dump_interval_s)));
+  }
   std::string listen_address = absl::GetFlag(FLAGS_listen);
-  error_specifications::RunBitcodeServer(listen_address);
+  error_specifications::BitcodeServiceOptions options;
+  options.admission_options.memory_budget_bytes =
+      absl::GetFlag(FLAGS_memory_budget_mb) << 20;
+  options.admission_options.max_concurrent_tasks =
+      absl::GetFlag(FLAGS_max_concurrent_tasks);
+  options.hash_cache_file = absl::GetFlag(FLAGS_hash_cache_file);
+  options.registry_file = absl::GetFlag(FLAGS_registry_file);
+  error_specifications::RunBitcodeServer(listen_address, options);
+  if (!metrics_file.empty()) {
+    error_specifications::MetricRegistry::Get().DumpToFile(metrics_file);
+  }
   google::FlushLogFiles(google::INFO);
 
   return 0;
@@ -0,0 +1,166 @@
+// Tests the persistent registry of bitcode handles.
+
+#include "bitcode/include/bitcode_registry.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "servers.h"
+
+namespace error_specifications {
+
+namespace {
+
+Uri FileUri(const std::string &path) {
+  Uri uri;
+  uri.set_scheme(Scheme::SCHEME_FILE);
+  uri.set_path(path);
+  return uri;
+}
+
+int CountLines(const std::string &path) {
+  std::ifstream ifs(path);
+  std::string line;
+  int lines = 0;
+  while (std::getline(ifs, line)) ++lines;
+  return lines;
+}
+
+class BitcodeRegistryTest : public ::testing::Test {
+ protected:
+  std::string dir_;
+  std::string log_file_;
+  // Handles that the validator accepts, and how often it was called.
+  std::set<std::string> valid_ids_;
+  int validations_ = 0;
+
+  void SetUp() override {
+    std::string dir_template = ::testing::TempDir() + "registry_XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    dir_ = dir_template;
+    log_file_ = dir_ + "/registry";
+  }
+
+  void TearDown() override {
+    std::remove(log_file_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  BitcodeRegistry::Validator Validator() {
+    return [this](const std::string &id, const Uri &uri) {
+      ++validations_;
+      return valid_ids_.count(id) > 0;
+    };
+  }
+};
+
+}  // namespace
+
+TEST_F(BitcodeRegistryTest, LookupRegistered) {
+  BitcodeRegistry registry(log_file_, Validator());
+  registry.Register("a", FileUri("a.bc"));
+
+  Uri uri;
+  ASSERT_TRUE(registry.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a.bc");
+  EXPECT_FALSE(registry.Lookup("b", &uri));
+  // Registrations made in this process are trusted.
+  EXPECT_EQ(validations_, 0);
+}
+
+// Registrations are replayed from the log and validated once, on their
+// first lookup.
+TEST_F(BitcodeRegistryTest, SurvivesReload) {
+  {
+    BitcodeRegistry registry(log_file_, Validator());
+    registry.Register("a", FileUri("a.bc"));
+    registry.Register("b", FileUri("b.bc"));
+  }
+
+  valid_ids_ = {"a", "b"};
+  BitcodeRegistry reloaded(log_file_, Validator());
+  EXPECT_EQ(validations_, 0);
+  Uri uri;
+  ASSERT_TRUE(reloaded.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a.bc");
+  ASSERT_TRUE(reloaded.Lookup("a", &uri));
+  ASSERT_TRUE(reloaded.Lookup("b", &uri));
+  EXPECT_EQ(uri.path(), "b.bc");
+  EXPECT_EQ(validations_, 2);
+}
+
+// A replayed registration whose file changed is forgotten, and can be
+// registered again.
+TEST_F(BitcodeRegistryTest, StaleEntryIsReRegistered) {
+  {
+    BitcodeRegistry registry(log_file_, Validator());
+    registry.Register("a", FileUri("a.bc"));
+  }
+
+  BitcodeRegistry reloaded(log_file_, Validator());
+  Uri uri;
+  EXPECT_FALSE(reloaded.Lookup("a", &uri));
+  EXPECT_FALSE(reloaded.Lookup("a", &uri));
+  EXPECT_EQ(validations_, 1);
+
+  reloaded.Register("a", FileUri("a2.bc"));
+  ASSERT_TRUE(reloaded.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a2.bc");
+  EXPECT_EQ(validations_, 1);
+
+  // The new registration is what the next restart sees.
+  valid_ids_ = {"a"};
+  BitcodeRegistry restarted(log_file_, Validator());
+  ASSERT_TRUE(restarted.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a2.bc");
+}
+
+// The latest registration of an id wins, and the log is compacted to one
+// line per id when it is replayed.
+TEST_F(BitcodeRegistryTest, CompactsLogOnLoad) {
+  {
+    BitcodeRegistry registry(log_file_, Validator());
+    registry.Register("a", FileUri("a1.bc"));
+    registry.Register("a", FileUri("a2.bc"));
+    registry.Register("a", FileUri("a2.bc"));
+    registry.Register("b", FileUri("b.bc"));
+  }
+  {
+    std::ofstream ofs(log_file_, std::ios::app);
+    ofs << "cut short";
+  }
+  EXPECT_EQ(CountLines(log_file_), 4);
+
+  valid_ids_ = {"a", "b"};
+  BitcodeRegistry reloaded(log_file_, Validator());
+  EXPECT_EQ(CountLines(log_file_), 2);
+  Uri uri;
+  ASSERT_TRUE(reloaded.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a2.bc");
+
+  BitcodeRegistry compacted(log_file_, Validator());
+  ASSERT_TRUE(compacted.Lookup("a", &uri));
+  EXPECT_EQ(uri.path(), "a2.bc");
+  ASSERT_TRUE(compacted.Lookup("b", &uri));
+  EXPECT_EQ(uri.path(), "b.bc");
+}
+
+TEST_F(BitcodeRegistryTest, InMemoryOnly) {
+  {
+    BitcodeRegistry registry("", Validator());
+    registry.Register("a", FileUri("a.bc"));
+  }
+  valid_ids_ = {"a"};
+  BitcodeRegistry fresh("", Validator());
+  Uri uri;
+  EXPECT_FALSE(fresh.Lookup("a", &uri));
+}
+
+}  // namespace error_specifications
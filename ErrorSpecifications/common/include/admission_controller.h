@@ -0,0 +1,137 @@
+// This file defines the admission controller shared by the services. Rather
+// than enqueueing every long-running task with TBB as soon as the RPC
+// arrives, services submit the task together with an estimate of its memory
+// footprint. Tasks that fit within the configured memory and concurrency
+// budget are enqueued immediately; the rest wait in FIFO order and their
+// queue position is published as AdmissionMetadata on the operation.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_ADMISSION_CONTROLLER_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_ADMISSION_CONTROLLER_H_
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "operations_service.h"
+#include "tbb/task.h"
+
+namespace error_specifications {
+
+struct AdmissionOptions {
+  // Sum of the estimated bytes that admitted tasks may hold at once.
+  // 0 means unlimited.
+  uint64_t memory_budget_bytes = 0;
+
+  // Maximum number of admitted tasks at once. 0 means unlimited.
+  uint64_t max_concurrent_tasks = 0;
+
+  // Estimate used for tasks submitted with kUnknownTaskBytes, i.e. whose
+  // footprint cannot be derived from their input before they run.
+  uint64_t default_task_bytes = 0;
+};
+
+// Passed to Submit when the caller cannot estimate the task's footprint.
+constexpr uint64_t kUnknownTaskBytes = 0;
+
+// Identifies one submission, from Submit to Release. Task names are not
+// unique, as tasks submitted in the same second for the same input share
+// one.
+using AdmissionTicket = uint64_t;
+
+class AdmissionController {
+ public:
+  AdmissionController(OperationsServiceImpl *operations_service,
+                      const AdmissionOptions &options);
+
+  // Enqueues task with TBB once there is budget for estimated_bytes, or for
+  // options.default_task_bytes if estimated_bytes is kUnknownTaskBytes.
+  // *ticket is set before the task can run, so it usually points into the
+  // task, which must call Release(*ticket) when it finishes, see
+  // AdmissionGuard. The progress of the task is published on the operation
+  // task_name.
+  // A task larger than the whole budget is admitted once nothing else is
+  // running, so that it cannot wait forever.
+  void Submit(const std::string &task_name, uint64_t estimated_bytes,
+              tbb::task *task, AdmissionTicket *ticket);
+
+  // Returns the budget held by ticket and admits waiting tasks.
+  void Release(AdmissionTicket ticket);
+
+ private:
+  struct PendingTask {
+    AdmissionTicket ticket;
+    std::string task_name;
+    uint64_t estimated_bytes;
+    tbb::task *task;
+  };
+
+  // Returns true if a task of estimated_bytes can start now.
+  // Requires mutex_ to be held.
+  bool FitsLocked(uint64_t estimated_bytes) const;
+
+  // Reserves the budget for pending and adds its task to admitted, to be
+  // enqueued with TBB once mutex_ is released.
+  // Requires mutex_ to be held.
+  void AdmitLocked(const PendingTask &pending,
+                   std::vector<tbb::task *> *admitted);
+
+  // Admits waiting tasks in FIFO order until the head no longer fits.
+  // Requires mutex_ to be held.
+  void AdmitWaitingLocked(std::vector<tbb::task *> *admitted);
+
+  // Publishes the queue position of every waiting task.
+  // Requires mutex_ to be held.
+  void PublishQueuePositionsLocked();
+
+  // Sets the queue and budget gauges of the metric registry.
+  // Requires mutex_ to be held.
+  void UpdateMetricsLocked();
+
+  // Publishes AdmissionMetadata for a single task.
+  // Requires mutex_ to be held.
+  void PublishLocked(const PendingTask &pending, uint64_t queue_position);
+
+  OperationsServiceImpl *operations_service_;
+  const AdmissionOptions options_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+
+  // The ticket of the next submission.
+  AdmissionTicket next_ticket_ = 0;
+
+  // Tasks waiting for budget, in submission order.
+  std::deque<PendingTask> pending_;
+
+  // Tickets of the admitted tasks to their estimated bytes.
+  std::unordered_map<AdmissionTicket, uint64_t> running_;
+
+  // Sum of the estimated bytes in running_.
+  uint64_t reserved_bytes_ = 0;
+};
+
+// Releases the admission of a task when it goes out of scope. Declare one at
+// the top of tbb::task::execute so every return path releases the budget.
+class AdmissionGuard {
+ public:
+  AdmissionGuard(AdmissionController *admission_controller,
+                 AdmissionTicket ticket)
+      : admission_controller_(admission_controller), ticket_(ticket) {}
+  ~AdmissionGuard() {
+    if (admission_controller_) admission_controller_->Release(ticket_);
+  }
+
+  AdmissionGuard(const AdmissionGuard &) = delete;
+  AdmissionGuard &operator=(const AdmissionGuard &) = delete;
+
+ private:
+  AdmissionController *admission_controller_;
+  AdmissionTicket ticket_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_ADMISSION_CONTROLLER_H_
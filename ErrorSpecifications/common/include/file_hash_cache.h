@@ -0,0 +1,48 @@
+// This file defines a persistent cache of file content hashes. Registering a
+// bitcode file hashes its contents to produce the handle; for large files
+// that dominates registration time. The cache remembers the digest of each
+// file keyed on its identity (canonical path, size, mtime, inode), so that
+// re-registering an unchanged file, including after a service restart, does
+// not read the file at all.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_FILE_HASH_CACHE_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_FILE_HASH_CACHE_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "include/grpcpp/grpcpp.h"
+
+namespace error_specifications {
+
+class FileHashCache {
+ public:
+  // Loads previously computed digests from cache_file and appends new ones
+  // to it. If cache_file is empty, the cache is kept in memory only.
+  explicit FileHashCache(const std::string &cache_file);
+
+  // Stores the SHA-256 hex digest of the file at file_path in out_hash,
+  // reusing the cached digest if the file's identity has not changed.
+  grpc::Status HashFile(const std::string &file_path, std::string &out_hash);
+
+ private:
+  // Builds the cache key for file_path. Returns false if the file cannot be
+  // resolved or its path cannot be stored in the cache file.
+  static bool GetFileKey(const std::string &file_path, std::string &out_key);
+
+  // Appends a single entry to cache_file_.
+  void AppendEntry(const std::string &key, const std::string &digest);
+
+  std::string cache_file_;
+
+  // Guards digests_ and appends to cache_file_.
+  std::mutex mutex_;
+
+  // File keys to hex digests.
+  std::unordered_map<std::string, std::string> digests_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_FILE_HASH_CACHE_H_
@@ -0,0 +1,189 @@
+// This file defines the process-wide registry of metrics: counters, gauges
+// and histograms that the analyses and the services update while tasks run.
+// They are read through the MetricsService (see proto/metrics.proto) or
+// dumped periodically to a file in the Prometheus text format.
+//
+// Looking a metric up takes a lock and builds its key, so code on a hot path
+// looks it up once and keeps the reference, which stays valid for the life
+// of the process:
+//
+//   static Counter &hits = MetricRegistry::Get().GetCounter(
+//       "eesi_llm_cache_hits_total", "LLM queries answered from the cache.");
+//   hits.Increment();
+//
+// Updating a metric is lock free.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "proto/metrics.pb.h"
+#include "timeline.h"
+
+namespace error_specifications {
+
+// The labels of a metric, as (name, value) pairs.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Adds amount to value without losing concurrent additions.
+inline void AtomicAdd(std::atomic<double> &value, double amount) {
+  double current = value.load(std::memory_order_relaxed);
+  while (!value.compare_exchange_weak(current, current + amount,
+                                      std::memory_order_relaxed)) {
+  }
+}
+
+class Counter {
+ public:
+  // amount must not be negative.
+  void Increment(double amount = 1) { AtomicAdd(value_, amount); }
+  double Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(double amount) { AtomicAdd(value_, amount); }
+  // Raises the gauge to value if it is lower, for peaks.
+  void SetMax(double value);
+  double Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+class Histogram {
+ public:
+  // bounds are the inclusive upper bounds of the buckets, in increasing
+  // order.
+  explicit Histogram(const std::vector<double> &bounds);
+
+  void Observe(double value);
+
+  // Writes the buckets, cumulative, the sum and the count to histogram.
+  void Snapshot(HistogramValue *histogram) const;
+
+  // Bounds of 1ms to about 2 minutes, for latencies in seconds.
+  static std::vector<double> LatencyBounds();
+  // Bounds of 1 to 2^20, for sizes.
+  static std::vector<double> SizeBounds();
+
+ private:
+  const std::vector<double> bounds_;
+  // The observations per bucket, the last one being above every bound.
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<double> sum_{0};
+};
+
+// Times a scope in seconds into a histogram.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram &histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    histogram_.Observe(std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count());
+  }
+
+  ScopedLatency(const ScopedLatency &) = delete;
+  ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+ private:
+  Histogram &histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// Records a run of the analysis pass pass_name: its number of runs, its wall
+// and CPU time, and the number of its runs in progress. The CPU time is the
+// process's, so it counts the worker threads of the pass but also the tasks
+// that run alongside it. The run is also a span on the current timeline, so
+// pass_name must be a string literal.
+class ScopedPassMetrics {
+ public:
+  explicit ScopedPassMetrics(const char *pass_name);
+  ~ScopedPassMetrics();
+
+  ScopedPassMetrics(const ScopedPassMetrics &) = delete;
+  ScopedPassMetrics &operator=(const ScopedPassMetrics &) = delete;
+
+ private:
+  Counter &wall_seconds_;
+  Counter &cpu_seconds_;
+  Gauge &running_;
+  const std::chrono::steady_clock::time_point wall_start_;
+  const double cpu_start_;
+  TimelineSpan span_;
+};
+
+class MetricRegistry {
+ public:
+  // Returns the process-wide registry.
+  static MetricRegistry &Get();
+
+  // Return the metric of family name with labels, creating it if needed.
+  // help is the description of the family, set by its first metric. A name
+  // must always be used with the same type, and a histogram family with the
+  // same bounds.
+  Counter &GetCounter(const std::string &name, const std::string &help,
+                      const MetricLabels &labels = MetricLabels());
+  Gauge &GetGauge(const std::string &name, const std::string &help,
+                  const MetricLabels &labels = MetricLabels());
+  Histogram &GetHistogram(const std::string &name, const std::string &help,
+                          const std::vector<double> &bounds,
+                          const MetricLabels &labels = MetricLabels());
+
+  // Writes the families whose name starts with name_prefix to response.
+  void Snapshot(const std::string &name_prefix,
+                GetMetricsResponse *response) const;
+
+  // Writes every family in the Prometheus text exposition format.
+  void WritePrometheusText(std::ostream &out) const;
+
+  // Starts a thread that rewrites path with WritePrometheusText every
+  // interval, for the node exporter's textfile collector. The file is
+  // replaced atomically, so readers never see a partial dump.
+  void DumpPeriodically(const std::string &path,
+                        std::chrono::seconds interval);
+
+  // Writes path once, as DumpPeriodically does.
+  void DumpToFile(const std::string &path) const;
+
+ private:
+  struct Family {
+    MetricType type;
+    std::string help;
+    std::vector<double> bounds;
+    // Only the metrics of type are used.
+    std::map<MetricLabels, std::unique_ptr<Counter>> counters;
+    std::map<MetricLabels, std::unique_ptr<Gauge>> gauges;
+    std::map<MetricLabels, std::unique_ptr<Histogram>> histograms;
+  };
+
+  // Returns family name, creating it with type and help if needed.
+  // Requires mutex_ to be held.
+  Family &GetFamilyLocked(const std::string &name, MetricType type,
+                          const std::string &help);
+
+  // Guards families_. Metrics are never removed, so the references handed
+  // out stay valid.
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_H_
@@ -0,0 +1,20 @@
+// This file defines the common metrics service. Like the operations service,
+// it is not run as a separate service: each server also runs a metrics
+// service, which reads the process-wide MetricRegistry.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVICE_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVICE_H_
+
+#include "proto/metrics.grpc.pb.h"
+
+namespace error_specifications {
+
+class MetricsServiceImpl final : public MetricsService::Service {
+  grpc::Status GetMetrics(grpc::ServerContext *context,
+                          const GetMetricsRequest *request,
+                          GetMetricsResponse *response) override;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_METRICS_SERVICE_H_
@@ -9,8 +9,11 @@
 #ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATIONS_SERVICE_H_
 #define ERROR_SPECIFICATIONS_COMMON_INCLUDE_OPERATIONS_SERVICE_H_
 
+#include <deque>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "proto/operations.grpc.pb.h"
 #include "tbb/concurrent_hash_map.h"
@@ -34,13 +37,34 @@ class OperationsServiceImpl final : public OperationsService::Service {
                                const CancelOperationRequest *request,
                                ::google::protobuf::Empty *response) override;
 
+  // Remembers that the done result of operation name was returned, so
+  // that progress updates for it still in flight are dropped. Requires the
+  // accessor of name in operation_progress_ to be held.
+  void MarkFinished(const std::string &name);
+
+  // Whether the done result of operation name was returned. Requires the
+  // accessor of name in operation_progress_ to be held.
+  bool IsFinished(const std::string &name);
+
   // A map from operation names to the latest Operation message.
   OperationTable operation_progress_;
 
+  // How many finished operation names are remembered. Late updates trail
+  // the final one by little, so only the most recent ones are kept.
+  static constexpr size_t kMaxFinishedOperations = 4096;
+
+  // Guards the finished operation names. Taken inside accessors of
+  // operation_progress_, never the other way around.
+  std::mutex finished_mutex_;
+  std::unordered_set<std::string> finished_;
+  // finished_, oldest first, to forget the oldest ones.
+  std::deque<std::string> finished_order_;
+
  public:
   // This is not part of the service API and is meant to be called
   // only from the service to update the progress of a running
-  // operation.
+  // operation. Once the done result of an operation has been returned by
+  // GetOperation, further updates that are not done are dropped.
   void UpdateOperation(std::string name, Operation operation);
 };
 
@@ -4,7 +4,10 @@
 #ifndef ERROR_SPECIFICATIONS_COMMON_SERVERS_H_
 #define ERROR_SPECIFICATIONS_COMMON_SERVERS_H_
 
+#include <memory>
+
 #include "include/grpcpp/grpcpp.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "proto/operations.grpc.pb.h"
 
 namespace error_specifications {
@@ -45,9 +48,18 @@ grpc::Status ConvertUriToFilePath(const Uri &uri, std::string &out_file_path);
 
 Uri FilePathToUri(const std::string &file_path);
 
+// Size of the chunks HashFile feeds to the digest.
+constexpr size_t kHashChunkSize = 4 * 1048576;
+
 grpc::Status HashString(const std::string &bitcode_data,
                         std::string &out_hashed_bitcode_data);
 
+// Computes the same SHA-256 hex digest as HashString over the contents of
+// file_path, streaming from a read-only memory mapping in kHashChunkSize
+// chunks instead of copying the file onto the heap.
+grpc::Status HashFile(const std::string &file_path,
+                      std::string &out_hashed_file);
+
 // Overriding operator for cleaner Uri printing
 inline std::ostream &operator<<(std::ostream &stream, const Uri& uri) {
   return stream << UriSchemes::scheme_to_string.at(uri.scheme()) + "://" 
@@ -62,6 +74,17 @@ std::string StripSuffixAfterDot(const std::string &string);
 
 grpc::Status ReadUriIntoString(const Uri &uri, std::string &data);
 
+// Reads the resource at uri into an owning, null-terminated MemoryBuffer.
+// file:// URIs are memory-mapped rather than copied (LLVM falls back to a
+// read for small files). gs:// objects are streamed once into a buffer sized
+// from the object metadata.
+grpc::Status ReadUriIntoBuffer(const Uri &uri,
+                               std::unique_ptr<llvm::MemoryBuffer> &out_buffer);
+
+// Stores the size in bytes of the resource at uri in out_size without
+// reading it.
+grpc::Status GetUriSize(const Uri &uri, uint64_t &out_size);
+
 // Returns a string representing the task name comprised of the RPC call, the
 // bitcode ID, and a time stamp.
 std::string GetTaskName(const std::string &request_name,
@@ -0,0 +1,140 @@
+// This file defines the timeline of a single request: spans of the work done
+// for it, on every thread, written out in the Chrome trace-event format so
+// that it can be opened in chrome://tracing or Perfetto. Where the metrics
+// (see metrics.h) add up the work of every request, a timeline shows when
+// each piece of one request ran, and what ran alongside it.
+//
+// A task that records a timeline installs it on its thread with
+// Timeline::Scope; spans started on that thread go to it:
+//
+//   TimelineSpan span(kTimelineScc, "Scc");
+//   span.Arg("scc", scc_index);
+//
+// Spans are no-ops on threads without a timeline, so code running on other
+// threads, e.g. TBB workers, installs the timeline of the task it works for:
+//
+//   Timeline *timeline = Timeline::Current();
+//   tbb::parallel_for(range, [timeline](...) {
+//     Timeline::Scope scope(timeline);
+//     ...
+//   });
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_TIMELINE_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_TIMELINE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "tbb/concurrent_vector.h"
+
+namespace error_specifications {
+
+// Categories of spans, which chrome://tracing can filter on.
+constexpr char kTimelinePass[] = "pass";
+constexpr char kTimelineScc[] = "scc";
+constexpr char kTimelineFunction[] = "function";
+constexpr char kTimelineLlm[] = "llm";
+constexpr char kTimelineBitcode[] = "bitcode";
+
+// Timelines must be owned by a std::shared_ptr, so that spans that outlive
+// the task, such as LLM calls it no longer waits for, can keep theirs alive.
+class Timeline : public std::enable_shared_from_this<Timeline> {
+ public:
+  // name is shown as the name of the process, e.g. the task name.
+  explicit Timeline(const std::string &name);
+
+  // Installs timeline as the current timeline of the calling thread until
+  // the end of the scope. timeline may be null.
+  class Scope {
+   public:
+    explicit Scope(Timeline *timeline);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+    Timeline *previous_;
+  };
+
+  // Returns the timeline installed on the calling thread, or null.
+  static Timeline *Current();
+
+  // Returns the time elapsed since the timeline was created.
+  std::chrono::microseconds Now() const;
+
+  // Adds a span on thread tid from start to end, relative to the creation of
+  // the timeline. args is the body of the JSON object of the span's
+  // arguments. An async span may overlap the other spans of its thread; it
+  // is drawn on a track of its own, named after category.
+  void AddSpan(const char *category, const char *name,
+               std::chrono::microseconds start, std::chrono::microseconds end,
+               int tid, std::string args, bool async = false);
+
+  // Writes the spans to path as a Chrome trace-event JSON file. Returns
+  // false if the file cannot be written. Must not run concurrently with
+  // AddSpan, i.e. only once the work of the task is done.
+  bool WriteChromeTrace(const std::string &path) const;
+
+  // Returns the ID of the calling thread, as the kernel names it.
+  static int CurrentThreadId();
+
+ private:
+  struct Span {
+    const char *category;
+    const char *name;
+    int64_t start_micros;
+    int64_t end_micros;
+    int tid;
+    std::string args;
+    bool async;
+  };
+
+  const std::string name_;
+  const std::chrono::steady_clock::time_point start_;
+  // Appended to by every thread working for the request.
+  tbb::concurrent_vector<Span> spans_;
+};
+
+// Adds a span from its construction to its destruction, or to End, to the
+// timeline of the calling thread, if it has one. The span is on the thread
+// that constructs it. name and category must outlive the timeline, e.g. be
+// string literals.
+class TimelineSpan {
+ public:
+  TimelineSpan(const char *category, const char *name)
+      : TimelineSpan(Timeline::Current(), category, name) {}
+  TimelineSpan(Timeline *timeline, const char *category, const char *name,
+               bool async = false);
+  ~TimelineSpan() { End(); }
+
+  // Ends the span now, possibly on another thread than the one that
+  // started it. Does nothing if the span has already ended.
+  void End();
+
+  TimelineSpan(const TimelineSpan &) = delete;
+  TimelineSpan &operator=(const TimelineSpan &) = delete;
+
+  // Whether the span is recorded. Arguments that are expensive to compute
+  // should only be computed if it is.
+  bool Enabled() const { return timeline_ != nullptr; }
+
+  TimelineSpan &Arg(const char *key, int64_t value);
+  TimelineSpan &Arg(const char *key, const std::string &value);
+
+ private:
+  // Null once the span has ended.
+  Timeline *timeline_;
+  const char *category_;
+  const char *name_;
+  const bool async_;
+  int tid_ = 0;
+  std::chrono::microseconds start_;
+  std::string args_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_TIMELINE_H_
@@ -0,0 +1,215 @@
+// This file defines structured tracing for the hot paths of the analyses,
+// which log too much, and format too much, for LOG(INFO).
+//
+// A trace event is a static name and a list of named arguments:
+//
+//   TRACE(kTraceInstruction, "ErrorConstantInt")
+//       .Arg("f", parent_fname)
+//       .Arg("c", return_value)
+//       .Arg("abstracted", return_lattice_confidence);
+//
+// Events whose level is above ERROR_SPECIFICATIONS_TRACE_LEVEL are removed
+// at compile time, arguments included. The others cost one relaxed load and
+// a branch unless their level is at most the level set at run time, since
+// their arguments are only evaluated when the event is enabled.
+//
+// Enabled events go to the sink set with Tracer::Configure:
+//  - kLog writes each event as one LOG(INFO) line, attributed to the call
+//    site of TRACE.
+//  - kRingBuffer copies the arguments into an in-memory ring buffer of fixed
+//    size that overwrites the oldest events. Scalars, strings, and enums with
+//    an operator<< are stored as bytes; they are only formatted when the
+//    buffer is dumped with Tracer::Dump.
+// Other values, pointers and string views included, are formatted with
+// operator<< when the event is recorded, since what they refer to may be
+// gone by the time the buffer is dumped.
+
+#ifndef ERROR_SPECIFICATIONS_COMMON_INCLUDE_TRACE_H_
+#define ERROR_SPECIFICATIONS_COMMON_INCLUDE_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// The highest trace level compiled in. Define it to 0 to compile out all
+// tracing, or to kTraceFunction to keep only the per-function events.
+#ifndef ERROR_SPECIFICATIONS_TRACE_LEVEL
+#define ERROR_SPECIFICATIONS_TRACE_LEVEL 2
+#endif
+
+// Starts a trace event with the given level and name, which must be a
+// string literal. The event is emitted at the end of the full expression.
+#define TRACE(level, name)                                           \
+  if ((level) > ERROR_SPECIFICATIONS_TRACE_LEVEL ||                  \
+      !::error_specifications::Tracer::Enabled(level)) {             \
+  } else                                                             \
+    ::error_specifications::TraceEvent((level), (name), __FILE__, __LINE__)
+
+namespace error_specifications {
+
+// Events about a whole function, a few per function.
+constexpr int kTraceFunction = 1;
+// Events about a basic block or an instruction.
+constexpr int kTraceInstruction = 2;
+
+enum class TraceSink { kNone, kLog, kRingBuffer };
+
+class Tracer {
+ public:
+  // Sends the events of level at most level to sink. ring_buffer_bytes is
+  // the size of the ring buffer of kRingBuffer, which is cleared.
+  static void Configure(int level, TraceSink sink, size_t ring_buffer_bytes);
+
+  static bool Enabled(int level) {
+    return level <= level_.load(std::memory_order_relaxed);
+  }
+
+  static TraceSink GetSink() { return sink_.load(std::memory_order_relaxed); }
+
+  // Writes the events in the ring buffer, oldest first, one per line.
+  static void Dump(std::ostream &out);
+
+  // Starts a thread that dumps the ring buffer to path, overwriting it,
+  // whenever the process receives signal_number. Blocks the signal in the
+  // calling thread, so it must be called before any other thread starts.
+  static void DumpOnSignal(int signal_number, const std::string &path);
+
+ private:
+  friend class TraceEvent;
+
+  // Emits the encoded event in record to the sink.
+  static void Emit(const std::string &record, const char *file, int line);
+
+  // The runtime level, which is 0 when the sink is kNone.
+  static std::atomic<int> level_;
+  static std::atomic<TraceSink> sink_;
+};
+
+// Builds one trace event. Only meant to be used through TRACE.
+class TraceEvent {
+ public:
+  TraceEvent(int level, const char *name, const char *file, int line);
+  ~TraceEvent() { Tracer::Emit(record_, file_, line_); }
+
+  TraceEvent(const TraceEvent &) = delete;
+  TraceEvent &operator=(const TraceEvent &) = delete;
+
+  TraceEvent &Arg(const char *key, bool value) {
+    return Scalar(key, kBool, static_cast<uint64_t>(value));
+  }
+  TraceEvent &Arg(const char *key, const char *value) {
+    return String(key, value, std::strlen(value));
+  }
+  TraceEvent &Arg(const char *key, const std::string &value) {
+    return String(key, value.data(), value.size());
+  }
+  TraceEvent &Arg(const char *key, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return Scalar(key, kDouble, bits);
+  }
+
+  template <typename T>
+  TraceEvent &Arg(const char *key, const T &value) {
+    return Value(key, value, std::integral_constant<int, ArgKind<T>()>());
+  }
+
+  // The types of encoded arguments.
+  enum ArgType : uint8_t {
+    kBool,
+    kInt,
+    kUnsigned,
+    kDouble,
+    kString,
+    kFormatted,
+  };
+
+  // A function that writes the value of type T stored in bytes to out.
+  using Formatter = void (*)(const char *bytes, std::ostream &out);
+
+ private:
+  // The largest value that is copied instead of being formatted.
+  static constexpr size_t kMaxCopiedBytes = 32;
+
+  // Only values that own all of their state are copied. A trivially
+  // copyable struct may still point to memory that does not outlive the
+  // event.
+  enum { kIntegral, kCopied, kEagerlyFormatted };
+  template <typename T>
+  static constexpr int ArgKind() {
+    return std::is_integral<T>::value
+               ? kIntegral
+               : (std::is_arithmetic<T>::value || std::is_enum<T>::value) &&
+                         sizeof(T) <= kMaxCopiedBytes
+                     ? kCopied
+                     : kEagerlyFormatted;
+  }
+
+  template <typename T>
+  TraceEvent &Value(const char *key, const T &value,
+                    std::integral_constant<int, kIntegral>) {
+    return std::is_signed<T>::value
+               ? Scalar(key, kInt, static_cast<uint64_t>(
+                                       static_cast<int64_t>(value)))
+               : Scalar(key, kUnsigned, static_cast<uint64_t>(value));
+  }
+
+  template <typename T>
+  TraceEvent &Value(const char *key, const T &value,
+                    std::integral_constant<int, kCopied>) {
+    Formatter formatter = &FormatCopied<T>;
+    Header(key, kFormatted);
+    Append(&formatter, sizeof(formatter));
+    const uint8_t size = sizeof(T);
+    Append(&size, sizeof(size));
+    Append(&value, sizeof(T));
+    return *this;
+  }
+
+  template <typename T>
+  TraceEvent &Value(const char *key, const T &value,
+                    std::integral_constant<int, kEagerlyFormatted>) {
+    std::ostringstream stream;
+    stream << value;
+    const std::string formatted = stream.str();
+    return String(key, formatted.data(), formatted.size());
+  }
+
+  template <typename T>
+  static void FormatCopied(const char *bytes, std::ostream &out) {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    std::memcpy(&storage, bytes, sizeof(T));
+    out << *reinterpret_cast<const T *>(&storage);
+  }
+
+  void Header(const char *key, ArgType type) {
+    Append(&key, sizeof(key));
+    Append(&type, sizeof(type));
+  }
+
+  TraceEvent &Scalar(const char *key, ArgType type, uint64_t value) {
+    Header(key, type);
+    Append(&value, sizeof(value));
+    return *this;
+  }
+
+  TraceEvent &String(const char *key, const char *data, size_t size);
+
+  void Append(const void *data, size_t size) {
+    record_.append(static_cast<const char *>(data), size);
+  }
+
+  // The encoded event: its level, timestamp and name, then its arguments.
+  std::string record_;
+  const char *file_;
+  int line_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_COMMON_INCLUDE_TRACE_H_
@@ -0,0 +1,160 @@
+#include "admission_controller.h"
+
+#include "glog/logging.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+namespace {
+
+struct AdmissionMetrics {
+  Gauge &queue_length = MetricRegistry::Get().GetGauge(
+      "admission_queue_length", "Tasks waiting for admission.");
+  Gauge &running_tasks = MetricRegistry::Get().GetGauge(
+      "admission_running_tasks", "Admitted tasks that have not finished.");
+  Gauge &reserved_bytes = MetricRegistry::Get().GetGauge(
+      "admission_reserved_bytes",
+      "Sum of the estimated bytes of the admitted tasks.");
+  Counter &submitted_tasks = MetricRegistry::Get().GetCounter(
+      "admission_submitted_tasks_total", "Tasks submitted for admission.");
+  Counter &queued_tasks = MetricRegistry::Get().GetCounter(
+      "admission_queued_tasks_total",
+      "Tasks that had to wait for admission.");
+};
+
+AdmissionMetrics &GetAdmissionMetrics() {
+  static AdmissionMetrics *const metrics = new AdmissionMetrics();
+  return *metrics;
+}
+
+}  // namespace
+
+AdmissionController::AdmissionController(
+    OperationsServiceImpl *operations_service, const AdmissionOptions &options)
+    : operations_service_(operations_service), options_(options) {}
+
+void AdmissionController::Submit(const std::string &task_name,
+                                 uint64_t estimated_bytes, tbb::task *task,
+                                 AdmissionTicket *ticket) {
+  std::vector<tbb::task *> admitted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (estimated_bytes == kUnknownTaskBytes) {
+      estimated_bytes = options_.default_task_bytes;
+    }
+    *ticket = next_ticket_++;
+    PendingTask pending{*ticket, task_name, estimated_bytes, task};
+    GetAdmissionMetrics().submitted_tasks.Increment();
+
+    if (options_.memory_budget_bytes != 0 &&
+        estimated_bytes > options_.memory_budget_bytes) {
+      LOG(WARNING) << task_name << " is estimated at " << estimated_bytes
+                   << " bytes, more than the whole memory budget of "
+                   << options_.memory_budget_bytes
+                   << " bytes. It will run alone.";
+    }
+
+    // Keep FIFO order: a task only skips the queue if nobody is waiting.
+    if (pending_.empty() && FitsLocked(estimated_bytes)) {
+      AdmitLocked(pending, &admitted);
+    } else {
+      pending_.push_back(pending);
+      LOG(INFO) << "Queued " << task_name << " at position "
+                << pending_.size();
+      GetAdmissionMetrics().queued_tasks.Increment();
+      PublishLocked(pending, pending_.size());
+    }
+    UpdateMetricsLocked();
+  }
+  for (tbb::task *admitted_task : admitted) {
+    tbb::task::enqueue(*admitted_task);
+  }
+}
+
+void AdmissionController::Release(AdmissionTicket ticket) {
+  std::vector<tbb::task *> admitted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = running_.find(ticket);
+    if (it == running_.end()) {
+      LOG(WARNING) << "Released unknown admission ticket " << ticket;
+      return;
+    }
+    reserved_bytes_ -= it->second;
+    running_.erase(it);
+
+    AdmitWaitingLocked(&admitted);
+    UpdateMetricsLocked();
+  }
+  for (tbb::task *admitted_task : admitted) {
+    tbb::task::enqueue(*admitted_task);
+  }
+}
+
+bool AdmissionController::FitsLocked(uint64_t estimated_bytes) const {
+  // Nothing running: always admit, otherwise an oversized task would starve.
+  if (running_.empty()) return true;
+  if (options_.max_concurrent_tasks != 0 &&
+      running_.size() >= options_.max_concurrent_tasks) {
+    return false;
+  }
+  if (options_.memory_budget_bytes != 0 &&
+      reserved_bytes_ + estimated_bytes > options_.memory_budget_bytes) {
+    return false;
+  }
+  return true;
+}
+
+void AdmissionController::AdmitLocked(const PendingTask &pending,
+                                      std::vector<tbb::task *> *admitted) {
+  running_[pending.ticket] = pending.estimated_bytes;
+  reserved_bytes_ += pending.estimated_bytes;
+  // Publish before enqueueing so the task's own updates always come later.
+  PublishLocked(pending, /*queue_position=*/0);
+  admitted->push_back(pending.task);
+}
+
+void AdmissionController::AdmitWaitingLocked(
+    std::vector<tbb::task *> *admitted) {
+  const size_t admitted_before = admitted->size();
+  while (!pending_.empty() && FitsLocked(pending_.front().estimated_bytes)) {
+    PendingTask pending = pending_.front();
+    pending_.pop_front();
+    LOG(INFO) << "Admitting " << pending.task_name;
+    AdmitLocked(pending, admitted);
+  }
+  if (admitted->size() != admitted_before) PublishQueuePositionsLocked();
+}
+
+void AdmissionController::PublishQueuePositionsLocked() {
+  uint64_t queue_position = 1;
+  for (const PendingTask &pending : pending_) {
+    PublishLocked(pending, queue_position++);
+  }
+}
+
+void AdmissionController::UpdateMetricsLocked() {
+  AdmissionMetrics &metrics = GetAdmissionMetrics();
+  metrics.queue_length.Set(pending_.size());
+  metrics.running_tasks.Set(running_.size());
+  metrics.reserved_bytes.Set(reserved_bytes_);
+}
+
+void AdmissionController::PublishLocked(const PendingTask &pending,
+                                        uint64_t queue_position) {
+  AdmissionMetadata metadata;
+  metadata.set_queue_position(queue_position);
+  metadata.set_queue_length(pending_.size());
+  metadata.set_estimated_bytes(pending.estimated_bytes);
+  metadata.set_reserved_bytes(reserved_bytes_);
+  metadata.set_memory_budget_bytes(options_.memory_budget_bytes);
+
+  Operation operation;
+  operation.set_name(pending.task_name);
+  operation.set_done(0);
+  operation.mutable_metadata()->PackFrom(metadata);
+  operation.set_metadata_type(metadata.GetTypeName());
+  operations_service_->UpdateOperation(pending.task_name, operation);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,151 @@
+#include "file_hash_cache.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <vector>
+
+#include "glog/logging.h"
+#include "metrics.h"
+#include "servers.h"
+
+namespace error_specifications {
+
+// Each line of the cache file is "<key>\t<digest>", where the key is
+// "<canonical path>\t<size>\t<mtime ns>\t<inode>". Later lines win, so the
+// file can be appended to without rewriting it.
+
+namespace {
+
+constexpr size_t kDigestLength = 64;
+
+bool IsDecimal(const std::string &field) {
+  return !field.empty() &&
+         field.find_first_not_of("0123456789") == std::string::npos;
+}
+
+// Returns true if line is a complete entry: a key of four fields and a
+// SHA-256 hex digest. A line cut short by a crash is not.
+bool ParseEntry(const std::string &line, std::string &out_key,
+                std::string &out_digest) {
+  std::vector<std::string> fields;
+  size_t field_start = 0;
+  while (true) {
+    const size_t field_end = line.find('\t', field_start);
+    fields.push_back(line.substr(field_start, field_end - field_start));
+    if (field_end == std::string::npos) break;
+    field_start = field_end + 1;
+  }
+  if (fields.size() != 5 || fields[0].empty() || !IsDecimal(fields[1]) ||
+      !IsDecimal(fields[2]) || !IsDecimal(fields[3])) {
+    return false;
+  }
+  const std::string &digest = fields[4];
+  if (digest.size() != kDigestLength ||
+      digest.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+  out_key = line.substr(0, line.size() - kDigestLength - 1);
+  out_digest = digest;
+  return true;
+}
+
+}  // namespace
+
+FileHashCache::FileHashCache(const std::string &cache_file)
+    : cache_file_(cache_file) {
+  if (cache_file_.empty()) return;
+
+  std::ifstream ifs(cache_file_);
+  if (!ifs) return;
+
+  std::string line;
+  std::string key;
+  std::string digest;
+  int num_entries = 0;
+  while (std::getline(ifs, line)) {
+    if (!ParseEntry(line, key, digest)) continue;
+    digests_[key] = digest;
+    ++num_entries;
+  }
+  LOG(INFO) << "Loaded " << num_entries << " file hashes from " << cache_file_;
+}
+
+bool FileHashCache::GetFileKey(const std::string &file_path,
+                               std::string &out_key) {
+  char canonical_path[PATH_MAX];
+  if (realpath(file_path.c_str(), canonical_path) == NULL) return false;
+
+  struct stat file_stat;
+  if (stat(canonical_path, &file_stat) != 0) return false;
+
+  const std::string path(canonical_path);
+  if (path.find_first_of("\t\n") != std::string::npos) return false;
+
+  const long long mtime_ns =
+      static_cast<long long>(file_stat.st_mtim.tv_sec) * 1000000000LL +
+      file_stat.st_mtim.tv_nsec;
+  out_key = path + "\t" + std::to_string(file_stat.st_size) + "\t" +
+            std::to_string(mtime_ns) + "\t" + std::to_string(file_stat.st_ino);
+  return true;
+}
+
+grpc::Status FileHashCache::HashFile(const std::string &file_path,
+                                     std::string &out_hash) {
+  static Counter &hits =
+      MetricRegistry::Get().GetCounter("eesi_file_hash_cache_hits_total",
+                                       "Files whose cached digest was reused.");
+  static Counter &misses = MetricRegistry::Get().GetCounter(
+      "eesi_file_hash_cache_misses_total", "Files that had to be hashed.");
+  static Histogram &hash_seconds = MetricRegistry::Get().GetHistogram(
+      "eesi_file_hash_seconds", "Time to hash a file that was not cached.",
+      Histogram::LatencyBounds());
+  std::string key;
+  const bool cacheable = GetFileKey(file_path, key);
+  if (cacheable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = digests_.find(key);
+    if (it != digests_.end()) {
+      out_hash = it->second;
+      hits.Increment();
+      return grpc::Status::OK;
+    }
+  }
+  misses.Increment();
+
+  // Hash without holding the lock; this is the slow part.
+  grpc::Status err;
+  {
+    ScopedLatency latency(hash_seconds);
+    err = error_specifications::HashFile(file_path, out_hash);
+  }
+  if (!err.ok() || !cacheable) return err;
+
+  // Only cache the digest if the file did not change while being hashed.
+  std::string key_after;
+  if (!GetFileKey(file_path, key_after) || key_after != key) {
+    return grpc::Status::OK;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (digests_.insert(std::make_pair(key, out_hash)).second) {
+    AppendEntry(key, out_hash);
+  }
+  return grpc::Status::OK;
+}
+
+void FileHashCache::AppendEntry(const std::string &key,
+                                const std::string &digest) {
+  if (cache_file_.empty()) return;
+
+  std::ofstream ofs(cache_file_, std::ios::app);
+  if (!ofs) {
+    LOG(WARNING) << "Unable to append to hash cache " << cache_file_;
+    return;
+  }
+  ofs << key << "\t" << digest << "\n";
+}
+
+}  // namespace error_specifications
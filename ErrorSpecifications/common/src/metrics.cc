@@ -0,0 +1,314 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Escapes a label value or a help text for the Prometheus text format.
+std::string Escape(const std::string &text, bool quote) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else if (c == '"' && quote) {
+      escaped += "\\\"";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Formats a sample value, with the spellings Prometheus expects for the
+// special values.
+std::string FormatValue(double value) {
+  if (std::isnan(value)) return "NaN";
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  std::ostringstream out;
+  out.precision(std::numeric_limits<double>::digits10);
+  out << value;
+  return out.str();
+}
+
+// Writes {name="value",...}, with extra appended to the labels, or nothing
+// if there are no labels.
+void WriteLabels(const MetricLabels &labels, const std::string &extra,
+                 std::ostream &out) {
+  if (labels.empty() && extra.empty()) return;
+  out << "{";
+  bool first = true;
+  for (const auto &label : labels) {
+    if (!first) out << ",";
+    out << label.first << "=\"" << Escape(label.second, /*quote=*/true)
+        << "\"";
+    first = false;
+  }
+  if (!extra.empty()) out << (first ? "" : ",") << extra;
+  out << "}";
+}
+
+const char *TypeName(MetricType type) {
+  switch (type) {
+    case METRIC_TYPE_COUNTER:
+      return "counter";
+    case METRIC_TYPE_GAUGE:
+      return "gauge";
+    case METRIC_TYPE_HISTOGRAM:
+      return "histogram";
+    default:
+      return "untyped";
+  }
+}
+
+// Returns the CPU time of the process, in seconds.
+double ProcessCpuSeconds() {
+  timespec cpu_time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+  return cpu_time.tv_sec + cpu_time.tv_nsec / 1e9;
+}
+
+void SetLabels(const MetricLabels &labels, Metric *metric) {
+  for (const auto &label : labels) {
+    (*metric->mutable_labels())[label.first] = label.second;
+  }
+}
+
+}  // namespace
+
+void Gauge::SetMax(double value) {
+  double current = value_.load(std::memory_order_relaxed);
+  while (current < value &&
+         !value_.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+Histogram::Histogram(const std::vector<double> &bounds)
+    : bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  for (size_t i = 0; i <= bounds_.size(); ++i) buckets_[i].store(0);
+}
+
+void Histogram::Observe(double value) {
+  const size_t bucket =
+      std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+      bounds_.begin();
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  AtomicAdd(sum_, value);
+}
+
+void Histogram::Snapshot(HistogramValue *histogram) const {
+  uint64_t count = 0;
+  for (size_t i = 0; i < bounds_.size(); ++i) {
+    count += buckets_[i].load(std::memory_order_relaxed);
+    histogram->add_bucket_upper_bounds(bounds_[i]);
+    histogram->add_bucket_counts(count);
+  }
+  count += buckets_[bounds_.size()].load(std::memory_order_relaxed);
+  histogram->set_sum(sum_.load(std::memory_order_relaxed));
+  histogram->set_count(count);
+}
+
+std::vector<double> Histogram::LatencyBounds() {
+  std::vector<double> bounds;
+  for (double bound = 0.001; bound < 200; bound *= 2) bounds.push_back(bound);
+  return bounds;
+}
+
+std::vector<double> Histogram::SizeBounds() {
+  std::vector<double> bounds;
+  for (double bound = 1; bound <= (1 << 20); bound *= 4) {
+    bounds.push_back(bound);
+  }
+  return bounds;
+}
+
+ScopedPassMetrics::ScopedPassMetrics(const char *pass_name)
+    : wall_seconds_(MetricRegistry::Get().GetCounter(
+          "eesi_pass_wall_seconds_total",
+          "Wall time spent in analysis passes.", {{"pass", pass_name}})),
+      cpu_seconds_(MetricRegistry::Get().GetCounter(
+          "eesi_pass_cpu_seconds_total",
+          "CPU time of the process while analysis passes ran.",
+          {{"pass", pass_name}})),
+      running_(MetricRegistry::Get().GetGauge(
+          "eesi_pass_running", "Runs of analysis passes in progress.",
+          {{"pass", pass_name}})),
+      wall_start_(std::chrono::steady_clock::now()),
+      cpu_start_(ProcessCpuSeconds()),
+      span_(kTimelinePass, pass_name) {
+  MetricRegistry::Get()
+      .GetCounter("eesi_pass_runs_total", "Runs of analysis passes.",
+                  {{"pass", pass_name}})
+      .Increment();
+  running_.Add(1);
+}
+
+ScopedPassMetrics::~ScopedPassMetrics() {
+  running_.Add(-1);
+  wall_seconds_.Increment(std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - wall_start_)
+                              .count());
+  cpu_seconds_.Increment(ProcessCpuSeconds() - cpu_start_);
+}
+
+MetricRegistry &MetricRegistry::Get() {
+  static MetricRegistry *registry = new MetricRegistry();
+  return *registry;
+}
+
+MetricRegistry::Family &MetricRegistry::GetFamilyLocked(
+    const std::string &name, MetricType type, const std::string &help) {
+  auto inserted = families_.emplace(name, Family());
+  Family &family = inserted.first->second;
+  if (inserted.second) {
+    family.type = type;
+    family.help = help;
+  } else if (family.type != type) {
+    LOG(FATAL) << "Metric " << name << " is a " << TypeName(family.type)
+               << ", not a " << TypeName(type);
+  }
+  return family;
+}
+
+Counter &MetricRegistry::GetCounter(const std::string &name,
+                                    const std::string &help,
+                                    const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Counter> &counter =
+      GetFamilyLocked(name, METRIC_TYPE_COUNTER, help).counters[labels];
+  if (!counter) counter.reset(new Counter());
+  return *counter;
+}
+
+Gauge &MetricRegistry::GetGauge(const std::string &name,
+                                const std::string &help,
+                                const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Gauge> &gauge =
+      GetFamilyLocked(name, METRIC_TYPE_GAUGE, help).gauges[labels];
+  if (!gauge) gauge.reset(new Gauge());
+  return *gauge;
+}
+
+Histogram &MetricRegistry::GetHistogram(const std::string &name,
+                                        const std::string &help,
+                                        const std::vector<double> &bounds,
+                                        const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Family &family = GetFamilyLocked(name, METRIC_TYPE_HISTOGRAM, help);
+  if (family.histograms.empty()) family.bounds = bounds;
+  std::unique_ptr<Histogram> &histogram = family.histograms[labels];
+  if (!histogram) histogram.reset(new Histogram(family.bounds));
+  return *histogram;
+}
+
+void MetricRegistry::Snapshot(const std::string &name_prefix,
+                              GetMetricsResponse *response) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &entry : families_) {
+    if (entry.first.compare(0, name_prefix.size(), name_prefix) != 0) {
+      continue;
+    }
+    const Family &family = entry.second;
+    MetricFamily *family_proto = response->add_families();
+    family_proto->set_name(entry.first);
+    family_proto->set_help(family.help);
+    family_proto->set_type(family.type);
+    for (const auto &counter : family.counters) {
+      Metric *metric = family_proto->add_metrics();
+      SetLabels(counter.first, metric);
+      metric->set_value(counter.second->Value());
+    }
+    for (const auto &gauge : family.gauges) {
+      Metric *metric = family_proto->add_metrics();
+      SetLabels(gauge.first, metric);
+      metric->set_value(gauge.second->Value());
+    }
+    for (const auto &histogram : family.histograms) {
+      Metric *metric = family_proto->add_metrics();
+      SetLabels(histogram.first, metric);
+      histogram.second->Snapshot(metric->mutable_histogram());
+    }
+  }
+}
+
+void MetricRegistry::WritePrometheusText(std::ostream &out) const {
+  GetMetricsResponse snapshot;
+  Snapshot("", &snapshot);
+  for (const MetricFamily &family : snapshot.families()) {
+    const std::string &name = family.name();
+    out << "# HELP " << name << " " << Escape(family.help(), /*quote=*/false)
+        << "\n";
+    out << "# TYPE " << name << " " << TypeName(family.type()) << "\n";
+    for (const Metric &metric : family.metrics()) {
+      // The proto map is unordered; print the labels sorted.
+      MetricLabels labels(metric.labels().begin(), metric.labels().end());
+      std::sort(labels.begin(), labels.end());
+      if (family.type() != METRIC_TYPE_HISTOGRAM) {
+        out << name;
+        WriteLabels(labels, "", out);
+        out << " " << FormatValue(metric.value()) << "\n";
+        continue;
+      }
+      const HistogramValue &histogram = metric.histogram();
+      for (int i = 0; i < histogram.bucket_upper_bounds_size(); ++i) {
+        out << name << "_bucket";
+        WriteLabels(labels,
+                    "le=\"" +
+                        FormatValue(histogram.bucket_upper_bounds(i)) + "\"",
+                    out);
+        out << " " << histogram.bucket_counts(i) << "\n";
+      }
+      out << name << "_bucket";
+      WriteLabels(labels, "le=\"+Inf\"", out);
+      out << " " << histogram.count() << "\n";
+      out << name << "_sum";
+      WriteLabels(labels, "", out);
+      out << " " << FormatValue(histogram.sum()) << "\n";
+      out << name << "_count";
+      WriteLabels(labels, "", out);
+      out << " " << histogram.count() << "\n";
+    }
+  }
+}
+
+void MetricRegistry::DumpToFile(const std::string &path) const {
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::trunc);
+    if (!out) {
+      LOG(WARNING) << "Unable to write metrics to " << temporary_path;
+      return;
+    }
+    WritePrometheusText(out);
+  }
+  if (rename(temporary_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Unable to replace " << path;
+  }
+}
+
+void MetricRegistry::DumpPeriodically(const std::string &path,
+                                      std::chrono::seconds interval) {
+  std::thread([this, path, interval]() {
+    for (;;) {
+      std::this_thread::sleep_for(interval);
+      DumpToFile(path);
+    }
+  }).detach();
+}
+
+}  // namespace error_specifications
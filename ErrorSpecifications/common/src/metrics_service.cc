@@ -0,0 +1,14 @@
+#include "metrics_service.h"
+
+#include "metrics.h"
+
+namespace error_specifications {
+
+grpc::Status MetricsServiceImpl::GetMetrics(grpc::ServerContext *context,
+                                            const GetMetricsRequest *request,
+                                            GetMetricsResponse *response) {
+  MetricRegistry::Get().Snapshot(request->name_prefix(), response);
+  return grpc::Status::OK;
+}
+
+}  // namespace error_specifications
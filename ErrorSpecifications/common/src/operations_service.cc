@@ -2,6 +2,8 @@
 
 namespace error_specifications {
 
+constexpr size_t OperationsServiceImpl::kMaxFinishedOperations;
+
 void OperationsServiceImpl::UpdateOperation(std::string operation_name,
                                             Operation operation) {
   OperationTable::accessor a;
@@ -13,10 +15,18 @@ void OperationsServiceImpl::UpdateOperation(std::string operation_name,
       return;
     }
     a->second = operation;
-  } else {
-    // The operation does not yet exist. Insert it.
-    operation_progress_.insert(std::make_pair(operation_name, operation));
+    return;
+  }
+  // The operation does not yet exist. Insert it, unless its result was
+  // already returned and erased: a late progress update would otherwise
+  // bring it back as an operation that never finishes. Holding the
+  // accessor of the new entry orders this against GetOperation.
+  operation_progress_.insert(a, operation_name);
+  if (!operation.done() && IsFinished(operation_name)) {
+    operation_progress_.erase(a);
+    return;
   }
+  a->second = operation;
 }
 
 grpc::Status OperationsServiceImpl::GetOperation(
@@ -32,12 +42,28 @@ grpc::Status OperationsServiceImpl::GetOperation(
 
   // If the operation is done, remove the key, i.e. do not cache results.
   if (operation->done()) {
+    MarkFinished(request->name());
     operation_progress_.erase(a);
   }
 
   return grpc::Status::OK;
 }
 
+void OperationsServiceImpl::MarkFinished(const std::string &name) {
+  std::lock_guard<std::mutex> lock(finished_mutex_);
+  if (!finished_.insert(name).second) return;
+  finished_order_.push_back(name);
+  if (finished_order_.size() > kMaxFinishedOperations) {
+    finished_.erase(finished_order_.front());
+    finished_order_.pop_front();
+  }
+}
+
+bool OperationsServiceImpl::IsFinished(const std::string &name) {
+  std::lock_guard<std::mutex> lock(finished_mutex_);
+  return finished_.count(name) > 0;
+}
+
 grpc::Status OperationsServiceImpl::DeleteOperation(
     grpc::ServerContext *context, const DeleteOperationRequest *request,
     Operation *operation) {
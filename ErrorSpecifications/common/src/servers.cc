@@ -1,9 +1,15 @@
 #include "servers.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <ctime>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include "glog/logging.h"
 #include "google/cloud/storage/client.h"
@@ -50,60 +56,141 @@ Uri FilePathToUri(const std::string &file_path) {
   return uri;
 }
 
-grpc::Status HashString(const std::string &input_string,
-                        std::string &out_hashed_string) {
-  EVP_MD_CTX *context = EVP_MD_CTX_new();
-  if (context == NULL) {
-    const std::string &err_msg =
-        "HashBitcodeData: Unable to create OpenSSL EVP context.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+namespace {
+
+// Hex digits for DigestToHex.
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// Converts a binary digest into a lowercase hex string.
+std::string DigestToHex(const unsigned char *digest, unsigned int length) {
+  std::string hex(2 * length, '0');
+  for (unsigned int i = 0; i < length; ++i) {
+    hex[2 * i] = kHexDigits[digest[i] >> 4];
+    hex[2 * i + 1] = kHexDigits[digest[i] & 0xf];
   }
+  return hex;
+}
 
-  // All paths must call EVP_MD_CTX_free(context) from this point forward.
+// Incremental SHA-256 over an OpenSSL EVP context. The context is freed on
+// destruction, so callers can return early on any error.
+class Sha256Digest {
+ public:
+  Sha256Digest() : context_(EVP_MD_CTX_new()) {}
+  ~Sha256Digest() {
+    if (context_ != NULL) EVP_MD_CTX_free(context_);
+  }
 
-  int err = EVP_DigestInit_ex(context, EVP_sha256(), NULL);
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg =
-        "HashBitcodeData: Unable to initialize message digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+  Sha256Digest(const Sha256Digest &) = delete;
+  Sha256Digest &operator=(const Sha256Digest &) = delete;
+
+  grpc::Status Init() {
+    if (context_ == NULL) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to create OpenSSL EVP context.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    if (EVP_DigestInit_ex(context_, EVP_sha256(), NULL) == 0) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to initialize message digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    return grpc::Status::OK;
   }
 
-  err = EVP_DigestUpdate(context, input_string.c_str(), input_string.length());
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg = "HashBitcodeData: Unable to update digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+  grpc::Status Update(const void *data, size_t length) {
+    if (EVP_DigestUpdate(context_, data, length) == 0) {
+      const std::string &err_msg = "HashBitcodeData: Unable to update digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    return grpc::Status::OK;
   }
 
-  // The actual hash.
-  unsigned char hash[EVP_MAX_MD_SIZE];
+  grpc::Status Final(std::string &out_hex) {
+    // The actual hash.
+    unsigned char hash[EVP_MAX_MD_SIZE];
 
-  // Hash length returned by OpenSSL.
-  unsigned int hash_length = 0;
+    // Hash length returned by OpenSSL.
+    unsigned int hash_length = 0;
 
-  err = EVP_DigestFinal_ex(context, hash, &hash_length);
-  if (err == 0) {
-    EVP_MD_CTX_free(context);
-    const std::string &err_msg = "HashBitcodeData: Unable to finalize digest.";
-    LOG(ERROR) << err_msg;
-    return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    if (EVP_DigestFinal_ex(context_, hash, &hash_length) == 0) {
+      const std::string &err_msg =
+          "HashBitcodeData: Unable to finalize digest.";
+      LOG(ERROR) << err_msg;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    out_hex = DigestToHex(hash, hash_length);
+    return grpc::Status::OK;
+  }
+
+ private:
+  EVP_MD_CTX *context_;
+};
+
+}  // namespace
+
+grpc::Status HashString(const std::string &input_string,
+                        std::string &out_hashed_string) {
+  Sha256Digest digest;
+  grpc::Status err = digest.Init();
+  if (!err.ok()) return err;
+  err = digest.Update(input_string.data(), input_string.length());
+  if (!err.ok()) return err;
+  return digest.Final(out_hashed_string);
+}
+
+grpc::Status HashFile(const std::string &file_path,
+                      std::string &out_hashed_file) {
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    const std::string &err_msg = "Unable to open file for hashing.";
+    LOG(ERROR) << err_msg << " " << file_path;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    const std::string &err_msg = "Unable to stat file for hashing.";
+    LOG(ERROR) << err_msg << " " << file_path;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
+  const size_t file_size = static_cast<size_t>(file_stat.st_size);
 
-  // Convert hash to string.
-  std::stringstream ss;
-  for (unsigned int i = 0; i < hash_length; ++i) {
-    ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+  Sha256Digest digest;
+  grpc::Status err = digest.Init();
+  if (!err.ok()) {
+    close(fd);
+    return err;
   }
 
-  out_hashed_string = ss.str();
+  // mmap rejects empty mappings; the digest of an empty file needs no data.
+  if (file_size > 0) {
+    void *mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      const std::string &err_msg = "Unable to map file for hashing.";
+      LOG(ERROR) << err_msg << " " << file_path;
+      return grpc::Status(grpc::StatusCode::INTERNAL, err_msg);
+    }
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
 
-  EVP_MD_CTX_free(context);
+    // Hash in chunks and drop each chunk once hashed, so hashing a large
+    // file does not pin the whole file in our address space.
+    const char *bytes = static_cast<const char *>(mapping);
+    for (size_t offset = 0; offset < file_size && err.ok();
+         offset += kHashChunkSize) {
+      const size_t length = std::min(kHashChunkSize, file_size - offset);
+      err = digest.Update(bytes + offset, length);
+      madvise(const_cast<char *>(bytes) + offset, length, MADV_DONTNEED);
+    }
+    munmap(mapping, file_size);
+  }
+  close(fd);
+  if (!err.ok()) return err;
 
-  return grpc::Status::OK;
+  return digest.Final(out_hashed_file);
 }
 
 std::string StripSuffixAfterDot(const std::string &input_string) {
@@ -165,6 +252,123 @@ grpc::Status ReadUriIntoString(const Uri &uri, std::string &data) {
   return grpc::Status::OK;
 }
 
+grpc::Status ReadUriIntoBuffer(
+    const Uri &uri, std::unique_ptr<llvm::MemoryBuffer> &out_buffer) {
+  switch (uri.scheme()) {
+    case Scheme::SCHEME_FILE:
+      {
+        std::string file_path;
+        grpc::Status err = ConvertUriToFilePath(uri, file_path);
+        if (!err.ok()) {
+          return err;
+        }
+        // Textual IR needs the null terminator; LLVM still maps the file
+        // unless its size is an exact multiple of the page size.
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+            llvm::MemoryBuffer::getFile(file_path, /*FileSize=*/-1,
+                                        /*RequiresNullTerminator=*/true);
+        if (!buffer) {
+          const std::string &err_msg = "Unable to read file.";
+          LOG(ERROR) << err_msg << " " << buffer.getError().message();
+          return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+        }
+        out_buffer = std::move(*buffer);
+      }
+      break;
+    case Scheme::SCHEME_GS:
+      {
+        google::cloud::StatusOr<google::cloud::storage::Client> client =
+            google::cloud::storage::Client::CreateDefaultClient();
+        if (!client) {
+          const std::string err_msg = "Failed to create GS storage client.";
+          LOG(ERROR) << err_msg << client.status();
+          return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, err_msg);
+        }
+        google::cloud::StatusOr<google::cloud::storage::ObjectMetadata>
+            metadata = client->GetObjectMetadata(uri.authority(), uri.path());
+        if (!metadata) {
+          const std::string err_msg = "Unable to get GS object metadata.";
+          LOG(ERROR) << err_msg << metadata.status();
+          return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+        }
+        const size_t object_size = metadata->size();
+        std::unique_ptr<llvm::WritableMemoryBuffer> buffer =
+            llvm::WritableMemoryBuffer::getNewUninitMemBuffer(object_size,
+                                                              uri.path());
+        if (!buffer) {
+          const std::string err_msg = "Unable to allocate buffer.";
+          LOG(ERROR) << err_msg;
+          return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, err_msg);
+        }
+        google::cloud::storage::ObjectReadStream stream =
+            client->ReadObject(uri.authority(), uri.path());
+        stream.read(buffer->getBufferStart(), object_size);
+        if (static_cast<size_t>(stream.gcount()) != object_size) {
+          const std::string err_msg = "Short read of GS object.";
+          LOG(ERROR) << err_msg << stream.status();
+          return grpc::Status(grpc::StatusCode::DATA_LOSS, err_msg);
+        }
+        out_buffer = std::move(buffer);
+      }
+      break;
+    default:
+      {
+        const std::string err_msg = "Invalid URI scheme provided.";
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+      }
+      break;
+  }
+
+  return grpc::Status::OK;
+}
+
+grpc::Status GetUriSize(const Uri &uri, uint64_t &out_size) {
+  switch (uri.scheme()) {
+    case Scheme::SCHEME_FILE:
+      {
+        std::string file_path;
+        grpc::Status err = ConvertUriToFilePath(uri, file_path);
+        if (!err.ok()) {
+          return err;
+        }
+        struct stat file_stat;
+        if (stat(file_path.c_str(), &file_stat) != 0) {
+          const std::string &err_msg = "Unable to stat file.";
+          return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+        }
+        out_size = static_cast<uint64_t>(file_stat.st_size);
+      }
+      break;
+    case Scheme::SCHEME_GS:
+      {
+        google::cloud::StatusOr<google::cloud::storage::Client> client =
+            google::cloud::storage::Client::CreateDefaultClient();
+        if (!client) {
+          const std::string err_msg = "Failed to create GS storage client.";
+          LOG(ERROR) << err_msg << client.status();
+          return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, err_msg);
+        }
+        google::cloud::StatusOr<google::cloud::storage::ObjectMetadata>
+            metadata = client->GetObjectMetadata(uri.authority(), uri.path());
+        if (!metadata) {
+          const std::string err_msg = "Unable to get GS object metadata.";
+          LOG(ERROR) << err_msg << metadata.status();
+          return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+        }
+        out_size = metadata->size();
+      }
+      break;
+    default:
+      {
+        const std::string err_msg = "Invalid URI scheme provided.";
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
+      }
+      break;
+  }
+
+  return grpc::Status::OK;
+}
+
 std::string GetTaskName(const std::string &request_name,
                         const std::string &unique_id) {
   std::time_t curr_time = std::time(nullptr);
@@ -0,0 +1,145 @@
+#include "timeline.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace error_specifications {
+
+namespace {
+
+thread_local Timeline *current_timeline = nullptr;
+
+// Writes text as a JSON string, quotes included.
+void WriteJsonString(const std::string &text, std::ostream &out) {
+  out << '"';
+  for (char c : text) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[7];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out << escaped;
+        } else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+}  // namespace
+
+Timeline::Timeline(const std::string &name)
+    : name_(name), start_(std::chrono::steady_clock::now()) {}
+
+Timeline::Scope::Scope(Timeline *timeline) : previous_(current_timeline) {
+  current_timeline = timeline;
+}
+
+Timeline::Scope::~Scope() { current_timeline = previous_; }
+
+Timeline *Timeline::Current() { return current_timeline; }
+
+std::chrono::microseconds Timeline::Now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_);
+}
+
+int Timeline::CurrentThreadId() {
+  thread_local const int tid = syscall(SYS_gettid);
+  return tid;
+}
+
+void Timeline::AddSpan(const char *category, const char *name,
+                       std::chrono::microseconds start,
+                       std::chrono::microseconds end, int tid,
+                       std::string args, bool async) {
+  spans_.push_back(Span{category, name, start.count(), end.count(), tid,
+                        std::move(args), async});
+}
+
+bool Timeline::WriteChromeTrace(const std::string &path) const {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) return false;
+
+  const int pid = getpid();
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid
+      << ",\"tid\":0,\"args\":{\"name\":";
+  WriteJsonString(name_, out);
+  out << "}}";
+  for (size_t id = 0; id < spans_.size(); ++id) {
+    const Span &span = spans_[id];
+    const auto write_header = [&](const char *phase, int64_t micros) {
+      out << ",\n{\"ph\":\"" << phase << "\",\"cat\":\"" << span.category
+          << "\",\"name\":\"" << span.name << "\",\"pid\":" << pid
+          << ",\"tid\":" << span.tid << ",\"ts\":" << micros;
+    };
+    if (span.async) {
+      // A begin and an end event, matched by their ID.
+      write_header("b", span.start_micros);
+      out << ",\"id\":" << id << ",\"args\":{" << span.args << "}}";
+      write_header("e", span.end_micros);
+      out << ",\"id\":" << id << "}";
+    } else {
+      write_header("X", span.start_micros);
+      out << ",\"dur\":" << span.end_micros - span.start_micros
+          << ",\"args\":{" << span.args << "}}";
+    }
+  }
+  out << "\n]}\n";
+  return static_cast<bool>(out);
+}
+
+TimelineSpan::TimelineSpan(Timeline *timeline, const char *category,
+                           const char *name, bool async)
+    : timeline_(timeline), category_(category), name_(name), async_(async) {
+  if (!timeline_) return;
+  tid_ = Timeline::CurrentThreadId();
+  start_ = timeline_->Now();
+}
+
+void TimelineSpan::End() {
+  if (!timeline_) return;
+  timeline_->AddSpan(category_, name_, start_, timeline_->Now(), tid_,
+                     std::move(args_), async_);
+  timeline_ = nullptr;
+}
+
+TimelineSpan &TimelineSpan::Arg(const char *key, int64_t value) {
+  if (!timeline_) return *this;
+  if (!args_.empty()) args_ += ",";
+  args_ += "\"";
+  args_ += key;
+  args_ += "\":";
+  args_ += std::to_string(value);
+  return *this;
+}
+
+TimelineSpan &TimelineSpan::Arg(const char *key, const std::string &value) {
+  if (!timeline_) return *this;
+  if (!args_.empty()) args_ += ",";
+  std::ostringstream encoded;
+  encoded << "\"" << key << "\":";
+  WriteJsonString(value, encoded);
+  args_ += encoded.str();
+  return *this;
+}
+
+}  // namespace error_specifications
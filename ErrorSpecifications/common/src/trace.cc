@@ -0,0 +1,224 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+namespace {
+
+// A byte ring buffer of whole records, each preceded by its size. Appending
+// a record drops the oldest records until it fits.
+class RingBuffer {
+ public:
+  void Reset(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_.assign(capacity, 0);
+    head_ = 0;
+    used_ = 0;
+  }
+
+  void Append(const std::string &record) {
+    const uint32_t size = record.size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sizeof(size) + size > bytes_.size()) return;
+    while (bytes_.size() - used_ < sizeof(size) + size) {
+      uint32_t oldest_size;
+      Read(head_, &oldest_size, sizeof(oldest_size));
+      head_ = (head_ + sizeof(oldest_size) + oldest_size) % bytes_.size();
+      used_ -= sizeof(oldest_size) + oldest_size;
+    }
+    const size_t tail = (head_ + used_) % bytes_.size();
+    Write(tail, &size, sizeof(size));
+    Write((tail + sizeof(size)) % bytes_.size(), record.data(), size);
+    used_ += sizeof(size) + size;
+  }
+
+  // Returns copies of the records, oldest first.
+  std::vector<std::string> Records() const {
+    std::vector<std::string> records;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t offset = 0; offset < used_;) {
+      const size_t position = (head_ + offset) % bytes_.size();
+      uint32_t size;
+      Read(position, &size, sizeof(size));
+      std::string record(size, '\0');
+      Read((position + sizeof(size)) % bytes_.size(), &record[0], size);
+      records.push_back(std::move(record));
+      offset += sizeof(size) + size;
+    }
+    return records;
+  }
+
+ private:
+  void Read(size_t position, void *data, size_t size) const {
+    const size_t first = std::min(size, bytes_.size() - position);
+    std::memcpy(data, bytes_.data() + position, first);
+    std::memcpy(static_cast<char *>(data) + first, bytes_.data(), size - first);
+  }
+
+  void Write(size_t position, const void *data, size_t size) {
+    const size_t first = std::min(size, bytes_.size() - position);
+    std::memcpy(bytes_.data() + position, data, first);
+    std::memcpy(bytes_.data(), static_cast<const char *>(data) + first,
+                size - first);
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<char> bytes_;
+  // The offset of the oldest record, and the number of bytes in use.
+  size_t head_ = 0;
+  size_t used_ = 0;
+};
+
+RingBuffer &GetRingBuffer() {
+  static RingBuffer *const ring_buffer = new RingBuffer();
+  return *ring_buffer;
+}
+
+// Reads a value of type T from record at offset, and advances offset.
+template <typename T>
+T Take(const std::string &record, size_t *offset) {
+  T value;
+  std::memcpy(&value, record.data() + *offset, sizeof(T));
+  *offset += sizeof(T);
+  return value;
+}
+
+// Writes the event encoded in record as "name key=value ...", after its
+// timestamp if with_time is set.
+void Format(const std::string &record, bool with_time, std::ostream &out) {
+  size_t offset = 0;
+  Take<uint8_t>(record, &offset);
+  const auto micros = Take<int64_t>(record, &offset);
+  if (with_time) {
+    out << micros / 1000000 << "." << std::setw(6) << std::setfill('0')
+        << micros % 1000000 << std::setfill(' ') << " ";
+  }
+  out << Take<const char *>(record, &offset);
+  while (offset < record.size()) {
+    out << " " << Take<const char *>(record, &offset) << "=";
+    const auto type = Take<TraceEvent::ArgType>(record, &offset);
+    switch (type) {
+      case TraceEvent::kBool:
+        out << (Take<uint64_t>(record, &offset) ? "true" : "false");
+        break;
+      case TraceEvent::kInt:
+        out << static_cast<int64_t>(Take<uint64_t>(record, &offset));
+        break;
+      case TraceEvent::kUnsigned:
+        out << Take<uint64_t>(record, &offset);
+        break;
+      case TraceEvent::kDouble: {
+        const uint64_t bits = Take<uint64_t>(record, &offset);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        out << value;
+        break;
+      }
+      case TraceEvent::kString: {
+        const auto size = Take<uint32_t>(record, &offset);
+        out.write(record.data() + offset, size);
+        offset += size;
+        break;
+      }
+      case TraceEvent::kFormatted: {
+        const auto formatter = Take<TraceEvent::Formatter>(record, &offset);
+        const auto size = Take<uint8_t>(record, &offset);
+        out << "\"";
+        formatter(record.data() + offset, out);
+        out << "\"";
+        offset += size;
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+std::atomic<int> Tracer::level_(0);
+std::atomic<TraceSink> Tracer::sink_(TraceSink::kNone);
+
+void Tracer::Configure(int level, TraceSink sink, size_t ring_buffer_bytes) {
+  // Disable tracing while the sink changes.
+  level_.store(0);
+  if (sink == TraceSink::kRingBuffer) {
+    GetRingBuffer().Reset(ring_buffer_bytes);
+  }
+  sink_.store(sink);
+  level_.store(sink == TraceSink::kNone ? 0 : level);
+}
+
+void Tracer::Dump(std::ostream &out) {
+  for (const std::string &record : GetRingBuffer().Records()) {
+    Format(record, /*with_time=*/true, out);
+    out << "\n";
+  }
+}
+
+void Tracer::DumpOnSignal(int signal_number, const std::string &path) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, signal_number);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread([signals, path]() {
+    for (;;) {
+      int received;
+      if (sigwait(&signals, &received) != 0) continue;
+      std::ofstream out(path, std::ios::trunc);
+      Dump(out);
+      LOG(INFO) << "Dumped trace to " << path;
+    }
+  }).detach();
+}
+
+void Tracer::Emit(const std::string &record, const char *file, int line) {
+  switch (GetSink()) {
+    case TraceSink::kNone:
+      break;
+    case TraceSink::kLog: {
+      google::LogMessage message(file, line);
+      Format(record, /*with_time=*/false, message.stream());
+      break;
+    }
+    case TraceSink::kRingBuffer:
+      GetRingBuffer().Append(record);
+      break;
+  }
+}
+
+constexpr size_t TraceEvent::kMaxCopiedBytes;
+
+TraceEvent::TraceEvent(int level, const char *name, const char *file,
+                       int line)
+    : file_(file), line_(line) {
+  const uint8_t encoded_level = level;
+  const int64_t micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  Append(&encoded_level, sizeof(encoded_level));
+  Append(&micros, sizeof(micros));
+  Append(&name, sizeof(name));
+}
+
+TraceEvent &TraceEvent::String(const char *key, const char *data,
+                               size_t size) {
+  const uint32_t encoded_size = size;
+  Header(key, kString);
+  Append(&encoded_size, sizeof(encoded_size));
+  Append(data, size);
+  return *this;
+}
+
+}  // namespace error_specifications
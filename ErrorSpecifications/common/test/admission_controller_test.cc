@@ -0,0 +1,162 @@
+// Tests the memory and concurrency budgets of the admission controller and
+// the queue positions it publishes on the operations.
+
+#include "common/include/admission_controller.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "operations_service.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Admission is observed through the published metadata, so the tasks do
+// nothing when they run.
+class NoopTask : public tbb::task {
+ public:
+  tbb::task *execute() override { return nullptr; }
+};
+
+class AdmissionControllerTest : public ::testing::Test {
+ protected:
+  void Configure(const AdmissionOptions &options) {
+    admission_controller_.reset(
+        new AdmissionController(&operations_service_, options));
+  }
+
+  AdmissionTicket Submit(const std::string &task_name,
+                         uint64_t estimated_bytes) {
+    AdmissionTicket ticket;
+    admission_controller_->Submit(task_name, estimated_bytes,
+                                  new (tbb::task::allocate_root()) NoopTask(),
+                                  &ticket);
+    return ticket;
+  }
+
+  // Returns the admission metadata last published for task_name.
+  AdmissionMetadata Published(const std::string &task_name) {
+    GetOperationRequest request;
+    request.set_name(task_name);
+    Operation operation;
+    // The implementation's override is private; the service's is public.
+    OperationsService::Service &service = operations_service_;
+    EXPECT_TRUE(service.GetOperation(nullptr, &request, &operation).ok())
+        << task_name;
+    AdmissionMetadata metadata;
+    EXPECT_TRUE(operation.metadata().UnpackTo(&metadata)) << task_name;
+    return metadata;
+  }
+
+  uint64_t QueuePosition(const std::string &task_name) {
+    return Published(task_name).queue_position();
+  }
+
+  OperationsServiceImpl operations_service_;
+  std::unique_ptr<AdmissionController> admission_controller_;
+};
+
+}  // namespace
+
+// Tasks start while their bytes fit in the budget, and the others wait in
+// submission order, even behind a task too large for the remaining budget.
+TEST_F(AdmissionControllerTest, AdmitsWithinMemoryBudget) {
+  AdmissionOptions options;
+  options.memory_budget_bytes = 100;
+  Configure(options);
+
+  const AdmissionTicket a = Submit("a", 40);
+  Submit("b", 40);
+  Submit("c", 40);
+  Submit("d", 10);
+  EXPECT_EQ(QueuePosition("a"), 0u);
+  EXPECT_EQ(QueuePosition("b"), 0u);
+  const AdmissionMetadata c = Published("c");
+  EXPECT_EQ(c.queue_position(), 1u);
+  EXPECT_EQ(c.queue_length(), 1u);
+  EXPECT_EQ(c.estimated_bytes(), 40u);
+  EXPECT_EQ(c.reserved_bytes(), 80u);
+  EXPECT_EQ(c.memory_budget_bytes(), 100u);
+  EXPECT_EQ(QueuePosition("d"), 2u);
+
+  admission_controller_->Release(a);
+  EXPECT_EQ(QueuePosition("c"), 0u);
+  const AdmissionMetadata d = Published("d");
+  EXPECT_EQ(d.queue_position(), 0u);
+  EXPECT_EQ(d.queue_length(), 0u);
+  EXPECT_EQ(d.reserved_bytes(), 90u);
+}
+
+// Waiting tasks move up the queue as the ones ahead of them start.
+TEST_F(AdmissionControllerTest, LimitsConcurrentTasks) {
+  AdmissionOptions options;
+  options.max_concurrent_tasks = 2;
+  Configure(options);
+
+  const AdmissionTicket a = Submit("a", 1 << 30);
+  const AdmissionTicket b = Submit("b", 1 << 30);
+  Submit("c", 1);
+  Submit("d", 1);
+  Submit("e", 1);
+  EXPECT_EQ(QueuePosition("c"), 1u);
+  EXPECT_EQ(QueuePosition("d"), 2u);
+  EXPECT_EQ(QueuePosition("e"), 3u);
+
+  admission_controller_->Release(b);
+  EXPECT_EQ(QueuePosition("c"), 0u);
+  EXPECT_EQ(QueuePosition("d"), 1u);
+  EXPECT_EQ(Published("e").queue_position(), 2u);
+  EXPECT_EQ(Published("e").queue_length(), 2u);
+
+  // Releasing an unknown or already released ticket changes nothing.
+  admission_controller_->Release(b);
+  admission_controller_->Release(1000);
+  EXPECT_EQ(QueuePosition("d"), 1u);
+
+  admission_controller_->Release(a);
+  EXPECT_EQ(QueuePosition("d"), 0u);
+  EXPECT_EQ(QueuePosition("e"), 1u);
+}
+
+// A task larger than the whole budget waits until nothing else runs, and
+// then runs alone.
+TEST_F(AdmissionControllerTest, RunsOversizedTaskAlone) {
+  AdmissionOptions options;
+  options.memory_budget_bytes = 100;
+  Configure(options);
+
+  const AdmissionTicket small = Submit("small", 10);
+  const AdmissionTicket large = Submit("large", 500);
+  EXPECT_EQ(QueuePosition("large"), 1u);
+
+  admission_controller_->Release(small);
+  EXPECT_EQ(QueuePosition("large"), 0u);
+  EXPECT_EQ(Published("large").reserved_bytes(), 500u);
+
+  Submit("after", 1);
+  EXPECT_EQ(QueuePosition("after"), 1u);
+  admission_controller_->Release(large);
+  EXPECT_EQ(QueuePosition("after"), 0u);
+  EXPECT_EQ(Published("after").reserved_bytes(), 1u);
+}
+
+// Tasks of unknown size are budgeted at the default size.
+TEST_F(AdmissionControllerTest, BudgetsUnknownSizeAtDefault) {
+  AdmissionOptions options;
+  options.memory_budget_bytes = 100;
+  options.default_task_bytes = 60;
+  Configure(options);
+
+  Submit("a", kUnknownTaskBytes);
+  Submit("b", kUnknownTaskBytes);
+  Submit("c", 40);
+  EXPECT_EQ(Published("a").estimated_bytes(), 60u);
+  EXPECT_EQ(QueuePosition("a"), 0u);
+  EXPECT_EQ(QueuePosition("b"), 1u);
+  EXPECT_EQ(QueuePosition("c"), 2u);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,206 @@
+// Tests hashing files from a memory map and the persistent digest cache.
+
+#include "common/include/file_hash_cache.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "servers.h"
+
+namespace error_specifications {
+
+namespace {
+
+void WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs << contents;
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  std::stringstream contents;
+  contents << ifs.rdbuf();
+  return contents.str();
+}
+
+// Sets the modification time of path to seconds since the epoch.
+void SetMtime(const std::string &path, time_t seconds) {
+  const struct timespec times[2] = {{seconds, 0}, {seconds, 0}};
+  ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+}
+
+std::string StringDigest(const std::string &contents) {
+  std::string digest;
+  EXPECT_TRUE(HashString(contents, digest).ok());
+  return digest;
+}
+
+class FileHashCacheTest : public ::testing::Test {
+ protected:
+  std::string dir_;
+  std::string file_;
+  std::string cache_file_;
+
+  void SetUp() override {
+    std::string dir_template = ::testing::TempDir() + "file_hash_XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    dir_ = dir_template;
+    file_ = dir_ + "/input.bc";
+    cache_file_ = dir_ + "/hashes";
+  }
+
+  void TearDown() override {
+    std::remove(file_.c_str());
+    std::remove(cache_file_.c_str());
+    rmdir(dir_.c_str());
+  }
+};
+
+}  // namespace
+
+// The memory-mapped digest matches hashing the contents as a string, for
+// empty files and around the chunk boundary.
+TEST_F(FileHashCacheTest, HashFileMatchesHashString) {
+  for (size_t size : {size_t{0}, size_t{1}, size_t{4096}, kHashChunkSize - 1,
+                      kHashChunkSize, kHashChunkSize + 1,
+                      2 * kHashChunkSize + 17}) {
+    std::string contents(size, '\0');
+    for (size_t i = 0; i < size; ++i) contents[i] = (i * 131 + 7) % 251;
+    WriteFile(file_, contents);
+
+    std::string digest;
+    ASSERT_TRUE(HashFile(file_, digest).ok()) << size;
+    EXPECT_EQ(digest, StringDigest(contents)) << size;
+  }
+}
+
+TEST_F(FileHashCacheTest, HashFileMissing) {
+  std::string digest;
+  EXPECT_FALSE(HashFile(dir_ + "/missing.bc", digest).ok());
+}
+
+// An unchanged file is served from the cache. Rewriting it with the same
+// size and mtime is invisible to the cache, which shows it was not read.
+TEST_F(FileHashCacheTest, ReusesDigestOfUnchangedFile) {
+  FileHashCache cache(cache_file_);
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+
+  std::string digest;
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+
+  WriteFile(file_, "other");
+  SetMtime(file_, 1000000);
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+}
+
+TEST_F(FileHashCacheTest, InvalidatedByMtime) {
+  FileHashCache cache(cache_file_);
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+
+  std::string digest;
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+
+  WriteFile(file_, "other");
+  SetMtime(file_, 1000001);
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("other"));
+}
+
+TEST_F(FileHashCacheTest, InvalidatedBySize) {
+  FileHashCache cache(cache_file_);
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+
+  std::string digest;
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+
+  WriteFile(file_, "first and more");
+  SetMtime(file_, 1000000);
+  ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first and more"));
+}
+
+// Digests survive a restart through the cache file.
+TEST_F(FileHashCacheTest, PersistsAcrossInstances) {
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+  std::string digest;
+  {
+    FileHashCache cache(cache_file_);
+    ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  }
+
+  WriteFile(file_, "other");
+  SetMtime(file_, 1000000);
+  FileHashCache reloaded(cache_file_);
+  ASSERT_TRUE(reloaded.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+}
+
+// A cache file whose last entry was cut short, anywhere in its key or its
+// digest, does not yield that entry.
+TEST_F(FileHashCacheTest, SkipsTruncatedEntry) {
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+  std::string digest;
+  {
+    FileHashCache cache(cache_file_);
+    ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  }
+  const std::string entry = ReadFile(cache_file_);
+  ASSERT_EQ(entry.back(), '\n');
+  const size_t digest_start = entry.rfind('\t') + 1;
+  const size_t inode_start = entry.rfind('\t', digest_start - 2) + 1;
+
+  // Same size and mtime, so a loaded entry would be reused.
+  WriteFile(file_, "other");
+  SetMtime(file_, 1000000);
+  for (size_t length : {digest_start + 63, digest_start + 20, digest_start,
+                        digest_start - 1, inode_start + 1}) {
+    SCOPED_TRACE(entry.substr(0, length));
+    WriteFile(cache_file_, entry.substr(0, length));
+    FileHashCache reloaded(cache_file_);
+    ASSERT_TRUE(reloaded.HashFile(file_, digest).ok());
+    EXPECT_EQ(digest, StringDigest("other"));
+  }
+
+  // The complete entry is still reused.
+  WriteFile(cache_file_, entry);
+  FileHashCache reloaded(cache_file_);
+  ASSERT_TRUE(reloaded.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("first"));
+}
+
+// Without a cache file nothing is persisted.
+TEST_F(FileHashCacheTest, InMemoryOnly) {
+  WriteFile(file_, "first");
+  SetMtime(file_, 1000000);
+  std::string digest;
+  {
+    FileHashCache cache("");
+    ASSERT_TRUE(cache.HashFile(file_, digest).ok());
+  }
+
+  WriteFile(file_, "other");
+  SetMtime(file_, 1000000);
+  FileHashCache fresh("");
+  ASSERT_TRUE(fresh.HashFile(file_, digest).ok());
+  EXPECT_EQ(digest, StringDigest("other"));
+}
+
+}  // namespace error_specifications
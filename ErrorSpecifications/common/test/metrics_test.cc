@@ -0,0 +1,230 @@
+// Tests the metric registry, its snapshots and its Prometheus text dumps.
+
+#include "common/include/metrics.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream in(path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+// Fills registry with a metric of each type, labels and help texts that
+// need escaping, and special values.
+void FillRegistry(MetricRegistry &registry) {
+  Histogram &latency = registry.GetHistogram(
+      "latency_seconds", "Latency.", {0.5, 1, 2.5}, {{"op", "read"}});
+  for (double value : {0.25, 0.5, 2.0, 7.0}) latency.Observe(value);
+  registry.GetGauge("queue_length", "Queued \"items\" \\ here.").Set(-2);
+  registry
+      .GetCounter("requests_total", "Requests.\nBy code.",
+                  {{"method", "get"}, {"code", "200"}})
+      .Increment(3);
+  registry
+      .GetCounter("requests_total", "Requests.",
+                  {{"method", "post"}, {"code", "500"}})
+      .Increment(0.5);
+  registry.GetGauge("ceiling", "C.")
+      .Set(std::numeric_limits<double>::infinity());
+  registry.GetGauge("temperature", "T.", {{"room", "a\"b\\c\nd"}})
+      .Set(std::nan(""));
+}
+
+// The Prometheus text of FillRegistry: families sorted by name, labels
+// sorted by name, histogram buckets cumulative.
+const char kFilledRegistryText[] =
+    "# HELP ceiling C.\n"
+    "# TYPE ceiling gauge\n"
+    "ceiling +Inf\n"
+    "# HELP latency_seconds Latency.\n"
+    "# TYPE latency_seconds histogram\n"
+    "latency_seconds_bucket{op=\"read\",le=\"0.5\"} 2\n"
+    "latency_seconds_bucket{op=\"read\",le=\"1\"} 2\n"
+    "latency_seconds_bucket{op=\"read\",le=\"2.5\"} 3\n"
+    "latency_seconds_bucket{op=\"read\",le=\"+Inf\"} 4\n"
+    "latency_seconds_sum{op=\"read\"} 9.75\n"
+    "latency_seconds_count{op=\"read\"} 4\n"
+    "# HELP queue_length Queued \"items\" \\\\ here.\n"
+    "# TYPE queue_length gauge\n"
+    "queue_length -2\n"
+    "# HELP requests_total Requests.\\nBy code.\n"
+    "# TYPE requests_total counter\n"
+    "requests_total{code=\"200\",method=\"get\"} 3\n"
+    "requests_total{code=\"500\",method=\"post\"} 0.5\n"
+    "# HELP temperature T.\n"
+    "# TYPE temperature gauge\n"
+    "temperature{room=\"a\\\"b\\\\c\\nd\"} NaN\n";
+
+}  // namespace
+
+TEST(MetricRegistryTest, ReturnsSameMetricForSameLabels) {
+  MetricRegistry registry;
+  Counter &get = registry.GetCounter("calls_total", "Calls.", {{"m", "get"}});
+  Counter &post = registry.GetCounter("calls_total", "Calls.", {{"m", "post"}});
+  EXPECT_NE(&get, &post);
+  EXPECT_EQ(&registry.GetCounter("calls_total", "Calls.", {{"m", "get"}}),
+            &get);
+  EXPECT_EQ(&registry.GetGauge("size", "Size."),
+            &registry.GetGauge("size", "Size."));
+}
+
+// Updates from many threads are all counted.
+TEST(MetricRegistryTest, CountsConcurrentUpdates) {
+  MetricRegistry registry;
+  Counter &counter = registry.GetCounter("events_total", "Events.");
+  Gauge &gauge = registry.GetGauge("level", "Level.");
+  Gauge &peak = registry.GetGauge("peak", "Peak.");
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&counter, &gauge, &peak, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        counter.Increment();
+        gauge.Add(0.5);
+        peak.SetMax(t * 10000 + i);
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  EXPECT_EQ(counter.Value(), 80000);
+  EXPECT_EQ(gauge.Value(), 40000);
+  EXPECT_EQ(peak.Value(), 79999);
+}
+
+// Bounds are inclusive, and the family keeps the bounds of its first
+// histogram.
+TEST(MetricRegistryTest, SnapshotsHistogram) {
+  MetricRegistry registry;
+  Histogram &histogram =
+      registry.GetHistogram("size_bytes", "Sizes.", {1, 4}, {{"k", "a"}});
+  for (double value : {0.0, 1.0, 2.0, 4.0, 5.0}) histogram.Observe(value);
+  registry.GetHistogram("size_bytes", "Sizes.", {10}, {{"k", "b"}})
+      .Observe(5);
+
+  GetMetricsResponse response;
+  registry.Snapshot("", &response);
+  ASSERT_EQ(response.families_size(), 1);
+  const MetricFamily &family = response.families(0);
+  EXPECT_EQ(family.type(), METRIC_TYPE_HISTOGRAM);
+  ASSERT_EQ(family.metrics_size(), 2);
+  const HistogramValue &a = family.metrics(0).histogram();
+  EXPECT_EQ(family.metrics(0).labels().at("k"), "a");
+  ASSERT_EQ(a.bucket_upper_bounds_size(), 2);
+  EXPECT_EQ(a.bucket_upper_bounds(0), 1);
+  EXPECT_EQ(a.bucket_upper_bounds(1), 4);
+  EXPECT_EQ(a.bucket_counts(0), 2u);
+  EXPECT_EQ(a.bucket_counts(1), 4u);
+  EXPECT_EQ(a.count(), 5u);
+  EXPECT_EQ(a.sum(), 12);
+  const HistogramValue &b = family.metrics(1).histogram();
+  ASSERT_EQ(b.bucket_upper_bounds_size(), 2);
+  EXPECT_EQ(b.bucket_counts(0), 0u);
+  EXPECT_EQ(b.bucket_counts(1), 0u);
+  EXPECT_EQ(b.count(), 1u);
+}
+
+TEST(MetricRegistryTest, SnapshotsFamiliesWithPrefix) {
+  MetricRegistry registry;
+  FillRegistry(registry);
+
+  GetMetricsResponse response;
+  registry.Snapshot("req", &response);
+  ASSERT_EQ(response.families_size(), 1);
+  const MetricFamily &family = response.families(0);
+  EXPECT_EQ(family.name(), "requests_total");
+  // The first metric of a family sets its help.
+  EXPECT_EQ(family.help(), "Requests.\nBy code.");
+  EXPECT_EQ(family.type(), METRIC_TYPE_COUNTER);
+  ASSERT_EQ(family.metrics_size(), 2);
+  EXPECT_EQ(family.metrics(0).labels().at("method"), "get");
+  EXPECT_EQ(family.metrics(0).labels().at("code"), "200");
+  EXPECT_EQ(family.metrics(0).value(), 3);
+  EXPECT_EQ(family.metrics(1).value(), 0.5);
+
+  GetMetricsResponse all;
+  registry.Snapshot("", &all);
+  EXPECT_EQ(all.families_size(), 5);
+  GetMetricsResponse none;
+  registry.Snapshot("eesi_", &none);
+  EXPECT_EQ(none.families_size(), 0);
+}
+
+TEST(MetricRegistryTest, WritesPrometheusText) {
+  MetricRegistry registry;
+  FillRegistry(registry);
+  std::ostringstream out;
+  registry.WritePrometheusText(out);
+  EXPECT_EQ(out.str(), kFilledRegistryText);
+}
+
+TEST(MetricRegistryTest, WritesEmptyRegistry) {
+  MetricRegistry registry;
+  std::ostringstream out;
+  registry.WritePrometheusText(out);
+  EXPECT_EQ(out.str(), "");
+}
+
+// The dump replaces the file and leaves no temporary file behind.
+TEST(MetricRegistryTest, DumpsToFile) {
+  std::string dir_template = ::testing::TempDir() + "metrics_test_XXXXXX";
+  ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+  const std::string path = dir_template + "/metrics.prom";
+  {
+    std::ofstream stale(path);
+    stale << "stale\n";
+  }
+
+  MetricRegistry registry;
+  FillRegistry(registry);
+  registry.DumpToFile(path);
+  EXPECT_EQ(ReadFile(path), kFilledRegistryText);
+  EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+
+  registry.GetGauge("queue_length", "Queued.").Set(7);
+  registry.DumpToFile(path);
+  EXPECT_NE(ReadFile(path).find("\nqueue_length 7\n"), std::string::npos);
+}
+
+// A pass run is recorded under the eesi_ prefix, labeled by the pass.
+TEST(ScopedPassMetricsTest, RecordsPassRun) {
+  { ScopedPassMetrics pass_metrics("MetricsTestPass"); }
+
+  GetMetricsResponse response;
+  MetricRegistry::Get().Snapshot("eesi_pass_", &response);
+  std::vector<std::string> names;
+  for (const MetricFamily &family : response.families()) {
+    names.push_back(family.name());
+    for (const Metric &metric : family.metrics()) {
+      if (metric.labels().at("pass") != "MetricsTestPass") continue;
+      if (family.name() == "eesi_pass_runs_total") {
+        EXPECT_EQ(metric.value(), 1);
+      } else if (family.name() == "eesi_pass_running") {
+        EXPECT_EQ(metric.value(), 0);
+      } else {
+        EXPECT_GE(metric.value(), 0);
+      }
+    }
+  }
+  EXPECT_EQ(names,
+            std::vector<std::string>(
+                {"eesi_pass_cpu_seconds_total", "eesi_pass_running",
+                 "eesi_pass_runs_total", "eesi_pass_wall_seconds_total"}));
+}
+
+}  // namespace error_specifications
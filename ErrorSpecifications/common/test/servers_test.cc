@@ -0,0 +1,95 @@
+// Tests reading local files through their URIs into memory buffers, and
+// getting their sizes.
+
+#include "common/include/servers.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+void WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs << contents;
+}
+
+class ServersTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::string dir_template = ::testing::TempDir() + "servers_XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    dir_ = dir_template;
+  }
+
+  // Reads the file at path through its URI, and checks that the buffer
+  // holds its contents followed by a null terminator.
+  void ExpectReadsFile(const std::string &path, const std::string &contents) {
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    ASSERT_TRUE(ReadUriIntoBuffer(FilePathToUri(path), buffer).ok()) << path;
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->getBuffer().str(), contents);
+    EXPECT_EQ(*buffer->getBufferEnd(), '\0');
+
+    uint64_t size = 0;
+    ASSERT_TRUE(GetUriSize(FilePathToUri(path), size).ok()) << path;
+    EXPECT_EQ(size, contents.size());
+  }
+
+  std::string dir_;
+};
+
+}  // namespace
+
+TEST_F(ServersTest, ReadsLocalFile) {
+  const std::string path = dir_ + "/module.ll";
+  const std::string contents = "define i32 @f() {\n  ret i32 0\n}\n";
+  WriteFile(path, contents);
+  ExpectReadsFile(path, contents);
+}
+
+// Files large enough to be memory-mapped, including those whose size is a
+// multiple of the page size, are read whole and null-terminated.
+TEST_F(ServersTest, ReadsLargeLocalFiles) {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  for (size_t size : {16 * page_size, 16 * page_size + 7}) {
+    std::string contents(size, '\0');
+    for (size_t i = 0; i < size; ++i) contents[i] = 'a' + i % 26;
+    const std::string path = dir_ + "/large" + std::to_string(size);
+    WriteFile(path, contents);
+    ExpectReadsFile(path, contents);
+  }
+}
+
+TEST_F(ServersTest, ReadsEmptyLocalFile) {
+  const std::string path = dir_ + "/empty";
+  WriteFile(path, "");
+  ExpectReadsFile(path, "");
+}
+
+TEST_F(ServersTest, RejectsMissingFileAndInvalidScheme) {
+  const Uri missing = FilePathToUri(dir_ + "/missing");
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  EXPECT_EQ(ReadUriIntoBuffer(missing, buffer).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(buffer, nullptr);
+  uint64_t size = 0;
+  EXPECT_EQ(GetUriSize(missing, size).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+
+  Uri invalid = missing;
+  invalid.set_scheme(Scheme::SCHEME_INVALID);
+  EXPECT_EQ(ReadUriIntoBuffer(invalid, buffer).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(GetUriSize(invalid, size).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+}  // namespace error_specifications
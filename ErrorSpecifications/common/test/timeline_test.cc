@@ -0,0 +1,173 @@
+// Tests the Chrome trace-event JSON that timelines are written as, by
+// parsing it back.
+
+#include "common/include/timeline.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "google/protobuf/struct.pb.h"
+#include "google/protobuf/util/json_util.h"
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+using google::protobuf::ListValue;
+using google::protobuf::Struct;
+using google::protobuf::Value;
+
+class TimelineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::string dir_template = ::testing::TempDir() + "timeline_XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    path_ = dir_template + "/timeline.json";
+  }
+
+  // Writes timeline and returns its events, checking that the file is JSON
+  // with times in milliseconds.
+  ListValue WriteAndParse(const Timeline &timeline) {
+    EXPECT_TRUE(timeline.WriteChromeTrace(path_));
+    std::ifstream in(path_);
+    std::stringstream json;
+    json << in.rdbuf();
+    Struct trace;
+    EXPECT_TRUE(
+        google::protobuf::util::JsonStringToMessage(json.str(), &trace).ok())
+        << json.str();
+    EXPECT_EQ(Field(trace, "displayTimeUnit").string_value(), "ms");
+    return Field(trace, "traceEvents").list_value();
+  }
+
+  static const Value &Field(const Struct &object, const std::string &key) {
+    static const Value *const kMissing = new Value();
+    auto it = object.fields().find(key);
+    EXPECT_NE(it, object.fields().end()) << key;
+    return it != object.fields().end() ? it->second : *kMissing;
+  }
+
+  static const Value &Field(const Value &object, const std::string &key) {
+    return Field(object.struct_value(), key);
+  }
+
+  std::string path_;
+};
+
+}  // namespace
+
+// The process is named after the timeline, and each span is a complete
+// event, or a begin and an end event with the same ID if it is async.
+TEST_F(TimelineTest, WritesSpansAsTraceEvents) {
+  auto timeline = std::make_shared<Timeline>("GetSpecifications-1");
+  timeline->AddSpan(kTimelinePass, "ErrorBlocksPass",
+                    std::chrono::microseconds(10),
+                    std::chrono::microseconds(25), 7, "\"functions\":3");
+  timeline->AddSpan(kTimelineLlm, "GetGptSpecification",
+                    std::chrono::microseconds(5),
+                    std::chrono::microseconds(40), 8, "", /*async=*/true);
+
+  const ListValue events = WriteAndParse(*timeline);
+  ASSERT_EQ(events.values_size(), 4);
+  const double pid = getpid();
+
+  const Value &process = events.values(0);
+  EXPECT_EQ(Field(process, "ph").string_value(), "M");
+  EXPECT_EQ(Field(process, "name").string_value(), "process_name");
+  EXPECT_EQ(Field(process, "pid").number_value(), pid);
+  EXPECT_EQ(Field(Field(process, "args"), "name").string_value(),
+            "GetSpecifications-1");
+
+  const Value &pass = events.values(1);
+  EXPECT_EQ(Field(pass, "ph").string_value(), "X");
+  EXPECT_EQ(Field(pass, "cat").string_value(), "pass");
+  EXPECT_EQ(Field(pass, "name").string_value(), "ErrorBlocksPass");
+  EXPECT_EQ(Field(pass, "pid").number_value(), pid);
+  EXPECT_EQ(Field(pass, "tid").number_value(), 7);
+  EXPECT_EQ(Field(pass, "ts").number_value(), 10);
+  EXPECT_EQ(Field(pass, "dur").number_value(), 15);
+  EXPECT_EQ(Field(Field(pass, "args"), "functions").number_value(), 3);
+
+  const Value &begin = events.values(2);
+  const Value &end = events.values(3);
+  EXPECT_EQ(Field(begin, "ph").string_value(), "b");
+  EXPECT_EQ(Field(end, "ph").string_value(), "e");
+  for (const Value *event : {&begin, &end}) {
+    EXPECT_EQ(Field(*event, "cat").string_value(), "llm");
+    EXPECT_EQ(Field(*event, "name").string_value(), "GetGptSpecification");
+    EXPECT_EQ(Field(*event, "tid").number_value(), 8);
+    EXPECT_EQ(Field(*event, "id").number_value(), 1);
+  }
+  EXPECT_EQ(Field(begin, "ts").number_value(), 5);
+  EXPECT_EQ(Field(end, "ts").number_value(), 40);
+  EXPECT_TRUE(Field(begin, "args").struct_value().fields().empty());
+}
+
+// Strings that are not valid as they are in JSON are escaped.
+TEST_F(TimelineTest, EscapesStrings) {
+  const std::string text = "quote\" backslash\\ newline\n tab\t bell\x07.";
+  auto timeline = std::make_shared<Timeline>(text);
+  {
+    Timeline::Scope scope(timeline.get());
+    TimelineSpan span(kTimelineFunction, "Function");
+    span.Arg("text", text).Arg("n", -5);
+  }
+
+  const ListValue events = WriteAndParse(*timeline);
+  ASSERT_EQ(events.values_size(), 2);
+  EXPECT_EQ(Field(Field(events.values(0), "args"), "name").string_value(),
+            text);
+  const Value &args = Field(events.values(1), "args");
+  EXPECT_EQ(Field(args, "text").string_value(), text);
+  EXPECT_EQ(Field(args, "n").number_value(), -5);
+}
+
+// Spans go to the timeline installed on their thread, on that thread's
+// track, and are not recorded without one.
+TEST_F(TimelineTest, RecordsSpansOfInstalledTimeline) {
+  auto outer = std::make_shared<Timeline>("outer");
+  auto inner = std::make_shared<Timeline>("inner");
+  {
+    TimelineSpan span(kTimelinePass, "Unrecorded");
+    EXPECT_FALSE(span.Enabled());
+    span.Arg("n", 1);
+  }
+  {
+    Timeline::Scope outer_scope(outer.get());
+    {
+      Timeline::Scope inner_scope(inner.get());
+      TimelineSpan span(kTimelineScc, "Inner");
+      EXPECT_TRUE(span.Enabled());
+    }
+    EXPECT_EQ(Timeline::Current(), outer.get());
+    TimelineSpan span(kTimelineScc, "Outer");
+    span.End();
+    // Ending twice records the span once.
+    span.End();
+  }
+  EXPECT_EQ(Timeline::Current(), nullptr);
+
+  for (const Timeline *timeline : {outer.get(), inner.get()}) {
+    const ListValue events = WriteAndParse(*timeline);
+    ASSERT_EQ(events.values_size(), 2);
+    const Value &span = events.values(1);
+    EXPECT_EQ(Field(span, "name").string_value(),
+              timeline == outer.get() ? "Outer" : "Inner");
+    EXPECT_EQ(Field(span, "tid").number_value(), Timeline::CurrentThreadId());
+    EXPECT_GE(Field(span, "ts").number_value(), 0);
+    EXPECT_GE(Field(span, "dur").number_value(), 0);
+  }
+}
+
+TEST_F(TimelineTest, FailsToWriteToMissingDirectory) {
+  Timeline timeline("missing");
+  EXPECT_FALSE(timeline.WriteChromeTrace(path_ + "/missing/timeline.json"));
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,167 @@
+// Tests the encoding of trace events, their ring buffer and its dumps.
+
+#include "common/include/trace.h"
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+enum class Color { kRed, kBlue };
+
+std::ostream &operator<<(std::ostream &out, Color color) {
+  return out << (color == Color::kRed ? "red" : "blue");
+}
+
+// Trivially copyable, but formatted through the pointer it holds.
+struct View {
+  const std::string *text;
+};
+
+std::ostream &operator<<(std::ostream &out, const View &view) {
+  return out << *view.text;
+}
+
+// Formatted with operator<< only.
+struct Point {
+  std::vector<int> coordinates;
+};
+
+std::ostream &operator<<(std::ostream &out, const Point &point) {
+  out << "(";
+  for (size_t i = 0; i < point.coordinates.size(); ++i) {
+    out << (i ? "," : "") << point.coordinates[i];
+  }
+  return out << ")";
+}
+
+// Returns the dumped events without their timestamps, which are checked to
+// be seconds with six decimals.
+std::vector<std::string> DumpEvents() {
+  std::ostringstream out;
+  Tracer::Dump(out);
+  std::istringstream lines(out.str());
+  std::vector<std::string> events;
+  std::string line;
+  while (std::getline(lines, line)) {
+    const size_t space = line.find(' ');
+    const size_t point = line.find('.');
+    EXPECT_NE(space, std::string::npos) << line;
+    EXPECT_EQ(space - point, 7u) << line;
+    EXPECT_EQ(line.substr(0, space).find_first_not_of("0123456789."),
+              std::string::npos)
+        << line;
+    events.push_back(line.substr(space + 1));
+  }
+  return events;
+}
+
+int evaluations = 0;
+
+int Evaluate() { return ++evaluations; }
+
+class TraceTest : public ::testing::Test {
+ protected:
+  void TearDown() override { Tracer::Configure(0, TraceSink::kNone, 0); }
+};
+
+}  // namespace
+
+TEST_F(TraceTest, EncodesArguments) {
+  Tracer::Configure(kTraceInstruction, TraceSink::kRingBuffer, 4096);
+  TRACE(kTraceFunction, "Scalars")
+      .Arg("b", true)
+      .Arg("i", -42)
+      .Arg("u", uint64_t{18446744073709551615u})
+      .Arg("d", 0.25)
+      .Arg("f", 1.5f);
+  TRACE(kTraceInstruction, "Strings")
+      .Arg("literal", "a b")
+      .Arg("string", std::string("c=d"))
+      .Arg("empty", "");
+  TRACE(kTraceFunction, "Formatted")
+      .Arg("color", Color::kBlue)
+      .Arg("point", Point{{1, -2, 3}});
+  TRACE(kTraceFunction, "NoArguments");
+
+  EXPECT_EQ(DumpEvents(),
+            std::vector<std::string>(
+                {"Scalars b=true i=-42 u=18446744073709551615 d=0.25 f=\"1.5\"",
+                 "Strings literal=a b string=c=d empty=",
+                 "Formatted color=\"blue\" point=(1,-2,3)", "NoArguments"}));
+}
+
+// Arguments that refer to other memory are formatted when the event is
+// recorded, not when the buffer is dumped.
+TEST_F(TraceTest, CopiesReferencedStrings) {
+  Tracer::Configure(kTraceInstruction, TraceSink::kRingBuffer, 4096);
+  char buffer[] = "before";
+  std::unique_ptr<std::string> text(new std::string("kept"));
+  TRACE(kTraceFunction, "Referenced")
+      .Arg("chars", static_cast<char *>(buffer))
+      .Arg("view", View{text.get()});
+  std::strcpy(buffer, "after!");
+  text.reset(new std::string("replaced"));
+
+  EXPECT_EQ(DumpEvents(),
+            std::vector<std::string>({"Referenced chars=before view=kept"}));
+}
+
+// Events above the runtime level are not recorded, and their arguments are
+// not evaluated.
+TEST_F(TraceTest, FiltersByLevel) {
+  Tracer::Configure(kTraceFunction, TraceSink::kRingBuffer, 4096);
+  evaluations = 0;
+  TRACE(kTraceInstruction, "Hidden").Arg("n", Evaluate());
+  TRACE(kTraceFunction, "Shown").Arg("n", Evaluate());
+  EXPECT_EQ(evaluations, 1);
+  EXPECT_EQ(DumpEvents(), std::vector<std::string>({"Shown n=1"}));
+
+  Tracer::Configure(kTraceInstruction, TraceSink::kNone, 0);
+  TRACE(kTraceFunction, "Disabled").Arg("n", Evaluate());
+  EXPECT_EQ(evaluations, 1);
+}
+
+// A full buffer drops its oldest events, and keeps every event it holds
+// whole, including the ones split across its end.
+TEST_F(TraceTest, WrapsAround) {
+  Tracer::Configure(kTraceInstruction, TraceSink::kRingBuffer, 256);
+  const int num_events = 100;
+  for (int i = 0; i < num_events; ++i) {
+    TRACE(kTraceFunction, "Event")
+        .Arg("i", i)
+        .Arg("s", std::string(i % 13, 'a' + i % 26));
+  }
+
+  const std::vector<std::string> events = DumpEvents();
+  ASSERT_GT(events.size(), 1u);
+  ASSERT_LT(events.size(), 20u);
+  const int first = num_events - static_cast<int>(events.size());
+  for (size_t j = 0; j < events.size(); ++j) {
+    const int i = first + static_cast<int>(j);
+    EXPECT_EQ(events[j], "Event i=" + std::to_string(i) + " s=" +
+                             std::string(i % 13, 'a' + i % 26));
+  }
+}
+
+// An event larger than the whole buffer is dropped without evicting the
+// others.
+TEST_F(TraceTest, DropsEventLargerThanBuffer) {
+  Tracer::Configure(kTraceInstruction, TraceSink::kRingBuffer, 128);
+  TRACE(kTraceFunction, "Small");
+  TRACE(kTraceFunction, "Large").Arg("s", std::string(200, 'x'));
+  EXPECT_EQ(DumpEvents(), std::vector<std::string>({"Small"}));
+
+  // Configuring clears the buffer.
+  Tracer::Configure(kTraceInstruction, TraceSink::kRingBuffer, 128);
+  EXPECT_TRUE(DumpEvents().empty());
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,141 @@
+// This analysis builds the call graph of a module once, for every pass that
+// walks the module bottom-up.
+
+// Functions are given dense IDs in module order. Calls are resolved like
+// the LLVM call graph resolves them, except that a call also reaches the
+// first function seen with the callee's source name, since the unique
+// numeric suffix LLVM appends can split one source function into several
+// llvm::Functions. Indirect calls and the external nodes of the LLVM call
+// graph are left out.
+
+// Everything is stored in flat arrays in compressed sparse row form: the
+// callees of function f are callees_[callee_offsets_[f]] up to
+// callees_[callee_offsets_[f + 1]], and likewise for the functions of an SCC
+// and the SCCs of a level. The SCCs are numbered bottom-up, in the order
+// llvm::scc_begin visits them from the external calling node, so only
+// functions callable from outside the module, directly or transitively, are
+// in an SCC. The level of an SCC is one above the highest level of the SCCs
+// it calls; SCCs on the same level never call each other, so they can be
+// analyzed at the same time once the levels below are done.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_CALL_GRAPH_PASS_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_CALL_GRAPH_PASS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "metrics.h"
+#include "progress_reporter.h"
+
+namespace error_specifications {
+
+using FunctionId = uint32_t;
+using SccId = uint32_t;
+
+class CallGraphPass : public llvm::ModulePass {
+ public:
+  static char ID;
+
+  // The SCC of functions that are not in any.
+  static constexpr SccId kNoScc = UINT32_MAX;
+
+  CallGraphPass() : llvm::ModulePass(ID) {}
+
+  // Entry point.
+  bool runOnModule(llvm::Module &module) override;
+
+  // Sets the reporter told when the pass starts. Optional; the pass does
+  // not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
+  size_t NumFunctions() const { return functions_.size(); }
+
+  llvm::Function *GetFunction(FunctionId function) const {
+    return functions_[function];
+  }
+
+  // Returns the ID of function, which must belong to the module.
+  FunctionId GetFunctionId(const llvm::Function &function) const {
+    return function_ids_.lookup(&function);
+  }
+
+  // Returns the functions called by function, each once, in the order of
+  // their first call.
+  llvm::ArrayRef<FunctionId> GetCallees(FunctionId function) const {
+    return Row(callee_offsets_, callees_, function);
+  }
+
+  // Returns the SCC of function, or kNoScc.
+  SccId GetScc(FunctionId function) const { return function_sccs_[function]; }
+
+  size_t NumSccs() const { return scc_levels_.size(); }
+
+  llvm::ArrayRef<FunctionId> GetSccFunctions(SccId scc) const {
+    return Row(scc_offsets_, scc_functions_, scc);
+  }
+
+  // Returns true if the functions of scc call each other, or the one
+  // function of scc calls itself.
+  bool SccHasLoop(SccId scc) const { return scc_has_loop_[scc]; }
+
+  uint32_t GetSccLevel(SccId scc) const { return scc_levels_[scc]; }
+
+  size_t NumLevels() const { return level_offsets_.size() - 1; }
+
+  // Returns the SCCs on level, in bottom-up order.
+  llvm::ArrayRef<SccId> GetLevelSccs(uint32_t level) const {
+    return Row(level_offsets_, level_sccs_, level);
+  }
+
+ private:
+  void getAnalysisUsage(llvm::AnalysisUsage &au) const override;
+
+  template <typename T>
+  static llvm::ArrayRef<T> Row(const std::vector<uint32_t> &offsets,
+                               const std::vector<T> &values, uint32_t row) {
+    return llvm::makeArrayRef(values.data() + offsets[row],
+                              offsets[row + 1] - offsets[row]);
+  }
+
+  // Fills callee_offsets_ and callees_.
+  void BuildCallees();
+
+  // Finds the SCCs with Tarjan's algorithm and fills the SCC arrays.
+  void BuildSccs();
+
+  // Assigns every SCC its level and fills the level arrays.
+  void BuildLevels();
+
+  std::vector<llvm::Function *> functions_;
+  llvm::DenseMap<const llvm::Function *, FunctionId> function_ids_;
+
+  std::vector<uint32_t> callee_offsets_;
+  std::vector<FunctionId> callees_;
+
+  std::vector<SccId> function_sccs_;
+  std::vector<uint32_t> scc_offsets_;
+  std::vector<FunctionId> scc_functions_;
+  std::vector<bool> scc_has_loop_;
+  std::vector<uint32_t> scc_levels_;
+
+  std::vector<uint32_t> level_offsets_;
+  std::vector<SccId> level_sccs_;
+
+  ProgressReporter *progress_reporter_ = nullptr;
+};
+
+// Returns the counter of the rounds of the fixpoint loops that pass_name
+// runs over the recursive SCCs of the call graph.
+Counter &GetSccIterationsCounter(const std::string &pass_name);
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_CALL_GRAPH_PASS_H_
@@ -1,41 +1,65 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_CHECKER_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_CHECKER_H_
 
-#include <memory>
-#include <unordered_map>
-#include <unordered_set>
+#include <set>
+#include <vector>
 
 #include "constraint.h"
+#include "google/protobuf/repeated_field.h"
 #include "llvm/IR/Instructions.h"
 #include "proto/eesi.pb.h"
 
 namespace error_specifications {
 
+// A violation found by the checker. Functions are checked in parallel, so
+// the checker only records what it found; the Violation protobuf, with its
+// strings and copies of the callee and parent functions, is built once the
+// response is.
+struct ViolationRecord {
+  ViolationType violation_type;
+  const llvm::CallInst *call_inst;
+  const llvm::Function *callee;
+  SignLatticeElement specification_lattice_element;
+};
+
 class Checker {
  public:
   Checker(){};
 
-  // Checks for violations associated with the CallInst.
+  // Checks for violations associated with the CallInst and appends them to
+  // violations. Does not modify the checker, so it may be called from
+  // several threads at once.
   void CheckViolations(const llvm::CallInst &call_inst,
                        const SignLatticeElement &specification_lattice_element,
-                       const std::set<SignLatticeElement> &callee_constraints);
+                       const std::set<SignLatticeElement> &callee_constraints,
+                       std::vector<ViolationRecord> *violations) const;
+
+  // Adds violations to the ones found so far. They are reported in the
+  // order in which they are added.
+  void AddViolations(const std::vector<ViolationRecord> &violations);
+
+  // Appends a Violation for every violation found to violations.
+  void GetViolations(
+      google::protobuf::RepeatedPtrField<Violation> *violations) const;
 
-  // Returns a vector of violations.
-  std::vector<Violation> GetViolations();
+  // Returns the number of violations found.
+  size_t NumViolations() const { return violations_.size(); }
 
  private:
-  // Checks for any unused violations and adds these violations to our
-  // violations_ map.
+  // Checks for an unused return value at the call and appends it to
+  // violations.
   void CheckUnusedViolations(
       const llvm::CallInst &call_inst,
-      const SignLatticeElement &specification_lattice_element);
+      const SignLatticeElement &specification_lattice_element,
+      std::vector<ViolationRecord> *violations) const;
 
-  // Returns true if the function should be checked for violations.
-  bool ShouldCheck(const Function &function,
-                   const SignLatticeElement &specification_lattice_element);
+  // Returns true if calls to callee should be checked for violations.
+  bool ShouldCheck(
+      const llvm::Function *callee,
+      const SignLatticeElement &specification_lattice_element) const;
 
   // Keeps track of all violations that have been found by the checker.
-  std::vector<Violation> violations_;
+  std::vector<ViolationRecord> violations_;
 };
 
 }  // namespace error_specifications
@@ -3,7 +3,11 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_CONFIDENCE_LATTICE_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_CONFIDENCE_LATTICE_H_
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 #include "constraint.h"
 #include "proto/eesi.grpc.pb.h"
@@ -21,17 +25,22 @@ constexpr short kMinConfidence = 0;
 // lattice element has confidence values of 0 (==0), 0 (<0), and 0 (>0).
 // However, a <=0 lattice element can have confidence values such as 80 (==0),
 // 100 (<0), and 0 (>0).
+//
+// The four confidences are packed into the 16-bit lanes of a single 64-bit
+// word, so that ConfidenceLattice can compare and combine all of them at once
+// with a few integer operations.
 class LatticeElementConfidence {
  public:
   explicit LatticeElementConfidence(short confidence_zero,
                                     short confidence_less_than_zero,
                                     short confidence_greater_than_zero,
                                     short confidence_emptyset)
-      : confidence_zero_(CheckConfidence(confidence_zero)),
-        confidence_less_than_zero_(CheckConfidence(confidence_less_than_zero)),
-        confidence_greater_than_zero_(
-            CheckConfidence(confidence_greater_than_zero)),
-        confidence_emptyset_(CheckConfidence(confidence_emptyset)) {}
+      : packed_(Lane(CheckConfidence(confidence_zero), kZeroShift) |
+                Lane(CheckConfidence(confidence_less_than_zero),
+                     kLessThanZeroShift) |
+                Lane(CheckConfidence(confidence_greater_than_zero),
+                     kGreaterThanZeroShift) |
+                Lane(CheckConfidence(confidence_emptyset), kEmptysetShift)) {}
 
   LatticeElementConfidence()
       : LatticeElementConfidence(
@@ -46,11 +55,7 @@ class LatticeElementConfidence {
                                  /* emptyset */ kMinConfidence) {}
 
   bool operator==(const LatticeElementConfidence &other) const {
-    return confidence_zero_ == other.GetConfidenceZero() &&
-           confidence_less_than_zero_ == other.GetConfidenceLessThanZero() &&
-           confidence_greater_than_zero_ ==
-               other.GetConfidenceGreaterThanZero() &&
-           confidence_emptyset_ == other.GetConfidenceEmptyset();
+    return packed_ == other.packed_;
   }
 
   bool operator!=(const LatticeElementConfidence &other) const {
@@ -58,33 +63,52 @@ class LatticeElementConfidence {
   }
 
   // Confidence value getters.
-  short GetConfidenceZero() const { return confidence_zero_; }
-  short GetConfidenceLessThanZero() const { return confidence_less_than_zero_; }
+  short GetConfidenceZero() const { return GetLane(kZeroShift); }
+  short GetConfidenceLessThanZero() const {
+    return GetLane(kLessThanZeroShift);
+  }
   short GetConfidenceGreaterThanZero() const {
-    return confidence_greater_than_zero_;
+    return GetLane(kGreaterThanZeroShift);
+  }
+  short GetConfidenceEmptyset() const { return GetLane(kEmptysetShift); }
+
+  // The packed confidences, one per 16-bit lane: ==0 in the lowest lane,
+  // then <0, >0 and emptyset.
+  uint64_t GetPacked() const { return packed_; }
+  static LatticeElementConfidence FromPacked(uint64_t packed) {
+    return LatticeElementConfidence(packed, PackedTag());
   }
-  short GetConfidenceEmptyset() const { return confidence_emptyset_; }
+
+  // Bit offsets of the lanes in the packed confidences.
+  static constexpr int kZeroShift = 0;
+  static constexpr int kLessThanZeroShift = 16;
+  static constexpr int kGreaterThanZeroShift = 32;
+  static constexpr int kEmptysetShift = 48;
 
  private:
-  // The confidence, from kMinConfidence to kMaxConfidence that the lattice
-  // element ==0 is correct.
-  short confidence_zero_;
-  // The confidence, from kMinConfidence to kMaxConfidence that the lattice
-  // element <0 is correct.
-  short confidence_less_than_zero_;
-  // The confidence, from kMinConfidence to kMaxConfidence that the lattice
-  // element >0 is correct.
-  short confidence_greater_than_zero_;
-  // The confidence, from kMinConfidence to kMaxConfidence that the lattice
-  // element being represented is actually bottom/empty-set. This is different
-  // than the lattice element of a specification being bottom by default. This
-  // confidence can be thought of as the confidence that the function related
-  // to the lattice element does not return any error indicating value.
-  short confidence_emptyset_;
+  struct PackedTag {};
+  LatticeElementConfidence(uint64_t packed, PackedTag) : packed_(packed) {}
+
+  static uint64_t Lane(short x, int shift) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(x)) << shift;
+  }
+
+  short GetLane(int shift) const {
+    return static_cast<short>((packed_ >> shift) & 0xFFFF);
+  }
+
+  // The confidences, from kMinConfidence to kMaxConfidence, that the
+  // lattice elements ==0, <0 and >0 are correct, and that the lattice
+  // element being represented is actually bottom/empty-set. The latter is
+  // different than the lattice element of a specification being bottom by
+  // default. This confidence can be thought of as the confidence that the
+  // function related to the lattice element does not return any error
+  // indicating value.
+  uint64_t packed_;
 
   // Asserts that the confidence is between kMinConfidence and kMaxConfidence
   // inclusive.
-  short CheckConfidence(const short x) {
+  static short CheckConfidence(const short x) {
     assert(kMinConfidence <= x && x <= kMaxConfidence);
     return x;
   }
@@ -99,9 +123,26 @@ class ConfidenceLattice {
   // max for the confidence values representing ==0, <0, and >0. The confidence
   // for empty-set is calculated by using a min.
   static LatticeElementConfidence Join(const LatticeElementConfidence &x,
-                                       const LatticeElementConfidence &y);
+                                       const LatticeElementConfidence &y) {
+    const uint64_t take_x = SelectJoinLanes(x.GetPacked(), y.GetPacked());
+    return LatticeElementConfidence::FromPacked((x.GetPacked() & take_x) |
+                                                (y.GetPacked() & ~take_x));
+  }
   static LatticeElementConfidence Meet(const LatticeElementConfidence &x,
-                                       const LatticeElementConfidence &y);
+                                       const LatticeElementConfidence &y) {
+    const uint64_t take_x = SelectJoinLanes(x.GetPacked(), y.GetPacked());
+    return LatticeElementConfidence::FromPacked((y.GetPacked() & take_x) |
+                                                (x.GetPacked() & ~take_x));
+  }
+
+  // Joins the count confidences starting at confidences into init.
+  static LatticeElementConfidence JoinAll(
+      const LatticeElementConfidence *confidences, size_t count,
+      LatticeElementConfidence init);
+  // Meets the count confidences starting at confidences into init.
+  static LatticeElementConfidence MeetAll(
+      const LatticeElementConfidence *confidences, size_t count,
+      LatticeElementConfidence init);
 
   static bool Intersects(const LatticeElementConfidence &x,
                          const SignLatticeElement &y);
@@ -212,11 +253,33 @@ class ConfidenceLattice {
   // Returns true if the confidence for ==0, <0, >0, and emptyset are all
   // kMinConfidence.
   static bool IsUnknown(const LatticeElementConfidence &x) {
-    return x.GetConfidenceZero() == kMinConfidence &&
-           x.GetConfidenceLessThanZero() == kMinConfidence &&
-           x.GetConfidenceGreaterThanZero() == kMinConfidence &&
-           x.GetConfidenceEmptyset() == kMinConfidence;
+    return x.GetPacked() == 0;
   }
+
+ private:
+  // The sign bit of every lane, and all bits of the emptyset lane.
+  static constexpr uint64_t kLaneHighBits = 0x8000800080008000u;
+  static constexpr uint64_t kEmptysetLane =
+      uint64_t{0xFFFF} << LatticeElementConfidence::kEmptysetShift;
+
+  // Returns a mask of the lanes in which x >= y. Confidences never reach
+  // the sign bit of a lane, so setting it in x keeps a lane's subtraction
+  // from borrowing from the next lane, and it survives iff x >= y.
+  static uint64_t GreaterOrEqualLanes(uint64_t x, uint64_t y) {
+    const uint64_t x_ge_y = ((x | kLaneHighBits) - y) & kLaneHighBits;
+    return (x_ge_y >> 15) * 0xFFFF;
+  }
+
+  // Returns a mask of the lanes that the join of x and y takes from x: the
+  // larger ==0, <0 and >0 confidences and the smaller emptyset confidence.
+  static uint64_t SelectJoinLanes(uint64_t x, uint64_t y) {
+    return GreaterOrEqualLanes(x, y) ^ kEmptysetLane;
+  }
+
+  // Returns the join of the signs whose confidence in x is at least
+  // threshold.
+  static SignLatticeElement SignsAtLeast(const LatticeElementConfidence &x,
+                                         int threshold);
 };
 
 inline std::ostream &operator<<(
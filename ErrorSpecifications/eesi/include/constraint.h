@@ -7,13 +7,17 @@
 //
 // Also see the SPARTA implementation of encoding finite abstract domains.
 //
-// Here the reflexive/transitive closure of the lattice is calculated by
-// and then hard-coded in `constraint.cc`.
+// Each element is encoded as the set of elements below it, the reflexive/
+// transitive closure of the Hasse diagram. The meet of two elements is the
+// element encoded by the intersection of their encodings. The operations are
+// run at compile time over every pair of elements, so at run time each one
+// is a single table lookup. The lattice laws are checked when compiling.
 
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_CONSTRAINT_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_CONSTRAINT_H_
 
-#include <bitset>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <map>
 #include <string>
@@ -23,36 +27,202 @@
 
 namespace error_specifications {
 
-// Bit vector large enough to represent our nine-element lattice.
-using LatticeEncoding = std::bitset<8>;
+// Number of SignLatticeElement values, including INVALID.
+constexpr int kNumSignLatticeElements =
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP + 1;
+
+// Bit vector with one bit per SignLatticeElement value.
+using LatticeEncoding = uint16_t;
+
+constexpr LatticeEncoding EncodeElement(SignLatticeElement x) {
+  return static_cast<LatticeEncoding>(1u << x);
+}
+
+// The elements below each element, itself included, indexed by element.
+//
+//       bot   <0   >0    0  <=0  >=0  !=0  top
+//  bot    1    0    0    0    0    0    0    0
+//   <0    1    1    0    0    0    0    0    0
+//   >0    1    0    1    0    0    0    0    0
+//    0    1    0    0    1    0    0    0    0
+//  <=0    1    1    0    1    1    0    0    0
+//  >=0    1    0    1    1    0    1    0    0
+//  !=0    1    1    1    0    0    0    1    0
+//  top    1    1    1    1    1    1    1    1
+constexpr LatticeEncoding kSignLatticeDownSets[kNumSignLatticeElements] = {
+    // INVALID is not part of the lattice.
+    0,
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO) |
+        EncodeElement(
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO) |
+        EncodeElement(
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO),
+    EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO) |
+        EncodeElement(
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO) |
+        EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO),
+    // Everything but INVALID.
+    static_cast<LatticeEncoding>(
+        ((1u << kNumSignLatticeElements) - 1) &
+        ~EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID)),
+};
+
+// The results of the lattice operations on every pair of elements, indexed
+// by SignLatticeElement. Entries involving INVALID are INVALID or false.
+struct SignLatticeTables {
+  SignLatticeElement meet[kNumSignLatticeElements][kNumSignLatticeElements];
+  SignLatticeElement join[kNumSignLatticeElements][kNumSignLatticeElements];
+  bool less_than[kNumSignLatticeElements][kNumSignLatticeElements];
+  SignLatticeElement complement[kNumSignLatticeElements];
+};
+
+// Returns the element encoded by down_set, or INVALID if there is none.
+constexpr SignLatticeElement DecodeDownSet(LatticeEncoding down_set) {
+  for (int e = 1; e < kNumSignLatticeElements; ++e) {
+    if (kSignLatticeDownSets[e] == down_set) {
+      return static_cast<SignLatticeElement>(e);
+    }
+  }
+  return SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID;
+}
+
+// Returns the elements above x, itself included.
+constexpr LatticeEncoding UpSet(int x) {
+  LatticeEncoding up_set = 0;
+  for (int e = 1; e < kNumSignLatticeElements; ++e) {
+    if (kSignLatticeDownSets[e] & (1u << x)) up_set |= 1u << e;
+  }
+  return up_set;
+}
+
+// Returns the element whose up set is up_set, or INVALID if there is none.
+constexpr SignLatticeElement DecodeUpSet(LatticeEncoding up_set) {
+  for (int e = 1; e < kNumSignLatticeElements; ++e) {
+    if (UpSet(e) == up_set) return static_cast<SignLatticeElement>(e);
+  }
+  return SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID;
+}
+
+constexpr SignLatticeTables BuildSignLatticeTables() {
+  SignLatticeTables tables{};
+  // The atoms, the elements right above bottom, are the signs a value can
+  // have. Every element is the set of its atoms, and its complement is the
+  // element with the other atoms.
+  constexpr LatticeEncoding bottom =
+      EncodeElement(SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM);
+  LatticeEncoding atoms = 0;
+  for (int e = 1; e < kNumSignLatticeElements; ++e) {
+    if ((kSignLatticeDownSets[e] & ~(1u << e)) == bottom) atoms |= 1u << e;
+  }
+  for (int x = 1; x < kNumSignLatticeElements; ++x) {
+    for (int y = 1; y < kNumSignLatticeElements; ++y) {
+      tables.meet[x][y] =
+          DecodeDownSet(kSignLatticeDownSets[x] & kSignLatticeDownSets[y]);
+      tables.join[x][y] = DecodeUpSet(UpSet(x) & UpSet(y));
+      tables.less_than[x][y] = (kSignLatticeDownSets[y] >> x) & 1u;
+      if ((kSignLatticeDownSets[y] & atoms) ==
+          (atoms & ~kSignLatticeDownSets[x])) {
+        tables.complement[x] = static_cast<SignLatticeElement>(y);
+      }
+    }
+  }
+  return tables;
+}
+
+// Returns true if the tables describe a bounded lattice whose complement is
+// an involution, i.e. the operations are closed, commutative, associative,
+// idempotent and absorbing, and agree with the order.
+constexpr bool SatisfiesLatticeLaws(const SignLatticeTables &t) {
+  constexpr int bottom = SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+  constexpr int top = SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
+  constexpr SignLatticeElement invalid =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID;
+  for (int x = 1; x < kNumSignLatticeElements; ++x) {
+    if (t.complement[x] == invalid || t.complement[t.complement[x]] != x ||
+        t.meet[x][t.complement[x]] != bottom ||
+        t.join[x][t.complement[x]] != top) {
+      return false;
+    }
+    if (t.meet[x][x] != x || t.join[x][x] != x || t.meet[x][top] != x ||
+        t.join[x][bottom] != x) {
+      return false;
+    }
+    for (int y = 1; y < kNumSignLatticeElements; ++y) {
+      const int meet = t.meet[x][y];
+      const int join = t.join[x][y];
+      if (meet == invalid || join == invalid || meet != t.meet[y][x] ||
+          join != t.join[y][x] || t.join[x][meet] != x ||
+          t.meet[x][join] != x || t.less_than[x][y] != (meet == x) ||
+          t.less_than[x][y] != (join == y)) {
+        return false;
+      }
+      for (int z = 1; z < kNumSignLatticeElements; ++z) {
+        if (t.meet[meet][z] != t.meet[x][t.meet[y][z]] ||
+            t.join[join][z] != t.join[x][t.join[y][z]]) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
 
 // This class is the actual sign lattice.
 class SignLattice {
  public:
   // Perform a meet between two lattice elements.
   static SignLatticeElement Meet(const SignLatticeElement &x,
-                                 const SignLatticeElement &y);
+                                 const SignLatticeElement &y) {
+    return kTables.meet[Index(x)][Index(y)];
+  }
 
   // Perform a join between two lattice elements.
   static SignLatticeElement Join(const SignLatticeElement &x,
-                                 const SignLatticeElement &y);
+                                 const SignLatticeElement &y) {
+    return kTables.join[Index(x)][Index(y)];
+  }
 
   // Returns the difference between two lattice elements
   // (i.e. \alpha( \gamma(x) - \gamma(y) )).
   static SignLatticeElement Difference(const SignLatticeElement &x,
-                                       const SignLatticeElement &y);
+                                       const SignLatticeElement &y) {
+    return Meet(x, Complement(y));
+  }
 
   // Returns true if the given element is bottom.
-  static bool IsBottom(const SignLatticeElement &x);
+  static bool IsBottom(const SignLatticeElement &x) {
+    return x == SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+  }
 
-  static SignLatticeElement Complement(const SignLatticeElement &x);
+  static SignLatticeElement Complement(const SignLatticeElement &x) {
+    return kTables.complement[Index(x)];
+  }
 
   // Returns true if the meet of the lattice elements is NOT bottom.
   static bool Intersects(const SignLatticeElement &x,
-                         const SignLatticeElement &y);
+                         const SignLatticeElement &y) {
+    return !IsBottom(Meet(x, y));
+  }
 
   static bool IsLessThan(const SignLatticeElement &x,
-                         const SignLatticeElement &y);
+                         const SignLatticeElement &y) {
+    return kTables.less_than[Index(x)][Index(y)];
+  }
 
   // For pretty-printing.
   static const std::unordered_map<std::string, SignLatticeElement>
@@ -61,67 +231,21 @@ class SignLattice {
       lattice_element_to_string;
 
  private:
-  // Encoding of the reflexive/transitive closure of
-  // immediately greater than relation.
-  // A meet operation is bitwise AND of the rows.
-  //
-  //       bot   <0   >0    0  <=0  >=0  !=0  top
-  //  bot    1    0    0    0    0    0    0    0
-  //   <0    1    1    0    0    0    0    0    0
-  //   >0    1    0    1    0    0    0    0    0
-  //    0    1    0    0    1    0    0    0    0
-  //  <=0    1    1    0    1    1    0    0    0
-  //  >=0    1    0    1    1    0    1    0    0
-  //  !=0    1    1    1    0    0    0    1    0
-  //  top    1    1    1    1    1    1    1    1
-  static const LatticeEncoding meet_bottom;
-  static const LatticeEncoding meet_less_than_zero;
-  static const LatticeEncoding meet_greater_than_zero;
-  static const LatticeEncoding meet_zero;
-  static const LatticeEncoding meet_less_than_equal_zero;
-  static const LatticeEncoding meet_greater_than_equal_zero;
-  static const LatticeEncoding meet_not_zero;
-  static const LatticeEncoding meet_top;
-
-  // LatticeEncoding of the reflexive/transitive closure of
-  // immediately less than relation.
-  // A join operation is bitwise AND of the rows.
-  //
-  //       bot   <0   >0    0  <=0  >=0  !=0  top
-  //  bot    1    1    1    1    1    1    1    1
-  //   <0    0    1    0    0    1    0    1    1
-  //   >0    0    0    1    0    0    1    1    1
-  //    0    0    0    0    1    1    1    0    1
-  //  <=0    0    0    0    0    1    0    0    1
-  //  >=0    0    0    0    0    0    1    0    1
-  //  !=0    0    0    0    0    0    0    1    1
-  //  top    0    0    0    0    0    0    0    1
-  static const LatticeEncoding join_bottom;
-  static const LatticeEncoding join_less_than_zero;
-  static const LatticeEncoding join_greater_than_zero;
-  static const LatticeEncoding join_zero;
-  static const LatticeEncoding join_less_than_equal_zero;
-  static const LatticeEncoding join_greater_than_equal_zero;
-  static const LatticeEncoding join_not_zero;
-  static const LatticeEncoding join_top;
-
-  // Maps from lattice elements to their bitset encoding.
-  static const std::map<SignLatticeElement, LatticeEncoding>
-      meet_lattice_element_encoding;
-  static const std::map<SignLatticeElement, LatticeEncoding>
-      join_lattice_element_encoding;
-
-  // Maps from the bitset encoding of lattice elements to the actual elements.
-  static const std::unordered_map<LatticeEncoding, SignLatticeElement>
-      meet_lattice_element_decoding;
-  static const std::unordered_map<LatticeEncoding, SignLatticeElement>
-      join_lattice_element_decoding;
-
-  // For computing the complement of an element.
-  static const std::map<SignLatticeElement, SignLatticeElement> complement;
-
-  // Map from lattice element to its offset in encoding bit vectors.
-  static const std::map<SignLatticeElement, int> offset;
+  // Returns x as a table index. Aborts if x is not an element of the
+  // lattice.
+  static int Index(SignLatticeElement x) {
+    if (static_cast<unsigned>(x) -
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM >=
+        static_cast<unsigned>(kNumSignLatticeElements) -
+            SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) {
+      abort();
+    }
+    return x;
+  }
+
+  static constexpr SignLatticeTables kTables = BuildSignLatticeTables();
+  static_assert(SatisfiesLatticeLaws(kTables),
+                "The sign lattice encoding is not a lattice.");
 };
 
 // Wraps a lattice element with other data
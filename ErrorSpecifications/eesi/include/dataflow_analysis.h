@@ -0,0 +1,511 @@
+// This file defines the intraprocedural dataflow framework shared by the
+// ReturnPropagation, ReturnConstraints, ReturnedValues and ReturnRange passes.
+//
+// A pass instantiates DataflowAnalysis with its fact type, the direction of
+// the analysis and itself as the transfer. The framework owns the facts at
+// every program point, the initialization of those facts, the joins at block
+// boundaries, the fixpoint loop and the instrumentation; the pass only
+// provides transfer functions.
+
+// Transfer interface
+// -------------------
+// For a forward analysis, the transfer provides
+//
+//   void Visit(const llvm::X &inst, const Fact &in, Fact &out);
+//
+// for every instruction class X it handles, and a fallback for
+// llvm::Instruction. For a backward analysis, in is written and out read:
+//
+//   void Visit(const llvm::X &inst, Fact &in, const Fact &out);
+//
+// Instructions are dispatched on their opcode, as llvm::InstVisitor does,
+// to the overload of Visit for their most derived class; classes the
+// transfer has no overload for reach the overload for their nearest base.
+// The transfer also provides
+//
+//   void JoinEdge(const llvm::BasicBlock &block, const Fact &edge,
+//                 Fact &boundary);
+//
+// which joins the fact of a neighbor of block (the exit of a predecessor for
+// a forward analysis, the entry of a successor for a backward one) into the
+// boundary fact of block.
+//
+// Transfer functions that pass facts directly to another block, e.g. along
+// the true edge of a branch, must do so with JoinIntoBlock, and only to the
+// blocks that follow the visited one in the direction of the analysis, so
+// that the worklist solver revisits them.
+
+// Solvers
+// --------
+// - kRoundRobin: visits every block of the function in layout order until a
+//   whole round changes no fact, including the boundary facts that
+//   transfers joined into blocks visited earlier in the round. Passes whose
+//   facts are not monotone (e.g., that kill entries at branches) use it.
+// - kWorklist: visits blocks in reverse post-order (post-order for backward
+//   analyses), and revisits a block only when a fact it depends on changed.
+//   Both solvers compute the same fixpoint for monotone transfers.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSIS_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSIS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "glog/logging.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "metrics.h"
+#include "tbb/tbb.h"
+
+namespace error_specifications {
+
+enum class DataflowDirection { kForward, kBackward };
+
+enum class DataflowSolver { kRoundRobin, kWorklist };
+
+// Counters of the work done by a DataflowAnalysis, summed over every thread.
+struct DataflowStats {
+  // Calls of Solve. Passes that iterate over recursive call graph SCCs solve
+  // some functions more than once.
+  std::atomic<uint64_t> solves{0};
+  // Rounds of the round-robin solver, or blocks taken off the worklist.
+  std::atomic<uint64_t> iterations{0};
+  std::atomic<uint64_t> block_visits{0};
+  std::atomic<uint64_t> transfers{0};
+  std::atomic<uint64_t> solve_microseconds{0};
+};
+
+// The metrics of the DataflowAnalysis of a pass, which the analysis updates
+// after every solve, so that they can be followed while the pass runs.
+struct DataflowMetrics {
+  explicit DataflowMetrics(const std::string &pass_name)
+      : solves(GetCounter("eesi_dataflow_solves_total",
+                          "Function solves of dataflow analyses.", pass_name)),
+        iterations(GetCounter(
+            "eesi_dataflow_iterations_total",
+            "Fixpoint iterations of dataflow analyses: rounds of the "
+            "round-robin solver or blocks taken off the worklist.",
+            pass_name)),
+        block_visits(GetCounter("eesi_dataflow_block_visits_total",
+                                "Blocks visited by dataflow analyses.",
+                                pass_name)),
+        transfers(GetCounter("eesi_dataflow_transfers_total",
+                             "Instruction transfers of dataflow analyses.",
+                             pass_name)),
+        solve_seconds(GetCounter("eesi_dataflow_solve_seconds_total",
+                                 "Time spent solving dataflow analyses.",
+                                 pass_name)),
+        program_points(GetGauge(
+            "eesi_dataflow_program_points",
+            "Program points with facts, over the live dataflow analyses.",
+            pass_name)),
+        peak_program_points(GetGauge(
+            "eesi_dataflow_peak_program_points",
+            "Peak of eesi_dataflow_program_points.", pass_name)),
+        fact_bytes(GetGauge(
+            "eesi_dataflow_fact_bytes",
+            "Bytes of the facts at the program points of the live dataflow "
+            "analyses, not counting the memory that the facts own.",
+            pass_name)),
+        peak_fact_bytes(GetGauge("eesi_dataflow_peak_fact_bytes",
+                                 "Peak of eesi_dataflow_fact_bytes.",
+                                 pass_name)) {}
+
+  Counter &solves;
+  Counter &iterations;
+  Counter &block_visits;
+  Counter &transfers;
+  Counter &solve_seconds;
+  Gauge &program_points;
+  Gauge &peak_program_points;
+  Gauge &fact_bytes;
+  Gauge &peak_fact_bytes;
+
+ private:
+  static Counter &GetCounter(const std::string &name, const std::string &help,
+                             const std::string &pass_name) {
+    return MetricRegistry::Get().GetCounter(name, help, {{"pass", pass_name}});
+  }
+  static Gauge &GetGauge(const std::string &name, const std::string &help,
+                         const std::string &pass_name) {
+    return MetricRegistry::Get().GetGauge(name, help, {{"pass", pass_name}});
+  }
+};
+
+// Stores the fact at every program point. The n instructions of a block
+// share its n + 1 program points: the output fact of an instruction is the
+// input fact of the next one. The points of a block are allocated together,
+// so the solver walks a block without looking up each instruction.
+//
+// Storage is the framework's only access to facts, so other layouts can be
+// plugged in by providing the same members: Initialize, Points, In, Out,
+// Contains, and the requeue flags of the solvers.
+template <typename Fact>
+class ProgramPointFacts {
+ public:
+  // Creates empty facts for the program points of function, and returns
+  // their number. May be called concurrently for different functions.
+  size_t Initialize(const llvm::Function &function) {
+    size_t num_points = 0;
+    for (const llvm::BasicBlock &block : function) {
+      BlockFacts &block_facts = blocks_[&block];
+      block_facts.points.resize(block.size() + 1);
+      Fact *point = block_facts.points.data();
+      for (const llvm::Instruction &inst : block) {
+        points_[&inst] = point++;
+      }
+      num_points += block_facts.points.size();
+    }
+    return num_points;
+  }
+
+  // The program points of block, from before its first instruction to after
+  // its last one.
+  Fact *Points(const llvm::BasicBlock &block) {
+    return blocks_.at(&block).points.data();
+  }
+
+  // Whether the requeue flag of block was set, clearing it.
+  bool TakeRequeue(const llvm::BasicBlock &block) {
+    BlockFacts &block_facts = blocks_.at(&block);
+    const bool requeue = block_facts.requeue;
+    block_facts.requeue = false;
+    return requeue;
+  }
+  void SetRequeue(const llvm::BasicBlock &block) {
+    blocks_.at(&block).requeue = true;
+  }
+
+  // Facts immediately before and after the instruction value. Throws
+  // std::out_of_range if value is not an initialized instruction.
+  Fact &In(const llvm::Value *value) { return *points_.at(value); }
+  const Fact &In(const llvm::Value *value) const { return *points_.at(value); }
+  Fact &Out(const llvm::Value *value) { return *(points_.at(value) + 1); }
+  const Fact &Out(const llvm::Value *value) const {
+    return *(points_.at(value) + 1);
+  }
+
+  bool Contains(const llvm::Value *value) const {
+    return points_.find(value) != points_.end();
+  }
+
+ private:
+  struct BlockFacts {
+    std::vector<Fact> points;
+    // Set when a transfer changed the boundary fact of this block with
+    // JoinIntoBlock.
+    bool requeue = false;
+  };
+
+  tbb::concurrent_unordered_map<const llvm::BasicBlock *, BlockFacts> blocks_;
+
+  // Instruction to the program point before it.
+  tbb::concurrent_unordered_map<const llvm::Value *, Fact *> points_;
+};
+
+template <typename Fact, DataflowDirection Direction, typename Transfer,
+          DataflowSolver Solver = DataflowSolver::kRoundRobin,
+          typename Storage = ProgramPointFacts<Fact>>
+class DataflowAnalysis {
+ public:
+  // pass_name labels the metrics of the analysis.
+  DataflowAnalysis(Transfer &transfer, const std::string &pass_name)
+      : transfer_(transfer), metrics_(pass_name) {}
+
+  ~DataflowAnalysis() {
+    metrics_.program_points.Add(-static_cast<double>(num_points_));
+    metrics_.fact_bytes.Add(-static_cast<double>(num_points_ * sizeof(Fact)));
+  }
+
+  // Creates the facts of every function, in parallel.
+  void Initialize(const std::vector<const llvm::Function *> &functions) {
+    std::atomic<size_t> num_points{0};
+    ParallelForEach(functions,
+                    [this, &num_points](const llvm::Function &function) {
+                      num_points += storage_.Initialize(function);
+                    });
+    num_points_ += num_points;
+    metrics_.program_points.Add(num_points);
+    metrics_.peak_program_points.SetMax(metrics_.program_points.Value());
+    metrics_.fact_bytes.Add(num_points * sizeof(Fact));
+    metrics_.peak_fact_bytes.SetMax(metrics_.fact_bytes.Value());
+  }
+
+  // Solves every function, in parallel. The functions must have been
+  // initialized.
+  void SolveAll(const std::vector<const llvm::Function *> &functions) {
+    ParallelForEach(functions, [this](const llvm::Function &function) {
+      Solve(function);
+    });
+  }
+
+  // Runs function to a fixpoint.
+  void Solve(const llvm::Function &function) {
+    const auto start = std::chrono::steady_clock::now();
+    SolveCounts counts;
+    if (Solver == DataflowSolver::kWorklist) {
+      SolveWorklist(function, counts);
+    } else {
+      SolveRoundRobin(function, counts);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    stats_.solves++;
+    stats_.iterations += counts.iterations;
+    stats_.block_visits += counts.block_visits;
+    stats_.transfers += counts.transfers;
+    stats_.solve_microseconds +=
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count();
+    metrics_.solves.Increment();
+    metrics_.iterations.Increment(counts.iterations);
+    metrics_.block_visits.Increment(counts.block_visits);
+    metrics_.transfers.Increment(counts.transfers);
+    metrics_.solve_seconds.Increment(
+        std::chrono::duration<double>(elapsed).count());
+  }
+
+  // Joins fact into the boundary fact of block: its entry for a forward
+  // analysis, its exit for a backward one.
+  void JoinIntoBlock(const llvm::BasicBlock &block, const Fact &fact) {
+    Fact &boundary = Boundary(block);
+    const Fact before = boundary;
+    boundary.Join(fact);
+    if (boundary != before) storage_.SetRequeue(block);
+  }
+
+  const Fact &GetInFact(const llvm::Value *inst) const {
+    return storage_.In(inst);
+  }
+  const Fact &GetOutFact(const llvm::Value *inst) const {
+    return storage_.Out(inst);
+  }
+
+  // Whether value is an instruction with facts.
+  bool HasFacts(const llvm::Value *value) const {
+    return storage_.Contains(value);
+  }
+
+  const DataflowStats &stats() const { return stats_; }
+
+  void LogStats(const std::string &pass_name) const {
+    LOG(INFO) << pass_name << ": " << stats_.solves.load()
+              << " function solves, " << stats_.iterations.load()
+              << " iterations, " << stats_.block_visits.load()
+              << " block visits and " << stats_.transfers.load()
+              << " transfers in " << stats_.solve_microseconds.load() / 1000
+              << " ms";
+  }
+
+ private:
+  static constexpr bool kForward = Direction == DataflowDirection::kForward;
+
+  // The work of one solve, counted on the solving thread and added to
+  // stats_ and metrics_ once it is done.
+  struct SolveCounts {
+    uint64_t iterations = 0;
+    uint64_t block_visits = 0;
+    uint64_t transfers = 0;
+  };
+
+  static void ParallelForEach(
+      const std::vector<const llvm::Function *> &functions,
+      const std::function<void(const llvm::Function &)> &body) {
+    tbb::parallel_for(
+        tbb::blocked_range<
+            std::vector<const llvm::Function *>::const_iterator>(
+            functions.begin(), functions.end()),
+        [&body](const auto &thread_functions) {
+          for (const llvm::Function *function : thread_functions) {
+            body(*function);
+          }
+        });
+  }
+
+  // The fact that neighbors join into: the entry of block for a forward
+  // analysis, its exit for a backward one.
+  Fact &Boundary(const llvm::BasicBlock &block) {
+    Fact *points = storage_.Points(block);
+    return kForward ? points[0] : points[block.size()];
+  }
+
+  // Joins the boundary facts of the blocks that flow into block.
+  void JoinNeighbors(const llvm::BasicBlock &block) {
+    Fact &boundary = Boundary(block);
+    if (kForward) {
+      for (const llvm::BasicBlock *pred : llvm::predecessors(&block)) {
+        transfer_.JoinEdge(block, storage_.Points(*pred)[pred->size()],
+                           boundary);
+      }
+    } else {
+      for (const llvm::BasicBlock *succ : llvm::successors(&block)) {
+        transfer_.JoinEdge(block, storage_.Points(*succ)[0], boundary);
+      }
+    }
+  }
+
+  // Applies the transfer of every instruction of block in the direction of
+  // the analysis. Returns whether any fact it writes changed.
+  bool VisitBlock(const llvm::BasicBlock &block, SolveCounts &counts) {
+    counts.block_visits++;
+    Fact *points = storage_.Points(block);
+    bool changed = false;
+    if (kForward) {
+      Fact *in = points;
+      for (const llvm::Instruction &inst : block) {
+        changed =
+            TransferInstruction(inst, *in, *(in + 1), counts) || changed;
+        ++in;
+      }
+    } else {
+      Fact *out = points + block.size();
+      for (auto it = block.rbegin(), end = block.rend(); it != end; ++it) {
+        changed =
+            TransferInstruction(*it, *(out - 1), *out, counts) || changed;
+        --out;
+      }
+    }
+    return changed;
+  }
+
+  // Applies the transfer of inst. Returns whether the fact it writes
+  // changed.
+  bool TransferInstruction(const llvm::Instruction &inst, Fact &in,
+                           Fact &out, SolveCounts &counts) {
+    counts.transfers++;
+    Fact &written = kForward ? out : in;
+    const Fact before = written;
+    Dispatch(inst, in, out);
+    return written != before;
+  }
+
+  // Calls the transfer overload for the class of inst, like
+  // llvm::InstVisitor::visit.
+  void Dispatch(const llvm::Instruction &inst, Fact &in, Fact &out) {
+    switch (inst.getOpcode()) {
+#define HANDLE_INST(NUM, OPCODE, CLASS)                         \
+  case llvm::Instruction::OPCODE:                               \
+    return Visit(static_cast<const llvm::CLASS &>(inst), in, out);
+#include "llvm/IR/Instruction.def"
+      default:
+        return Visit(inst, in, out);
+    }
+  }
+
+  // Passes the fact that inst reads as const.
+  template <typename Inst>
+  void Visit(const Inst &inst, Fact &in, Fact &out) {
+    Visit(inst, in, out, std::integral_constant<bool, kForward>());
+  }
+  template <typename Inst>
+  void Visit(const Inst &inst, Fact &in, Fact &out, std::true_type) {
+    transfer_.Visit(inst, static_cast<const Fact &>(in), out);
+  }
+  template <typename Inst>
+  void Visit(const Inst &inst, Fact &in, Fact &out, std::false_type) {
+    transfer_.Visit(inst, in, static_cast<const Fact &>(out));
+  }
+
+  void SolveRoundRobin(const llvm::Function &function, SolveCounts &counts) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      counts.iterations++;
+      for (const llvm::BasicBlock &block : function) {
+        // Joins into blocks not visited yet in this round are seen now.
+        storage_.TakeRequeue(block);
+        JoinNeighbors(block);
+        changed = VisitBlock(block, counts) || changed;
+      }
+      // A transfer joined into a block visited before it in this round, or
+      // into its own block: that block has to be visited again.
+      for (const llvm::BasicBlock &block : function) {
+        changed = storage_.TakeRequeue(block) || changed;
+      }
+    }
+  }
+
+  void SolveWorklist(const llvm::Function &function, SolveCounts &counts) {
+    if (function.empty()) return;
+
+    // Blocks in the order they are taken off the worklist: reverse
+    // post-order, then the unreachable blocks in layout order. Backward
+    // analyses take them in the opposite order.
+    std::vector<const llvm::BasicBlock *> order;
+    llvm::DenseMap<const llvm::BasicBlock *, unsigned> rank;
+    llvm::ReversePostOrderTraversal<const llvm::Function *> rpo(&function);
+    for (const llvm::BasicBlock *block : rpo) {
+      rank[block] = order.size();
+      order.push_back(block);
+    }
+    for (const llvm::BasicBlock &block : function) {
+      if (rank.count(&block) == 0) {
+        rank[&block] = order.size();
+        order.push_back(&block);
+      }
+    }
+    if (!kForward) {
+      std::reverse(order.begin(), order.end());
+      for (unsigned i = 0; i < order.size(); ++i) rank[order[i]] = i;
+    }
+
+    std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>>
+        worklist;
+    std::vector<bool> queued(order.size(), true);
+    for (unsigned i = 0; i < order.size(); ++i) worklist.push(i);
+
+    auto enqueue = [&](const llvm::BasicBlock *block) {
+      const unsigned i = rank[block];
+      if (!queued[i]) {
+        queued[i] = true;
+        worklist.push(i);
+      }
+    };
+
+    while (!worklist.empty()) {
+      const unsigned i = worklist.top();
+      worklist.pop();
+      queued[i] = false;
+      counts.iterations++;
+
+      const llvm::BasicBlock &block = *order[i];
+      storage_.TakeRequeue(block);
+      JoinNeighbors(block);
+      const bool changed = VisitBlock(block, counts);
+
+      // The blocks that join the facts of this one, and that its transfers
+      // may have joined facts into.
+      auto requeue = [&](const llvm::BasicBlock *dependent) {
+        if (storage_.TakeRequeue(*dependent) || changed) enqueue(dependent);
+      };
+      if (kForward) {
+        for (const llvm::BasicBlock *succ : llvm::successors(&block)) {
+          requeue(succ);
+        }
+      } else {
+        for (const llvm::BasicBlock *pred : llvm::predecessors(&block)) {
+          requeue(pred);
+        }
+      }
+    }
+  }
+
+  Transfer &transfer_;
+  Storage storage_;
+  DataflowStats stats_;
+  DataflowMetrics metrics_;
+  // The program points initialized by this analysis.
+  size_t num_points_ = 0;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_DATAFLOW_ANALYSIS_H_
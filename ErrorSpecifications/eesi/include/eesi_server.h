@@ -8,6 +8,8 @@
 
 #include "tbb/task.h"
 
+#include "admission_controller.h"
+#include "metrics_service.h"
 #include "operations_service.h"
 #include "proto/eesi.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
@@ -25,11 +27,28 @@ class EesiServiceImpl final : public EesiService::Service {
                                 Operation *operation) override;
 
  public:
+  // Timelines requested by clients are written to timeline_dir. If it is
+  // empty, requests for timelines are rejected.
+  EesiServiceImpl(const AdmissionOptions &admission_options,
+                  const std::string &timeline_dir)
+      : admission_controller(&operations_service, admission_options),
+        timeline_dir(timeline_dir) {}
+
   // Because TBB can throw exceptions.
   ~EesiServiceImpl() throw() {}
 
   // The operations service for this EESI service.
   OperationsServiceImpl operations_service;
+
+  // Queues GetSpecifications tasks beyond the memory/concurrency budget.
+  // Must be declared after operations_service.
+  AdmissionController admission_controller;
+
+  // Serves the metrics of the process.
+  MetricsServiceImpl metrics_service;
+
+  // The directory timelines are written to, chosen by the server operator.
+  const std::string timeline_dir;
 };
 
 // This is a TBB task that runs EESI specification inference on bitcode
@@ -42,10 +61,17 @@ class GetSpecificationsTask : public tbb::task {
   std::string task_name;
   GetSpecificationsRequest request;
   OperationsServiceImpl *operations_service;
+  AdmissionController *admission_controller;
+  AdmissionTicket admission_ticket;
   std::string bitcode_server_address;
+  // Where to write the timeline of the run, or empty for none. Chosen by
+  // the server, never by the client.
+  std::string timeline_file;
 };
 
-void RunEesiServer(const std::string &eesi_server_address);
+void RunEesiServer(const std::string &eesi_server_address,
+                   const AdmissionOptions &admission_options,
+                   const std::string &timeline_dir);
 
 }  // namespace error_specifications
 
@@ -2,23 +2,39 @@
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_ERROR_BLOCKS_PASS_H_
 
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
-#include "call_graph_underapproximation.h"
+#include "call_graph_pass.h"
 #include "checker.h"
 #include "confidence_lattice.h"
 #include "constraint.h"
+#include "function_table.h"
 #include "gpt_model.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
+#include "progress_reporter.h"
 #include "proto/eesi.grpc.pb.h"
+#include "source_index.h"
+#include "submodule_matcher.h"
 
 namespace error_specifications {
 
+class ReturnConstraintsPass;
+
+// Budget, in estimated prompt tokens, for the context specifications of an
+// LLM query when the request does not set one.
+constexpr uint64_t kDefaultLlmContextTokenBudget = 2048;
+
+// Number of third-party functions per LLM query when the request does not
+// set one.
+constexpr size_t kDefaultLlmThirdPartyChunkSize = 64;
+
 // This LLVM pass is responsible for implementing the error specification
 // inference rules.
 struct ErrorBlocksPass : public llvm::ModulePass {
@@ -32,6 +48,10 @@ struct ErrorBlocksPass : public llvm::ModulePass {
 
   void SetSpecificationsRequest(const GetSpecificationsRequest &request);
 
+  // Sets the reporter that receives SCC, function and LLM call progress.
+  // Optional; the pass does not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter);
+
   // Get the final set of inferred function error specifications.
   GetSpecificationsResponse GetSpecifications() const;
 
@@ -42,12 +62,16 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   std::unordered_set<std::string> GetNonDoomedFunctions() const;
 
  private:
+  // Tests the scheduling of LLM queries without running the pass.
+  friend class ErrorBlocksPassTest;
+
   using ErrorSpecificationMap =
       std::unordered_map<std::string, LatticeElementConfidence>;
   using ErrorOnlyFuncToArgMap =
       std::unordered_multimap<std::string,
                               std::unordered_map<int, ConstantValue>>;
-  using ReturnTypeMap = std::unordered_map<std::string, FunctionReturnType>;
+  using ConstraintsByFunction =
+      std::unordered_map<std::string, std::set<SignLatticeElement>>;
 
   // Performs static analysis to infer the error specification of the
   // function. Returns true if the error specification for the function has been
@@ -77,19 +101,139 @@ struct ErrorBlocksPass : public llvm::ModulePass {
       llvm::Function *func,
       const std::unordered_map<std::string, FunctionReturnType>
           &converged_functions);
-  bool LlmExpandErrorSpecification(llvm::Function *func);
-  bool LlmExpandThirdPartyErrorSpecifications(
-      std::vector<std::pair<std::string, std::string>> function_names);
+
+  // Expands the error specifications of funcs with a single batched LLM
+  // query. Returns the functions whose query updated a specification.
+  std::unordered_set<llvm::Function *> LlmExpandErrorSpecifications(
+      const std::vector<llvm::Function *> &funcs);
   bool GptExpandErrorSpecification(llvm::Function *func,
                                    std::vector<Specification> specifications);
-  bool runOnThirdPartyFunctions(const llvm::CallGraph &call_graph);
+
+  // A chunk of third-party functions that the LLM is asked about by name.
+  struct ThirdPartyQuery {
+    std::vector<std::pair<std::string, std::string>> function_names;
+    // The specifications sent as context, and their functions.
+    std::vector<Specification> specifications;
+    std::vector<std::string> context_function_names;
+    // Null once the answer has been applied.
+    std::unique_ptr<PendingThirdPartySpecifications> pending;
+  };
+
+  // Asks the LLM about the third-party functions of the call graph,
+  // llm_third_party_chunk_size_ functions per query, with all of the
+  // queries in flight at once.
+  void StartThirdPartyQueries(const CallGraphPass &call_graph);
+  // Splits functions into consecutive chunks of chunk_size functions, the
+  // last of which may be smaller.
+  static std::vector<std::vector<std::pair<std::string, std::string>>>
+  ChunkThirdPartyFunctions(
+      const std::vector<std::pair<std::string, std::string>> &functions,
+      size_t chunk_size);
+  void StartThirdPartyQuery(
+      std::vector<std::pair<std::string, std::string>> function_names);
+
+  // Applies the answer to third_party_queries_[index], waiting for it if
+  // needed. Returns true if any error specification was updated.
+  bool ApplyThirdPartyQuery(size_t index);
+
+  // Applies the third-party answers that have arrived, or all of them,
+  // waiting for the rest, if wait is true.
+  void ApplyThirdPartyQueries(bool wait);
+
+  // Applies the answers about the third-party functions that func calls,
+  // waiting for them if needed.
+  void AwaitThirdPartyQueries(const llvm::Function &func);
+
+  // The inputs of the LLM query for one function, and what is needed to
+  // apply its answer.
+  struct LlmQuery {
+    llvm::Function *func;
+    GptSpecificationQuery query;
+    // The callees whose specifications are part of the query context.
+    std::vector<std::string> context_function_names;
+    short average_non_zero_confidence;
+  };
+
+  // Builds the LLM query for func from the current specifications of its
+  // callees. Returns false if func has no body to show the LLM.
+  bool BuildLlmQuery(llvm::Function *func, LlmQuery *out_query);
+
+  // Applies the LLM's answer to query. Returns true if any error
+  // specification was updated.
+  bool ApplyLlmSpecifications(
+      const LlmQuery &query,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &llm_specifications);
+
+  // How often a caller calls a callee, and whether the callee's return value
+  // constrains any block of the caller.
+  struct CalleeSignals {
+    uint64_t call_sites = 0;
+    bool constrained = false;
+  };
+
+  // Fills callee_signals_ and callers_ from the module.
+  void IndexCalleeSignals(llvm::Module &module);
+
+  // Trims the candidate context specifications of an LLM query about
+  // functions called from callers to llm_context_token_budget_. Direct
+  // callees of callers rank first, then callees whose return value the
+  // callers check, then the most called. specifications and the parallel
+  // function_names are filtered in place, most relevant first.
+  // tokens_per_specification is the prompt overhead of one specification
+  // besides its name.
+  void SelectLlmContext(const std::unordered_set<std::string> &callers,
+                        uint64_t tokens_per_specification,
+                        std::vector<Specification> *specifications,
+                        std::vector<std::string> *function_names);
+
+  // A function that may need an LLM query, ranked for the query budget.
+  struct LlmCandidate {
+    llvm::Function *func;
+    std::string name;
+    // Expected value of knowing the function's specification.
+    double value;
+    uint64_t estimated_tokens;
+    // Set once the function's depth has been processed, whether or not it
+    // was queried.
+    bool decided;
+  };
+
+  // Returns true if the request caps the run's LLM queries.
+  bool HasLlmQueryBudget() const;
+
+  // Fills llm_candidates_ with the functions of sccs, which are in
+  // bottom-up order, by decreasing expected value. A function's value
+  // counts its call sites and the callers that check its return value, and
+  // a share of the value of each checking caller, whose own specification
+  // may be inferred from the function's.
+  void RankLlmCandidates(
+      const std::vector<std::vector<llvm::Function *>> &sccs);
+
+  // Estimates the tokens of the LLM query for func, whose source name is
+  // func_name, before its callees' specifications are known.
+  uint64_t EstimateLlmQueryTokens(const llvm::Function &func,
+                                  const std::string &func_name);
+
+  // Returns the functions of to_expand, those of depth_funcs still unknown
+  // after static analysis, that are worth querying. The remaining budget
+  // goes to candidates by decreasing value; candidates of later depths hold
+  // back the share of it that the fraction of functions found unknown so
+  // far predicts they will need. The other functions of to_expand are
+  // added to llm_skipped_functions_.
+  std::vector<llvm::Function *> AdmitLlmQueries(
+      const std::vector<llvm::Function *> &depth_funcs,
+      const std::vector<llvm::Function *> &to_expand);
 
   // Returns true if any new error values were added.
   // Called for each basic block.
   LatticeElementConfidence VisitBlock(const llvm::BasicBlock &BB);
 
-  std::set<SignLatticeElement> CollectConstraints(
-      const llvm::Function &parent_function, const std::string &fn_name);
+  // Returns the constraints on the return values of the functions called in
+  // parent_function, by the source name of the called function.
+  ConstraintsByFunction CollectConstraints(
+      const ReturnConstraintsPass &return_constraints_pass,
+      const llvm::Function &parent_function) const;
 
   // Returns true if any new error values were added.
   // Called for each call instruction.
@@ -98,13 +242,22 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // Helper function for adding values to error_return_values_ map.
   LatticeElementConfidence AddErrorValue(const llvm::Function *, int64_t);
 
+  // Returns the ID of source_name in function_table_, growing the per-name
+  // state if it is new.
+  NameId InternName(const std::string &source_name);
+
+  // Resizes the per-name state to the number of names in function_table_.
+  void GrowNameState();
+
   // Adds a function name to the non-doomed functions set. Returns true if we
   // update the set.
   bool AddNonDoomedFunction(const llvm::Function &f);
   bool AddNonDoomedFunction(const std::string &function_name);
+  bool AddNonDoomedFunction(NameId function_name);
 
-  bool IsDoomedFunction(const llvm::Function &f);
-  bool IsDoomedFunction(const std::string &function_name);
+  // Unresolved callees are doomed.
+  bool IsDoomedFunction(const llvm::Function &f) const;
+  bool IsDoomedFunction(NameId function_name) const;
 
   // Returns the abstraction of a concrete integer.
   SignLatticeElement AbstractInteger(int64_t concrete) const;
@@ -121,6 +274,7 @@ struct ErrorBlocksPass : public llvm::ModulePass {
       const llvm::Function *node) const;
   LatticeElementConfidence GetErrorSpecification(
       const std::string &source_name) const;
+  LatticeElementConfidence GetErrorSpecification(NameId function_name) const;
 
   // Updates the error specification for func by joining with delta, also
   // sets the confidence for the specification.
@@ -146,21 +300,25 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // Returns true if the given Function is an error-only function.
   bool IsErrorOnlyFunction(const llvm::Function *func) const;
 
-  // Returns true if the given value is an error code.
-  bool IsErrorCode(int64_t value, const std::string &filename) const;
+  // Returns true if the given value is an error code in file.
+  bool IsErrorCode(int64_t value, FileId file);
 
-  // Returns true if the given value is a success code.
-  bool IsSuccessCode(int64_t value, const std::string &filename) const;
+  // Returns true if the given value is a success code in file.
+  bool IsSuccessCode(int64_t value, FileId file);
 
   // Returns true if the given value is a success code for the given function.
   // This IsSuccessCode variant considers the smart-success-code-zero heuristic.
   bool IsSuccessCode(const std::string &function_name, const int64_t value,
-                     const std::string &filename) const;
+                     FileId file);
 
   // Returns true if the smart-success-code-zero heuristic is enabled and if the
   // heuristic determines that the given function has 0 as a success code.
-  bool ShouldSmartDropZero(const std::string &function_name,
-                           const std::string &filename) const;
+  bool ShouldSmartDropZero(const std::string &function_name, FileId file);
+
+  // Returns whether value is an error code and whether it is a success code
+  // in file, as a combination of kErrorCode and kSuccessCode, memoized per
+  // file and value.
+  uint8_t ClassifyCode(int64_t value, FileId file);
 
   // Adds a function to the set of functions that return domain knowledge codes.
   // This should be called whenever a function returns a domain knowledge
@@ -177,14 +335,17 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // function.
   bool IgnoreFunction(const llvm::Function *function) const;
 
-  // Gathers associated constraints with functions (specifications) and calls
-  // the checker's CheckViolations, which looks for any violations associated
-  // the CallInst.
-  void CheckViolations(const llvm::CallInst &call_inst);
+  // Checks every defined function for violations of the inferred
+  // specifications, in parallel, and adds them to the checker in module
+  // order. Called once the specifications have converged.
+  void CheckViolations();
 
-  // Iterates through all instructions for a function and checks for any
-  // violations associated with CallInsts.
-  void CheckViolations(const llvm::Function &func);
+  // Calls the checker's CheckViolations on every call in func to a function
+  // that has a specification, together with the constraints func puts on
+  // its return value, and appends the violations found to violations.
+  void CheckViolations(const ReturnConstraintsPass &return_constraints_pass,
+                       const llvm::Function &func,
+                       std::vector<ViolationRecord> *violations) const;
 
   // The checker is used for finding bugs that violate the error specifications
   // that EESI has inferred.
@@ -197,9 +358,54 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // LlamaModel *language_model_;
   GptModel *language_model_;
 
+  // Receives progress updates, may be null.
+  ProgressReporter *progress_reporter_ = nullptr;
+
   // The path to the ctags file for the benchmark analyzed.
   std::string ctags_file_;
 
+  // Source of the functions of the module, for LLM queries. Null when the
+  // LLM is not used.
+  std::unique_ptr<SourceIndex> source_index_;
+
+  // Budget, in estimated prompt tokens, for the context of an LLM query.
+  uint64_t llm_context_token_budget_ = kDefaultLlmContextTokenBudget;
+
+  // Caller to callee to CalleeSignals, for ranking LLM context.
+  std::unordered_map<std::string,
+                     std::unordered_map<std::string, CalleeSignals>>
+      callee_signals_;
+
+  // Callee to the functions that call it.
+  std::unordered_map<std::string, std::unordered_set<std::string>> callers_;
+
+  // Caps on the run's per-function LLM queries, in queries and estimated
+  // tokens; 0 means no cap. And what has been admitted against them so far.
+  uint64_t llm_query_budget_ = 0;
+  uint64_t llm_token_budget_ = 0;
+  uint64_t llm_queries_used_ = 0;
+  uint64_t llm_tokens_used_ = 0;
+
+  // The functions that may need an LLM query, by decreasing value, and the
+  // index of each function in it. Only filled when there is a budget.
+  std::vector<LlmCandidate> llm_candidates_;
+  std::unordered_map<const llvm::Function *, size_t> llm_candidate_indices_;
+
+  // Number of decided candidates, and how many of them static analysis
+  // left unknown.
+  uint64_t llm_candidates_decided_ = 0;
+  uint64_t llm_candidates_unknown_ = 0;
+
+  // Functions not queried because the budget ran out.
+  std::set<std::string> llm_skipped_functions_;
+
+  size_t llm_third_party_chunk_size_ = kDefaultLlmThirdPartyChunkSize;
+
+  // The third-party queries of the run, and the third-party functions whose
+  // answer has not been applied yet, with the index of their query.
+  std::vector<ThirdPartyQuery> third_party_queries_;
+  std::unordered_map<std::string, size_t> pending_third_party_functions_;
+
   // The minimum number of functions to use as evidence when
   // inferring new specifications using the embedding.
   // Should be greater than zero; 5 is a reasonable value here.
@@ -219,8 +425,14 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   std::unordered_map<const llvm::Function *, std::unordered_set<int64_t>>
       error_return_values_;
 
-  // A map from function _source_ names to its error specification.
-  ErrorSpecificationMap error_specifications_;
+  // The source names of the functions of the module and of those named by
+  // the domain knowledge and the LLM, with what is known of the former. The
+  // per-name state below is indexed by the NameIds it hands out, and unknown
+  // or INVALID for names that have none.
+  FunctionTable function_table_;
+
+  // The error specification of each source name.
+  std::vector<LatticeElementConfidence> error_specifications_;
 
   // Domain knowledge: Multimap of function names to sets of arguments required
   // to consider a call error-only.  If a function has multiple entries, then
@@ -230,19 +442,40 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // be LLVM name of error-only functions, but that depends on the compilation
   // process, and therefore this is necessarily the source name.
   ErrorOnlyFuncToArgMap error_only_functions_;
+  // Whether each source name has an entry in error_only_functions_.
+  std::vector<bool> error_only_names_;
 
-  // Domain knowledge: error codes mapped to submodules. If the set of
-  // submodules is empty, then the error codes are considered for the entire
-  // project.
-  std::unordered_map<int64_t, std::unordered_set<std::string>> error_codes_;
+  // Domain knowledge: error codes mapped to the sorted IDs of their
+  // submodules in submodule_matcher_. If the set of submodules is empty,
+  // then the error codes are considered for the entire project.
+  std::unordered_map<int64_t, std::vector<SubmoduleId>> error_codes_;
   std::unordered_map<std::string, SignLatticeElement> error_code_names_;
 
   // Domain knowledge: the corresponding success codes of the domain
   // knowledge error codes.
-  std::unordered_map<int64_t, std::unordered_set<std::string>> success_codes_;
+  std::unordered_map<int64_t, std::vector<SubmoduleId>> success_codes_;
   std::unordered_map<std::string, SignLatticeElement> success_code_names_;
 
-  std::unordered_map<std::string, llvm::Function *> name_to_function_;
+  // The submodules of all error and success codes.
+  SubmoduleMatcher submodule_matcher_;
+
+  // Flags returned by ClassifyCode.
+  static constexpr uint8_t kErrorCode = 1;
+  static constexpr uint8_t kSuccessCode = 2;
+
+  struct FileCodes {
+    // Whether submodules has been computed.
+    bool matched = false;
+    // The submodules whose names occur in the file name.
+    std::vector<SubmoduleId> submodules;
+    // The ClassifyCode result for each value classified in the file.
+    std::unordered_map<int64_t, uint8_t> code_classes;
+  };
+  // What is known of the codes in each source file, indexed by FileId.
+  std::vector<FileCodes> file_codes_;
+
+  // The llvm::Function analyzed for each source name.
+  std::vector<llvm::Function *> name_to_function_;
 
   // Whether to apply a heuristic to determine if 0 is a success code in certain
   // contexts, instead of every time.
@@ -254,12 +487,13 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // Map of function source names that correspond to initial error
   // specifications. These should never change.
   ErrorSpecificationMap initial_error_specifications_;
+  std::vector<bool> has_initial_specification_;
 
   std::unordered_map<std::string, std::vector<Specification>>
       llm_specifications_;
 
-  // Map of function source names that correspond to their return type.
-  ReturnTypeMap function_return_types_;
+  // The return type of each source name.
+  std::vector<FunctionReturnType> function_return_types_;
 
   // The set of functions that domain knowledge reaches. In other words, these
   // functions are connected to domain knowledge via the call graph in some
@@ -267,7 +501,7 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   // specifications. These functions may also not have functions whose
   // specifications would be inferred by EESIER, as these can potentially
   // be external functions that we could not analyze the body for.
-  std::unordered_set<std::string> non_doomed_function_names_;
+  std::vector<bool> non_doomed_functions_;
 
   // Tracking the function name to the functions involved in inferring the
   // particular lattice element;
@@ -280,8 +514,8 @@ struct ErrorBlocksPass : public llvm::ModulePass {
   std::unordered_map<std::string, std::unordered_set<std::string>>
       sources_of_inference_emptyset_;
 
-  std::unordered_map<std::string, std::unordered_set<std::string>>
-      called_functions_;
+  // The resolved callees of each source name.
+  std::vector<std::set<NameId>> called_functions_;
   std::unordered_set<std::string> inferred_with_llm_;
 };
 
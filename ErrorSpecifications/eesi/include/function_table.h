@@ -0,0 +1,112 @@
+// This file defines the table of what ErrorBlocksPass needs to know about
+// the functions of a module, computed once per module.
+
+// Specifications, return types and the other per-function state of the
+// analysis are keyed by source name, since the unique suffix LLVM appends
+// can give one source function several llvm::Functions, and the domain
+// knowledge and the LLM name functions that the module may not define.
+// Every source name is interned to a dense NameId, so that the state can
+// live in vectors indexed by it and looking a function up does not build a
+// string. Names are only converted back to strings for logs and responses.
+// Source files are interned the same way, and every basic block is given
+// the FileId of its first instruction up front.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_TABLE_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_TABLE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "call_graph_pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "proto/bitcode.pb.h"
+
+namespace error_specifications {
+
+using NameId = uint32_t;
+using FileId = uint32_t;
+
+class FunctionTable {
+ public:
+  // The name of unresolved callees, and of names that were never interned.
+  static constexpr NameId kNoName = UINT32_MAX;
+
+  struct FunctionInfo {
+    NameId name;
+    FunctionReturnType return_type;
+    // The source file of the first instruction.
+    FileId file;
+    bool is_intrinsic;
+  };
+
+  // Returns the ID of source_name, giving it the next one if it has none.
+  NameId InternName(const std::string &source_name);
+
+  // Returns the ID of source_name, or kNoName if it has none.
+  NameId FindName(llvm::StringRef source_name) const;
+
+  // Returns the source name with ID name; the empty string for kNoName.
+  const std::string &GetName(NameId name) const;
+
+  size_t NumNames() const { return names_.size(); }
+
+  // Returns the ID of source file file_name, giving it the next one if it
+  // has none. Instructions without debug info are in the empty file name.
+  FileId InternFile(llvm::StringRef file_name);
+
+  const std::string &GetFile(FileId file) const { return files_[file]; }
+
+  size_t NumFiles() const { return files_.size(); }
+
+  // Adds the functions of the module of call_graph and interns their
+  // source names. call_graph must outlive the table.
+  void AddFunctions(const CallGraphPass &call_graph);
+
+  // Returns the entry of function, which must be in the module.
+  const FunctionInfo &GetInfo(const llvm::Function &function) const {
+    return functions_[call_graph_->GetFunctionId(function)];
+  }
+
+  // Returns the name of function.
+  NameId GetNameId(const llvm::Function &function) const {
+    return GetInfo(function).name;
+  }
+
+  // Returns the name of the function that call_inst calls, or kNoName if
+  // the callee cannot be resolved or is an intrinsic.
+  NameId GetCalleeNameId(const llvm::CallInst &call_inst) const;
+
+  // Returns the source file of the first instruction of basic_block, which
+  // must be in the module.
+  FileId GetBlockFile(const llvm::BasicBlock &basic_block) const {
+    return block_files_.lookup(&basic_block);
+  }
+
+  // Returns the source file of inst.
+  FileId GetInstructionFile(const llvm::Instruction &inst);
+
+  bool IsVoid(const llvm::Function &function) const {
+    return GetInfo(function).return_type ==
+           FunctionReturnType::FUNCTION_RETURN_TYPE_VOID;
+  }
+
+ private:
+  std::vector<std::string> names_;
+  llvm::StringMap<NameId> name_ids_;
+
+  std::vector<std::string> files_;
+  llvm::StringMap<FileId> file_ids_;
+  llvm::DenseMap<const llvm::BasicBlock *, FileId> block_files_;
+
+  const CallGraphPass *call_graph_ = nullptr;
+  // Indexed by FunctionId.
+  std::vector<FunctionInfo> functions_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_FUNCTION_TABLE_H_
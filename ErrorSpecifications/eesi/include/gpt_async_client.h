@@ -0,0 +1,337 @@
+// This file defines the process-wide asynchronous client used to talk to the
+// GptService. Every GptModel, i.e. every running analysis task, shares the
+// same provider quota, so the limits live here rather than in GptModel: a
+// cap on the number of calls in flight, and token buckets for the provider's
+// requests-per-minute and tokens-per-minute quotas. Calls run over a single
+// grpc::CompletionQueue drained by one poller thread and complete futures
+// that the caller can wait on.
+//
+// Calls are spread over a pool of GptService replicas, each usually holding
+// its own API key and quota. Channels are created once per address and
+// shared by every call. Replicas that keep failing are ejected for a while.
+//
+// Each attempt of a call has a deadline. Attempts that fail with a transient
+// status are retried after a jittered exponential backoff. Optionally, an
+// attempt still running after the p95 latency of recent calls is hedged: a
+// duplicate attempt is issued and whichever answers first wins. The end to
+// end run time is dominated by the slowest LLM responses, not the average.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_GPT_ASYNC_CLIENT_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_GPT_ASYNC_CLIENT_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "include/grpcpp/alarm.h"
+#include "include/grpcpp/grpcpp.h"
+#include "proto/gpt.grpc.pb.h"
+#include "timeline.h"
+
+namespace error_specifications {
+
+// How calls are spread over the replicas.
+enum class GptBalancing {
+  kRoundRobin,
+  // The replica with the fewest attempts in flight, round robin among ties.
+  kLeastOutstanding,
+};
+
+struct GptClientOptions {
+  // Addresses of the GptService replicas used by calls that name none.
+  std::vector<std::string> endpoints = {"localhost:50059"};
+  GptBalancing balancing = GptBalancing::kLeastOutstanding;
+  // A replica whose attempts fail ejection_failures times in a row with
+  // UNAVAILABLE or DEADLINE_EXCEEDED gets no calls for ejection_ms. 0
+  // disables ejection.
+  uint64_t ejection_failures = 3;
+  uint64_t ejection_ms = 30000;
+
+  // Maximum number of GptService calls in flight. 0 means unlimited.
+  uint64_t max_in_flight = 16;
+  // Provider quotas. 0 means unlimited.
+  uint64_t requests_per_minute = 0;
+  uint64_t tokens_per_minute = 0;
+
+  // Deadline of a single attempt. 0 means no deadline.
+  uint64_t deadline_ms = 180000;
+  // Maximum number of attempts of a call, hedged attempts included.
+  uint64_t max_attempts = 4;
+  // The backoff before retry n is drawn uniformly from
+  // [0, min(max_backoff_ms, initial_backoff_ms * 2^n)].
+  uint64_t initial_backoff_ms = 1000;
+  uint64_t max_backoff_ms = 60000;
+  // Whether to hedge attempts that outlive the p95 latency.
+  bool hedge = false;
+};
+
+// A token bucket that refills continuously at a rate given per minute and
+// holds at most a minute's worth of tokens, which is how providers meter
+// their quotas. Callers may take more tokens than are available; the bucket
+// goes into debt and later callers wait for it to be repaid, so waiters are
+// served in arrival order.
+class TokenBucket {
+ public:
+  // A rate of 0 never blocks.
+  explicit TokenBucket(uint64_t tokens_per_minute);
+
+  // Takes tokens from the bucket, sleeping until they are available.
+  void Acquire(uint64_t tokens);
+
+  // Takes tokens from the bucket without waiting. Used where blocking is not
+  // allowed; the debt delays later callers of Acquire.
+  void Charge(uint64_t tokens);
+
+ private:
+  // Refills and takes tokens. Returns the resulting debt, in seconds.
+  double Take(uint64_t tokens);
+
+  double tokens_per_second_;
+  double capacity_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  double available_;
+  std::chrono::steady_clock::time_point last_refill_;
+};
+
+// The outcome of an asynchronous GptService call.
+template <typename Response>
+struct GptCallResult {
+  grpc::Status status;
+  Response response;
+};
+
+class GptAsyncClient {
+ public:
+  // Starts an attempt on the given replica, context and completion queue by
+  // calling a PrepareAsync method of the stub. Called once per attempt, so
+  // it must own the request.
+  template <typename Response>
+  using PrepareCall =
+      std::function<std::unique_ptr<grpc::ClientAsyncResponseReader<Response>>(
+          GptService::Stub *, grpc::ClientContext *, grpc::CompletionQueue *)>;
+
+  // Returns the process-wide client.
+  static GptAsyncClient &Get();
+
+  // Sets the limits. Should be called once at startup, before any call.
+  void Configure(const GptClientOptions &options);
+
+  // Starts a call that issues num_completions LLM completions using about
+  // estimated_tokens tokens in total. Its attempts go to the replicas at
+  // endpoints, or to the configured ones if endpoints is empty. Blocks while
+  // the client is at its in-flight limit or out of quota, which throttles
+  // the callers instead of letting the provider reject requests.
+  template <typename Response>
+  std::future<GptCallResult<Response>> Start(
+      const std::vector<std::string> &endpoints, PrepareCall<Response> prepare,
+      uint64_t num_completions, uint64_t estimated_tokens) {
+    Acquire(num_completions, estimated_tokens);
+    auto *call = new Call<Response>(this, endpoints, std::move(prepare),
+                                    num_completions, estimated_tokens);
+    std::future<GptCallResult<Response>> result = call->promise.get_future();
+    call->Begin();
+    return result;
+  }
+
+ private:
+  // A replica and its channel.
+  struct Endpoint {
+    std::string address;
+    std::unique_ptr<GptService::Stub> stub;
+    uint64_t outstanding = 0;
+    uint64_t consecutive_failures = 0;
+    std::chrono::steady_clock::time_point ejected_until;
+  };
+
+  // A call and its attempts. Attempts, backoffs and hedges complete on the
+  // poller thread; everything else happens under mutex_.
+  class CallBase {
+   public:
+    // A completion queue tag.
+    struct Tag {
+      enum Kind { kAttempt, kRetry, kHedge };
+      CallBase *call;
+      Kind kind;
+      size_t attempt;
+    };
+
+    // The call is a span of the timeline of the calling thread, if it has
+    // one, from its construction to its completion.
+    CallBase(GptAsyncClient *client, const std::vector<std::string> &endpoints,
+             uint64_t num_completions, uint64_t estimated_tokens);
+    virtual ~CallBase() {}
+
+    // Starts the first attempt and arms the hedge.
+    void Begin();
+
+    // Handles the event of tag. Returns true once nothing refers to the
+    // call anymore and it can be deleted.
+    bool Proceed(const Tag &tag, bool ok);
+
+   protected:
+    // Starts attempt number index on stub and the client's completion
+    // queue.
+    virtual void StartAttempt(size_t index, Tag *tag,
+                              std::chrono::system_clock::time_point deadline,
+                              GptService::Stub *stub,
+                              grpc::CompletionQueue *cq) = 0;
+    // Cancels attempt number index if it is still running.
+    virtual void CancelAttempt(size_t index) = 0;
+    virtual const grpc::Status &AttemptStatus(size_t index) const = 0;
+    // Completes the future with the outcome of attempt number index.
+    virtual void Complete(size_t index) = 0;
+
+   private:
+    void StartNextAttempt();
+    void OnAttemptDone(size_t index);
+    void ScheduleRetry();
+    void Finish(size_t index);
+
+    GptAsyncClient *client_;
+    const std::vector<std::string> endpoints_;
+    const uint64_t num_completions_;
+    const uint64_t estimated_tokens_;
+    // Kept alive until the call completes, which may be after the task
+    // that started it has stopped waiting for it. Declared before span_,
+    // which refers to it.
+    std::shared_ptr<Timeline> timeline_;
+    std::unique_ptr<TimelineSpan> span_;
+
+    // Guards everything below.
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Tag>> attempt_tags_;
+    std::vector<std::chrono::steady_clock::time_point> attempt_starts_;
+    std::vector<Endpoint *> attempt_endpoints_;
+    size_t attempts_running_ = 0;
+    std::unique_ptr<grpc::Alarm> retry_alarm_;
+    std::unique_ptr<grpc::Alarm> hedge_alarm_;
+    Tag retry_tag_{this, Tag::kRetry, 0};
+    Tag hedge_tag_{this, Tag::kHedge, 0};
+    size_t alarms_pending_ = 0;
+    bool done_ = false;
+  };
+
+  template <typename Response>
+  class Call : public CallBase {
+   public:
+    Call(GptAsyncClient *client, const std::vector<std::string> &endpoints,
+         PrepareCall<Response> prepare, uint64_t num_completions,
+         uint64_t estimated_tokens)
+        : CallBase(client, endpoints, num_completions, estimated_tokens),
+          prepare_(std::move(prepare)) {}
+
+    std::promise<GptCallResult<Response>> promise;
+
+   protected:
+    void StartAttempt(size_t index, Tag *tag,
+                      std::chrono::system_clock::time_point deadline,
+                      GptService::Stub *stub,
+                      grpc::CompletionQueue *cq) override {
+      attempts_.emplace_back(new Attempt());
+      Attempt &attempt = *attempts_[index];
+      if (deadline != std::chrono::system_clock::time_point::max()) {
+        attempt.context.set_deadline(deadline);
+      }
+      attempt.reader = prepare_(stub, &attempt.context, cq);
+      attempt.reader->StartCall();
+      attempt.reader->Finish(&attempt.result.response, &attempt.result.status,
+                             tag);
+    }
+
+    void CancelAttempt(size_t index) override {
+      attempts_[index]->context.TryCancel();
+    }
+
+    const grpc::Status &AttemptStatus(size_t index) const override {
+      return attempts_[index]->result.status;
+    }
+
+    void Complete(size_t index) override {
+      promise.set_value(std::move(attempts_[index]->result));
+    }
+
+   private:
+    struct Attempt {
+      grpc::ClientContext context;
+      std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader;
+      GptCallResult<Response> result;
+    };
+
+    PrepareCall<Response> prepare_;
+    std::vector<std::unique_ptr<Attempt>> attempts_;
+  };
+
+  GptAsyncClient();
+
+  // Waits for an in-flight slot and for quota.
+  void Acquire(uint64_t num_completions, uint64_t estimated_tokens);
+
+  // Takes quota for a retried or hedged attempt without waiting.
+  void Charge(uint64_t num_completions, uint64_t estimated_tokens);
+
+  // Frees the in-flight slot of a completed call.
+  void Release();
+
+  // Picks the replica for an attempt among addresses, or among the
+  // configured replicas if addresses is empty, and counts the attempt as
+  // outstanding on it.
+  Endpoint *PickEndpoint(const std::vector<std::string> &addresses);
+
+  // Records the outcome of an attempt on endpoint, ejecting it if it keeps
+  // failing.
+  void ReportEndpoint(Endpoint *endpoint, const grpc::Status &status);
+
+  // Returns the deadline of an attempt starting now.
+  std::chrono::system_clock::time_point AttemptDeadline();
+
+  // Returns the jittered backoff before retry number retry.
+  std::chrono::milliseconds Backoff(size_t retry);
+
+  // Returns how long to wait before hedging an attempt, or a negative
+  // duration if it should not be hedged.
+  std::chrono::milliseconds HedgeDelay();
+
+  // Records the latency of a successful attempt.
+  void RecordLatency(std::chrono::steady_clock::duration latency);
+
+  // Returns the maximum number of attempts of a call.
+  uint64_t MaxAttempts();
+
+  // Completes calls until the queue is shut down.
+  void PollCompletionQueue();
+
+  grpc::CompletionQueue cq_;
+  std::thread poller_;
+
+  std::unique_ptr<TokenBucket> request_bucket_;
+  std::unique_ptr<TokenBucket> token_bucket_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable slot_available_;
+  GptClientOptions options_;
+  uint64_t in_flight_ = 0;
+  std::mt19937_64 random_;
+  // Latencies of the most recent successful attempts, in milliseconds.
+  std::deque<int64_t> latencies_ms_;
+  // The channel pool, by address. Entries are never removed.
+  std::unordered_map<std::string, std::unique_ptr<Endpoint>> endpoints_;
+  // Rotates the choice among equally good replicas.
+  size_t next_endpoint_ = 0;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_GPT_ASYNC_CLIENT_H_
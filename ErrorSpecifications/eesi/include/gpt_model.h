@@ -1,30 +1,137 @@
 #ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_GPT_MODEL_H_
 #define ERROR_SPECIFICATIONS_EESI_INCLUDE_GPT_MODEL_H_
 
+#include <cstdint>
+#include <future>
+#include <memory>
+
+#include "gpt_async_client.h"
 #include "include/grpcpp/grpcpp.h"
 #include "proto/gpt.grpc.pb.h"
 
 namespace error_specifications {
+
+// Maximum number of functions sent in a single GetGptSpecificationsBatch RPC.
+constexpr size_t kMaxGptBatchSize = 32;
+
+// A single function to query through GptModel::GetSpecificationsBatch.
+struct GptSpecificationQuery {
+  std::string function_name;
+  // Error specifications of the callees, for context.
+  std::vector<Specification> specifications;
+  // Source of the function, or empty to let the service find it by ctags.
+  std::string function_definition;
+};
+
+// The answer to a third-party query started with
+// GptModel::StartThirdPartySpecifications, which may still be in flight.
+class PendingThirdPartySpecifications {
+ public:
+  // Returns true if Get() would not block.
+  bool IsReady() const;
+
+  // Waits for the answer. A failed query yields an empty map. Must be
+  // called at most once.
+  std::unordered_map<std::string, SignLatticeElement> Get();
+
+ private:
+  friend class GptModel;
+
+  // Set when answered from the cache, in which case call_ is not valid.
+  bool cached_ = false;
+  std::unordered_map<std::string, SignLatticeElement> cached_answer_;
+  std::future<GptCallResult<GetGptThirdPartySpecificationsResponse>> call_;
+  std::string cache_key_;
+};
+
 class GptModel {
  public:
-  GptModel(std::string llm_name, std::string ctags_file);
+  // Queries go to the GptService replicas at endpoints, or to the ones the
+  // GptAsyncClient is configured with if endpoints is empty.
+  GptModel(std::string llm_name, std::string ctags_file,
+           std::vector<std::string> endpoints = {});
   virtual ~GptModel() {}
   std::unordered_map<std::string, SignLatticeElement> GetSpecification(
       std::string function_name, std::vector<Specification> specifications,
       std::unordered_map<std::string, SignLatticeElement> error_code_names,
-      std::unordered_map<std::string, SignLatticeElement> success_code_names);
+      std::unordered_map<std::string, SignLatticeElement> success_code_names,
+      std::string function_definition = "");
+  // Like GetSpecification, but returns without waiting for the GptService.
+  // Calls are throttled by the process-wide GptAsyncClient.
+  std::future<std::unordered_map<std::string, SignLatticeElement>>
+  GetSpecificationAsync(
+      const std::string &function_name,
+      const std::vector<Specification> &specifications,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &error_code_names,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &success_code_names,
+      const std::string &function_definition = "");
+  // Queries the specifications of several functions, kMaxGptBatchSize per
+  // RPC, with the RPCs in flight concurrently. Returns one result per query,
+  // in order; a failed query yields an empty map, like GetSpecification.
+  std::vector<std::unordered_map<std::string, SignLatticeElement>>
+  GetSpecificationsBatch(
+      const std::vector<GptSpecificationQuery> &queries,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &error_code_names,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &success_code_names);
   std::unordered_map<std::string, SignLatticeElement>
   GetThirdPartySpecifications(
       std::vector<std::pair<std::string, std::string>> function_names,
       std::vector<Specification> specifications,
       std::unordered_map<std::string, SignLatticeElement> error_code_names,
       std::unordered_map<std::string, SignLatticeElement> success_code_names);
+  // Like GetThirdPartySpecifications, but returns without waiting for the
+  // GptService, so that several chunks of functions can be in flight.
+  std::unique_ptr<PendingThirdPartySpecifications>
+  StartThirdPartySpecifications(
+      const std::vector<std::pair<std::string, std::string>> &function_names,
+      const std::vector<Specification> &specifications,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &error_code_names,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &success_code_names);
   bool IsLLMNameEmpty();
 
+  // Estimates the tokens that querying query uses, as charged against the
+  // GptAsyncClient's token rate limit.
+  uint64_t EstimateSpecificationTokens(
+      const GptSpecificationQuery &query,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &error_code_names,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &success_code_names) const;
+
+  // Number of queries answered from, and missing in, the LlmResponseCache
+  // for this model instance.
+  uint64_t cache_hits() const { return cache_hits_; }
+  uint64_t cache_misses() const { return cache_misses_; }
+
+  // Returns the LlmResponseCache key for a request: a SHA-256 over every
+  // request field that shapes the prompt, with repeated fields and maps
+  // sorted. Returns an empty string if hashing fails.
+  static std::string GetCacheKey(const GetGptSpecificationRequest &request);
+  static std::string GetCacheKey(
+      const GetGptThirdPartySpecificationsRequest &request);
+
  private:
-  std::unique_ptr<GptService::Stub> stub_;
+  // Builds the request for a single function.
+  GetGptSpecificationRequest MakeSpecificationRequest(
+      const std::string &function_name,
+      const std::vector<Specification> &specifications,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &error_code_names,
+      const std::unordered_map<std::string, SignLatticeElement>
+          &success_code_names,
+      const std::string &function_definition) const;
+
+  std::vector<std::string> endpoints_;
   std::string ctags_file_;
   std::string llm_name_;
+  uint64_t cache_hits_ = 0;
+  uint64_t cache_misses_ = 0;
 };
 
 }  // namespace error_specifications
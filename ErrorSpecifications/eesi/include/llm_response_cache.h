@@ -0,0 +1,57 @@
+// This file defines the process-wide cache of GptService responses. LLM
+// queries are slow and billed, and re-running a benchmark after a tweak to
+// the analysis mostly repeats queries that were already answered. Responses
+// are keyed by a SHA-256 over the inputs that determine the prompt, kept in
+// memory, and appended to a log file so they survive restarts.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_LLM_RESPONSE_CACHE_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_LLM_RESPONSE_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "google/protobuf/message.h"
+
+namespace error_specifications {
+
+class LlmResponseCache {
+ public:
+  // Returns the process-wide cache.
+  static LlmResponseCache &Get();
+
+  // Loads the responses stored in cache_file and appends new ones to it.
+  // Should be called once at startup, before any lookups. Without a call
+  // the cache is kept in memory only.
+  void Open(const std::string &cache_file);
+
+  // If a response is cached for key, parses it into response and returns
+  // true. Counts a hit or a miss.
+  bool Lookup(const std::string &key, google::protobuf::Message *response);
+
+  // Caches response under key.
+  void Insert(const std::string &key,
+              const google::protobuf::Message &response);
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+ private:
+  LlmResponseCache() {}
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::string cache_file_;
+
+  // Keys to serialized responses.
+  std::unordered_map<std::string, std::string> responses_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_LLM_RESPONSE_CACHE_H_
@@ -0,0 +1,74 @@
+// Tracks the progress of a GetSpecifications operation and publishes it
+// through a callback at a bounded rate. The analysis passes update counters
+// on every unit of work; the callback only fires when at least
+// min_interval has elapsed since the previous publication, so reporting is
+// cheap enough to leave on in the hot loops.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_PROGRESS_REPORTER_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_PROGRESS_REPORTER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "proto/eesi.pb.h"
+
+namespace error_specifications {
+
+class ProgressReporter {
+ public:
+  using Callback = std::function<void(const GetSpecificationsMetadata &)>;
+
+  // The default minimum time between two published updates.
+  static constexpr std::chrono::milliseconds kDefaultMinInterval =
+      std::chrono::milliseconds(500);
+
+  ProgressReporter(
+      Callback callback,
+      std::chrono::milliseconds min_interval = kDefaultMinInterval);
+
+  // Sets the name of the stage that is currently running. Always publishes.
+  void SetCurrentPass(const std::string &pass_name);
+
+  // Sets the total number of SCCs and starts the clock used for the ETA.
+  void SetSccsTotal(uint64_t sccs_total);
+
+  void IncrementSccsProcessed();
+  void IncrementFunctionsAnalyzed();
+  void IncrementLlmCallsIssued(uint64_t count = 1);
+  void IncrementLlmCallsCompleted(uint64_t count = 1);
+
+  void SetLlmContextTokenBudget(uint64_t budget);
+  // Counts the context specifications kept and dropped for one LLM query.
+  void AddLlmContextSelection(uint64_t kept, uint64_t dropped);
+  void IncrementLlmQueriesSkipped(uint64_t count = 1);
+
+  // Returns the current metadata, with the elapsed time and ETA filled in.
+  GetSpecificationsMetadata Snapshot();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Publishes the metadata if forced or if min_interval_ has elapsed since
+  // the last publication. Requires mutex_ to be held.
+  void MaybePublishLocked(bool force);
+
+  // Fills in elapsed_seconds and eta_seconds. Requires mutex_ to be held.
+  void UpdateTimingLocked();
+
+  Callback callback_;
+  std::chrono::milliseconds min_interval_;
+
+  // Guards everything below; LLM calls may complete on other threads.
+  std::mutex mutex_;
+  GetSpecificationsMetadata metadata_;
+  Clock::time_point start_time_;
+  Clock::time_point scc_start_time_;
+  Clock::time_point last_publish_time_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_PROGRESS_REPORTER_H_
@@ -7,15 +7,19 @@
 #include <unordered_set>
 
 #include "constraint.h"
+#include "dataflow_analysis.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include "progress_reporter.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
+struct ReturnPropagationPass;
+
 class ReturnConstraintsFact {
  public:
   std::unordered_map<std::string, Constraint> value;
@@ -26,10 +30,10 @@ class ReturnConstraintsFact {
     value = other.value;
   }
 
-  bool operator==(const ReturnConstraintsFact &other) {
+  bool operator==(const ReturnConstraintsFact &other) const {
     return value == other.value;
   }
-  bool operator!=(const ReturnConstraintsFact &other) {
+  bool operator!=(const ReturnConstraintsFact &other) const {
     return value != other.value;
   }
 
@@ -81,11 +85,17 @@ class ReturnConstraintsPass : public llvm::ModulePass {
   // Entry point.
   bool runOnModule(llvm::Module &M) override;
 
+  // Sets the reporter told when the pass starts. Optional; the pass does
+  // not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
   // Called for each function.
   void RunOnFunction(const llvm::Function &F);
 
-  ReturnConstraintsFact GetInFact(const llvm::Value *) const;
-  ReturnConstraintsFact GetOutFact(const llvm::Value *) const;
+  const ReturnConstraintsFact &GetInFact(const llvm::Value *) const;
+  const ReturnConstraintsFact &GetOutFact(const llvm::Value *) const;
 
   static std::pair<SignLatticeElement, SignLatticeElement> AbstractICmp(
       const llvm::ICmpInst &I);
@@ -98,34 +108,35 @@ class ReturnConstraintsPass : public llvm::ModulePass {
       const Function &called_function);
 
  private:
-  // Called for each basic block.
-  bool VisitBlock(const llvm::BasicBlock &BB);
-
-  // Transfer functions.
-  void VisitCallInst(const llvm::CallInst &I,
-                     std::shared_ptr<const ReturnConstraintsFact> input,
-                     std::shared_ptr<ReturnConstraintsFact> out);
-  void VisitBranchInst(const llvm::BranchInst &I,
-                       std::shared_ptr<const ReturnConstraintsFact> input,
-                       std::shared_ptr<ReturnConstraintsFact> out);
-  void VisitSwitchInst(const llvm::SwitchInst &I,
-                       std::shared_ptr<const ReturnConstraintsFact> input,
-                       std::shared_ptr<ReturnConstraintsFact> out);
-  void VisitPHINode(const llvm::PHINode &I,
-                    std::shared_ptr<const ReturnConstraintsFact> input,
-                    std::shared_ptr<ReturnConstraintsFact> out);
+  // Branches kill the constraints they test, so the facts are not monotone
+  // and the blocks are solved round-robin as they always have been.
+  using Dataflow =
+      DataflowAnalysis<ReturnConstraintsFact, DataflowDirection::kForward,
+                       ReturnConstraintsPass, DataflowSolver::kRoundRobin>;
+  friend Dataflow;
+
+  // Transfer functions, called by dataflow_.
+  void JoinEdge(const llvm::BasicBlock &BB, const ReturnConstraintsFact &pred,
+                ReturnConstraintsFact &in);
+  void Visit(const llvm::Instruction &I, const ReturnConstraintsFact &in,
+             ReturnConstraintsFact &out);
+  void Visit(const llvm::CallInst &I, const ReturnConstraintsFact &in,
+             ReturnConstraintsFact &out);
+  void Visit(const llvm::BranchInst &I, const ReturnConstraintsFact &in,
+             ReturnConstraintsFact &out);
+  void Visit(const llvm::SwitchInst &I, const ReturnConstraintsFact &in,
+             ReturnConstraintsFact &out);
+  void Visit(const llvm::PHINode &I, const ReturnConstraintsFact &in,
+             ReturnConstraintsFact &out);
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
-  // A map from values (instructions) to dataflow facts
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnConstraintsFact>>
-      input_facts_;
+  // Dataflow facts at the program points immediately before and after each
+  // instruction.
+  Dataflow dataflow_{*this, "ReturnConstraintsPass"};
 
-  // A map from values (instructions) to dataflow facts
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnConstraintsFact>>
-      output_facts_;
+  // Resolves the values tested by branches, set by runOnModule.
+  const ReturnPropagationPass *return_propagation_ = nullptr;
 
   static const std::map<
       std::pair<llvm::ICmpInst::Predicate, SignLatticeElement>,
@@ -134,6 +145,8 @@ class ReturnConstraintsPass : public llvm::ModulePass {
 
   static const std::map<SignLatticeElement, SignLatticeElement>
       unsigned_replacement;
+
+  ProgressReporter *progress_reporter_ = nullptr;
 };
 
 }  //  namespace error_specifications
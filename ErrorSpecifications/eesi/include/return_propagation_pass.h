@@ -11,6 +11,9 @@
 #include "llvm/Support/raw_ostream.h"
 #include "tbb/tbb.h"
 
+#include "dataflow_analysis.h"
+#include "progress_reporter.h"
+
 namespace error_specifications {
 
 // A dataflow fact is a map from LLVM values to the functions they hold return
@@ -27,11 +30,11 @@ class ReturnPropagationFact {
     value = other.value;
   }
 
-  bool operator==(const ReturnPropagationFact &other) {
+  bool operator==(const ReturnPropagationFact &other) const {
     return value == other.value;
   }
 
-  bool operator!=(const ReturnPropagationFact &other) {
+  bool operator!=(const ReturnPropagationFact &other) const {
     return value != other.value;
   }
 
@@ -48,43 +51,54 @@ struct ReturnPropagationPass : public llvm::ModulePass {
 
   ReturnPropagationPass() : llvm::ModulePass(ID) {}
 
-  // Dataflow facts at the program point immediately following instruction.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnPropagationFact>>
-      input_facts_;
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnPropagationFact>>
-      output_facts_;
+  using Dataflow =
+      DataflowAnalysis<ReturnPropagationFact, DataflowDirection::kForward,
+                       ReturnPropagationPass, DataflowSolver::kWorklist>;
+
+  // Dataflow facts at the program points immediately before and after each
+  // instruction.
+  Dataflow dataflow_{*this, "ReturnPropagationPass"};
 
   bool finished = false;
 
   bool runOnModule(llvm::Module &M) override;
-  bool RunOnFunction(const llvm::Function &F);
-  bool VisitBlock(const llvm::BasicBlock &BB);
-
-  void VisitCallInst(const llvm::CallInst &I,
-                     std::shared_ptr<const ReturnPropagationFact> input,
-                     std::shared_ptr<ReturnPropagationFact> out);
-  void VisitLoadInst(const llvm::LoadInst &I,
-                     std::shared_ptr<const ReturnPropagationFact> input,
-                     std::shared_ptr<ReturnPropagationFact> out);
-  void VisitStoreInst(const llvm::StoreInst &I,
-                      std::shared_ptr<const ReturnPropagationFact> input,
-                      std::shared_ptr<ReturnPropagationFact> out);
-  void VisitBitCastInst(const llvm::BitCastInst &I,
-                        std::shared_ptr<const ReturnPropagationFact> input,
-                        std::shared_ptr<ReturnPropagationFact> out);
-  void VisitPtrToIntInst(const llvm::PtrToIntInst &I,
-                         std::shared_ptr<const ReturnPropagationFact> input,
-                         std::shared_ptr<ReturnPropagationFact> out);
-  void VisitBinaryOperator(const llvm::BinaryOperator &I,
-                           std::shared_ptr<const ReturnPropagationFact> input,
-                           std::shared_ptr<ReturnPropagationFact> out);
-  void VisitPHINode(const llvm::PHINode &I,
-                    std::shared_ptr<const ReturnPropagationFact> input,
-                    std::shared_ptr<ReturnPropagationFact> out);
+
+  // Sets the reporter told when the pass starts. Optional; the pass does
+  // not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
+  void RunOnFunction(const llvm::Function &F);
+
+  // Whether v is an instruction with dataflow facts.
+  bool HasFacts(const llvm::Value *v) const;
+  const ReturnPropagationFact &GetInFact(const llvm::Value *v) const;
+  const ReturnPropagationFact &GetOutFact(const llvm::Value *v) const;
+
+  // Transfer functions, called by dataflow_.
+  void JoinEdge(const llvm::BasicBlock &BB, const ReturnPropagationFact &pred,
+                ReturnPropagationFact &in);
+  void Visit(const llvm::Instruction &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::CallInst &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::LoadInst &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::StoreInst &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::BitCastInst &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::PtrToIntInst &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::BinaryOperator &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
+  void Visit(const llvm::PHINode &I, const ReturnPropagationFact &in,
+             ReturnPropagationFact &out);
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+
+  ProgressReporter *progress_reporter_ = nullptr;
 };
 
 }  // namespace error_specifications
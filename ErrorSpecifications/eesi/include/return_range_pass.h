@@ -3,12 +3,16 @@
 
 #include <unordered_map>
 
+#include "call_graph_pass.h"
+#include "dataflow_analysis.h"
 #include "llvm.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "progress_reporter.h"
 #include "proto/eesi.grpc.pb.h"
 #include "returned_values_pass.h"
+#include "tbb/concurrent_unordered_map.h"
 
 namespace error_specifications {
 
@@ -64,11 +68,25 @@ class ReturnRangePass : public llvm::ModulePass {
  public:
   static char ID;
 
+  using ReturnRangeMap =
+      tbb::concurrent_unordered_map<const llvm::Function *,
+                                    SignLatticeElement>;
+
   ReturnRangePass() : llvm::ModulePass(ID) {}
 
   // Entry point.
   bool runOnModule(llvm::Module &M) override;
 
+  // Sets the reporter told when the pass starts. Optional; the pass does
+  // not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
+  // Called for each SCC of the call graph; iterates over its functions
+  // until their return ranges no longer change.
+  void RunOnScc(const CallGraphPass &call_graph, SccId scc);
+
   // Called for each function.
   void RunOnFunction(const llvm::Function &func);
 
@@ -82,34 +100,55 @@ class ReturnRangePass : public llvm::ModulePass {
       const SignLatticeElement default_return) const;
 
   // Get the return ranges of all functions.
-  const std::unordered_map<const llvm::Function *, SignLatticeElement>
-      &GetReturnRanges() const;
+  const ReturnRangeMap &GetReturnRanges() const;
 
-  ReturnRangeFact GetInFact(const llvm::Instruction *inst) const;
-  ReturnRangeFact GetOutFact(const llvm::Instruction *inst) const;
+  const ReturnRangeFact &GetInFact(const llvm::Instruction *inst) const;
+  const ReturnRangeFact &GetOutFact(const llvm::Instruction *inst) const;
 
  private:
-  // Map from llvm functions to their return ranges.
-  std::unordered_map<const llvm::Function *, SignLatticeElement> return_ranges_;
+  // Map from llvm functions to their return ranges. Functions on the same
+  // level of the call graph are analyzed at the same time, so the map allows
+  // concurrent insertion.
+  ReturnRangeMap return_ranges_;
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
-  // Called for each basic block.
-  bool VisitBlock(const llvm::BasicBlock &BB);
-
-  // Transfer functions
-  void VisitStoreInst(const llvm::StoreInst &I, const ReturnRangeFact &in,
-                      ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
+  // Return instructions join into the ranges of the whole function, which
+  // makes the results depend on the order the blocks are visited in; the
+  // blocks are solved round-robin as they always have been.
+  using Dataflow =
+      DataflowAnalysis<ReturnRangeFact, DataflowDirection::kForward,
+                       ReturnRangePass, DataflowSolver::kRoundRobin>;
+  friend Dataflow;
+
+  // Transfer functions, called by dataflow_. Entries of values that cannot
+  // be returned after the instruction are dropped.
+  void JoinEdge(const llvm::BasicBlock &BB, const ReturnRangeFact &pred,
+                ReturnRangeFact &in);
+  void Visit(const llvm::Instruction &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::StoreInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::LoadInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::BitCastInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::PtrToIntInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::TruncInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::SExtInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::PHINode &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::BranchInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::SwitchInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
+  void Visit(const llvm::ReturnInst &I, const ReturnRangeFact &in,
+             ReturnRangeFact &out);
   void VisitLoadLikeInst(const llvm::Instruction &I, const ReturnRangeFact &in,
-                         ReturnRangeFact &out,
-                         const ReturnedValuesFact &out_rvf);
-  void VisitPHINode(const llvm::PHINode &I, const ReturnRangeFact &in,
-                    ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
-  void VisitBranchInst(const llvm::BranchInst &I, const ReturnRangeFact &in,
-                       ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
-  void VisitSwitchInst(const llvm::SwitchInst &I, const ReturnRangeFact &in,
-                       ReturnRangeFact &out, const ReturnedValuesFact &out_rvf);
-  void VisitReturnInst(const llvm::ReturnInst &I, const ReturnRangeFact &in);
+                         ReturnRangeFact &out);
 
   // If a returned value is being checked (e.g., in an icmp or switch
   // instruction), resolve the value and return it.  Otherwise, return null.
@@ -132,15 +171,14 @@ class ReturnRangePass : public llvm::ModulePass {
   // 3. It does not return an integer or a pointer.
   bool ShouldIgnore(const llvm::Function *func) const;
 
-  // A map from instructions to dataflow facts.
-  std::unordered_map<const llvm::Instruction *,
-                     std::shared_ptr<ReturnRangeFact>>
-      input_facts_;
+  // Dataflow facts at the program points immediately before and after each
+  // instruction.
+  Dataflow dataflow_{*this, "ReturnRangePass"};
+
+  // Which values can be returned at each program point, set by runOnModule.
+  const ReturnedValuesPass *returned_values_ = nullptr;
 
-  // A map from instructions to dataflow facts.
-  std::unordered_map<const llvm::Instruction *,
-                     std::shared_ptr<ReturnRangeFact>>
-      output_facts_;
+  ProgressReporter *progress_reporter_ = nullptr;
 };
 
 }  //  namespace error_specifications
@@ -57,6 +57,8 @@
 #include "tbb/tbb.h"
 
 #include "constraint.h"
+#include "dataflow_analysis.h"
+#include "progress_reporter.h"
 
 namespace error_specifications {
 
@@ -68,10 +70,10 @@ class ReturnedValuesFact {
 
   ReturnedValuesFact(const ReturnedValuesFact &other) { value = other.value; }
 
-  bool operator==(const ReturnedValuesFact &other) {
+  bool operator==(const ReturnedValuesFact &other) const {
     return value == other.value;
   }
-  bool operator!=(const ReturnedValuesFact &other) {
+  bool operator!=(const ReturnedValuesFact &other) const {
     return value != other.value;
   }
 
@@ -101,64 +103,65 @@ class ReturnedValuesPass : public llvm::ModulePass {
   // Entry point.
   bool runOnModule(llvm::Module &M) override;
 
+  // Sets the reporter told when the pass starts. Optional; the pass does
+  // not take ownership.
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
   // Called for each function.
   void RunOnFunction(const llvm::Function &F);
 
-  ReturnedValuesFact GetInFact(const llvm::Value *) const;
-  ReturnedValuesFact GetOutFact(const llvm::Value *) const;
+  const ReturnedValuesFact &GetInFact(const llvm::Value *) const;
+  const ReturnedValuesFact &GetOutFact(const llvm::Value *) const;
 
  private:
-  // Called for each basic block.
-  bool visitBlock(const llvm::BasicBlock &BB);
-
-  // Transfer functions.
-  void VisitReturnInst(const llvm::ReturnInst &I,
-                       std::shared_ptr<ReturnedValuesFact> input,
-                       std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitCallInst(const llvm::CallInst &I,
-                     std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitLoadInst(const llvm::LoadInst &I,
-                     std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitStoreInst(const llvm::StoreInst &I,
-                      std::shared_ptr<ReturnedValuesFact> input,
-                      std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitBitCastInst(const llvm::BitCastInst &I,
-                        std::shared_ptr<ReturnedValuesFact> input,
-                        std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitPtrToIntInst(const llvm::PtrToIntInst &I,
-                         std::shared_ptr<ReturnedValuesFact> input,
-                         std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitTruncInst(const llvm::TruncInst &I,
-                      std::shared_ptr<ReturnedValuesFact> input,
-                      std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitSExtInst(const llvm::SExtInst &I,
-                     std::shared_ptr<ReturnedValuesFact> input,
-                     std::shared_ptr<const ReturnedValuesFact> out);
-  void VisitPHINode(const llvm::PHINode &I,
-                    std::shared_ptr<ReturnedValuesFact> input,
-                    std::shared_ptr<const ReturnedValuesFact> out);
+  // The transfer functions only ever add values, so the blocks are solved
+  // with a worklist.
+  using Dataflow =
+      DataflowAnalysis<ReturnedValuesFact, DataflowDirection::kBackward,
+                       ReturnedValuesPass, DataflowSolver::kWorklist>;
+  friend Dataflow;
+
+  // Transfer functions, called by dataflow_.
+  void JoinEdge(const llvm::BasicBlock &BB, const ReturnedValuesFact &succ,
+                ReturnedValuesFact &out);
+  void Visit(const llvm::Instruction &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::ReturnInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::CallInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::LoadInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::StoreInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::BitCastInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::PtrToIntInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::TruncInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::SExtInst &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
+  void Visit(const llvm::PHINode &I, ReturnedValuesFact &input,
+             const ReturnedValuesFact &out);
 
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
   // Helper function for adding values to return_propagated map.
   void AddReturnPropagated(const llvm::Function *, const std::string &);
 
-  // A map from values (instructions) to dataflow facts.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnedValuesFact>>
-      input_facts_;
-
-  // A map from values (instructions) to dataflow facts.
-  tbb::concurrent_unordered_map<const llvm::Value *,
-                                std::shared_ptr<ReturnedValuesFact>>
-      output_facts_;
+  // Dataflow facts at the program points immediately before and after each
+  // instruction.
+  Dataflow dataflow_{*this, "ReturnedValuesPass"};
 
   // A map from functions to propagated functions.
   tbb::concurrent_unordered_map<const llvm::Function *,
                                 std::unordered_set<std::string>>
       return_propagated_;
+
+  ProgressReporter *progress_reporter_ = nullptr;
 };
 
 }  // namespace error_specifications
@@ -0,0 +1,74 @@
+// This file defines the index from functions to their source code, built
+// once per run from the module's debug info. The LLM is shown the body of
+// the function it is asked about; extracting it here lets the request carry
+// the body, so the GptService no longer needs a ctags file or access to the
+// benchmark's sources. Source files are memory mapped and their line
+// offsets computed on first use, after which a lookup is a couple of hash
+// lookups and a copy.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_SOURCE_INDEX_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_SOURCE_INDEX_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace error_specifications {
+
+class SourceIndex {
+ public:
+  // Indexes the functions of module that have debug info. Source files
+  // that do not exist at their recorded path are looked up under
+  // fallback_directory, if it is not empty: first at the longest trailing
+  // part of their path found there, then by file name anywhere below it,
+  // if a single file has that name.
+  SourceIndex(const llvm::Module &module,
+              const std::string &fallback_directory);
+
+  // Stores the source of func, from the line of its name to its closing
+  // brace, in out_source. Returns false if func has no debug info or its
+  // file cannot be read. Static functions of the same name in different
+  // files each get their own source.
+  bool GetFunctionSource(const llvm::Function &func, std::string *out_source);
+
+ private:
+  struct Location {
+    std::string file;
+    // 1-based and inclusive.
+    unsigned begin_line;
+    unsigned end_line;
+  };
+
+  struct SourceFile {
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    // Offset of the start of each line; line n starts at line_offsets[n-1].
+    std::vector<size_t> line_offsets;
+  };
+
+  // Maps and indexes path on first use. Returns null if it cannot be read.
+  const SourceFile *GetFile(const std::string &path);
+
+  // Returns where to read the file recorded at path, which is path itself
+  // unless it is missing and found under fallback_directory_.
+  std::string ResolvePath(const std::string &path);
+
+  std::string fallback_directory_;
+
+  // File name to the paths of the files of that name below
+  // fallback_directory_. Filled on first use.
+  std::unordered_map<std::string, std::vector<std::string>> fallback_files_;
+  bool fallback_files_listed_ = false;
+
+  std::unordered_map<const llvm::Function *, Location> functions_;
+
+  // Path to file, or to null if the file cannot be read.
+  std::unordered_map<std::string, std::unique_ptr<SourceFile>> files_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_SOURCE_INDEX_H_
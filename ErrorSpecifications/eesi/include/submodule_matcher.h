@@ -0,0 +1,73 @@
+// This file defines a matcher that finds which submodules of the domain
+// knowledge occur in a file name.
+
+// Error and success codes can be restricted to submodules, which hold for a
+// file when the submodule name is a substring of its name. Checking every
+// submodule of a code with std::string::find costs a scan of the file name
+// per submodule; the matcher instead compiles all submodule names into one
+// Aho-Corasick automaton and finds all of them in a single scan.
+
+#ifndef ERROR_SPECIFICATIONS_EESI_INCLUDE_SUBMODULE_MATCHER_H_
+#define ERROR_SPECIFICATIONS_EESI_INCLUDE_SUBMODULE_MATCHER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace error_specifications {
+
+using SubmoduleId = uint32_t;
+
+class SubmoduleMatcher {
+ public:
+  SubmoduleMatcher();
+
+  // Returns the ID of submodule, giving it the next one if it has none.
+  // Submodules cannot be added after Compile.
+  SubmoduleId AddSubmodule(const std::string &submodule);
+
+  size_t NumSubmodules() const { return submodule_ids_.size(); }
+
+  // Builds the automaton from the submodules added so far.
+  void Compile();
+
+  // Returns the sorted IDs of the submodules that occur in file_name.
+  std::vector<SubmoduleId> Match(llvm::StringRef file_name) const;
+
+ private:
+  static constexpr uint32_t kNoState = UINT32_MAX;
+
+  struct State {
+    // The longest proper suffix of this state's string that is in the trie.
+    uint32_t fail = 0;
+    // The nearest state on the fail chain that ends a submodule.
+    uint32_t output = kNoState;
+    // The submodule that this state's string is, if any.
+    SubmoduleId submodule = UINT32_MAX;
+  };
+
+  // Returns the transition of the trie from state on c, or kNoState.
+  uint32_t Next(uint32_t state, unsigned char c) const {
+    auto it = edges_.find(Edge(state, c));
+    return it != edges_.end() ? it->second : kNoState;
+  }
+
+  static uint64_t Edge(uint32_t state, unsigned char c) {
+    return static_cast<uint64_t>(state) << 8 | c;
+  }
+
+  llvm::StringMap<SubmoduleId> submodule_ids_;
+  bool compiled_ = false;
+
+  // The trie of the submodule names, with state 0 as the root.
+  std::vector<State> states_;
+  llvm::DenseMap<uint64_t, uint32_t> edges_;
+};
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_EESI_INCLUDE_SUBMODULE_MATCHER_H_
@@ -0,0 +1,211 @@
+#include "call_graph_pass.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "glog/logging.h"
+#include "llvm.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Instructions.h"
+
+namespace error_specifications {
+
+constexpr SccId CallGraphPass::kNoScc;
+
+Counter &GetSccIterationsCounter(const std::string &pass_name) {
+  return MetricRegistry::Get().GetCounter(
+      "eesi_scc_fixpoint_iterations_total",
+      "Rounds of the fixpoint loops over the SCCs of the call graph.",
+      {{"pass", pass_name}});
+}
+
+bool CallGraphPass::runOnModule(llvm::Module &module) {
+  ScopedPassMetrics pass_metrics("CallGraphPass");
+  if (progress_reporter_) progress_reporter_->SetCurrentPass("CallGraphPass");
+  functions_.clear();
+  function_ids_.clear();
+  for (llvm::Function &function : module) {
+    function_ids_[&function] = functions_.size();
+    functions_.push_back(&function);
+  }
+
+  BuildCallees();
+  BuildSccs();
+  BuildLevels();
+
+  Histogram &scc_sizes = MetricRegistry::Get().GetHistogram(
+      "eesi_scc_size", "Functions per SCC of the call graphs built.",
+      Histogram::SizeBounds());
+  for (SccId scc = 0; scc < NumSccs(); ++scc) {
+    scc_sizes.Observe(GetSccFunctions(scc).size());
+  }
+
+  LOG(INFO) << "Call graph: " << functions_.size() << " functions, "
+            << callees_.size() << " call edges, " << NumSccs() << " SCCs on "
+            << NumLevels() << " levels";
+
+  // Does not modify bitcode.
+  return false;
+}
+
+void CallGraphPass::BuildCallees() {
+  // The first callee seen with each source name stands for all of them.
+  llvm::StringMap<FunctionId> canonical_callees;
+  // The caller whose callees were last added, for deduplication.
+  std::vector<FunctionId> last_caller(functions_.size(), UINT32_MAX);
+
+  callee_offsets_.assign(1, 0);
+  callees_.clear();
+  std::vector<FunctionId> canonical;
+  for (FunctionId caller = 0; caller < functions_.size(); ++caller) {
+    auto add_callee = [this, caller, &last_caller](FunctionId callee) {
+      if (last_caller[callee] == caller) return;
+      last_caller[callee] = caller;
+      callees_.push_back(callee);
+    };
+
+    // Calls to the canonical functions follow all direct calls, as they
+    // did when they were added to an LLVM call graph afterwards; the order
+    // matters to the order in which SCCs are found.
+    canonical.clear();
+    for (const llvm::BasicBlock &basic_block : *functions_[caller]) {
+      for (const llvm::Instruction &inst : basic_block) {
+        const auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+        if (!call_inst) continue;
+        const llvm::Function *callee = GetCalleeFunction(*call_inst);
+        if (!callee) continue;
+        const FunctionId callee_id = function_ids_.lookup(callee);
+        add_callee(callee_id);
+        canonical.push_back(
+            canonical_callees.try_emplace(GetSourceName(*callee), callee_id)
+                .first->second);
+      }
+    }
+    for (FunctionId callee : canonical) add_callee(callee);
+    callee_offsets_.push_back(callees_.size());
+  }
+}
+
+void CallGraphPass::BuildSccs() {
+  const size_t num_functions = functions_.size();
+  constexpr uint32_t kUnvisited = 0;
+  constexpr uint32_t kDone = UINT32_MAX;
+
+  // Tarjan's algorithm, iterating over the callees of each node in order so
+  // that the SCCs come out in the order llvm::scc_iterator gives them. The
+  // DFS starts from the functions that the LLVM call graph's external
+  // calling node calls: those that can be called from outside the module.
+  std::vector<uint32_t> visit_numbers(num_functions, kUnvisited);
+  std::vector<uint32_t> min_visited(num_functions);
+  uint32_t next_visit_number = 1;
+  std::vector<FunctionId> scc_stack;
+  // The node being visited and the index of its next callee.
+  std::vector<std::pair<FunctionId, uint32_t>> visit_stack;
+
+  function_sccs_.assign(num_functions, kNoScc);
+  scc_offsets_.assign(1, 0);
+  scc_functions_.clear();
+  scc_has_loop_.clear();
+
+  auto visit = [&](FunctionId function) {
+    visit_numbers[function] = min_visited[function] = next_visit_number++;
+    scc_stack.push_back(function);
+    visit_stack.push_back(std::make_pair(function, callee_offsets_[function]));
+  };
+
+  for (FunctionId root = 0; root < num_functions; ++root) {
+    const llvm::Function *function = functions_[root];
+    if (visit_numbers[root] != kUnvisited ||
+        (function->hasLocalLinkage() && !function->hasAddressTaken())) {
+      continue;
+    }
+
+    visit(root);
+    while (!visit_stack.empty()) {
+      const FunctionId node = visit_stack.back().first;
+      uint32_t &next_callee = visit_stack.back().second;
+      if (next_callee < callee_offsets_[node + 1]) {
+        const FunctionId callee = callees_[next_callee++];
+        if (visit_numbers[callee] == kUnvisited) {
+          visit(callee);
+        } else {
+          min_visited[node] =
+              std::min(min_visited[node], visit_numbers[callee]);
+        }
+        continue;
+      }
+
+      visit_stack.pop_back();
+      if (!visit_stack.empty()) {
+        const FunctionId caller = visit_stack.back().first;
+        min_visited[caller] = std::min(min_visited[caller], min_visited[node]);
+      }
+      if (min_visited[node] != visit_numbers[node]) continue;
+
+      // node is the root of an SCC, made of it and the nodes above it on the
+      // stack.
+      const SccId scc = scc_has_loop_.size();
+      FunctionId member;
+      do {
+        member = scc_stack.back();
+        scc_stack.pop_back();
+        visit_numbers[member] = kDone;
+        function_sccs_[member] = scc;
+        scc_functions_.push_back(member);
+      } while (member != node);
+      scc_offsets_.push_back(scc_functions_.size());
+
+      const llvm::ArrayRef<FunctionId> callees = GetCallees(node);
+      scc_has_loop_.push_back(
+          GetSccFunctions(scc).size() > 1 ||
+          std::find(callees.begin(), callees.end(), node) != callees.end());
+    }
+  }
+}
+
+void CallGraphPass::BuildLevels() {
+  // Callee SCCs are numbered before their callers, so one pass in SCC order
+  // sees the levels of all callees.
+  const size_t num_sccs = scc_has_loop_.size();
+  scc_levels_.assign(num_sccs, 0);
+  uint32_t num_levels = 0;
+  for (SccId scc = 0; scc < num_sccs; ++scc) {
+    uint32_t level = 0;
+    for (FunctionId function : GetSccFunctions(scc)) {
+      for (FunctionId callee : GetCallees(function)) {
+        const SccId callee_scc = function_sccs_[callee];
+        if (callee_scc != scc) {
+          level = std::max(level, scc_levels_[callee_scc] + 1);
+        }
+      }
+    }
+    scc_levels_[scc] = level;
+    num_levels = std::max(num_levels, level + 1);
+  }
+
+  // Counting sort of the SCCs by level, which keeps them bottom-up within
+  // each level.
+  level_offsets_.assign(num_levels + 1, 0);
+  for (uint32_t level : scc_levels_) ++level_offsets_[level + 1];
+  for (uint32_t level = 0; level < num_levels; ++level) {
+    level_offsets_[level + 1] += level_offsets_[level];
+  }
+  level_sccs_.resize(num_sccs);
+  std::vector<uint32_t> next(level_offsets_.begin(), level_offsets_.end() - 1);
+  for (SccId scc = 0; scc < num_sccs; ++scc) {
+    level_sccs_[next[scc_levels_[scc]]++] = scc;
+  }
+}
+
+void CallGraphPass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
+  au.setPreservesAll();
+}
+
+char CallGraphPass::ID = 0;
+static llvm::RegisterPass<CallGraphPass> X(
+    "eesi-call-graph",
+    "Call graph of the module in compressed sparse row form, with its SCCs",
+    false, true);
+
+}  // namespace error_specifications
@@ -24,52 +24,39 @@ namespace error_specifications {
 void Checker::CheckViolations(
     const llvm::CallInst &call_inst,
     const SignLatticeElement &specification_lattice_element,
-    const std::set<SignLatticeElement> &callee_constraints) {
-  CheckUnusedViolations(call_inst, specification_lattice_element);
+    const std::set<SignLatticeElement> &callee_constraints,
+    std::vector<ViolationRecord> *violations) const {
+  CheckUnusedViolations(call_inst, specification_lattice_element, violations);
 }
 
 void Checker::CheckUnusedViolations(
     const llvm::CallInst &call_inst,
-    const SignLatticeElement &specification_lattice_element) {
-  const Function &spec_function = GetCallee(call_inst);
+    const SignLatticeElement &specification_lattice_element,
+    std::vector<ViolationRecord> *violations) const {
+  const llvm::Function *callee = GetCalleeFunction(call_inst);
   // Simply return if specification should not be checked.
-  if (!ShouldCheck(spec_function, specification_lattice_element)) return;
+  if (!ShouldCheck(callee, specification_lattice_element)) return;
 
   // Unused call violation is simple as we can just utilize LLVM's use_empty()
   // for call instructions.
-  if (call_inst.use_empty() &&
-      ShouldCheck(spec_function, specification_lattice_element)) {
-    Violation violation;
-    violation.mutable_location()->CopyFrom(GetDebugLocation(call_inst));
-
-    Specification specification;
-    specification.set_lattice_element(specification_lattice_element);
-    specification.mutable_function()->CopyFrom(spec_function);
-
-    violation.mutable_specification()->CopyFrom(specification);
-    violation.set_violation_type(
-        ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE);
-    violation.set_message("Unused return value.");
-
-    const Function &parent_function =
-        LlvmToProtoFunction(*call_inst.getParent()->getParent());
-    violation.mutable_parent_function()->CopyFrom(parent_function);
-
-    violations_.push_back(violation);
+  if (call_inst.use_empty()) {
+    violations->push_back(
+        ViolationRecord{ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE,
+                        &call_inst, callee, specification_lattice_element});
   }
 }
 
 bool Checker::ShouldCheck(
-    const Function &function,
-    const SignLatticeElement &specification_lattice_element) {
+    const llvm::Function *callee,
+    const SignLatticeElement &specification_lattice_element) const {
   assert(specification_lattice_element !=
          SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
 
-  if (function.source_name().empty()) {
+  if (!callee || GetSourceName(*callee).empty()) {
     return false;
   }
 
-  if (function.return_type() == FunctionReturnType::FUNCTION_RETURN_TYPE_VOID) {
+  if (GetReturnType(*callee) == FunctionReturnType::FUNCTION_RETURN_TYPE_VOID) {
     return false;
   }
 
@@ -83,6 +70,33 @@ bool Checker::ShouldCheck(
   return true;
 }
 
-std::vector<Violation> Checker::GetViolations() { return violations_; }
+void Checker::AddViolations(const std::vector<ViolationRecord> &violations) {
+  violations_.insert(violations_.end(), violations.begin(), violations.end());
+}
+
+void Checker::GetViolations(
+    google::protobuf::RepeatedPtrField<Violation> *violations) const {
+  violations->Reserve(violations->size() + violations_.size());
+  for (const ViolationRecord &record : violations_) {
+    Violation *violation = violations->Add();
+    *violation->mutable_location() = GetDebugLocation(*record.call_inst);
+
+    Specification *specification = violation->mutable_specification();
+    specification->set_lattice_element(record.specification_lattice_element);
+    *specification->mutable_function() = LlvmToProtoFunction(*record.callee);
+
+    violation->set_violation_type(record.violation_type);
+    switch (record.violation_type) {
+      case ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE:
+        violation->set_message("Unused return value.");
+        break;
+      default:
+        break;
+    }
+
+    *violation->mutable_parent_function() =
+        LlvmToProtoFunction(*record.call_inst->getFunction());
+  }
+}
 
 }  // namespace error_specifications
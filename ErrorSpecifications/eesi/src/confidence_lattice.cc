@@ -3,106 +3,76 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
-#include <numeric>
 #include <vector>
 
 namespace error_specifications {
 
-LatticeElementConfidence ConfidenceLattice::JoinOnVector(
-    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
-  auto confidence_zero = kMinConfidence;
-  auto confidence_less_than_zero = kMinConfidence;
-  auto confidence_greater_than_zero = kMinConfidence;
-  auto confidence_emptyset = kMinConfidence;
-  LatticeElementConfidence join_result = lattice_element_confidences.front();
-  for (auto lattice_element_confidence : lattice_element_confidences) {
-    join_result = Join(join_result, lattice_element_confidence);
-  }
+constexpr int LatticeElementConfidence::kZeroShift;
+constexpr int LatticeElementConfidence::kLessThanZeroShift;
+constexpr int LatticeElementConfidence::kGreaterThanZeroShift;
+constexpr int LatticeElementConfidence::kEmptysetShift;
 
-  return join_result;
-}
+constexpr uint64_t ConfidenceLattice::kLaneHighBits;
+constexpr uint64_t ConfidenceLattice::kEmptysetLane;
 
-LatticeElementConfidence ConfidenceLattice::MeetOnVector(
-    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
-  auto confidence_zero = kMinConfidence;
-  auto confidence_less_than_zero = kMinConfidence;
-  auto confidence_greater_than_zero = kMinConfidence;
-  auto confidence_emptyset = kMinConfidence;
-  LatticeElementConfidence meet_result = lattice_element_confidences.front();
-  for (auto lattice_element_confidence : lattice_element_confidences) {
-    meet_result = Meet(meet_result, lattice_element_confidence);
+LatticeElementConfidence ConfidenceLattice::JoinAll(
+    const LatticeElementConfidence *confidences, size_t count,
+    LatticeElementConfidence init) {
+  uint64_t join_result = init.GetPacked();
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t x = confidences[i].GetPacked();
+    const uint64_t take_x = SelectJoinLanes(x, join_result);
+    join_result = (x & take_x) | (join_result & ~take_x);
   }
-
-  return meet_result;
+  return LatticeElementConfidence::FromPacked(join_result);
 }
 
-LatticeElementConfidence ConfidenceLattice::KeepHighest(
-    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
-  auto confidence_zero = kMinConfidence;
-  auto confidence_less_than_zero = kMinConfidence;
-  auto confidence_greater_than_zero = kMinConfidence;
-  auto confidence_emptyset = kMinConfidence;
-  auto max_confidence = kMinConfidence;
-  LatticeElementConfidence join_result;
-  for (auto lattice_element_confidence : lattice_element_confidences) {
-    if (confidence_zero < lattice_element_confidence.GetConfidenceZero()) {
-      confidence_zero = lattice_element_confidence.GetConfidenceZero();
-    }
-    if (confidence_less_than_zero <
-        lattice_element_confidence.GetConfidenceLessThanZero()) {
-      confidence_less_than_zero =
-          lattice_element_confidence.GetConfidenceLessThanZero();
-    }
-    if (confidence_greater_than_zero <
-        lattice_element_confidence.GetConfidenceGreaterThanZero()) {
-      confidence_greater_than_zero =
-          lattice_element_confidence.GetConfidenceGreaterThanZero();
-    }
-    if (confidence_emptyset <
-        lattice_element_confidence.GetConfidenceEmptyset()) {
-      confidence_emptyset = lattice_element_confidence.GetConfidenceEmptyset();
-    }
-    if (max_confidence < GetMaxWithEmptyset(lattice_element_confidence)) {
-      max_confidence = GetMaxWithEmptyset(lattice_element_confidence);
-    }
-  }
-
-  if (confidence_zero != max_confidence) {
-    confidence_zero = kMinConfidence;
-  }
-  if (confidence_less_than_zero != max_confidence) {
-    confidence_less_than_zero = kMinConfidence;
-  }
-  if (confidence_greater_than_zero != max_confidence) {
-    confidence_greater_than_zero = kMinConfidence;
-  }
-  if (confidence_emptyset != max_confidence) {
-    confidence_emptyset = kMinConfidence;
+LatticeElementConfidence ConfidenceLattice::MeetAll(
+    const LatticeElementConfidence *confidences, size_t count,
+    LatticeElementConfidence init) {
+  uint64_t meet_result = init.GetPacked();
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t x = confidences[i].GetPacked();
+    const uint64_t take_x = SelectJoinLanes(x, meet_result);
+    meet_result = (meet_result & take_x) | (x & ~take_x);
   }
+  return LatticeElementConfidence::FromPacked(meet_result);
+}
 
-  return LatticeElementConfidence(confidence_zero, confidence_less_than_zero,
-                                  confidence_greater_than_zero,
-                                  confidence_emptyset);
+LatticeElementConfidence ConfidenceLattice::JoinOnVector(
+    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
+  return JoinAll(lattice_element_confidences.data(),
+                 lattice_element_confidences.size(),
+                 lattice_element_confidences.front());
 }
 
-LatticeElementConfidence ConfidenceLattice::Join(
-    const LatticeElementConfidence &x, const LatticeElementConfidence &y) {
-  return LatticeElementConfidence(
-      std::max(x.GetConfidenceZero(), y.GetConfidenceZero()),
-      std::max(x.GetConfidenceLessThanZero(), y.GetConfidenceLessThanZero()),
-      std::max(x.GetConfidenceGreaterThanZero(),
-               y.GetConfidenceGreaterThanZero()),
-      std::min(x.GetConfidenceEmptyset(), y.GetConfidenceEmptyset()));
+LatticeElementConfidence ConfidenceLattice::MeetOnVector(
+    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
+  return MeetAll(lattice_element_confidences.data(),
+                 lattice_element_confidences.size(),
+                 lattice_element_confidences.front());
 }
 
-LatticeElementConfidence ConfidenceLattice::Meet(
-    const LatticeElementConfidence &x, const LatticeElementConfidence &y) {
+LatticeElementConfidence ConfidenceLattice::KeepHighest(
+    const std::vector<LatticeElementConfidence> &lattice_element_confidences) {
+  // The lane-wise maximum of all four confidences, emptyset included.
+  uint64_t highest = 0;
+  for (const auto &lattice_element_confidence : lattice_element_confidences) {
+    const uint64_t x = lattice_element_confidence.GetPacked();
+    const uint64_t take_x = GreaterOrEqualLanes(x, highest);
+    highest = (x & take_x) | (highest & ~take_x);
+  }
+  const LatticeElementConfidence highest_confidence =
+      LatticeElementConfidence::FromPacked(highest);
+  const short max_confidence = GetMaxWithEmptyset(highest_confidence);
+  auto keep = [max_confidence](short confidence) {
+    return confidence == max_confidence ? confidence : kMinConfidence;
+  };
   return LatticeElementConfidence(
-      std::min(x.GetConfidenceZero(), y.GetConfidenceZero()),
-      std::min(x.GetConfidenceLessThanZero(), y.GetConfidenceLessThanZero()),
-      std::min(x.GetConfidenceGreaterThanZero(),
-               y.GetConfidenceGreaterThanZero()),
-      std::max(x.GetConfidenceEmptyset(), y.GetConfidenceEmptyset()));
+      keep(highest_confidence.GetConfidenceZero()),
+      keep(highest_confidence.GetConfidenceLessThanZero()),
+      keep(highest_confidence.GetConfidenceGreaterThanZero()),
+      keep(highest_confidence.GetConfidenceEmptyset()));
 }
 
 LatticeElementConfidence ConfidenceLattice::Intersection(
@@ -363,64 +333,45 @@ ConfidenceLattice::SignLatticeElementToLatticeElementConfidence(
       x, kMinConfidence);
 }
 
+SignLatticeElement ConfidenceLattice::SignsAtLeast(
+    const LatticeElementConfidence &x, int threshold) {
+  // Indexed by the signs that reach the threshold: ==0 is bit 0, <0 bit 1
+  // and >0 bit 2.
+  static constexpr SignLatticeElement kSignsToElement[] = {
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP,
+  };
+  // Every confidence reaches a threshold of at most kMinConfidence, and none
+  // one above kMaxConfidence.
+  const uint64_t lane_threshold =
+      std::min(std::max(threshold, static_cast<int>(kMinConfidence)),
+               kMaxConfidence + 1);
+  const uint64_t at_least = GreaterOrEqualLanes(
+      x.GetPacked(), lane_threshold * 0x0001000100010001u);
+  const unsigned signs =
+      ((at_least >> LatticeElementConfidence::kZeroShift) & 1) |
+      ((at_least >> (LatticeElementConfidence::kLessThanZeroShift - 1)) & 2) |
+      ((at_least >> (LatticeElementConfidence::kGreaterThanZeroShift - 2)) &
+       4);
+  return kSignsToElement[signs];
+}
+
 SignLatticeElement
 ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
     const LatticeElementConfidence &x) {
-  SignLatticeElement zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceZero() > kMinConfidence) {
-    zero_result = SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
-  }
-  SignLatticeElement less_than_zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceLessThanZero() > kMinConfidence) {
-    less_than_zero_result =
-        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
-  }
-  SignLatticeElement greater_than_zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceGreaterThanZero() > kMinConfidence) {
-    greater_than_zero_result =
-        SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO;
-  }
-
-  std::vector<SignLatticeElement> results{zero_result, less_than_zero_result,
-                                          greater_than_zero_result};
-  auto result = std::accumulate(results.begin(), results.end(),
-                                SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
-                                SignLattice::Join);
-
-  return result;
+  return SignsAtLeast(x, kMinConfidence + 1);
 }
 
 SignLatticeElement
 ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
     const LatticeElementConfidence &x, int threshold) {
-  SignLatticeElement zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceZero() >= threshold) {
-    zero_result = SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
-  }
-  SignLatticeElement less_than_zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceLessThanZero() >= threshold) {
-    less_than_zero_result =
-        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
-  }
-  SignLatticeElement greater_than_zero_result =
-      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-  if (x.GetConfidenceGreaterThanZero() >= threshold) {
-    greater_than_zero_result =
-        SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO;
-  }
-
-  std::vector<SignLatticeElement> results{zero_result, less_than_zero_result,
-                                          greater_than_zero_result};
-  auto result = std::accumulate(results.begin(), results.end(),
-                                SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
-                                SignLattice::Join);
-
-  return result;
+  return SignsAtLeast(x, threshold);
 }
 
 LatticeElementConfidence ConfidenceLattice::Difference(
@@ -2,12 +2,15 @@
 
 #include <stdio.h>
 
+#include <atomic>
+#include <cctype>
 #include <ctime>
 #include <iostream>
 #include <numeric>
 #include <string>
 #include <vector>
 
+#include "call_graph_pass.h"
 #include "error_blocks_pass.h"
 #include "glog/logging.h"
 #include "include/grpcpp/grpcpp.h"
@@ -18,6 +21,7 @@
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
 #include "operations_service.h"
+#include "progress_reporter.h"
 #include "proto/bitcode.grpc.pb.h"
 #include "proto/operations.grpc.pb.h"
 #include "return_constraints_pass.h"
@@ -26,15 +30,62 @@
 #include "returned_values_pass.h"
 #include "servers.h"
 #include "tbb/task.h"
+#include "timeline.h"
 
 namespace error_specifications {
 
+namespace {
+
+// Returns a path in timeline_dir for the timeline of task_name. Task names
+// hold the client's bitcode ID and a timestamp, so only safe characters of
+// it are kept, and a sequence number keeps tasks started in the same second
+// apart.
+std::string TimelinePath(const std::string &timeline_dir,
+                         const std::string &task_name) {
+  static std::atomic<uint64_t> sequence_number(0);
+  std::string file_name;
+  for (char c : task_name) {
+    if (isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_') {
+      file_name += c;
+    } else if (!file_name.empty() && file_name.back() != '_') {
+      file_name += '_';
+    }
+  }
+  while (!file_name.empty() && file_name.back() == '_') file_name.pop_back();
+  return timeline_dir + "/" + file_name + "-" +
+         std::to_string(sequence_number++) + ".trace.json";
+}
+
+}  // namespace
+
 tbb::task *GetSpecificationsTask::execute(void) {
   LOG(INFO) << task_name;
+  AdmissionGuard admission_guard(admission_controller, admission_ticket);
+
+  // Record a timeline of the run if the request asks for one. The passes,
+  // and the workers they start, add their spans to it.
+  std::shared_ptr<Timeline> timeline;
+  if (!timeline_file.empty()) {
+    timeline = std::make_shared<Timeline>(task_name);
+  }
+  Timeline::Scope timeline_scope(timeline.get());
 
   Operation result;
   result.set_name(task_name);
 
+  // Publish progress as operation metadata. The reporter bounds how often
+  // the operations table is written.
+  ProgressReporter progress_reporter(
+      [this](const GetSpecificationsMetadata &metadata) {
+        Operation progress;
+        progress.set_name(task_name);
+        progress.set_done(0);
+        progress.mutable_metadata()->PackFrom(metadata);
+        progress.set_metadata_type(metadata.GetTypeName());
+        operations_service->UpdateOperation(task_name, progress);
+      });
+  progress_reporter.SetCurrentPass("DownloadBitcode");
+
   // Connect to the bitcode service
   std::shared_ptr<grpc::Channel> channel;
   std::unique_ptr<BitcodeService::Stub> stub;
@@ -42,6 +93,7 @@ tbb::task *GetSpecificationsTask::execute(void) {
                                 grpc::InsecureChannelCredentials());
   stub = BitcodeService::NewStub(channel);
 
+  TimelineSpan download_span(kTimelineBitcode, "DownloadBitcode");
   grpc::ClientContext download_context;
   DownloadBitcodeRequest download_req;
   download_req.mutable_bitcode_id()->CopyFrom(request.bitcode_id());
@@ -55,6 +107,11 @@ tbb::task *GetSpecificationsTask::execute(void) {
 
   std::string bitcode_bytes =
       std::accumulate(chunks.begin(), chunks.end(), std::string(""));
+  download_span.Arg("bytes", bitcode_bytes.size());
+  download_span.End();
+
+  progress_reporter.SetCurrentPass("ParseBitcode");
+  TimelineSpan parse_span(kTimelineBitcode, "ParseBitcode");
 
   // Initialize an LLVM MemoryBuffer.
   std::unique_ptr<llvm::MemoryBuffer> buffer =
@@ -70,15 +127,25 @@ tbb::task *GetSpecificationsTask::execute(void) {
     err.print("eesi-server", llvm::errs());
     abort();
   }
+  parse_span.End();
 
   llvm::legacy::PassManager pass_manager;
+  CallGraphPass *call_graph = new CallGraphPass();
   ReturnPropagationPass *return_propagation = new ReturnPropagationPass();
   ReturnConstraintsPass *return_constraints = new ReturnConstraintsPass();
   ReturnedValuesPass *returned_values = new ReturnedValuesPass();
   ReturnRangePass *return_range = new ReturnRangePass();
   ErrorBlocksPass *error_blocks = new ErrorBlocksPass();
 
+  // Each pass publishes its name when it starts.
+  call_graph->SetProgressReporter(&progress_reporter);
+  return_propagation->SetProgressReporter(&progress_reporter);
+  return_constraints->SetProgressReporter(&progress_reporter);
+  returned_values->SetProgressReporter(&progress_reporter);
+  return_range->SetProgressReporter(&progress_reporter);
   error_blocks->SetSpecificationsRequest(request);
+  error_blocks->SetProgressReporter(&progress_reporter);
+  pass_manager.add(call_graph);
   pass_manager.add(return_propagation);
   pass_manager.add(return_constraints);
   pass_manager.add(error_blocks);
@@ -90,7 +157,21 @@ tbb::task *GetSpecificationsTask::execute(void) {
   GetSpecificationsResponse get_specifications_response =
       error_blocks->GetSpecifications();
 
+  if (timeline) {
+    if (timeline->WriteChromeTrace(timeline_file)) {
+      LOG(INFO) << "Wrote the timeline of " << task_name << " to "
+                << timeline_file;
+      get_specifications_response.set_timeline_file(timeline_file);
+    } else {
+      LOG(WARNING) << "Unable to write the timeline of " << task_name
+                   << " to " << timeline_file;
+    }
+  }
+
+  progress_reporter.SetCurrentPass("Done");
   result.set_done(1);
+  result.mutable_metadata()->PackFrom(progress_reporter.Snapshot());
+  result.set_metadata_type(GetSpecificationsMetadata().GetTypeName());
 
   // Packing into google.protobuf.Any
   result.mutable_response()->PackFrom(get_specifications_response);
@@ -110,6 +191,13 @@ grpc::Status EesiServiceImpl::GetSpecifications(
     LOG(ERROR) << err_msg;
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, err_msg);
   }
+  if (request->record_timeline() && timeline_dir.empty()) {
+    const std::string err_msg =
+        "Timelines are disabled: the service was started without "
+        "--timeline_dir.";
+    LOG(ERROR) << err_msg;
+    return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, err_msg);
+  }
 
   // Return the name of the operation so client can check on progress.
   std::string task_name =
@@ -124,7 +212,12 @@ grpc::Status EesiServiceImpl::GetSpecifications(
   task->request = *request;
   task->task_name = task_name;
   task->bitcode_server_address = bitcode_server_address;
-  tbb::task::enqueue(*task);
+  task->admission_controller = &admission_controller;
+  if (request->record_timeline()) {
+    task->timeline_file = TimelinePath(timeline_dir, task_name);
+  }
+  admission_controller.Submit(task_name, kUnknownTaskBytes, task,
+                              &task->admission_ticket);
 
   return grpc::Status::OK;
 }
@@ -135,8 +228,10 @@ grpc::Status EesiServiceImpl::GetErrorHandlers(
   return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
 }
 
-void RunEesiServer(const std::string &server_address) {
-  EesiServiceImpl service;
+void RunEesiServer(const std::string &server_address,
+                   const AdmissionOptions &admission_options,
+                   const std::string &timeline_dir) {
+  EesiServiceImpl service(admission_options, timeline_dir);
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
@@ -145,6 +240,7 @@ void RunEesiServer(const std::string &server_address) {
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
   builder.RegisterService(&service.operations_service);
+  builder.RegisterService(&service.metrics_service);
   // Finally assemble the server.
   std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
   std::cout << "Server listening on " << server_address << std::endl;
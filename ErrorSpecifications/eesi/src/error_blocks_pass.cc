@@ -1,6 +1,7 @@
 #include "error_blocks_pass.h"
 
 #include <algorithm>
+#include <chrono>
 #include <numeric>
 #include <unordered_map>
 #include <vector>
@@ -8,22 +9,79 @@
 #include "eesi_common.h"
 #include "glog/logging.h"
 #include "llvm.h"
-#include "llvm/ADT/SCCIterator.h"
-#include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/Path.h"
+#include "metrics.h"
 #include "return_constraints_pass.h"
 #include "return_propagation_pass.h"
 #include "return_range_pass.h"
 #include "returned_values_pass.h"
+#include "tbb/tbb.h"
+#include "timeline.h"
+#include "trace.h"
 
 namespace error_specifications {
 
+namespace {
+
+// Prompt tokens of one context specification besides its name. A function
+// query lists it as "name: element"; a third-party query shows it as a
+// question and an answer, i.e. two chat messages.
+constexpr uint64_t kContextTokensPerSpecification = 4;
+constexpr uint64_t kThirdPartyContextTokensPerSpecification = 12;
+constexpr uint64_t kContextBytesPerToken = 4;
+
+// Weights of the signals in the expected value of an LLM query. Every call
+// site is a place where the specification can flag an unchecked error; a
+// caller that checks the return value can also have its own specification
+// inferred from it, and passes on part of its value.
+constexpr double kLlmQueryBaseValue = 1;
+constexpr double kCallSiteValue = 1;
+constexpr double kCheckingCallerValue = 2;
+constexpr double kPropagatedValueDecay = 0.5;
+
+// Returns true if a code restricted to code_submodules is considered in a
+// file whose name contains file_submodules, both sorted. No submodules
+// means that the code is considered for all functions.
+bool CodeHoldsInFile(const std::vector<SubmoduleId> &code_submodules,
+                     const std::vector<SubmoduleId> &file_submodules) {
+  if (code_submodules.empty()) return true;
+  auto code_it = code_submodules.begin();
+  auto file_it = file_submodules.begin();
+  while (code_it != code_submodules.end() && file_it != file_submodules.end()) {
+    if (*code_it == *file_it) return true;
+    if (*code_it < *file_it) {
+      ++code_it;
+    } else {
+      ++file_it;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+constexpr uint8_t ErrorBlocksPass::kErrorCode;
+constexpr uint8_t ErrorBlocksPass::kSuccessCode;
+
 void ErrorBlocksPass::SetSpecificationsRequest(
     const GetSpecificationsRequest &req) {
   smart_success_code_zero_ = req.smart_success_code_zero();
   checker_ = new Checker();
-  language_model_ = new GptModel(req.llm_name(), req.ctags_file());
+  ctags_file_ = req.ctags_file();
+  language_model_ = new GptModel(
+      req.llm_name(), req.ctags_file(),
+      std::vector<std::string>(req.gpt_endpoints().begin(),
+                               req.gpt_endpoints().end()));
+  if (req.llm_context_token_budget() > 0) {
+    llm_context_token_budget_ = req.llm_context_token_budget();
+  }
+  llm_query_budget_ = req.llm_query_budget();
+  if (req.llm_third_party_chunk_size() > 0) {
+    llm_third_party_chunk_size_ = req.llm_third_party_chunk_size();
+  }
+  llm_token_budget_ = req.llm_token_budget();
 
   for (const auto &error_only_fn : req.error_only_functions()) {
     const auto source_name = error_only_fn.function().source_name();
@@ -44,32 +102,38 @@ void ErrorBlocksPass::SetSpecificationsRequest(
     }
 
     error_only_functions_.insert({source_name, required_arg_map});
+    error_only_names_[InternName(source_name)] = true;
     AddNonDoomedFunction(source_name);
   }
 
   // Store error codes.
   for (const auto &error_code : req.error_codes()) {
-    if (error_codes_.find(error_code.value()) == error_codes_.end()) {
-      error_codes_[error_code.value()] = std::unordered_set<std::string>();
-    }
+    std::vector<SubmoduleId> &submodules = error_codes_[error_code.value()];
     for (const auto &submodule : error_code.submodules()) {
-      error_codes_[error_code.value()].insert(submodule);
+      submodules.push_back(submodule_matcher_.AddSubmodule(submodule));
     }
     error_code_names_[error_code.name()] = AbstractInteger(error_code.value());
   }
 
   // Store success codes.
   for (const auto &success_code : req.success_codes()) {
-    if (success_codes_.find(success_code.value()) == success_codes_.end()) {
-      success_codes_[success_code.value()] = std::unordered_set<std::string>();
-    }
+    std::vector<SubmoduleId> &submodules = success_codes_[success_code.value()];
     for (const auto &submodule : success_code.submodules()) {
-      success_codes_[success_code.value()].insert(submodule);
+      submodules.push_back(submodule_matcher_.AddSubmodule(submodule));
     }
     success_code_names_[success_code.name()] =
         AbstractInteger(success_code.value());
   }
 
+  for (auto *codes : {&error_codes_, &success_codes_}) {
+    for (auto &code : *codes) {
+      std::sort(code.second.begin(), code.second.end());
+      code.second.erase(std::unique(code.second.begin(), code.second.end()),
+                        code.second.end());
+    }
+  }
+  submodule_matcher_.Compile();
+
   // Store initial specifications.
   for (const auto &specification : req.initial_specifications()) {
     // Convert the specification to a constraint.
@@ -78,8 +142,7 @@ void ErrorBlocksPass::SetSpecificationsRequest(
     // meet operations.
     std::string specification_function_name =
         specification.function().source_name();
-    LOG(INFO) << "InitSpec"
-              << " f=" << specification_function_name;
+    TRACE(kTraceFunction, "InitSpec").Arg("f", specification_function_name);
     // The confidence of any domain knowledge is always kMaxConfidence. The
     // relevant confidence values will be set to kMinConfidence if the lattice
     // element for the specification does not intersect (non-bottom Meet) with
@@ -98,29 +161,50 @@ void ErrorBlocksPass::SetSpecificationsRequest(
     // Save a copy of the initial specification so that we can assert
     // that it has not been modified.
     initial_error_specifications_[specification_function_name] = c;
+    const NameId name = InternName(specification_function_name);
+    has_initial_specification_[name] = true;
 
     // Bootstrap the analysis with the initial specification.
-    error_specifications_[specification_function_name] = c;
-    AddNonDoomedFunction(specification_function_name);
+    error_specifications_[name] = c;
+    AddNonDoomedFunction(name);
   }
 }
 
+void ErrorBlocksPass::SetProgressReporter(ProgressReporter *progress_reporter) {
+  progress_reporter_ = progress_reporter;
+}
+
+NameId ErrorBlocksPass::InternName(const std::string &source_name) {
+  const NameId name = function_table_.InternName(source_name);
+  if (name >= error_specifications_.size()) GrowNameState();
+  return name;
+}
+
+void ErrorBlocksPass::GrowNameState() {
+  const size_t num_names = function_table_.NumNames();
+  error_specifications_.resize(num_names);
+  function_return_types_.resize(
+      num_names, FunctionReturnType::FUNCTION_RETURN_TYPE_INVALID);
+  has_initial_specification_.resize(num_names, false);
+  error_only_names_.resize(num_names, false);
+  non_doomed_functions_.resize(num_names, false);
+  called_functions_.resize(num_names);
+  name_to_function_.resize(num_names, nullptr);
+}
+
 bool ErrorBlocksPass::IgnoreFunction(const llvm::Function *function) const {
-  return function == nullptr || function->isIntrinsic() ||
-         initial_error_specifications_.find(GetSourceName(*function)) !=
-             initial_error_specifications_.end() ||
-         IsVoidFunction(*function);
+  if (function == nullptr || function->isIntrinsic()) return true;
+  const FunctionTable::FunctionInfo &info = function_table_.GetInfo(*function);
+  return has_initial_specification_[info.name] ||
+         info.return_type == FunctionReturnType::FUNCTION_RETURN_TYPE_VOID;
 }
 
-bool ErrorBlocksPass::runOnThirdPartyFunctions(
-    const llvm::CallGraph &call_graph) {
-  // return false;
+void ErrorBlocksPass::StartThirdPartyQueries(const CallGraphPass &call_graph) {
   std::vector<std::pair<std::string, std::string>> third_party_functions;
   int num_third_party = 0;
-  for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
-       ++scc_it) {
-    for (auto node : *scc_it) {
-      auto f = node->getFunction();
+  for (SccId scc = 0; scc < call_graph.NumSccs(); ++scc) {
+    for (FunctionId function : call_graph.GetSccFunctions(scc)) {
+      auto f = call_graph.GetFunction(function);
       if (!IgnoreFunction(f) && f->begin() == f->end()) {
         std::string return_type_str = "Pointer";
         if (GetReturnType((*f)) ==
@@ -134,25 +218,58 @@ bool ErrorBlocksPass::runOnThirdPartyFunctions(
     }
   }
   LOG(INFO) << "Number of third party functions: " << num_third_party;
-  return LlmExpandThirdPartyErrorSpecifications(third_party_functions);
+  // The functions come in bottom-up order, so the first chunks are about
+  // the functions that the first SCCs call.
+  for (auto &chunk : ChunkThirdPartyFunctions(third_party_functions,
+                                              llm_third_party_chunk_size_)) {
+    StartThirdPartyQuery(std::move(chunk));
+  }
+}
+
+std::vector<std::vector<std::pair<std::string, std::string>>>
+ErrorBlocksPass::ChunkThirdPartyFunctions(
+    const std::vector<std::pair<std::string, std::string>> &functions,
+    size_t chunk_size) {
+  std::vector<std::vector<std::pair<std::string, std::string>>> chunks;
+  for (size_t begin = 0; begin < functions.size(); begin += chunk_size) {
+    const size_t end = std::min(functions.size(), begin + chunk_size);
+    chunks.emplace_back(functions.begin() + begin, functions.begin() + end);
+  }
+  return chunks;
 }
 
 bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
   LOG(INFO) << "ErrorBlocksPass running on module...";
+  ScopedPassMetrics pass_metrics("ErrorBlocksPass");
+  Counter &scc_iterations = GetSccIterationsCounter("ErrorBlocksPass");
   module_ = &module;
 
-  // Generating the call graph and traversing the SCCs bottom-up.
-  llvm::CallGraph call_graph = CallGraphUnderapproximation(module);
+  if (progress_reporter_) {
+    progress_reporter_->SetCurrentPass("ErrorBlocksPass");
+  }
 
-  // Going to first run with the LLM on third-party functions, seeing if it
-  // knows anything just by name (e.g., malloc, fwrite, etc.).
-  // TODO(patrickjchap): Undo this
-  bool updated_third_party = runOnThirdPartyFunctions(call_graph);
-  // bool updated_third_party = false;
-  if (updated_third_party) {
-    LOG(INFO) << "Updated third party functions!";
+  // Traversing the SCCs of the call graph bottom-up.
+  const CallGraphPass &call_graph = getAnalysis<CallGraphPass>();
+  function_table_.AddFunctions(call_graph);
+  GrowNameState();
+
+  if (!language_model_->IsLLMNameEmpty()) {
+    IndexCalleeSignals(module);
+    // Sources moved since compilation are looked for next to the ctags
+    // file, which sits at the root of the benchmark.
+    source_index_.reset(new SourceIndex(
+        module, llvm::sys::path::parent_path(ctags_file_).str()));
+    if (progress_reporter_) {
+      progress_reporter_->SetLlmContextTokenBudget(llm_context_token_budget_);
+    }
   }
 
+  // Going to first run with the LLM on third-party functions, seeing if it
+  // knows anything just by name (e.g., malloc, fwrite, etc.). The answers
+  // are applied as they arrive; an SCC only waits for the ones about the
+  // functions it calls.
+  StartThirdPartyQueries(call_graph);
+
   // The set of functions whose error specifications have converged
   // and are not bottom, along with their return type.
   std::unordered_map<std::string, FunctionReturnType> converged_functions;
@@ -165,7 +282,11 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
     FunctionReturnType typ =
         f == nullptr ? FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER
                      : GetReturnType(*f);
-    function_return_types_.insert(std::make_pair(kv.first, typ));
+    FunctionReturnType &return_type =
+        function_return_types_[function_table_.FindName(kv.first)];
+    if (return_type == FunctionReturnType::FUNCTION_RETURN_TYPE_INVALID) {
+      return_type = typ;
+    }
     converged_functions.insert(std::make_pair(kv.first, typ));
   }
 
@@ -178,84 +299,155 @@ bool ErrorBlocksPass::runOnModule(llvm::Module &module) {
     AddNonDoomedFunction(function_label);
   }
 
-  for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
-       ++scc_it) {
-    std::vector<llvm::Function *> scc_funcs;
-    for (auto node : *scc_it) {
-      auto f = node->getFunction();
-      if (!IgnoreFunction(f)) scc_funcs.push_back(f);
+  // Collect the functions of the SCCs bottom-up. SCCs on the same level of
+  // the call graph never call each other, so all of their functions are
+  // ready for the LLM at the same time and can be queried in one batch.
+  std::vector<std::vector<llvm::Function *>> sccs(call_graph.NumSccs());
+  for (SccId scc = 0; scc < call_graph.NumSccs(); ++scc) {
+    for (FunctionId function : call_graph.GetSccFunctions(scc)) {
+      auto f = call_graph.GetFunction(function);
+      if (!IgnoreFunction(f)) sccs[scc].push_back(f);
     }
-    const bool has_loop = scc_it.hasLoop();
-    bool changed = false;
-    do {
-      changed = false;
-      for (auto func : scc_funcs) {
-        // Analyzing the function, attempting to infer a specification.
-        changed = RunOnFunction(func) || changed;
+  }
+
+  if (!language_model_->IsLLMNameEmpty() && HasLlmQueryBudget()) {
+    RankLlmCandidates(sccs);
+  }
+
+  if (progress_reporter_) progress_reporter_->SetSccsTotal(sccs.size());
+
+  for (uint32_t level = 0; level < call_graph.NumLevels(); ++level) {
+    const llvm::ArrayRef<SccId> depth_sccs = call_graph.GetLevelSccs(level);
+    for (size_t scc_index : depth_sccs) {
+      const auto &scc_funcs = sccs[scc_index];
+      const bool has_loop = call_graph.SccHasLoop(scc_index);
+      TimelineSpan scc_span(kTimelineScc, "Scc");
+      scc_span.Arg("scc", scc_index)
+          .Arg("level", level)
+          .Arg("functions", scc_funcs.size());
+      ApplyThirdPartyQueries(/*wait=*/false);
+      {
+        TimelineSpan await_span(kTimelineLlm, "AwaitThirdPartyQueries");
+        for (auto func : scc_funcs) AwaitThirdPartyQueries(*func);
       }
-      // Perform fixpoint only if SCC has a loop.
-    } while (has_loop && changed);
+      bool changed = false;
+      int64_t iterations = 0;
+      do {
+        changed = false;
+        scc_iterations.Increment();
+        ++iterations;
+        for (auto func : scc_funcs) {
+          // Analyzing the function, attempting to infer a specification.
+          changed = RunOnFunction(func) || changed;
+        }
+        // Perform fixpoint only if SCC has a loop.
+      } while (has_loop && changed);
+      scc_span.Arg("iterations", iterations);
+    }
 
     if (!language_model_->IsLLMNameEmpty()) {
       const auto &return_range_pass = getAnalysis<ReturnRangePass>();
-      auto it1 = std::partition(
-          scc_funcs.begin(), scc_funcs.end(),
-          [this, &return_range_pass](llvm::Function *func) {
-            const auto return_range = return_range_pass.GetReturnRange(
-                *func,
-                /*default=*/SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP);
-            std::string func_name = GetSourceName(*func);
-            return ReturnsDomainKnowledgeCodes(func_name) ||
-                   ConfidenceLattice::IsEmptyset(
-                       GetErrorSpecification(func_name)) ||
-                   !ConfidenceLattice::IsUnknown(
-                       GetErrorSpecification(func_name));
-          });
-      // it1 to scc_funcs.end() are the functions whose error
-      // specifications are bottom. We only need to expand the error
-      // specifications for these functions.
-      auto it2 =
-          std::partition(it1, std::end(scc_funcs),
-                         [this, &converged_functions](llvm::Function *func) {
-                           // return ExpandErrorSpecification(func,
-                           // converged_functions);
-                           return LlmExpandErrorSpecification(func);
-                         });
-      // scc_funcs.begin() to it2 are the functions whose error
-      // specifications
-      // are not bottom and have converged. Add these to the set of
-      //      converged
-      // functions.
-      std::for_each(std::begin(scc_funcs), it2,
-                    [this, &converged_functions](auto f) {
-                      converged_functions.insert(
-                          std::make_pair(GetSourceName(*f), GetReturnType(*f)));
-                    });
+      // For each SCC, the start of its functions whose error specifications
+      // are bottom. We only need to expand the error specifications for
+      // these functions.
+      std::vector<std::vector<llvm::Function *>::iterator> unknown_begins;
+      std::vector<llvm::Function *> depth_funcs;
+      std::vector<llvm::Function *> to_expand;
+      for (size_t scc_index : depth_sccs) {
+        auto &scc_funcs = sccs[scc_index];
+        depth_funcs.insert(depth_funcs.end(), scc_funcs.begin(),
+                           scc_funcs.end());
+        auto it1 = std::partition(
+            scc_funcs.begin(), scc_funcs.end(),
+            [this, &return_range_pass](llvm::Function *func) {
+              const auto return_range = return_range_pass.GetReturnRange(
+                  *func,
+                  /*default=*/SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP);
+              std::string func_name = GetSourceName(*func);
+              return ReturnsDomainKnowledgeCodes(func_name) ||
+                     ConfidenceLattice::IsEmptyset(
+                         GetErrorSpecification(func_name)) ||
+                     !ConfidenceLattice::IsUnknown(
+                         GetErrorSpecification(func_name));
+            });
+        unknown_begins.push_back(it1);
+        to_expand.insert(to_expand.end(), it1, scc_funcs.end());
+      }
+
+      const std::unordered_set<llvm::Function *> expanded =
+          LlmExpandErrorSpecifications(AdmitLlmQueries(depth_funcs, to_expand));
+
+      for (size_t i = 0; i < depth_sccs.size(); ++i) {
+        auto &scc_funcs = sccs[depth_sccs[i]];
+        auto it2 = std::partition(unknown_begins[i], std::end(scc_funcs),
+                                  [&expanded](llvm::Function *func) {
+                                    return expanded.count(func) > 0;
+                                  });
+        // scc_funcs.begin() to it2 are the functions whose error
+        // specifications are not bottom and have converged. Add these to the
+        // set of converged functions.
+        std::for_each(std::begin(scc_funcs), it2,
+                      [this, &converged_functions](auto f) {
+                        converged_functions.insert(std::make_pair(
+                            GetSourceName(*f), GetReturnType(*f)));
+                      });
+      }
     }
+    if (progress_reporter_) {
+      for (size_t i = 0; i < depth_sccs.size(); ++i) {
+        progress_reporter_->IncrementSccsProcessed();
+      }
+    }
+  }
+
+  // Answers about functions that nothing analyzed calls still belong in the
+  // results.
+  {
+    TimelineSpan await_span(kTimelineLlm, "AwaitThirdPartyQueries");
+    ApplyThirdPartyQueries(/*wait=*/true);
   }
 
+  // The specifications have converged, so every call can now be checked
+  // against the specification of its callee.
+  CheckViolations();
+
   // Just printing off the reachable functions and the total count, as well as
   // the total count of specifications.
-  LOG(INFO) << "Functions that are non-doomed:";
-  for (auto non_doomed_function_name : non_doomed_function_names_) {
-    LOG(INFO) << non_doomed_function_name;
+  for (NameId name = 0; name < non_doomed_functions_.size(); ++name) {
+    if (non_doomed_functions_[name]) {
+      TRACE(kTraceFunction, "NonDoomed")
+          .Arg("f", function_table_.GetName(name));
+    }
   }
 
   // We can ignore checking for LLVM intrinsics here as IgnoreFunction() is
   // called on every function before it gets added to function_return_types_.
   auto total_non_void_functions = std::count_if(
       function_return_types_.begin(), function_return_types_.end(),
-      [this](std::pair<std::string, FunctionReturnType> f) {
-        return f.second == FunctionReturnType::FUNCTION_RETURN_TYPE_INTEGER ||
-               f.second == FunctionReturnType::FUNCTION_RETURN_TYPE_POINTER;
+      [](FunctionReturnType return_type) {
+        return return_type ==
+                   FunctionReturnType::FUNCTION_RETURN_TYPE_INTEGER ||
+               return_type == FunctionReturnType::FUNCTION_RETURN_TYPE_POINTER;
       });
 
   LOG(INFO) << "Total number of Integer/Pointer functions: "
             << total_non_void_functions;
   LOG(INFO) << "Total number of non-doomed functions: "
-            << non_doomed_function_names_.size();
+            << std::count(non_doomed_functions_.begin(),
+                          non_doomed_functions_.end(), true);
   LOG(INFO) << "Total number of specifications inferred: "
-            << error_specifications_.size();
+            << std::count_if(error_specifications_.begin(),
+                             error_specifications_.end(),
+                             [](const LatticeElementConfidence &spec) {
+                               return !ConfidenceLattice::IsUnknown(spec);
+                             });
+  if (HasLlmQueryBudget()) {
+    LOG(INFO) << "LLM queries: " << llm_queries_used_ << " ("
+              << llm_tokens_used_ << " estimated tokens), skipped "
+              << llm_skipped_functions_.size() << " functions";
+  }
+  LOG(INFO) << "LLM cache hits: " << language_model_->cache_hits()
+            << ", misses: " << language_model_->cache_misses();
 
   LOG(INFO) << "ErrorBlocks Finished";
   google::FlushLogFiles(google::INFO);
@@ -332,12 +524,12 @@ void ErrorBlocksPass::AddInferenceSourceZero(std::string function_name,
   sources_of_inference_zero_[function_name].insert(context_function);
 }
 
-bool ErrorBlocksPass::LlmExpandThirdPartyErrorSpecifications(
+void ErrorBlocksPass::StartThirdPartyQuery(
     std::vector<std::pair<std::string, std::string>> function_names) {
-  LOG(INFO) << "LLM Third party expansion";
-  bool updated = false;
-  std::vector<Specification> specifications;
-  std::vector<std::string> specification_function_names;
+  LOG(INFO) << "LLM Third party expansion of " << function_names.size()
+            << " functions";
+  ThirdPartyQuery query;
+  query.function_names = std::move(function_names);
   for (auto init_spec : initial_error_specifications_) {
     Function f;
     f.set_llvm_name(init_spec.first);
@@ -347,11 +539,47 @@ bool ErrorBlocksPass::LlmExpandThirdPartyErrorSpecifications(
     s.set_lattice_element(
         ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
             init_spec.second));
-    specifications.push_back(s);
-    specification_function_names.push_back(init_spec.first);
+    query.specifications.push_back(s);
+    query.context_function_names.push_back(init_spec.first);
+  }
+  // The most relevant domain knowledge is what the callers of the
+  // third-party functions also call.
+  std::unordered_set<std::string> third_party_callers;
+  for (const auto &function_name : query.function_names) {
+    auto callers_it = callers_.find(function_name.first);
+    if (callers_it == callers_.end()) continue;
+    third_party_callers.insert(callers_it->second.begin(),
+                               callers_it->second.end());
+  }
+  SelectLlmContext(third_party_callers,
+                   kThirdPartyContextTokensPerSpecification,
+                   &query.specifications, &query.context_function_names);
+  if (progress_reporter_) progress_reporter_->IncrementLlmCallsIssued();
+  query.pending = language_model_->StartThirdPartySpecifications(
+      query.function_names, query.specifications, error_code_names_,
+      success_code_names_);
+
+  const size_t index = third_party_queries_.size();
+  for (const auto &function_name : query.function_names) {
+    pending_third_party_functions_[function_name.first] = index;
+  }
+  third_party_queries_.push_back(std::move(query));
+}
+
+bool ErrorBlocksPass::ApplyThirdPartyQuery(size_t index) {
+  ThirdPartyQuery &query = third_party_queries_[index];
+  if (!query.pending) return false;
+  auto llm_specifications = query.pending->Get();
+  query.pending.reset();
+  for (const auto &function_name : query.function_names) {
+    pending_third_party_functions_.erase(function_name.first);
   }
-  auto llm_specifications = language_model_->GetThirdPartySpecifications(
-      function_names, specifications, error_code_names_, success_code_names_);
+  if (progress_reporter_) progress_reporter_->IncrementLlmCallsCompleted();
+
+  const std::vector<Specification> &specifications = query.specifications;
+  const std::vector<std::string> &specification_function_names =
+      query.context_function_names;
+  bool updated = false;
   for (auto specification : llm_specifications) {
     // This is confusing, but we are translating the proto "BOTTOM" response
     // from the model as emptyset, since we are only passing lattice elements
@@ -364,7 +592,9 @@ bool ErrorBlocksPass::LlmExpandThirdPartyErrorSpecifications(
     lattice_confidence =
         ConfidenceLattice::SignLatticeElementToLatticeElementConfidence(
             specification.second, kMinConfidence, 0.5);
-    LOG(INFO) << "LLama says: " << lattice_confidence;
+    TRACE(kTraceFunction, "LlmThirdPartyAnswer")
+        .Arg("f", specification.first)
+        .Arg("answer", lattice_confidence);
     bool updated_spec =
         UpdateErrorSpecification(specification.first, lattice_confidence) ||
         updated;
@@ -373,9 +603,9 @@ bool ErrorBlocksPass::LlmExpandThirdPartyErrorSpecifications(
     updated = updated_spec || updated;
     if (updated_spec) {
       llm_specifications_[specification.first] = specifications;
-      LOG(INFO) << "LLM successful update!";
-      LOG(INFO) << "LLM specification: "
-                << GetErrorSpecification(specification.first);
+      TRACE(kTraceFunction, "LlmUpdate")
+          .Arg("f", specification.first)
+          .Arg("spec", GetErrorSpecification(specification.first));
       AddInferenceSources(specification.first, specification_function_names,
                           GetErrorSpecification(specification.first));
       inferred_with_llm_.insert(specification.first);
@@ -384,10 +614,74 @@ bool ErrorBlocksPass::LlmExpandThirdPartyErrorSpecifications(
   return updated;
 }
 
-bool ErrorBlocksPass::LlmExpandErrorSpecification(llvm::Function *func) {
+void ErrorBlocksPass::ApplyThirdPartyQueries(bool wait) {
+  if (pending_third_party_functions_.empty()) return;
+  for (size_t i = 0; i < third_party_queries_.size(); ++i) {
+    const ThirdPartyQuery &query = third_party_queries_[i];
+    if (query.pending && (wait || query.pending->IsReady())) {
+      ApplyThirdPartyQuery(i);
+    }
+  }
+}
+
+void ErrorBlocksPass::AwaitThirdPartyQueries(const llvm::Function &func) {
+  if (pending_third_party_functions_.empty()) return;
+  for (const auto &basic_block : func) {
+    for (const auto &inst : basic_block) {
+      const auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call) continue;
+      auto pending_it =
+          pending_third_party_functions_.find(GetCalleeSourceName(*call));
+      if (pending_it != pending_third_party_functions_.end()) {
+        ApplyThirdPartyQuery(pending_it->second);
+      }
+    }
+  }
+}
+
+std::unordered_set<llvm::Function *>
+ErrorBlocksPass::LlmExpandErrorSpecifications(
+    const std::vector<llvm::Function *> &funcs) {
+  // All queries are built before any answer is applied, so every function
+  // sees the same context no matter where it sits in the batch.
+  std::vector<LlmQuery> queries;
+  std::vector<GptSpecificationQuery> gpt_queries;
+  for (llvm::Function *func : funcs) {
+    LlmQuery query;
+    if (!BuildLlmQuery(func, &query)) continue;
+    gpt_queries.push_back(query.query);
+    queries.push_back(std::move(query));
+  }
+
+  std::unordered_set<llvm::Function *> updated_funcs;
+  if (queries.empty()) return updated_funcs;
+
+  if (progress_reporter_) {
+    progress_reporter_->IncrementLlmCallsIssued(queries.size());
+  }
+  TimelineSpan llm_span(kTimelineLlm, "GetSpecificationsBatch");
+  llm_span.Arg("queries", queries.size());
+  auto llm_specifications = language_model_->GetSpecificationsBatch(
+      gpt_queries, error_code_names_, success_code_names_);
+  llm_span.End();
+  if (progress_reporter_) {
+    progress_reporter_->IncrementLlmCallsCompleted(queries.size());
+  }
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (ApplyLlmSpecifications(queries[i], llm_specifications[i])) {
+      updated_funcs.insert(queries[i].func);
+    }
+  }
+  return updated_funcs;
+}
+
+bool ErrorBlocksPass::BuildLlmQuery(llvm::Function *func,
+                                    LlmQuery *out_query) {
   // LLM needs function source code on this step, so must have basic blocks.
   if (!func || func->begin() == func->end()) return false;
-  const std::string func_name = GetSourceName(*func);
+  const NameId func_name_id = function_table_.GetNameId(*func);
+  const std::string &func_name = function_table_.GetName(func_name_id);
   LOG(INFO) << "LLM Expand " << func_name;
   // TODO(patrickjchap): After testing, we need to ensure we have all the
   // called function error specifications passed to the LLM for
@@ -397,63 +691,339 @@ bool ErrorBlocksPass::LlmExpandErrorSpecification(llvm::Function *func) {
   short average_non_zero_confidence = 0;
   short divisor = 0;
   std::vector<std::string> specification_function_names;
-  if (called_functions_.find(func_name) != called_functions_.end()) {
-    for (auto called_function : called_functions_[func_name]) {
-      auto lattice_confidence = GetErrorSpecification(called_function);
-      if (ConfidenceLattice::IsUnknown(lattice_confidence)) {
-        LOG(INFO) << "No error specification for called " << called_function;
-        continue;
-      }
-      LOG(INFO) << "Found called error specification for " << called_function;
-      SignLatticeElement lattice_element =
-          ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
-              lattice_confidence);
-      Function f;
-      f.set_llvm_name(called_function);
-      f.set_source_name(called_function);
-      Specification s;
-      s.mutable_function()->CopyFrom(f);
-      s.set_lattice_element(lattice_element);
-      s.set_confidence_emptyset(lattice_confidence.GetConfidenceEmptyset());
-      s.set_confidence_less_than_zero(
-          lattice_confidence.GetConfidenceLessThanZero());
-      if (lattice_confidence.GetConfidenceLessThanZero() > max_confidence_val) {
-        max_confidence_val = lattice_confidence.GetConfidenceLessThanZero();
-      }
-      if (lattice_confidence.GetConfidenceLessThanZero() > kMinConfidence) {
-        average_non_zero_confidence =
-            lattice_confidence.GetConfidenceLessThanZero();
-        divisor++;
-      }
-      s.set_confidence_zero(lattice_confidence.GetConfidenceZero());
-      if (lattice_confidence.GetConfidenceZero() > max_confidence_val) {
-        max_confidence_val = lattice_confidence.GetConfidenceZero();
-      }
-      if (lattice_confidence.GetConfidenceZero() > kMinConfidence) {
-        average_non_zero_confidence = lattice_confidence.GetConfidenceZero();
-        divisor++;
+  for (NameId called_function_id : called_functions_[func_name_id]) {
+    const std::string &called_function =
+        function_table_.GetName(called_function_id);
+    auto lattice_confidence = GetErrorSpecification(called_function_id);
+    if (ConfidenceLattice::IsUnknown(lattice_confidence)) {
+      TRACE(kTraceFunction, "LlmContextMissing").Arg("g", called_function);
+      continue;
+    }
+    TRACE(kTraceFunction, "LlmContextFound").Arg("g", called_function);
+    SignLatticeElement lattice_element =
+        ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
+            lattice_confidence);
+    Function f;
+    f.set_llvm_name(called_function);
+    f.set_source_name(called_function);
+    Specification s;
+    s.mutable_function()->CopyFrom(f);
+    s.set_lattice_element(lattice_element);
+    s.set_confidence_emptyset(lattice_confidence.GetConfidenceEmptyset());
+    s.set_confidence_less_than_zero(
+        lattice_confidence.GetConfidenceLessThanZero());
+    if (lattice_confidence.GetConfidenceLessThanZero() > max_confidence_val) {
+      max_confidence_val = lattice_confidence.GetConfidenceLessThanZero();
+    }
+    if (lattice_confidence.GetConfidenceLessThanZero() > kMinConfidence) {
+      average_non_zero_confidence =
+          lattice_confidence.GetConfidenceLessThanZero();
+      divisor++;
+    }
+    s.set_confidence_zero(lattice_confidence.GetConfidenceZero());
+    if (lattice_confidence.GetConfidenceZero() > max_confidence_val) {
+      max_confidence_val = lattice_confidence.GetConfidenceZero();
+    }
+    if (lattice_confidence.GetConfidenceZero() > kMinConfidence) {
+      average_non_zero_confidence = lattice_confidence.GetConfidenceZero();
+      divisor++;
+    }
+    s.set_confidence_greater_than_zero(
+        lattice_confidence.GetConfidenceGreaterThanZero());
+    if (lattice_confidence.GetConfidenceGreaterThanZero() >
+        max_confidence_val) {
+      max_confidence_val = lattice_confidence.GetConfidenceGreaterThanZero();
+    }
+    if (lattice_confidence.GetConfidenceGreaterThanZero() > kMinConfidence) {
+      average_non_zero_confidence =
+          lattice_confidence.GetConfidenceGreaterThanZero();
+      divisor++;
+    }
+    specifications.push_back(s);
+    specification_function_names.push_back(called_function);
+  }
+  if (divisor != 0) {
+    average_non_zero_confidence = average_non_zero_confidence / divisor;
+  }
+  SelectLlmContext({func_name}, kContextTokensPerSpecification,
+                   &specifications, &specification_function_names);
+
+  out_query->func = func;
+  out_query->query.function_name = func_name;
+  out_query->query.specifications = std::move(specifications);
+  // Without debug info or sources the definition stays empty and the
+  // service falls back to ctags.
+  if (source_index_) {
+    source_index_->GetFunctionSource(*func,
+                                     &out_query->query.function_definition);
+  }
+  out_query->context_function_names = std::move(specification_function_names);
+  out_query->average_non_zero_confidence = average_non_zero_confidence;
+  return true;
+}
+
+void ErrorBlocksPass::IndexCalleeSignals(llvm::Module &module) {
+  ReturnConstraintsPass &return_constraints_pass =
+      getAnalysis<ReturnConstraintsPass>();
+  for (const auto &func : module) {
+    if (func.isDeclaration()) continue;
+    const std::string caller_name = GetSourceName(func);
+    auto &signals = callee_signals_[caller_name];
+    for (const auto &basic_block : func) {
+      // Constraints on executing the block, keyed by the function whose
+      // return value is checked.
+      const ReturnConstraintsFact &return_constraints_fact =
+          return_constraints_pass.GetInFact(
+              GetFirstInstructionOfBB(&basic_block));
+      for (const auto &kv : return_constraints_fact.value) {
+        if (!kv.first.empty()) signals[kv.first].constrained = true;
       }
-      s.set_confidence_greater_than_zero(
-          lattice_confidence.GetConfidenceGreaterThanZero());
-      if (lattice_confidence.GetConfidenceGreaterThanZero() >
-          max_confidence_val) {
-        max_confidence_val = lattice_confidence.GetConfidenceGreaterThanZero();
+      for (const auto &inst : basic_block) {
+        const auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        if (!call) continue;
+        const std::string callee_name = GetCalleeSourceName(*call);
+        if (callee_name.empty()) continue;
+        ++signals[callee_name].call_sites;
+        callers_[callee_name].insert(caller_name);
       }
-      if (lattice_confidence.GetConfidenceGreaterThanZero() > kMinConfidence) {
-        average_non_zero_confidence =
-            lattice_confidence.GetConfidenceGreaterThanZero();
-        divisor++;
+    }
+  }
+}
+
+void ErrorBlocksPass::SelectLlmContext(
+    const std::unordered_set<std::string> &callers,
+    uint64_t tokens_per_specification,
+    std::vector<Specification> *specifications,
+    std::vector<std::string> *function_names) {
+  struct Candidate {
+    size_t index;
+    bool direct;
+    bool constrained;
+    uint64_t call_sites;
+    uint64_t tokens;
+  };
+
+  std::vector<Candidate> candidates;
+  uint64_t total_tokens = 0;
+  for (size_t i = 0; i < function_names->size(); ++i) {
+    const std::string &function_name = (*function_names)[i];
+    Candidate candidate{i, false, false, 0, 0};
+    for (const auto &caller : callers) {
+      auto caller_it = callee_signals_.find(caller);
+      if (caller_it == callee_signals_.end()) continue;
+      auto signals_it = caller_it->second.find(function_name);
+      if (signals_it == caller_it->second.end()) continue;
+      candidate.direct = candidate.direct || signals_it->second.call_sites > 0;
+      candidate.constrained =
+          candidate.constrained || signals_it->second.constrained;
+      candidate.call_sites += signals_it->second.call_sites;
+    }
+    candidate.tokens =
+        (function_name.size() + kContextBytesPerToken - 1) /
+            kContextBytesPerToken +
+        tokens_per_specification;
+    total_tokens += candidate.tokens;
+    candidates.push_back(candidate);
+  }
+  if (total_tokens <= llm_context_token_budget_) {
+    if (progress_reporter_) {
+      progress_reporter_->AddLlmContextSelection(candidates.size(), 0);
+    }
+    return;
+  }
+
+  // Ties are broken by name so that the same inputs always give the same
+  // prompt, and thus the same LLM cache key.
+  std::sort(candidates.begin(), candidates.end(),
+            [function_names](const Candidate &a, const Candidate &b) {
+              if (a.direct != b.direct) return a.direct;
+              if (a.constrained != b.constrained) return a.constrained;
+              if (a.call_sites != b.call_sites) {
+                return a.call_sites > b.call_sites;
+              }
+              return (*function_names)[a.index] < (*function_names)[b.index];
+            });
+
+  // Fill the budget greedily; a long name that does not fit may leave room
+  // for shorter, less relevant ones.
+  std::vector<Specification> kept_specifications;
+  std::vector<std::string> kept_function_names;
+  uint64_t used_tokens = 0;
+  for (const Candidate &candidate : candidates) {
+    if (used_tokens + candidate.tokens > llm_context_token_budget_) continue;
+    used_tokens += candidate.tokens;
+    kept_specifications.push_back((*specifications)[candidate.index]);
+    kept_function_names.push_back((*function_names)[candidate.index]);
+  }
+
+  const uint64_t dropped = candidates.size() - kept_specifications.size();
+  TRACE(kTraceFunction, "LlmContextSelected")
+      .Arg("kept", kept_specifications.size())
+      .Arg("candidates", candidates.size())
+      .Arg("tokens", used_tokens)
+      .Arg("candidate_tokens", total_tokens);
+  if (progress_reporter_) {
+    progress_reporter_->AddLlmContextSelection(kept_specifications.size(),
+                                               dropped);
+  }
+  *specifications = std::move(kept_specifications);
+  *function_names = std::move(kept_function_names);
+}
+
+bool ErrorBlocksPass::HasLlmQueryBudget() const {
+  return llm_query_budget_ > 0 || llm_token_budget_ > 0;
+}
+
+void ErrorBlocksPass::RankLlmCandidates(
+    const std::vector<std::vector<llvm::Function *>> &sccs) {
+  // Walking the SCCs top-down values every caller before its callees.
+  // Callers in the same SCC pass on nothing, which keeps recursion finite.
+  std::unordered_map<std::string, double> values;
+  for (auto scc_it = sccs.rbegin(); scc_it != sccs.rend(); ++scc_it) {
+    std::vector<LlmCandidate> scc_candidates;
+    for (llvm::Function *func : *scc_it) {
+      if (!func || func->isDeclaration()) continue;
+      LlmCandidate candidate{func, GetSourceName(*func), kLlmQueryBaseValue,
+                             0, false};
+      auto callers_it = callers_.find(candidate.name);
+      if (callers_it != callers_.end()) {
+        for (const auto &caller : callers_it->second) {
+          auto caller_it = callee_signals_.find(caller);
+          if (caller_it == callee_signals_.end()) continue;
+          auto signals_it = caller_it->second.find(candidate.name);
+          if (signals_it == caller_it->second.end()) continue;
+          candidate.value += kCallSiteValue * signals_it->second.call_sites;
+          if (!signals_it->second.constrained) continue;
+          candidate.value += kCheckingCallerValue;
+          auto value_it = values.find(caller);
+          if (value_it != values.end()) {
+            candidate.value += kPropagatedValueDecay * value_it->second;
+          }
+        }
       }
-      specifications.push_back(s);
-      specification_function_names.push_back(called_function);
+      candidate.estimated_tokens =
+          EstimateLlmQueryTokens(*func, candidate.name);
+      scc_candidates.push_back(std::move(candidate));
+    }
+    for (auto &candidate : scc_candidates) {
+      values[candidate.name] = candidate.value;
+      llm_candidates_.push_back(std::move(candidate));
     }
   }
-  if (divisor != 0) {
-    average_non_zero_confidence = average_non_zero_confidence / divisor;
+
+  // Ties are broken by name so that the same module always spends the
+  // budget on the same functions.
+  std::sort(llm_candidates_.begin(), llm_candidates_.end(),
+            [](const LlmCandidate &a, const LlmCandidate &b) {
+              if (a.value != b.value) return a.value > b.value;
+              return a.name < b.name;
+            });
+  for (size_t i = 0; i < llm_candidates_.size(); ++i) {
+    llm_candidate_indices_[llm_candidates_[i].func] = i;
+  }
+  LOG(INFO) << "Ranked " << llm_candidates_.size()
+            << " LLM query candidates for a budget of " << llm_query_budget_
+            << " queries and " << llm_token_budget_ << " tokens";
+}
+
+uint64_t ErrorBlocksPass::EstimateLlmQueryTokens(
+    const llvm::Function &func, const std::string &func_name) {
+  GptSpecificationQuery query;
+  query.function_name = func_name;
+  if (source_index_) {
+    source_index_->GetFunctionSource(func, &query.function_definition);
   }
+  // At most every callee can be in the context, within its budget.
+  uint64_t context_tokens = 0;
+  auto signals_it = callee_signals_.find(func_name);
+  if (signals_it != callee_signals_.end()) {
+    for (const auto &kv : signals_it->second) {
+      if (kv.second.call_sites == 0) continue;
+      context_tokens +=
+          (kv.first.size() + kContextBytesPerToken - 1) /
+              kContextBytesPerToken +
+          kContextTokensPerSpecification;
+    }
+  }
+  return language_model_->EstimateSpecificationTokens(
+             query, error_code_names_, success_code_names_) +
+         std::min(context_tokens, llm_context_token_budget_);
+}
+
+std::vector<llvm::Function *> ErrorBlocksPass::AdmitLlmQueries(
+    const std::vector<llvm::Function *> &depth_funcs,
+    const std::vector<llvm::Function *> &to_expand) {
+  if (!HasLlmQueryBudget()) return to_expand;
+
+  const std::unordered_set<const llvm::Function *> unknown(to_expand.begin(),
+                                                           to_expand.end());
+  for (const llvm::Function *func : depth_funcs) {
+    auto index_it = llm_candidate_indices_.find(func);
+    if (index_it == llm_candidate_indices_.end()) continue;
+    llm_candidates_[index_it->second].decided = true;
+    ++llm_candidates_decided_;
+    if (unknown.count(func) > 0) ++llm_candidates_unknown_;
+  }
+  const double later_share =
+      static_cast<double>(llm_candidates_unknown_ + 1) /
+      (llm_candidates_decided_ + 1);
+
+  auto fits = [this](double queries, double tokens) {
+    return (llm_query_budget_ == 0 || queries <= llm_query_budget_) &&
+           (llm_token_budget_ == 0 || tokens <= llm_token_budget_);
+  };
+  double queries = llm_queries_used_;
+  double tokens = llm_tokens_used_;
+  std::unordered_set<const llvm::Function *> admitted;
+  for (const LlmCandidate &candidate : llm_candidates_) {
+    const bool is_unknown = unknown.count(candidate.func) > 0;
+    if (candidate.decided && !is_unknown) continue;
+    const double share = is_unknown ? 1 : later_share;
+    if (!fits(queries + share, tokens + share * candidate.estimated_tokens)) {
+      continue;
+    }
+    queries += share;
+    tokens += share * candidate.estimated_tokens;
+    if (is_unknown) admitted.insert(candidate.func);
+  }
+
+  std::vector<llvm::Function *> to_query;
+  uint64_t skipped = 0;
+  for (llvm::Function *func : to_expand) {
+    auto index_it = llm_candidate_indices_.find(func);
+    // Functions without a body are never queried, so cost nothing.
+    if (index_it == llm_candidate_indices_.end()) {
+      to_query.push_back(func);
+      continue;
+    }
+    const LlmCandidate &candidate = llm_candidates_[index_it->second];
+    if (admitted.count(func) > 0) {
+      ++llm_queries_used_;
+      llm_tokens_used_ += candidate.estimated_tokens;
+      to_query.push_back(func);
+      continue;
+    }
+    LOG(INFO) << "LLM budget: skipping " << candidate.name << " (value "
+              << candidate.value << ")";
+    llm_skipped_functions_.insert(candidate.name);
+    ++skipped;
+  }
+  if (progress_reporter_ && skipped > 0) {
+    progress_reporter_->IncrementLlmQueriesSkipped(skipped);
+  }
+  return to_query;
+}
+
+bool ErrorBlocksPass::ApplyLlmSpecifications(
+    const LlmQuery &query,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &llm_specifications) {
+  const short average_non_zero_confidence = query.average_non_zero_confidence;
+  const std::vector<Specification> &specifications =
+      query.query.specifications;
+  const std::vector<std::string> &specification_function_names =
+      query.context_function_names;
   bool updated = false;
-  auto llm_specifications = language_model_->GetSpecification(
-      func_name, specifications, error_code_names_, success_code_names_);
   for (auto specification : llm_specifications) {
     // This is confusing, but we are translating the proto "BOTTOM" response
     // from the model as emptyset, since we are only passing lattice elements
@@ -467,15 +1037,17 @@ bool ErrorBlocksPass::LlmExpandErrorSpecification(llvm::Function *func) {
           ConfidenceLattice::SignLatticeElementToLatticeElementConfidence(
               specification.second, kMinConfidence, ratio);
     }
-    LOG(INFO) << "LLM says: " << lattice_confidence;
+    TRACE(kTraceFunction, "LlmAnswer")
+        .Arg("f", specification.first)
+        .Arg("answer", lattice_confidence);
     bool updated_spec =
         UpdateErrorSpecification(specification.first, lattice_confidence);
     // if (specification.first != func_name) continue;
     if (updated_spec) {
       llm_specifications_[specification.first] = specifications;
-      LOG(INFO) << "LLM successful update!";
-      LOG(INFO) << "LLM specification: "
-                << GetErrorSpecification(specification.first);
+      TRACE(kTraceFunction, "LlmUpdate")
+          .Arg("f", specification.first)
+          .Arg("spec", GetErrorSpecification(specification.first));
       AddInferenceSources(specification.first, specification_function_names,
                           GetErrorSpecification(specification.first));
       inferred_with_llm_.insert(specification.first);
@@ -486,25 +1058,25 @@ bool ErrorBlocksPass::LlmExpandErrorSpecification(llvm::Function *func) {
 }
 
 bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
-  const auto fn_name = GetSourceName(*fn);
+  const FunctionTable::FunctionInfo &fn_info = function_table_.GetInfo(*fn);
+  const std::string &fn_name = function_table_.GetName(fn_info.name);
   // Ideally we want to incorporate the LLVM names back into this, but the
   // entire pipeline would have to account for this, which it doesn't.... Just
   // take the first instance. This is very hacky and poorly written, but this
   // just needs to work for now.
-  if (name_to_function_.find(fn_name) != name_to_function_.end()) {
-    llvm::Function *found_func = (*(name_to_function_.find(fn_name))).second;
-    if (found_func != fn) {
-      return false;
-    }
-  } else {
-    name_to_function_[fn_name] = fn;
+  llvm::Function *&found_func = name_to_function_[fn_info.name];
+  if (found_func == nullptr) {
+    found_func = fn;
+  } else if (found_func != fn) {
+    return false;
   }
 
-  LOG(INFO) << "Analyze " << fn_name;
+  TRACE(kTraceFunction, "Analyze").Arg("f", fn_name);
+  TimelineSpan function_span(kTimelineFunction, "RunOnFunction");
+  if (function_span.Enabled()) function_span.Arg("function", fn_name);
+  if (progress_reporter_) progress_reporter_->IncrementFunctionsAnalyzed();
   // Add every function to return type map.
-  function_return_types_[fn_name] =
-      fn == nullptr ? FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER
-                    : GetReturnType(*fn);
+  function_return_types_[fn_info.name] = fn_info.return_type;
 
   // Initialize the join result to emptyset.
   std::vector<LatticeElementConfidence> block_confidences;
@@ -534,22 +1106,13 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
         kMinConfidence, kMinConfidence, kMinConfidence, kMaxConfidence);
   } else {
     // Join the result of every analyzed block.
-    std::for_each(
-        it, block_confidences.end(),
-        [&blocks_join_result](LatticeElementConfidence block_confidence) {
-          blocks_join_result =
-              ConfidenceLattice::Join(block_confidence, blocks_join_result);
-        });
+    blocks_join_result = ConfidenceLattice::JoinAll(
+        &*it, block_confidences.end() - it, blocks_join_result);
   }
 
   // We need these names to check for SmartSuccessCodeZero.
-  std::string parent_fname = GetSourceName(*fn);
-  std::string function_fname;
-  if (fn && fn->begin() != fn->end()) {
-    const llvm::Instruction *first_bb =
-        GetFirstInstructionOfBB(&*(fn->begin()));
-    function_fname = GetSourceFileName(*first_bb);
-  }
+  const std::string &parent_fname = fn_name;
+  const FileId function_fname = fn_info.file;
 
   // If 0 is the first processed error return statement, the heuristic will
   // incorrectly count it towards the error specification.
@@ -560,32 +1123,26 @@ bool ErrorBlocksPass::RunOnFunction(llvm::Function *fn) {
         blocks_join_result, SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
     if (downgraded_lattice_confidence != blocks_join_result) {
       blocks_join_result = downgraded_lattice_confidence;
-      LOG(INFO) << "Retroactively dropped 0 from error specification for "
-                << parent_fname;
+      TRACE(kTraceFunction, "RetroactiveDropZero").Arg("f", parent_fname);
     }
   }
 
   return UpdateErrorSpecification(fn, blocks_join_result);
 }
 
-std::set<SignLatticeElement> ErrorBlocksPass::CollectConstraints(
-    const llvm::Function &parent_function, const std::string &fn_name) {
-  std::set<SignLatticeElement> ret;
-
-  ReturnConstraintsPass &return_constraints_pass =
-      getAnalysis<ReturnConstraintsPass>();
+ErrorBlocksPass::ConstraintsByFunction ErrorBlocksPass::CollectConstraints(
+    const ReturnConstraintsPass &return_constraints_pass,
+    const llvm::Function &parent_function) const {
+  ConstraintsByFunction ret;
 
-  // Go over every instruction in parent_function.
+  // Go over every instruction in parent_function and collect the constraints
+  // on the return value of every function it calls.
   for (auto &basic_block : parent_function) {
     for (auto &inst : basic_block) {
-      ReturnConstraintsFact return_constraints_fact =
+      const ReturnConstraintsFact &return_constraints_fact =
           return_constraints_pass.GetInFact(&inst);
-      const auto &fn_constraint = return_constraints_fact.value.find(fn_name);
-      // If there there is constraint on the instruction associated with
-      // fn_name.
-      if (fn_constraint != return_constraints_fact.value.end()) {
-        // Then add that constraint to ret.
-        ret.insert(fn_constraint->second.lattice_element);
+      for (const auto &fn_constraint : return_constraints_fact.value) {
+        ret[fn_constraint.first].insert(fn_constraint.second.lattice_element);
       }
     }
   }
@@ -593,34 +1150,104 @@ std::set<SignLatticeElement> ErrorBlocksPass::CollectConstraints(
   return ret;
 }
 
-void ErrorBlocksPass::CheckViolations(const llvm::Function &func) {
-  for (const auto &basic_block : func) {
-    for (const auto &inst : basic_block) {
-      if (const llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
-        CheckViolations(*call);
-      }
+void ErrorBlocksPass::CheckViolations() {
+  const auto start = std::chrono::steady_clock::now();
+  TimelineSpan check_span(kTimelinePass, "CheckViolations");
+  if (progress_reporter_) progress_reporter_->SetCurrentPass("CheckViolations");
+  std::vector<const llvm::Function *> functions;
+  for (const auto &func : *module_) {
+    if (!func.isDeclaration() && !IgnoreFunction(&func)) {
+      functions.push_back(&func);
     }
   }
-}
 
-void ErrorBlocksPass::CheckViolations(const llvm::CallInst &call_inst) {
-  const Function callee_function = GetCallee(call_inst);
+  // Each thread records the violations it finds, tagged with the index of
+  // the function they are in. Sorting the merged records by that index
+  // reports them in module order however the functions were partitioned.
+  using IndexedViolation = std::pair<size_t, ViolationRecord>;
+  tbb::enumerable_thread_specific<std::vector<IndexedViolation>> buffers;
+  const ReturnConstraintsPass &return_constraints_pass =
+      getAnalysis<ReturnConstraintsPass>();
+  Timeline *timeline = Timeline::Current();
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, functions.size()),
+      [this, &functions, &buffers, &return_constraints_pass,
+       timeline](const tbb::blocked_range<size_t> &range) {
+        Timeline::Scope timeline_scope(timeline);
+        TimelineSpan range_span(kTimelineFunction, "CheckViolations");
+        range_span.Arg("functions", range.size());
+        std::vector<IndexedViolation> &buffer = buffers.local();
+        std::vector<ViolationRecord> violations;
+        for (size_t i = range.begin(); i != range.end(); ++i) {
+          violations.clear();
+          CheckViolations(return_constraints_pass, *functions[i],
+                          &violations);
+          for (const ViolationRecord &violation : violations) {
+            buffer.push_back(std::make_pair(i, violation));
+          }
+        }
+      });
 
-  const std::string &callee_function_name = callee_function.source_name();
-  auto confidence_it = error_specifications_.find(callee_function_name);
-  if (confidence_it == error_specifications_.end()) {
-    return;
+  std::vector<IndexedViolation> merged;
+  for (const auto &buffer : buffers) {
+    merged.insert(merged.end(), buffer.begin(), buffer.end());
   }
+  std::stable_sort(merged.begin(), merged.end(),
+                   [](const IndexedViolation &a, const IndexedViolation &b) {
+                     return a.first < b.first;
+                   });
+  std::vector<ViolationRecord> violations;
+  violations.reserve(merged.size());
+  for (const auto &indexed_violation : merged) {
+    violations.push_back(indexed_violation.second);
+  }
+  checker_->AddViolations(violations);
+
+  LOG(INFO) << "Checked " << functions.size() << " functions, found "
+            << violations.size() << " violations in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms";
+}
 
-  const LatticeElementConfidence &lattice_confidence = confidence_it->second;
+void ErrorBlocksPass::CheckViolations(
+    const ReturnConstraintsPass &return_constraints_pass,
+    const llvm::Function &func,
+    std::vector<ViolationRecord> *violations) const {
+  // The constraints are only needed for calls to functions that have a
+  // specification, and are collected at most once per function.
+  bool collected_constraints = false;
+  ConstraintsByFunction constraints;
+  const std::set<SignLatticeElement> no_constraints;
 
-  auto callee_constraints =
-      CollectConstraints(*(call_inst.getFunction()), callee_function_name);
+  for (const auto &basic_block : func) {
+    for (const auto &inst : basic_block) {
+      const llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call) continue;
+
+      const NameId callee = function_table_.GetCalleeNameId(*call);
+      const LatticeElementConfidence &lattice_confidence =
+          GetErrorSpecification(callee);
+      if (ConfidenceLattice::IsUnknown(lattice_confidence)) continue;
+      const std::string &callee_function_name = function_table_.GetName(callee);
+
+      if (!collected_constraints) {
+        constraints = CollectConstraints(return_constraints_pass, func);
+        collected_constraints = true;
+      }
+      auto constraints_it = constraints.find(callee_function_name);
 
-  SignLatticeElement lattice_element =
-      ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
-          lattice_confidence);
-  checker_->CheckViolations(call_inst, lattice_element, callee_constraints);
+      SignLatticeElement lattice_element =
+          ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
+              lattice_confidence);
+      checker_->CheckViolations(*call, lattice_element,
+                                constraints_it != constraints.end()
+                                    ? constraints_it->second
+                                    : no_constraints,
+                                violations);
+    }
+  }
 }
 
 LatticeElementConfidence ErrorBlocksPass::VisitBlock(
@@ -632,24 +1259,25 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
   LatticeElementConfidence join_result(kMinConfidence, kMinConfidence,
                                        kMinConfidence, kMaxConfidence);
 
-  std::string parent_fname = GetSourceName(*BB.getParent());
+  const NameId parent = function_table_.GetNameId(*BB.getParent());
+  const std::string &parent_fname = function_table_.GetName(parent);
   const llvm::Instruction *bb_first = GetFirstInstructionOfBB(&BB);
-  const std::string &function_fname = GetSourceFileName(*bb_first);
-  if (called_functions_.find(parent_fname) == called_functions_.end()) {
-    called_functions_[parent_fname] = {};
-  }
+  const FileId function_fname = function_table_.GetBlockFile(BB);
   for (auto ii = BB.begin(), ie = BB.end(); ii != ie; ++ii) {
     const llvm::Instruction &I = *ii;
     if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
       join_result = ConfidenceLattice::Join(VisitCallInst(*inst), join_result);
-      std::string callee_name = GetCalleeSourceName(*inst);
-      called_functions_[parent_fname].insert(callee_name);
-      LOG(INFO) << "Added called function -> " << callee_name << " for "
-                << parent_fname << "!";
+      const NameId callee = function_table_.GetCalleeNameId(*inst);
+      if (callee != FunctionTable::kNoName) {
+        called_functions_[parent].insert(callee);
+      }
+      TRACE(kTraceInstruction, "CalledFunction")
+          .Arg("f", parent_fname)
+          .Arg("g", function_table_.GetName(callee));
     }
   }
   ReturnedValuesPass &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-  ReturnedValuesFact rtf = returned_values_pass.GetInFact(bb_first);
+  const ReturnedValuesFact &rtf = returned_values_pass.GetInFact(bb_first);
 
   // Only process blocks that can return a single value,
   // i.e. there exists a value that must be returned. If this is not true,
@@ -667,19 +1295,21 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       int64_t return_value = int_return->getSExtValue();
 
       if (IsErrorCode(return_value, function_fname)) {
-        AddNonDoomedFunction(parent_fname);
+        AddNonDoomedFunction(parent);
         AddFunctionReturningDomainKnowledgeCodes(parent_fname);
         join_result = ConfidenceLattice::Join(
             AddErrorValue(BB.getParent(), return_value), join_result);
-        LOG(INFO) << "ErrorCode"
-                  << " c=" << return_value << *bb_first;
+        TRACE(kTraceInstruction, "ErrorCode")
+            .Arg("c", return_value)
+            .Arg("S", GetDebugLocation(*bb_first));
       } else if (IsSuccessCode(parent_fname, return_value, function_fname)) {
         // This check is different from the IsErrorCode check, since 0 might
         // not be considered a success code if the corresponding heuristic is
         // enabled.
         AddFunctionReturningDomainKnowledgeCodes(parent_fname);
-        LOG(INFO) << "SuccessCode"
-                  << " c=" << return_value << *bb_first;
+        TRACE(kTraceInstruction, "SuccessCode")
+            .Arg("c", return_value)
+            .Arg("S", GetDebugLocation(*bb_first));
         return join_result;
       }
     }
@@ -689,7 +1319,8 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
   ReturnConstraintsPass &return_constraints_pass =
       getAnalysis<ReturnConstraintsPass>();
   const llvm::Instruction *bb_last = GetLastInstructionOfBB(&BB);
-  ReturnConstraintsFact rcf = return_constraints_pass.GetOutFact(bb_last);
+  const ReturnConstraintsFact &rcf =
+      return_constraints_pass.GetOutFact(bb_last);
   // string constraint_fname is the function whose return value is
   // constraining this block. Constraint block_constraint is the abstract
   // value of the constraint on block execution. Constraint constraint_aerv is
@@ -747,14 +1378,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             /* >0 */ return_confidence_not_zero,
             block_intersection_confidence.GetConfidenceEmptyset());
 
-        LOG(INFO) << "ErrorConstantBool"
-                  << " f=" << parent_fname << *bb_last
-                  << " c=" << (*maybe_bool ? "true" : "false")
-                  << " abstracted=\"" << return_lattice_confidence << "\""
-                  << " fprime=" << constraint_fname << " l=\""
-                  << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
-                  << "\"";
+        TRACE(kTraceInstruction, "ErrorConstantBool")
+            .Arg("f", parent_fname)
+            .Arg("S", GetDebugLocation(*bb_last))
+            .Arg("c", *maybe_bool)
+            .Arg("abstracted", return_lattice_confidence)
+            .Arg("fprime", constraint_fname)
+            .Arg("l", block_constraint.lattice_element)
+            .Arg("E(fprime)", GetErrorSpecification(constraint_fname));
       } else if (const llvm::ConstantInt *int_return =
                      llvm::dyn_cast<llvm::ConstantInt>(returned_value)) {
         int64_t return_value = int_return->getSExtValue();
@@ -784,13 +1415,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             return_confidence_zero, return_confidence_less_than_zero,
             return_confidence_greater_than_zero,
             block_intersection_confidence.GetConfidenceEmptyset());
-        LOG(INFO) << "ErrorConstantInt"
-                  << " f=" << parent_fname << *bb_last << " c=" << return_value
-                  << " abstracted=\"" << return_lattice_confidence << "\""
-                  << " fprime=" << constraint_fname << " l=\""
-                  << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
-                  << "\"";
+        TRACE(kTraceInstruction, "ErrorConstantInt")
+            .Arg("f", parent_fname)
+            .Arg("S", GetDebugLocation(*bb_last))
+            .Arg("c", return_value)
+            .Arg("abstracted", return_lattice_confidence)
+            .Arg("fprime", constraint_fname)
+            .Arg("l", block_constraint.lattice_element)
+            .Arg("E(fprime)", GetErrorSpecification(constraint_fname));
       } else if (llvm::isa<llvm::ConstantPointerNull>(returned_value)) {
         propagate_callee = constraint_fname;
         // The confidence_zero should be the max of the constraining
@@ -801,13 +1433,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             return_confidence_zero, /* <0 */ kMinConfidence,
             /* >0 */ kMinConfidence,
             block_intersection_confidence.GetConfidenceEmptyset());
-        LOG(INFO) << "ErrorConstantNull"
-                  << " f=" << parent_fname << *bb_last << " c=0"
-                  << " abstracted=\"" << return_lattice_confidence << "\""
-                  << " fprime=" << constraint_fname << " l=\""
-                  << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname)
-                  << "\"";
+        TRACE(kTraceInstruction, "ErrorConstantNull")
+            .Arg("f", parent_fname)
+            .Arg("S", GetDebugLocation(*bb_last))
+            .Arg("c", 0)
+            .Arg("abstracted", return_lattice_confidence)
+            .Arg("fprime", constraint_fname)
+            .Arg("l", block_constraint.lattice_element)
+            .Arg("E(fprime)", GetErrorSpecification(constraint_fname));
       } else if (const auto maybe_string_literal =
                      ExtractStringLiteral(*returned_value)) {
         // The confidence_less_than_zero and confidence_greater_than_zero
@@ -822,13 +1455,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             return_confidence_greater_than_zero,
             block_intersection_confidence.GetConfidenceEmptyset());
         propagate_callee = constraint_fname;
-        LOG(INFO) << "ErrorStringLiteral"
-                  << " f=" << parent_fname << *bb_last << " c=\""
-                  << maybe_string_literal->str() << "\""
-                  << " abstracted=\"" << return_lattice_confidence << "\""
-                  << " fprime=" << constraint_fname << " l=\""
-                  << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << GetErrorSpecification(constraint_fname);
+        TRACE(kTraceInstruction, "ErrorStringLiteral")
+            .Arg("f", parent_fname)
+            .Arg("S", GetDebugLocation(*bb_last))
+            .Arg("c", maybe_string_literal->str())
+            .Arg("abstracted", return_lattice_confidence)
+            .Arg("fprime", constraint_fname)
+            .Arg("l", block_constraint.lattice_element)
+            .Arg("E(fprime)", GetErrorSpecification(constraint_fname));
       }
     }
 
@@ -855,16 +1489,18 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
         if (callee_name.compare(constraint_fname) == 0) {
           return_lattice_confidence = ConfidenceLattice::Meet(
               callee_confidence, block_intersection_confidence);
-          LOG(INFO) << "Returned function same as constraining function, "
-                    << "performing meet: " << return_lattice_confidence;
+          TRACE(kTraceInstruction, "PropagationMeet")
+              .Arg("g", callee_name)
+              .Arg("met", return_lattice_confidence);
         }
-        LOG(INFO) << "PropagationDirect"
-                  << " f=" << parent_fname << *bb_last
-                  << " fprime=" << constraint_fname << " constraint=\""
-                  << block_constraint.lattice_element << "\""
-                  << " E(fprime)=\"" << constraining_function_confidence << "\""
-                  << " g=\"" << propagate_callee << "\""
-                  << " E(g)=\"" << callee_confidence;
+        TRACE(kTraceInstruction, "PropagationDirect")
+            .Arg("f", parent_fname)
+            .Arg("S", GetDebugLocation(*bb_last))
+            .Arg("fprime", constraint_fname)
+            .Arg("constraint", block_constraint.lattice_element)
+            .Arg("E(fprime)", constraining_function_confidence)
+            .Arg("g", propagate_callee)
+            .Arg("E(g)", callee_confidence);
 
         AddInferenceSource(parent_fname, constraint_fname, callee_confidence);
         if (ReturnsDomainKnowledgeCodes(propagate_callee)) {
@@ -877,8 +1513,9 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
           if (downgraded_lattice_confidence != return_lattice_confidence) {
             // In this case, the heuristic didn't drop the callee's 0
             // return...
-            LOG(INFO) << "Downgraded directly propagated lattice element to "
-                      << downgraded_lattice_confidence;
+            TRACE(kTraceInstruction, "DowngradedDirect")
+                .Arg("f", parent_fname)
+                .Arg("downgraded", downgraded_lattice_confidence);
           }
           return_lattice_confidence = downgraded_lattice_confidence;
         }
@@ -888,8 +1525,8 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
       // The function is returning a value which can hold a call instruction
       // at this program point. Check to see if the returned value can hold
       // the return value of a function.
-      ReturnPropagationFact rpf =
-          *(return_propagation_pass.output_facts_.at(bb_last));
+      const ReturnPropagationFact &rpf =
+          return_propagation_pass.GetOutFact(bb_last);
 
       if (rpf.value.find(returned_value) != rpf.value.end()) {
         if (rpf.value.at(returned_value).size() > 1) {
@@ -926,13 +1563,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                 return_confidence_zero, return_confidence_less_than_zero,
                 return_confidence_greater_than_zero,
                 block_intersection_confidence.GetConfidenceEmptyset());
-            LOG(INFO) << "PropagationIndirectConstantInt"
-                      << " f=" << parent_fname << *bb_last
-                      << " c=" << return_value << " abstracted=\""
-                      << return_lattice_confidence << "\""
-                      << " fprime=" << constraint_fname << " constraint=\""
-                      << block_constraint.lattice_element << "\""
-                      << " E(fprime)=\"" << constraining_function_confidence;
+            TRACE(kTraceInstruction, "PropagationIndirectConstantInt")
+                .Arg("f", parent_fname)
+                .Arg("S", GetDebugLocation(*bb_last))
+                .Arg("c", return_value)
+                .Arg("abstracted", return_lattice_confidence)
+                .Arg("fprime", constraint_fname)
+                .Arg("constraint", block_constraint.lattice_element)
+                .Arg("E(fprime)", constraining_function_confidence);
             AddInferenceSource(parent_fname, constraint_fname,
                                return_lattice_confidence);
           } else if (llvm::isa<llvm::ConstantPointerNull>(v)) {
@@ -944,13 +1582,14 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                 return_confidence_zero, /* <0 */ kMinConfidence,
                 /* >0 */ kMinConfidence,
                 block_intersection_confidence.GetConfidenceEmptyset());
-            LOG(INFO) << "PropagationIndirectConstantNull"
-                      << " f=" << parent_fname << *bb_last << " c=0"
-                      << " abstracted=\"" << return_lattice_confidence << "\""
-                      << " fprime=" << constraint_fname << " l=\""
-                      << block_constraint.lattice_element << "\""
-                      << " E(fprime)=\""
-                      << GetErrorSpecification(constraint_fname) << "\"";
+            TRACE(kTraceInstruction, "PropagationIndirectConstantNull")
+                .Arg("f", parent_fname)
+                .Arg("S", GetDebugLocation(*bb_last))
+                .Arg("c", 0)
+                .Arg("abstracted", return_lattice_confidence)
+                .Arg("fprime", constraint_fname)
+                .Arg("l", block_constraint.lattice_element)
+                .Arg("E(fprime)", GetErrorSpecification(constraint_fname));
           } else if (const llvm::CallInst *call =
                          llvm::dyn_cast<llvm::CallInst>(v)) {
             std::string callee_name = GetCallee(*call).source_name();
@@ -969,21 +1608,22 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
             if (callee_name.compare(constraint_fname) == 0) {
               return_lattice_confidence = ConfidenceLattice::Meet(
                   callee_confidence, block_intersection_confidence);
-              LOG(INFO) << "Returned function same as constraining function, "
-                        << "performing meet: " << return_lattice_confidence;
+              TRACE(kTraceInstruction, "PropagationMeet")
+                  .Arg("g", callee_name)
+                  .Arg("met", return_lattice_confidence);
             }
 
             propagate_callee = callee_name;
             // If we return a call instruction (in this case indirectly), we
             // take the callee function's confidence.
-            LOG(INFO) << "PropagationIndirect"
-                      << " f=" << parent_fname << *bb_last
-                      << " fprime=" << constraint_fname << " constraint=\""
-                      << block_constraint.lattice_element << "\""
-                      << " E(fprime)=\"" << constraining_function_confidence
-                      << "\""
-                      << " g=\"" << propagate_callee << "\""
-                      << " E(g)=\"" << callee_confidence;
+            TRACE(kTraceInstruction, "PropagationIndirect")
+                .Arg("f", parent_fname)
+                .Arg("S", GetDebugLocation(*bb_last))
+                .Arg("fprime", constraint_fname)
+                .Arg("constraint", block_constraint.lattice_element)
+                .Arg("E(fprime)", constraining_function_confidence)
+                .Arg("g", propagate_callee)
+                .Arg("E(g)", callee_confidence);
 
             AddInferenceSource(parent_fname, constraint_fname,
                                callee_confidence);
@@ -996,9 +1636,9 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
                 return_lattice_confidence,
                 SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
             if (downgraded_lattice_confidence != return_lattice_confidence) {
-              LOG(INFO)
-                  << "Downgraded indirectly propagated lattice element to "
-                  << downgraded_lattice_confidence;
+              TRACE(kTraceInstruction, "DowngradedIndirect")
+                  .Arg("f", parent_fname)
+                  .Arg("downgraded", downgraded_lattice_confidence);
             }
             return_lattice_confidence = downgraded_lattice_confidence;
           }
@@ -1019,12 +1659,12 @@ LatticeElementConfidence ErrorBlocksPass::VisitBlock(
 
 LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
     const llvm::CallInst &call_inst) {
-  const std::string callee_name = GetCalleeSourceName(call_inst);
+  const NameId callee = function_table_.GetCalleeNameId(call_inst);
+  const std::string &callee_name = function_table_.GetName(callee);
   const llvm::Function *parent = call_inst.getFunction();
-  const std::string &function_fname = GetSourceFileName(call_inst);
   // If the callee is in our list of reachable functions, then add the caller
   // as well.
-  if (!IsDoomedFunction(callee_name)) {
+  if (!IsDoomedFunction(callee)) {
     AddNonDoomedFunction(*parent);
   }
 
@@ -1057,8 +1697,9 @@ LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
   ReturnedValuesPass &returned_values_pass = getAnalysis<ReturnedValuesPass>();
 
   // Get set of values that can be returned from this instruction.
-  ReturnedValuesFact rtf = returned_values_pass.GetInFact(&call_inst);
+  const ReturnedValuesFact &rtf = returned_values_pass.GetInFact(&call_inst);
 
+  const FileId function_fname = function_table_.GetInstructionFile(call_inst);
   LatticeElementConfidence join_result(kMinConfidence, kMinConfidence,
                                        kMinConfidence, kMaxConfidence);
   for (const auto &v : rtf.value) {
@@ -1072,25 +1713,35 @@ LatticeElementConfidence ErrorBlocksPass::VisitCallInst(
             SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
       }
       join_result = ConfidenceLattice::Join(delta, join_result);
-      LOG(INFO) << "ErrorOnlyCallBool eo=" << call_inst
-                << " c=" << (*maybe_bool ? "true" : "false");
+      TRACE(kTraceInstruction, "ErrorOnlyCallBool")
+          .Arg("eo", callee_name)
+          .Arg("callsite", GetDebugLocation(call_inst))
+          .Arg("c", *maybe_bool);
     } else if (const llvm::ConstantInt *int_return =
                    llvm::dyn_cast<llvm::ConstantInt>(v)) {
       const int64_t return_value = int_return->getSExtValue();
-      if (!IsSuccessCode(GetSourceName(*parent), return_value,
-                         function_fname)) {
+      if (!IsSuccessCode(
+              function_table_.GetName(function_table_.GetNameId(*parent)),
+              return_value, function_fname)) {
         join_result = ConfidenceLattice::Join(
             AddErrorValue(parent, return_value), join_result);
-        LOG(INFO) << "ErrorOnlyCallInt eo=" << call_inst
-                  << " c=" << return_value;
+        TRACE(kTraceInstruction, "ErrorOnlyCallInt")
+            .Arg("eo", callee_name)
+            .Arg("callsite", GetDebugLocation(call_inst))
+            .Arg("c", return_value);
       } else {
-        LOG(INFO) << "ErrorOnlyCallInt eo=" << call_inst
-                  << " c=" << return_value << " (success code)";
+        TRACE(kTraceInstruction, "ErrorOnlyCallSuccessCode")
+            .Arg("eo", callee_name)
+            .Arg("callsite", GetDebugLocation(call_inst))
+            .Arg("c", return_value);
       }
     } else if (llvm::isa<llvm::ConstantPointerNull>(v)) {
       join_result = ConfidenceLattice::Join(
           AddErrorValue(parent, /*return_value*/ 0), join_result);
-      LOG(INFO) << "ErrorOnlyCallPointer eo=" << call_inst << " c=0";
+      TRACE(kTraceInstruction, "ErrorOnlyCallPointer")
+          .Arg("eo", callee_name)
+          .Arg("callsite", GetDebugLocation(call_inst))
+          .Arg("c", 0);
     }
   }
   return join_result;
@@ -1133,48 +1784,55 @@ LatticeElementConfidence ErrorBlocksPass::AddErrorValue(const llvm::Function *f,
 }
 
 bool ErrorBlocksPass::AddNonDoomedFunction(const llvm::Function &f) {
-  return AddNonDoomedFunction(GetSourceName(f));
+  return AddNonDoomedFunction(function_table_.GetNameId(f));
 }
 
 bool ErrorBlocksPass::AddNonDoomedFunction(const std::string &function_name) {
-  return non_doomed_function_names_.insert(function_name).second;
+  return AddNonDoomedFunction(InternName(function_name));
+}
+
+bool ErrorBlocksPass::AddNonDoomedFunction(NameId function_name) {
+  if (non_doomed_functions_[function_name]) return false;
+  non_doomed_functions_[function_name] = true;
+  return true;
 }
 
-bool ErrorBlocksPass::IsDoomedFunction(const llvm::Function &f) {
-  return IsDoomedFunction(GetSourceName(f));
+bool ErrorBlocksPass::IsDoomedFunction(const llvm::Function &f) const {
+  return IsDoomedFunction(function_table_.GetNameId(f));
 }
 
-bool ErrorBlocksPass::IsDoomedFunction(const std::string &function_name) {
-  return non_doomed_function_names_.find(function_name) ==
-         non_doomed_function_names_.end();
+bool ErrorBlocksPass::IsDoomedFunction(NameId function_name) const {
+  return function_name == FunctionTable::kNoName ||
+         !non_doomed_functions_[function_name];
 }
 
 GetSpecificationsResponse ErrorBlocksPass::GetSpecifications() const {
   GetSpecificationsResponse response;
-  for (const auto &function_lattice_confidence : error_specifications_) {
+  for (NameId name = 0; name < error_specifications_.size(); ++name) {
+    const LatticeElementConfidence &lattice_confidence =
+        error_specifications_[name];
     // Skip "unknown" error specifications since the default assumption is
     // that function specifications are unknown when not reported by the
     // analysis.
-    if (ConfidenceLattice::IsUnknown(function_lattice_confidence.second)) {
+    if (ConfidenceLattice::IsUnknown(lattice_confidence)) {
       continue;
     }
 
     // Copying the inferred specifications to the response.
-    const std::string &llvm_name = function_lattice_confidence.first;
+    const std::string &llvm_name = function_table_.GetName(name);
     const std::string &source_name = LlvmToSourceName(llvm_name);
-    FunctionReturnType return_type =
-        FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER;
-    if (function_return_types_.find(source_name) !=
-        function_return_types_.end()) {
-      return_type = function_return_types_.find(source_name)->second;
+    FunctionReturnType return_type = function_return_types_[name];
+    if (return_type == FunctionReturnType::FUNCTION_RETURN_TYPE_INVALID) {
+      return_type = FunctionReturnType::FUNCTION_RETURN_TYPE_OTHER;
     }
 
-    LOG(INFO) << "Function: " << source_name
-              << " spec: " << function_lattice_confidence.second;
+    TRACE(kTraceFunction, "Specification")
+        .Arg("f", source_name)
+        .Arg("spec", lattice_confidence);
     // Enforce invariant initial specifications from domain knowledge.
     auto initial_spec_it = initial_error_specifications_.find(source_name);
     if (initial_spec_it != initial_error_specifications_.end()) {
-      assert(initial_spec_it->second == function_lattice_confidence.second);
+      assert(initial_spec_it->second == lattice_confidence);
     }
 
     std::unordered_set<std::string> function_sources_of_inference_zero;
@@ -1205,7 +1863,7 @@ GetSpecificationsResponse ErrorBlocksPass::GetSpecifications() const {
     }
     SignLatticeElement lattice_element =
         ConfidenceLattice::LatticeElementConfidenceToSignLatticeElement(
-            function_lattice_confidence.second);
+            lattice_confidence);
     Function f;
     f.set_llvm_name(llvm_name);
     f.set_source_name(source_name);
@@ -1214,13 +1872,13 @@ GetSpecificationsResponse ErrorBlocksPass::GetSpecifications() const {
     s->mutable_function()->CopyFrom(f);
     s->set_lattice_element(lattice_element);
     s->set_confidence_zero(
-        function_lattice_confidence.second.GetConfidenceZero());
+        lattice_confidence.GetConfidenceZero());
     s->set_confidence_less_than_zero(
-        function_lattice_confidence.second.GetConfidenceLessThanZero());
+        lattice_confidence.GetConfidenceLessThanZero());
     s->set_confidence_greater_than_zero(
-        function_lattice_confidence.second.GetConfidenceGreaterThanZero());
+        lattice_confidence.GetConfidenceGreaterThanZero());
     s->set_confidence_emptyset(
-        function_lattice_confidence.second.GetConfidenceEmptyset());
+        lattice_confidence.GetConfidenceEmptyset());
     *s->mutable_sources_of_inference_emptyset() = {
         function_sources_of_inference_emptyset.begin(),
         function_sources_of_inference_emptyset.end()};
@@ -1237,11 +1895,10 @@ GetSpecificationsResponse ErrorBlocksPass::GetSpecifications() const {
                              inferred_with_llm_.end());
   }
 
-  std::vector<Violation> violations = checker_->GetViolations();
-  // Copying over all found violations to the response.
-  for (auto &violation : violations) {
-    response.add_violations()->CopyFrom(violation);
-  }
+  checker_->GetViolations(response.mutable_violations());
+
+  *response.mutable_llm_skipped_functions() = {llm_skipped_functions_.begin(),
+                                               llm_skipped_functions_.end()};
 
   return response;
 }
@@ -1257,34 +1914,38 @@ SignLatticeElement ErrorBlocksPass::AbstractInteger(int64_t v) const {
 }
 
 std::unordered_set<std::string> ErrorBlocksPass::GetNonDoomedFunctions() const {
-  return non_doomed_function_names_;
+  std::unordered_set<std::string> non_doomed_function_names;
+  for (NameId name = 0; name < non_doomed_functions_.size(); ++name) {
+    if (non_doomed_functions_[name]) {
+      non_doomed_function_names.insert(function_table_.GetName(name));
+    }
+  }
+  return non_doomed_function_names;
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const llvm::CallInst &call_inst) const {
-  std::string function_name = GetCalleeSourceName(call_inst);
-  if (function_name.empty()) {
-    // All confidence values are 0 by default.
-    return LatticeElementConfidence();
-  }
-  return GetErrorSpecification(function_name);
+  return GetErrorSpecification(function_table_.GetCalleeNameId(call_inst));
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const llvm::Function *fn) const {
   assert(fn != nullptr);
-  return GetErrorSpecification(GetSourceName(*fn));
+  return GetErrorSpecification(function_table_.GetNameId(*fn));
 }
 
 LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
     const std::string &function_name) const {
-  ErrorSpecificationMap::const_iterator it =
-      error_specifications_.find(function_name);
-  if (it != error_specifications_.end()) {
-    return it->second;
+  return GetErrorSpecification(function_table_.FindName(function_name));
+}
+
+LatticeElementConfidence ErrorBlocksPass::GetErrorSpecification(
+    NameId function_name) const {
+  if (function_name == FunctionTable::kNoName) {
+    // All confidence values are 0 by default.
+    return LatticeElementConfidence();
   }
-  // All confidence values are 0 by default.
-  return LatticeElementConfidence();
+  return error_specifications_[function_name];
 }
 
 bool ErrorBlocksPass::UpdateErrorSpecification(std::string func_name,
@@ -1314,8 +1975,8 @@ bool ErrorBlocksPass::UpdateErrorSpecification(const llvm::Function *func,
   // the way that the expansion is currently performed. However, if we decide
   // to do something like expanding on all return values, then this is
   // necessary. Explained here: https://github.com/95616ARG/indra/issues/785
-  std::string function_name = GetSourceName(*func);
-  const auto &current = GetErrorSpecification(function_name);
+  const NameId function_name = function_table_.GetNameId(*func);
+  const auto current = GetErrorSpecification(function_name);
   // Check if current is currently bottom. If delta is emptyset, then joining
   // with bottom/unknown would cause the delta to become bottom/unknown as
   // well.
@@ -1354,26 +2015,24 @@ bool ErrorBlocksPass::UpdateErrorSpecification(const llvm::Function *func,
   // specification joined with the delta with any of confidence values
   // modified from KeepIfMax and RemoveLowestNonMin.
   error_specifications_[function_name] = delta;
-  LOG(INFO) << "Updated: " << function_name << " spec: " << delta;
+  TRACE(kTraceFunction, "Updated")
+      .Arg("f", function_table_.GetName(function_name))
+      .Arg("spec", delta);
   return current != delta;
 }
 
 bool ErrorBlocksPass::RemoveFromErrorSpecification(
     const std::string &function_name, LatticeElementConfidence to_remove) {
-  auto it = error_specifications_.find(function_name);
-  if (it != error_specifications_.end()) {
-    auto current = it->second;
-    auto updated = ConfidenceLattice::Difference(current, to_remove);
-
-    if (ConfidenceLattice::IsUnknown(updated)) {
-      error_specifications_.erase(function_name);
-    } else {
-      it->second = updated;
-    }
-
-    return current != updated;
+  const NameId name = function_table_.FindName(function_name);
+  if (name == FunctionTable::kNoName ||
+      ConfidenceLattice::IsUnknown(error_specifications_[name])) {
+    return false;
   }
-  return false;
+  const auto current = error_specifications_[name];
+  // An unknown specification is the same as none.
+  const auto updated = ConfidenceLattice::Difference(current, to_remove);
+  error_specifications_[name] = updated;
+  return current != updated;
 }
 
 bool ErrorBlocksPass::ValuesAreEqual(
@@ -1401,11 +2060,11 @@ bool ErrorBlocksPass::ValuesAreEqual(
 
 bool ErrorBlocksPass::IsErrorOnlyFunctionCall(
     const llvm::CallInst &call_inst) const {
-  const auto callee_name = GetCalleeSourceName(call_inst);
-
-  if (error_only_functions_.count(callee_name) == 0) {
+  const NameId callee = function_table_.GetCalleeNameId(call_inst);
+  if (callee == FunctionTable::kNoName || !error_only_names_[callee]) {
     return false;  // No error-only definition for this callee
   }
+  const std::string &callee_name = function_table_.GetName(callee);
 
   // Iterate through this callee's error-only definitions
   auto error_only_definitions_ = error_only_functions_.equal_range(callee_name);
@@ -1439,43 +2098,43 @@ bool ErrorBlocksPass::IsErrorOnlyFunctionCall(
 }
 
 bool ErrorBlocksPass::IsErrorOnlyFunction(const llvm::Function *func) const {
-  return error_only_functions_.count(GetSourceName(*func)) > 0;
+  return error_only_names_[function_table_.GetNameId(*func)];
 }
 
-bool ErrorBlocksPass::IsErrorCode(int64_t value,
-                                  const std::string &filename) const {
-  auto it = error_codes_.find(value);
-  if (it == error_codes_.end()) {
-    return false;
-  }
-  // No submodules are set, error codes are considered for all functions.
-  if (it->second.size() == 0) {
-    return true;
-  }
-  for (auto submodule_name : it->second) {
-    if (filename.find(submodule_name) != std::string::npos) {
-      return true;
-    }
-  }
-  return false;
+bool ErrorBlocksPass::IsErrorCode(int64_t value, FileId file) {
+  return ClassifyCode(value, file) & kErrorCode;
 }
 
-bool ErrorBlocksPass::IsSuccessCode(int64_t value,
-                                    const std::string &filename) const {
-  auto it = success_codes_.find(value);
-  if (it == success_codes_.end()) {
-    return false;
+bool ErrorBlocksPass::IsSuccessCode(int64_t value, FileId file) {
+  return ClassifyCode(value, file) & kSuccessCode;
+}
+
+uint8_t ErrorBlocksPass::ClassifyCode(int64_t value, FileId file) {
+  if (file >= file_codes_.size()) {
+    file_codes_.resize(function_table_.NumFiles());
   }
-  // No submodules are set, error codes are considered for all functions.
-  if (it->second.size() == 0) {
-    return true;
+  FileCodes &file_codes = file_codes_[file];
+  auto class_it = file_codes.code_classes.find(value);
+  if (class_it != file_codes.code_classes.end()) return class_it->second;
+
+  if (!file_codes.matched) {
+    file_codes.submodules =
+        submodule_matcher_.Match(function_table_.GetFile(file));
+    file_codes.matched = true;
   }
-  for (auto submodule_name : it->second) {
-    if (filename.find(submodule_name) != std::string::npos) {
-      return true;
-    }
+  uint8_t code_class = 0;
+  auto error_it = error_codes_.find(value);
+  if (error_it != error_codes_.end() &&
+      CodeHoldsInFile(error_it->second, file_codes.submodules)) {
+    code_class |= kErrorCode;
   }
-  return false;
+  auto success_it = success_codes_.find(value);
+  if (success_it != success_codes_.end() &&
+      CodeHoldsInFile(success_it->second, file_codes.submodules)) {
+    code_class |= kSuccessCode;
+  }
+  file_codes.code_classes.emplace(value, code_class);
+  return code_class;
 }
 
 void ErrorBlocksPass::AddFunctionReturningDomainKnowledgeCodes(
@@ -1489,28 +2148,28 @@ bool ErrorBlocksPass::ReturnsDomainKnowledgeCodes(
 }
 
 bool ErrorBlocksPass::IsSuccessCode(const std::string &function_name,
-                                    const int64_t value,
-                                    const std::string &filename) const {
+                                    const int64_t value, FileId file) {
   if (smart_success_code_zero_ && value == 0) {
-    return ShouldSmartDropZero(function_name, filename);
+    return ShouldSmartDropZero(function_name, file);
   } else {
-    return IsSuccessCode(value, filename);
+    return IsSuccessCode(value, file);
   }
 }
 
 bool ErrorBlocksPass::ShouldSmartDropZero(const std::string &function_name,
-                                          const std::string &filename) const {
+                                          FileId file) {
   // Here, we apply a heuristic, since returning 0 is a bit complicated due to
   // ambiguity.  It might be a domain knowledge success code, or the current
   // function might return e.g. 0 on error and 1 on success. However, if a
   // function returns a domain knowledge status code, then since the domain
   // knowledge success and error codes form a collective set of return codes,
   // we know 0 must be a success return.
-  return smart_success_code_zero_ && IsSuccessCode(0, filename) &&
+  return smart_success_code_zero_ && IsSuccessCode(0, file) &&
          ReturnsDomainKnowledgeCodes(function_name);
 }
 
 void ErrorBlocksPass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
+  au.addRequired<CallGraphPass>();
   au.addRequired<ReturnPropagationPass>();
   au.addRequired<ReturnedValuesPass>();
   au.addRequired<ReturnConstraintsPass>();
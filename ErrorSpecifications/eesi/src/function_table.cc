@@ -0,0 +1,65 @@
+#include "function_table.h"
+
+#include <utility>
+
+#include "eesi_common.h"
+#include "llvm.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+
+namespace error_specifications {
+
+constexpr NameId FunctionTable::kNoName;
+
+NameId FunctionTable::InternName(const std::string &source_name) {
+  auto inserted = name_ids_.try_emplace(source_name, names_.size());
+  if (inserted.second) names_.push_back(source_name);
+  return inserted.first->second;
+}
+
+NameId FunctionTable::FindName(llvm::StringRef source_name) const {
+  auto it = name_ids_.find(source_name);
+  return it != name_ids_.end() ? it->second : kNoName;
+}
+
+const std::string &FunctionTable::GetName(NameId name) const {
+  static const std::string *const kEmptyName = new std::string();
+  return name != kNoName ? names_[name] : *kEmptyName;
+}
+
+FileId FunctionTable::InternFile(llvm::StringRef file_name) {
+  auto inserted = file_ids_.try_emplace(file_name, files_.size());
+  if (inserted.second) files_.push_back(file_name.str());
+  return inserted.first->second;
+}
+
+FileId FunctionTable::GetInstructionFile(const llvm::Instruction &inst) {
+  const llvm::DILocation *location = inst.getDebugLoc();
+  return InternFile(location ? location->getFilename() : llvm::StringRef());
+}
+
+void FunctionTable::AddFunctions(const CallGraphPass &call_graph) {
+  call_graph_ = &call_graph;
+  functions_.clear();
+  functions_.reserve(call_graph.NumFunctions());
+  for (FunctionId id = 0; id < call_graph.NumFunctions(); ++id) {
+    const llvm::Function &function = *call_graph.GetFunction(id);
+    FunctionInfo info;
+    info.name = InternName(GetSourceName(function));
+    info.return_type = GetReturnType(function);
+    for (const llvm::BasicBlock &basic_block : function) {
+      block_files_[&basic_block] =
+          GetInstructionFile(*GetFirstInstructionOfBB(&basic_block));
+    }
+    info.file = function.empty() ? InternFile(llvm::StringRef())
+                                 : GetBlockFile(function.getEntryBlock());
+    info.is_intrinsic = function.isIntrinsic();
+    functions_.push_back(std::move(info));
+  }
+}
+
+NameId FunctionTable::GetCalleeNameId(const llvm::CallInst &call_inst) const {
+  const llvm::Function *callee = GetCalleeFunction(call_inst);
+  return callee ? GetNameId(*callee) : kNoName;
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,433 @@
+#include "gpt_async_client.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Number of recent latencies the hedging delay is computed from, and how
+// many are needed before hedging starts.
+constexpr size_t kLatencyWindow = 256;
+constexpr size_t kMinHedgeSamples = 20;
+
+// Returns true if an attempt that failed with code may succeed if retried.
+// The Python service reports a rate limited provider as RESOURCE_EXHAUSTED
+// and an overloaded or unreachable one as UNAVAILABLE. Anything else, such
+// as an UNKNOWN error raised by the service itself, would fail again.
+bool IsRetryable(grpc::StatusCode code) {
+  switch (code) {
+    case grpc::StatusCode::DEADLINE_EXCEEDED:
+    case grpc::StatusCode::RESOURCE_EXHAUSTED:
+    case grpc::StatusCode::UNAVAILABLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct GptMetrics {
+  Counter &calls_ok = MetricRegistry::Get().GetCounter(
+      "eesi_llm_calls_total", "GptService calls, by outcome.",
+      {{"status", "ok"}});
+  Counter &calls_failed = MetricRegistry::Get().GetCounter(
+      "eesi_llm_calls_total", "GptService calls, by outcome.",
+      {{"status", "error"}});
+  Counter &attempts = MetricRegistry::Get().GetCounter(
+      "eesi_llm_attempts_total",
+      "GptService attempts, retries and hedges included.");
+  Counter &retries = MetricRegistry::Get().GetCounter(
+      "eesi_llm_retries_total", "GptService attempts that were retries.");
+  Counter &hedges = MetricRegistry::Get().GetCounter(
+      "eesi_llm_hedges_total", "GptService attempts that were hedges.");
+  Histogram &call_seconds = MetricRegistry::Get().GetHistogram(
+      "eesi_llm_call_seconds",
+      "Time from the first attempt of a GptService call to its outcome.",
+      Histogram::LatencyBounds());
+  Histogram &attempt_seconds = MetricRegistry::Get().GetHistogram(
+      "eesi_llm_attempt_seconds",
+      "Latency of the successful GptService attempts.",
+      Histogram::LatencyBounds());
+  Histogram &wait_seconds = MetricRegistry::Get().GetHistogram(
+      "eesi_llm_wait_seconds",
+      "Time GptService calls waited for an in-flight slot and for quota.",
+      Histogram::LatencyBounds());
+  Gauge &in_flight = MetricRegistry::Get().GetGauge(
+      "eesi_llm_in_flight", "GptService calls in flight.");
+  Gauge &waiting = MetricRegistry::Get().GetGauge(
+      "eesi_llm_waiting_calls",
+      "GptService calls waiting for an in-flight slot or for quota.");
+};
+
+GptMetrics &GetGptMetrics() {
+  static GptMetrics *const metrics = new GptMetrics();
+  return *metrics;
+}
+
+}  // namespace
+
+TokenBucket::TokenBucket(uint64_t tokens_per_minute)
+    : tokens_per_second_(tokens_per_minute / 60.0),
+      capacity_(static_cast<double>(tokens_per_minute)),
+      available_(static_cast<double>(tokens_per_minute)),
+      last_refill_(std::chrono::steady_clock::now()) {}
+
+double TokenBucket::Take(uint64_t tokens) {
+  if (tokens_per_second_ <= 0 || tokens == 0) return 0;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = now - last_refill_;
+  available_ =
+      std::min(capacity_, available_ + elapsed.count() * tokens_per_second_);
+  last_refill_ = now;
+  available_ -= tokens;
+  return available_ < 0 ? -available_ / tokens_per_second_ : 0;
+}
+
+void TokenBucket::Acquire(uint64_t tokens) {
+  const double debt_seconds = Take(tokens);
+  if (debt_seconds > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(debt_seconds));
+  }
+}
+
+void TokenBucket::Charge(uint64_t tokens) { Take(tokens); }
+
+GptAsyncClient::CallBase::CallBase(GptAsyncClient *client,
+                                   const std::vector<std::string> &endpoints,
+                                   uint64_t num_completions,
+                                   uint64_t estimated_tokens)
+    : client_(client),
+      endpoints_(endpoints),
+      num_completions_(num_completions),
+      estimated_tokens_(estimated_tokens) {
+  if (Timeline *timeline = Timeline::Current()) {
+    timeline_ = timeline->shared_from_this();
+    span_.reset(new TimelineSpan(timeline_.get(), kTimelineLlm,
+                                 "GptServiceCall", /*async=*/true));
+    span_->Arg("completions", num_completions_)
+        .Arg("estimated_tokens", estimated_tokens_);
+  }
+}
+
+void GptAsyncClient::CallBase::Begin() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  StartNextAttempt();
+
+  const std::chrono::milliseconds hedge_delay = client_->HedgeDelay();
+  if (hedge_delay.count() >= 0 && client_->MaxAttempts() > 1) {
+    hedge_alarm_.reset(new grpc::Alarm());
+    hedge_alarm_->Set(&client_->cq_,
+                      std::chrono::system_clock::now() + hedge_delay,
+                      &hedge_tag_);
+    ++alarms_pending_;
+  }
+}
+
+bool GptAsyncClient::CallBase::Proceed(const Tag &tag, bool ok) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  switch (tag.kind) {
+    case Tag::kAttempt:
+      --attempts_running_;
+      client_->ReportEndpoint(attempt_endpoints_[tag.attempt],
+                              AttemptStatus(tag.attempt));
+      // Attempts that lost to another one come back cancelled; ignore them.
+      if (!done_) OnAttemptDone(tag.attempt);
+      break;
+    case Tag::kRetry:
+      --alarms_pending_;
+      if (ok && !done_) {
+        GetGptMetrics().retries.Increment();
+        client_->Charge(num_completions_, estimated_tokens_);
+        StartNextAttempt();
+      }
+      break;
+    case Tag::kHedge:
+      --alarms_pending_;
+      // ok is false if the alarm was cancelled.
+      if (ok && !done_ && attempts_running_ > 0 &&
+          attempt_tags_.size() < client_->MaxAttempts()) {
+        LOG(INFO) << "Hedging a GptService call still running after the p95 "
+                     "latency";
+        GetGptMetrics().hedges.Increment();
+        client_->Charge(num_completions_, estimated_tokens_);
+        StartNextAttempt();
+      }
+      break;
+  }
+  return done_ && attempts_running_ == 0 && alarms_pending_ == 0;
+}
+
+void GptAsyncClient::CallBase::StartNextAttempt() {
+  const size_t index = attempt_tags_.size();
+  attempt_tags_.emplace_back(new Tag{this, Tag::kAttempt, index});
+  attempt_starts_.push_back(std::chrono::steady_clock::now());
+  // Retries and hedges may land on another replica than the first attempt.
+  attempt_endpoints_.push_back(client_->PickEndpoint(endpoints_));
+  ++attempts_running_;
+  GetGptMetrics().attempts.Increment();
+  StartAttempt(index, attempt_tags_.back().get(), client_->AttemptDeadline(),
+               attempt_endpoints_.back()->stub.get(), &client_->cq_);
+}
+
+void GptAsyncClient::CallBase::OnAttemptDone(size_t index) {
+  const grpc::Status &status = AttemptStatus(index);
+  if (status.ok()) {
+    client_->RecordLatency(std::chrono::steady_clock::now() -
+                           attempt_starts_[index]);
+    Finish(index);
+    return;
+  }
+  if (!IsRetryable(status.error_code())) {
+    Finish(index);
+    return;
+  }
+  // A hedged attempt is still running and may yet succeed.
+  if (attempts_running_ > 0) return;
+  if (attempt_tags_.size() >= client_->MaxAttempts()) {
+    LOG(WARNING) << "Giving up on a GptService call after "
+                 << attempt_tags_.size() << " attempts";
+    Finish(index);
+    return;
+  }
+  LOG(WARNING) << "Retrying a GptService call that failed with: "
+               << status.error_message();
+  ScheduleRetry();
+}
+
+void GptAsyncClient::CallBase::ScheduleRetry() {
+  // The hedge was timed for the first attempt.
+  if (hedge_alarm_) hedge_alarm_->Cancel();
+
+  // Every attempt but the first was a retry.
+  const size_t retry = attempt_tags_.size() - 1;
+  retry_alarm_.reset(new grpc::Alarm());
+  retry_alarm_->Set(&client_->cq_,
+                    std::chrono::system_clock::now() + client_->Backoff(retry),
+                    &retry_tag_);
+  ++alarms_pending_;
+}
+
+void GptAsyncClient::CallBase::Finish(size_t index) {
+  done_ = true;
+  for (size_t i = 0; i < attempt_tags_.size(); ++i) {
+    if (i != index) CancelAttempt(i);
+  }
+  if (hedge_alarm_) hedge_alarm_->Cancel();
+  client_->Release();
+  GptMetrics &metrics = GetGptMetrics();
+  (AttemptStatus(index).ok() ? metrics.calls_ok : metrics.calls_failed)
+      .Increment();
+  metrics.call_seconds.Observe(std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() -
+                                   attempt_starts_.front())
+                                   .count());
+  if (span_) {
+    span_->Arg("status", AttemptStatus(index).error_code())
+        .Arg("attempts", attempt_tags_.size());
+    span_->End();
+  }
+  Complete(index);
+}
+
+GptAsyncClient &GptAsyncClient::Get() {
+  static GptAsyncClient *client = new GptAsyncClient();
+  return *client;
+}
+
+GptAsyncClient::GptAsyncClient()
+    : request_bucket_(new TokenBucket(0)),
+      token_bucket_(new TokenBucket(0)),
+      random_(std::random_device()()) {
+  Configure(GptClientOptions());
+  poller_ = std::thread(&GptAsyncClient::PollCompletionQueue, this);
+}
+
+void GptAsyncClient::Configure(const GptClientOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+  if (options_.endpoints.empty()) {
+    options_.endpoints = GptClientOptions().endpoints;
+  }
+  request_bucket_.reset(new TokenBucket(options.requests_per_minute));
+  token_bucket_.reset(new TokenBucket(options.tokens_per_minute));
+  std::string endpoints;
+  for (const auto &endpoint : options_.endpoints) {
+    if (!endpoints.empty()) endpoints += ",";
+    endpoints += endpoint;
+  }
+  LOG(INFO) << "GptService replicas: " << endpoints << " ("
+            << (options.balancing == GptBalancing::kRoundRobin
+                    ? "round robin"
+                    : "least outstanding")
+            << ")";
+  LOG(INFO) << "GptService client limits: " << options.max_in_flight
+            << " in flight, " << options.requests_per_minute
+            << " requests/min, " << options.tokens_per_minute
+            << " tokens/min (0 is unlimited); " << options.deadline_ms
+            << " ms deadline, " << options.max_attempts << " attempts"
+            << (options.hedge ? ", hedged" : "");
+}
+
+void GptAsyncClient::Acquire(uint64_t num_completions,
+                             uint64_t estimated_tokens) {
+  GptMetrics &metrics = GetGptMetrics();
+  metrics.waiting.Add(1);
+  {
+    ScopedLatency wait_latency(metrics.wait_seconds);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      slot_available_.wait(lock, [this] {
+        return options_.max_in_flight == 0 ||
+               in_flight_ < options_.max_in_flight;
+      });
+      ++in_flight_;
+      metrics.in_flight.Set(in_flight_);
+    }
+    // Take a slot before the quota so that quota is not spent on calls that
+    // cannot start yet.
+    request_bucket_->Acquire(num_completions);
+    token_bucket_->Acquire(estimated_tokens);
+  }
+  metrics.waiting.Add(-1);
+}
+
+void GptAsyncClient::Charge(uint64_t num_completions,
+                            uint64_t estimated_tokens) {
+  request_bucket_->Charge(num_completions);
+  token_bucket_->Charge(estimated_tokens);
+}
+
+void GptAsyncClient::Release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_flight_;
+    GetGptMetrics().in_flight.Set(in_flight_);
+  }
+  slot_available_.notify_one();
+}
+
+GptAsyncClient::Endpoint *GptAsyncClient::PickEndpoint(
+    const std::vector<std::string> &addresses) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::vector<std::string> &candidates =
+      addresses.empty() ? options_.endpoints : addresses;
+
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<Endpoint *> healthy;
+  std::vector<Endpoint *> all;
+  for (const auto &address : candidates) {
+    std::unique_ptr<Endpoint> &endpoint = endpoints_[address];
+    if (!endpoint) {
+      endpoint.reset(new Endpoint());
+      endpoint->address = address;
+      endpoint->stub = GptService::NewStub(
+          grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    }
+    all.push_back(endpoint.get());
+    if (endpoint->ejected_until <= now) healthy.push_back(endpoint.get());
+  }
+  // With every replica ejected, trying one beats failing the call.
+  const std::vector<Endpoint *> &choices = healthy.empty() ? all : healthy;
+
+  const size_t start = next_endpoint_++ % choices.size();
+  Endpoint *picked = choices[start];
+  if (options_.balancing == GptBalancing::kLeastOutstanding) {
+    for (size_t i = 1; i < choices.size(); ++i) {
+      Endpoint *endpoint = choices[(start + i) % choices.size()];
+      if (endpoint->outstanding < picked->outstanding) picked = endpoint;
+    }
+  }
+  ++picked->outstanding;
+  return picked;
+}
+
+void GptAsyncClient::ReportEndpoint(Endpoint *endpoint,
+                                    const grpc::Status &status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  --endpoint->outstanding;
+  switch (status.error_code()) {
+    case grpc::StatusCode::UNAVAILABLE:
+    case grpc::StatusCode::DEADLINE_EXCEEDED:
+      ++endpoint->consecutive_failures;
+      break;
+    case grpc::StatusCode::CANCELLED:
+      // Attempts that lost to a hedge say nothing about the replica.
+      return;
+    default:
+      endpoint->consecutive_failures = 0;
+      return;
+  }
+  if (options_.ejection_failures == 0 ||
+      endpoint->consecutive_failures < options_.ejection_failures) {
+    return;
+  }
+  LOG(WARNING) << "Ejecting GptService replica " << endpoint->address
+               << " for " << options_.ejection_ms << " ms after "
+               << endpoint->consecutive_failures << " failures in a row";
+  endpoint->consecutive_failures = 0;
+  endpoint->ejected_until = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(options_.ejection_ms);
+}
+
+std::chrono::system_clock::time_point GptAsyncClient::AttemptDeadline() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (options_.deadline_ms == 0) {
+    return std::chrono::system_clock::time_point::max();
+  }
+  return std::chrono::system_clock::now() +
+         std::chrono::milliseconds(options_.deadline_ms);
+}
+
+std::chrono::milliseconds GptAsyncClient::Backoff(size_t retry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Full jitter: concurrent calls that failed together spread out instead
+  // of retrying in lockstep.
+  const uint64_t ceiling =
+      std::min(options_.max_backoff_ms,
+               options_.initial_backoff_ms << std::min<size_t>(retry, 20));
+  std::uniform_int_distribution<uint64_t> distribution(0, ceiling);
+  return std::chrono::milliseconds(distribution(random_));
+}
+
+std::chrono::milliseconds GptAsyncClient::HedgeDelay() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!options_.hedge || latencies_ms_.size() < kMinHedgeSamples) {
+    return std::chrono::milliseconds(-1);
+  }
+  std::vector<int64_t> latencies(latencies_ms_.begin(), latencies_ms_.end());
+  auto p95 = latencies.begin() + latencies.size() * 95 / 100;
+  std::nth_element(latencies.begin(), p95, latencies.end());
+  return std::chrono::milliseconds(*p95);
+}
+
+void GptAsyncClient::RecordLatency(
+    std::chrono::steady_clock::duration latency) {
+  GetGptMetrics().attempt_seconds.Observe(
+      std::chrono::duration<double>(latency).count());
+  std::lock_guard<std::mutex> lock(mutex_);
+  latencies_ms_.push_back(
+      std::chrono::duration_cast<std::chrono::milliseconds>(latency).count());
+  if (latencies_ms_.size() > kLatencyWindow) latencies_ms_.pop_front();
+}
+
+uint64_t GptAsyncClient::MaxAttempts() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::max<uint64_t>(1, options_.max_attempts);
+}
+
+void GptAsyncClient::PollCompletionQueue() {
+  void *tag;
+  bool ok;
+  while (cq_.Next(&tag, &ok)) {
+    auto *call_tag = static_cast<CallBase::Tag *>(tag);
+    CallBase *call = call_tag->call;
+    if (call->Proceed(*call_tag, ok)) delete call;
+  }
+}
+
+}  // namespace error_specifications
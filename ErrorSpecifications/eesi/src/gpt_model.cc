@@ -1,26 +1,151 @@
 #include "gpt_model.h"
 
+#include <algorithm>
+#include <future>
+#include <map>
+#include <sstream>
+#include <vector>
+
 #include "glog/logging.h"
+#include "gpt_async_client.h"
 #include "include/grpcpp/grpcpp.h"
+#include "llm_response_cache.h"
 #include "proto/eesi.grpc.pb.h"
+#include "servers.h"
 
 namespace error_specifications {
 
-GptModel::GptModel(std::string llm_name, std::string ctags_file) {
-  std::shared_ptr<grpc::Channel> channel;
-  channel = grpc::CreateChannel("localhost:50059",
-                                grpc::InsecureChannelCredentials());
+namespace {
+
+using SpecificationMap = std::unordered_map<std::string, SignLatticeElement>;
+
+// The GptService may issue two completions per query: the question itself
+// and a reprompt for the part of the specification the LLM left out.
+constexpr uint64_t kCompletionsPerQuery = 2;
+
+// Rough number of tokens in a completion: the instructions and examples of
+// the prompt, the function definition and the answer. The request itself
+// only carries the context, at about four bytes per token.
+constexpr uint64_t kTokensPerCompletion = 2048;
+constexpr uint64_t kRequestBytesPerToken = 4;
+
+// Estimates the tokens used by a request carrying num_queries queries.
+uint64_t EstimateTokens(const google::protobuf::Message &request,
+                        uint64_t num_queries) {
+  return num_queries * kCompletionsPerQuery * kTokensPerCompletion +
+         request.ByteSizeLong() / kRequestBytesPerToken;
+}
+
+// Returns a future that is already satisfied with value.
+std::future<SpecificationMap> MakeReadyFuture(SpecificationMap value) {
+  std::promise<SpecificationMap> promise;
+  promise.set_value(std::move(value));
+  return promise.get_future();
+}
+
+// Returns true if response should be cached. An empty answer is not: the
+// service also answers that way when it could not read the function or
+// parse the completion, which a later run may well get past.
+bool IsCacheable(const GetGptSpecificationResponse &response) {
+  return !response.failed() && response.specifications_size() > 0;
+}
+
+bool IsCacheable(const GetGptThirdPartySpecificationsResponse &response) {
+  return response.specifications_size() > 0;
+}
+
+// Appends a length-prefixed field so that distinct inputs never concatenate
+// to the same key material.
+void AppendKeyField(const std::string &field, std::string &key_material) {
+  key_material += std::to_string(field.size());
+  key_material += ':';
+  key_material += field;
+}
+
+// Appends the parts of the context specifications that reach the prompt,
+// sorted by function name so the key does not depend on their order.
+void AppendKeySpecifications(
+    const google::protobuf::RepeatedPtrField<Specification> &specifications,
+    std::string &key_material) {
+  std::vector<std::pair<std::string, int>> sorted_specifications;
+  for (const auto &specification : specifications) {
+    sorted_specifications.push_back(std::make_pair(
+        specification.function().source_name(),
+        static_cast<int>(specification.lattice_element())));
+  }
+  std::sort(sorted_specifications.begin(), sorted_specifications.end());
+  AppendKeyField(std::to_string(sorted_specifications.size()), key_material);
+  for (const auto &specification : sorted_specifications) {
+    AppendKeyField(specification.first, key_material);
+    AppendKeyField(std::to_string(specification.second), key_material);
+  }
+}
 
-  if (!channel) {
-    // const std::string &err_msg = "Unable to connect to embedding service.";
-    // LOG(ERROR) << err_msg;
-    stub_ = nullptr;
-    return;
+// Appends the entries of a proto map in key order.
+template <typename Value>
+void AppendKeyMap(const google::protobuf::Map<std::string, Value> &map,
+                  std::string &key_material) {
+  std::map<std::string, std::string> sorted_map;
+  for (const auto &kv : map) {
+    std::ostringstream value;
+    value << kv.second;
+    sorted_map[kv.first] = value.str();
+  }
+  AppendKeyField(std::to_string(sorted_map.size()), key_material);
+  for (const auto &kv : sorted_map) {
+    AppendKeyField(kv.first, key_material);
+    AppendKeyField(kv.second, key_material);
   }
+}
+
+// Hashes key_material into a cache key. Returns an empty string on failure,
+// in which case the response is not cached.
+std::string HashKeyMaterial(const std::string &key_material) {
+  std::string key;
+  if (!HashString(key_material, key).ok()) return "";
+  return key;
+}
+
+}  // namespace
+
+std::string GptModel::GetCacheKey(const GetGptSpecificationRequest &request) {
+  std::string key_material;
+  AppendKeyField("GetGptSpecification", key_material);
+  AppendKeyField(request.llm_name(), key_material);
+  // Function names are only unique within a benchmark; the ctags file
+  // identifies the benchmark.
+  AppendKeyField(request.ctags_file(), key_material);
+  AppendKeyField(request.function_name(), key_material);
+  // Only keyed when set, so entries cached before the field existed stay
+  // valid for queries without it.
+  if (!request.function_definition().empty()) {
+    AppendKeyField(request.function_definition(), key_material);
+  }
+  AppendKeySpecifications(request.error_specifications(), key_material);
+  AppendKeyMap(request.error_code_names(), key_material);
+  AppendKeyMap(request.success_code_names(), key_material);
+  return HashKeyMaterial(key_material);
+}
+
+std::string GptModel::GetCacheKey(
+    const GetGptThirdPartySpecificationsRequest &request) {
+  std::string key_material;
+  AppendKeyField("GetGptThirdPartySpecifications", key_material);
+  AppendKeyField(request.llm_name(), key_material);
+  AppendKeyMap(request.function_names(), key_material);
+  AppendKeySpecifications(request.error_specifications(), key_material);
+  AppendKeyMap(request.error_code_names(), key_material);
+  AppendKeyMap(request.success_code_names(), key_material);
+  return HashKeyMaterial(key_material);
+}
+
+GptModel::GptModel(std::string llm_name, std::string ctags_file,
+                   std::vector<std::string> endpoints) {
+  // Channels to the replicas are pooled by the GptAsyncClient.
   llm_name_ = llm_name;
-  stub_ = GptService::NewStub(channel);
   ctags_file_ = ctags_file;
-}  // namespace error_specifications
+  endpoints_ = endpoints;
+}
 
 std::unordered_map<std::string, SignLatticeElement>
 GptModel::GetThirdPartySpecifications(
@@ -28,7 +153,18 @@ GptModel::GetThirdPartySpecifications(
     std::vector<Specification> specifications,
     std::unordered_map<std::string, SignLatticeElement> error_code_names,
     std::unordered_map<std::string, SignLatticeElement> success_code_names) {
-  if (!stub_) return std::unordered_map<std::string, SignLatticeElement>();
+  return StartThirdPartySpecifications(function_names, specifications,
+                                       error_code_names, success_code_names)
+      ->Get();
+}
+
+std::unique_ptr<PendingThirdPartySpecifications>
+GptModel::StartThirdPartySpecifications(
+    const std::vector<std::pair<std::string, std::string>> &function_names,
+    const std::vector<Specification> &specifications,
+    const std::unordered_map<std::string, SignLatticeElement> &error_code_names,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &success_code_names) {
   GetGptThirdPartySpecificationsRequest request;
   // I should change this so I don't have to convert here.
   std::unordered_map<std::string, std::string> function_names_map;
@@ -43,49 +179,236 @@ GptModel::GetThirdPartySpecifications(
   *request.mutable_error_code_names() = {error_code_names.begin(),
                                          error_code_names.end()};
 
+  std::unique_ptr<PendingThirdPartySpecifications> pending(
+      new PendingThirdPartySpecifications());
   GetGptThirdPartySpecificationsResponse response;
-  grpc::ClientContext context;
-  grpc::Status status =
-      stub_->GetGptThirdPartySpecifications(&context, request, &response);
-  if (!status.ok()) {
-    LOG(WARNING) << status.error_message();
-    return std::unordered_map<std::string, SignLatticeElement>();
+  pending->cache_key_ = GetCacheKey(request);
+  if (!pending->cache_key_.empty() &&
+      LlmResponseCache::Get().Lookup(pending->cache_key_, &response)) {
+    ++cache_hits_;
+    pending->cached_ = true;
+    pending->cached_answer_ =
+        SpecificationMap(response.specifications().begin(),
+                         response.specifications().end());
+    return pending;
   }
-  return std::unordered_map<std::string, SignLatticeElement>(
-      response.specifications().begin(), response.specifications().end());
-};
+  ++cache_misses_;
+
+  pending->call_ =
+      GptAsyncClient::Get().Start<GetGptThirdPartySpecificationsResponse>(
+          endpoints_,
+          [request](GptService::Stub *stub, grpc::ClientContext *context,
+                    grpc::CompletionQueue *cq) {
+            return stub->PrepareAsyncGetGptThirdPartySpecifications(
+                context, request, cq);
+          },
+          kCompletionsPerQuery, EstimateTokens(request, 1));
+  return pending;
+}
+
+bool PendingThirdPartySpecifications::IsReady() const {
+  return cached_ || call_.wait_for(std::chrono::seconds(0)) ==
+                        std::future_status::ready;
+}
+
+std::unordered_map<std::string, SignLatticeElement>
+PendingThirdPartySpecifications::Get() {
+  if (cached_) return std::move(cached_answer_);
+  GptCallResult<GetGptThirdPartySpecificationsResponse> result = call_.get();
+  if (!result.status.ok()) {
+    LOG(WARNING) << result.status.error_message();
+    return SpecificationMap();
+  }
+  if (!cache_key_.empty() && IsCacheable(result.response)) {
+    LlmResponseCache::Get().Insert(cache_key_, result.response);
+  }
+  return SpecificationMap(result.response.specifications().begin(),
+                          result.response.specifications().end());
+}
 
 std::unordered_map<std::string, SignLatticeElement> GptModel::GetSpecification(
     std::string function_name, std::vector<Specification> specifications,
     std::unordered_map<std::string, SignLatticeElement> error_code_names,
-    std::unordered_map<std::string, SignLatticeElement> success_code_names) {
-  if (!stub_) return std::unordered_map<std::string, SignLatticeElement>();
+    std::unordered_map<std::string, SignLatticeElement> success_code_names,
+    std::string function_definition) {
+  return GetSpecificationAsync(function_name, specifications, error_code_names,
+                               success_code_names, function_definition)
+      .get();
+}
+
+std::future<std::unordered_map<std::string, SignLatticeElement>>
+GptModel::GetSpecificationAsync(
+    const std::string &function_name,
+    const std::vector<Specification> &specifications,
+    const std::unordered_map<std::string, SignLatticeElement> &error_code_names,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &success_code_names,
+    const std::string &function_definition) {
+  GetGptSpecificationRequest request =
+      MakeSpecificationRequest(function_name, specifications, error_code_names,
+                               success_code_names, function_definition);
 
+  GetGptSpecificationResponse response;
+  const std::string cache_key = GetCacheKey(request);
+  if (!cache_key.empty() &&
+      LlmResponseCache::Get().Lookup(cache_key, &response)) {
+    ++cache_hits_;
+    return MakeReadyFuture(SpecificationMap(
+        response.specifications().begin(), response.specifications().end()));
+  }
+  ++cache_misses_;
+
+  auto call = GptAsyncClient::Get().Start<GetGptSpecificationResponse>(
+      endpoints_,
+      [request](GptService::Stub *stub, grpc::ClientContext *context,
+                grpc::CompletionQueue *cq) {
+        return stub->PrepareAsyncGetGptSpecification(context, request, cq);
+      },
+      kCompletionsPerQuery, EstimateTokens(request, 1));
+
+  // Unpack the response in the thread that waits for it, not on the
+  // client's poller thread.
+  return std::async(
+      std::launch::deferred,
+      [cache_key](std::future<GptCallResult<GetGptSpecificationResponse>>
+                      call) {
+        GptCallResult<GetGptSpecificationResponse> result = call.get();
+        if (!result.status.ok()) {
+          // This happens when a label does not exist in the model, which
+          // can happen frequently (e.g. the function is never called).
+          LOG(WARNING) << result.status.error_message();
+          return SpecificationMap();
+        }
+        if (!cache_key.empty() && IsCacheable(result.response)) {
+          LlmResponseCache::Get().Insert(cache_key, result.response);
+        }
+        return SpecificationMap(result.response.specifications().begin(),
+                                result.response.specifications().end());
+      },
+      std::move(call));
+}
+
+GetGptSpecificationRequest GptModel::MakeSpecificationRequest(
+    const std::string &function_name,
+    const std::vector<Specification> &specifications,
+    const std::unordered_map<std::string, SignLatticeElement> &error_code_names,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &success_code_names,
+    const std::string &function_definition) const {
   GetGptSpecificationRequest request;
   request.set_function_name(function_name);
   request.set_llm_name(llm_name_);
   request.set_ctags_file(ctags_file_);
+  request.set_function_definition(function_definition);
   *request.mutable_error_specifications() = {specifications.begin(),
                                              specifications.end()};
   *request.mutable_error_code_names() = {error_code_names.begin(),
                                          error_code_names.end()};
   *request.mutable_success_code_names() = {success_code_names.begin(),
                                            success_code_names.end()};
+  return request;
+}
 
-  GetGptSpecificationResponse response;
-  grpc::ClientContext context;
-  grpc::Status status =
-      stub_->GetGptSpecification(&context, request, &response);
-  if (!status.ok()) {
-    // This happens when a label does not exist in the model, which
-    // can happen frequently (e.g. the function is never called).
-    LOG(WARNING) << status.error_message();
-    return std::unordered_map<std::string, SignLatticeElement>();
+std::vector<std::unordered_map<std::string, SignLatticeElement>>
+GptModel::GetSpecificationsBatch(
+    const std::vector<GptSpecificationQuery> &queries,
+    const std::unordered_map<std::string, SignLatticeElement> &error_code_names,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &success_code_names) {
+  std::vector<std::unordered_map<std::string, SignLatticeElement>> results(
+      queries.size());
+  // Answer what we can from the cache and batch the rest.
+  std::vector<size_t> pending_indices;
+  std::vector<std::string> pending_keys;
+  std::vector<GetGptSpecificationRequest> pending_requests;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    GetGptSpecificationRequest request = MakeSpecificationRequest(
+        queries[i].function_name, queries[i].specifications, error_code_names,
+        success_code_names, queries[i].function_definition);
+    const std::string cache_key = GetCacheKey(request);
+    GetGptSpecificationResponse response;
+    if (!cache_key.empty() &&
+        LlmResponseCache::Get().Lookup(cache_key, &response)) {
+      ++cache_hits_;
+      results[i] = SpecificationMap(response.specifications().begin(),
+                                    response.specifications().end());
+      continue;
+    }
+    ++cache_misses_;
+    pending_indices.push_back(i);
+    pending_keys.push_back(cache_key);
+    pending_requests.push_back(std::move(request));
   }
 
-  return std::unordered_map<std::string, SignLatticeElement>(
-      response.specifications().begin(), response.specifications().end());
+  // Start every chunk before waiting on any, so that they run concurrently
+  // up to the client's in-flight limit.
+  std::vector<std::future<GptCallResult<GetGptSpecificationsBatchResponse>>>
+      calls;
+  std::vector<size_t> call_begins;
+  for (size_t begin = 0; begin < pending_requests.size();
+       begin += kMaxGptBatchSize) {
+    const size_t end =
+        std::min(begin + kMaxGptBatchSize, pending_requests.size());
+    GetGptSpecificationsBatchRequest batch_request;
+    for (size_t i = begin; i < end; ++i) {
+      *batch_request.add_requests() = pending_requests[i];
+    }
+    calls.push_back(
+        GptAsyncClient::Get().Start<GetGptSpecificationsBatchResponse>(
+            endpoints_,
+            [batch_request](GptService::Stub *stub,
+                            grpc::ClientContext *context,
+                            grpc::CompletionQueue *cq) {
+              return stub->PrepareAsyncGetGptSpecificationsBatch(
+                  context, batch_request, cq);
+            },
+            (end - begin) * kCompletionsPerQuery,
+            EstimateTokens(batch_request, end - begin)));
+    call_begins.push_back(begin);
+  }
+
+  for (size_t call_index = 0; call_index < calls.size(); ++call_index) {
+    const size_t begin = call_begins[call_index];
+    const size_t end =
+        std::min(begin + kMaxGptBatchSize, pending_requests.size());
+    GptCallResult<GetGptSpecificationsBatchResponse> result =
+        calls[call_index].get();
+    if (!result.status.ok()) {
+      LOG(WARNING) << result.status.error_message();
+      continue;
+    }
+    const GetGptSpecificationsBatchResponse &batch_response = result.response;
+    if (static_cast<size_t>(batch_response.responses_size()) != end - begin) {
+      LOG(WARNING) << "Batch of " << end - begin << " requests returned "
+                   << batch_response.responses_size() << " responses.";
+      continue;
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+      const GetGptSpecificationResponse &response =
+          batch_response.responses(i - begin);
+      results[pending_indices[i]] = SpecificationMap(
+          response.specifications().begin(), response.specifications().end());
+      if (!pending_keys[i].empty() && IsCacheable(response)) {
+        LlmResponseCache::Get().Insert(pending_keys[i], response);
+      }
+    }
+  }
+
+  return results;
 }
 
 bool GptModel::IsLLMNameEmpty() { return llm_name_.empty(); }
+
+uint64_t GptModel::EstimateSpecificationTokens(
+    const GptSpecificationQuery &query,
+    const std::unordered_map<std::string, SignLatticeElement> &error_code_names,
+    const std::unordered_map<std::string, SignLatticeElement>
+        &success_code_names) const {
+  return EstimateTokens(
+      MakeSpecificationRequest(query.function_name, query.specifications,
+                               error_code_names, success_code_names,
+                               query.function_definition),
+      1);
+}
 }  // namespace error_specifications
@@ -0,0 +1,115 @@
+#include "llm_response_cache.h"
+
+#include <fstream>
+
+#include "glog/logging.h"
+#include "metrics.h"
+
+namespace error_specifications {
+
+// Each line of the cache file is "<key>\t<hex encoded response>". Later lines
+// for the same key win.
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+std::string ToHex(const std::string &bytes) {
+  std::string hex(2 * bytes.size(), '0');
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    const unsigned char byte = static_cast<unsigned char>(bytes[i]);
+    hex[2 * i] = kHexDigits[byte >> 4];
+    hex[2 * i + 1] = kHexDigits[byte & 0xf];
+  }
+  return hex;
+}
+
+int FromHexDigit(char digit) {
+  if (digit >= '0' && digit <= '9') return digit - '0';
+  if (digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+  return -1;
+}
+
+// Returns false if hex is not a valid hex encoding.
+bool FromHex(const std::string &hex, std::string &out_bytes) {
+  if (hex.size() % 2 != 0) return false;
+  out_bytes.resize(hex.size() / 2);
+  for (size_t i = 0; i < out_bytes.size(); ++i) {
+    const int high = FromHexDigit(hex[2 * i]);
+    const int low = FromHexDigit(hex[2 * i + 1]);
+    if (high < 0 || low < 0) return false;
+    out_bytes[i] = static_cast<char>((high << 4) | low);
+  }
+  return true;
+}
+
+}  // namespace
+
+LlmResponseCache &LlmResponseCache::Get() {
+  static LlmResponseCache *cache = new LlmResponseCache();
+  return *cache;
+}
+
+void LlmResponseCache::Open(const std::string &cache_file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cache_file_ = cache_file;
+  if (cache_file_.empty()) return;
+
+  std::ifstream ifs(cache_file_);
+  if (!ifs) return;
+
+  std::string line;
+  int num_entries = 0;
+  while (std::getline(ifs, line)) {
+    const size_t separator = line.find('\t');
+    std::string response;
+    // A line cut short by a crash will not decode; skip it.
+    if (separator == std::string::npos ||
+        !FromHex(line.substr(separator + 1), response)) {
+      continue;
+    }
+    responses_[line.substr(0, separator)] = response;
+    ++num_entries;
+  }
+  LOG(INFO) << "Loaded " << num_entries << " LLM responses from "
+            << cache_file_;
+}
+
+bool LlmResponseCache::Lookup(const std::string &key,
+                              google::protobuf::Message *response) {
+  static Counter &hits = MetricRegistry::Get().GetCounter(
+      "eesi_llm_cache_hits_total", "LLM queries answered from the cache.");
+  static Counter &misses = MetricRegistry::Get().GetCounter(
+      "eesi_llm_cache_misses_total", "LLM queries not in the cache.");
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = responses_.find(key);
+    if (it != responses_.end() && response->ParseFromString(it->second)) {
+      ++hits_;
+      hits.Increment();
+      return true;
+    }
+  }
+  ++misses_;
+  misses.Increment();
+  return false;
+}
+
+void LlmResponseCache::Insert(const std::string &key,
+                              const google::protobuf::Message &response) {
+  std::string serialized;
+  if (!response.SerializeToString(&serialized)) return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  responses_[key] = serialized;
+  if (cache_file_.empty()) return;
+
+  std::ofstream ofs(cache_file_, std::ios::app);
+  if (!ofs) {
+    LOG(WARNING) << "Unable to append to LLM cache " << cache_file_;
+    return;
+  }
+  ofs << key << "\t" << ToHex(serialized) << "\n";
+}
+
+}  // namespace error_specifications
@@ -4,17 +4,164 @@
 #include "absl/flags/parse.h"
 #include <glog/logging.h>
 
+#include <signal.h>
+
+#include <chrono>
+#include <fstream>
 #include <string>
+#include <vector>
 
+#include "gpt_async_client.h"
+#include "llm_response_cache.h"
+#include "metrics.h"
 #include "servers.h"
+#include "trace.h"
 
 ABSL_FLAG(std::string, listen, "localhost:50052", "The address to listen on.");
+ABSL_FLAG(uint64_t, memory_budget_mb, 0,
+          "Total estimated memory, in MiB, that concurrently running analysis "
+          "tasks may use. Requests beyond the budget are queued. 0 means "
+          "unlimited.");
+ABSL_FLAG(uint64_t, max_concurrent_tasks, 0,
+          "Maximum number of analysis tasks that run at once. 0 means "
+          "unlimited.");
+ABSL_FLAG(uint64_t, task_memory_estimate_mb, 20480,
+          "Estimated memory, in MiB, of a single GetSpecifications task. The "
+          "bitcode lives on the bitcode service, so its size is not known "
+          "when the request is admitted.");
+ABSL_FLAG(std::string, llm_cache_file, "",
+          "File that persists GptService responses across runs. Queries with "
+          "the same model, function, context and code names are answered "
+          "from it. If empty, responses are cached in memory only.");
+ABSL_FLAG(std::vector<std::string>, gpt_endpoints,
+          std::vector<std::string>({"localhost:50059"}),
+          "Comma-separated addresses of the GptService replicas to spread LLM "
+          "queries over, unless a request names its own.");
+ABSL_FLAG(std::string, gpt_balancing, "least_outstanding",
+          "How LLM queries are spread over the GptService replicas: "
+          "\"least_outstanding\" or \"round_robin\".");
+ABSL_FLAG(uint64_t, gpt_ejection_failures, 3,
+          "Number of consecutive unavailable or timed out attempts after "
+          "which a GptService replica is ejected. 0 disables ejection.");
+ABSL_FLAG(uint64_t, gpt_ejection_ms, 30000,
+          "How long an ejected GptService replica gets no queries, in "
+          "milliseconds.");
+ABSL_FLAG(uint64_t, llm_max_in_flight, 16,
+          "Maximum number of GptService RPCs in flight across all analysis "
+          "tasks. 0 means unlimited.");
+ABSL_FLAG(uint64_t, llm_requests_per_minute, 0,
+          "LLM completions per minute allowed by the provider. Calls are "
+          "delayed to stay under it. 0 means unlimited.");
+ABSL_FLAG(uint64_t, llm_tokens_per_minute, 0,
+          "LLM tokens per minute allowed by the provider, compared against "
+          "an estimate of each call's tokens. 0 means unlimited.");
+ABSL_FLAG(uint64_t, llm_deadline_ms, 180000,
+          "Deadline of a single GptService attempt, in milliseconds. 0 means "
+          "no deadline.");
+ABSL_FLAG(uint64_t, llm_max_attempts, 4,
+          "Maximum number of attempts of a GptService call, retries and "
+          "hedges included. Transient failures are retried after a jittered "
+          "exponential backoff.");
+ABSL_FLAG(bool, llm_hedge, false,
+          "Issue a duplicate GptService attempt when the first one runs past "
+          "the p95 latency of recent calls, and take whichever answers first.");
+ABSL_FLAG(int32_t, trace_level, 1,
+          "Highest level of the analysis trace events to emit: 0 for none, 1 "
+          "for per-function events, 2 for per-block and per-call events as "
+          "well. Levels above the ERROR_SPECIFICATIONS_TRACE_LEVEL the "
+          "service was compiled with are never emitted.");
+ABSL_FLAG(std::string, trace_sink, "log",
+          "Where trace events go: \"log\" to the INFO log, \"ring_buffer\" "
+          "to an in-memory ring buffer that is dumped to --trace_dump_file on "
+          "SIGUSR1 and at exit, or \"none\".");
+ABSL_FLAG(uint64_t, trace_ring_buffer_mb, 64,
+          "Size of the trace ring buffer, in MiB.");
+ABSL_FLAG(std::string, trace_dump_file, "eesi_trace.txt",
+          "File the trace ring buffer is dumped to.");
+ABSL_FLAG(std::string, metrics_file, "",
+          "File that the metrics of the service, also served by the "
+          "GetMetrics rpc, are written to in the Prometheus text format "
+          "every --metrics_dump_interval_s seconds and at exit. If empty, "
+          "they are only served by the rpc.");
+ABSL_FLAG(uint64_t, metrics_dump_interval_s, 15,
+          "Seconds between two writes of --metrics_file.");
+ABSL_FLAG(std::string, timeline_dir, "",
+          "Directory that the timelines of the GetSpecifications requests "
+          "that ask for one are written to, as Chrome trace-event JSON "
+          "files named after the task. If empty, such requests are "
+          "rejected.");
 
 int main(int argc, char **argv) {
   google::InitGoogleLogging("eesi-service");
   absl::ParseCommandLine(argc, argv);
+  const std::string trace_sink = absl::GetFlag(FLAGS_trace_sink);
+  const std::string trace_dump_file = absl::GetFlag(FLAGS_trace_dump_file);
+  error_specifications::TraceSink sink;
+  if (trace_sink == "log") {
+    sink = error_specifications::TraceSink::kLog;
+  } else if (trace_sink == "ring_buffer") {
+    sink = error_specifications::TraceSink::kRingBuffer;
+    // Before any other thread starts.
+    error_specifications::Tracer::DumpOnSignal(SIGUSR1, trace_dump_file);
+  } else if (trace_sink == "none") {
+    sink = error_specifications::TraceSink::kNone;
+  } else {
+    LOG(ERROR) << "Unknown --trace_sink: " << trace_sink;
+    return 1;
+  }
+  error_specifications::Tracer::Configure(
+      absl::GetFlag(FLAGS_trace_level), sink,
+      absl::GetFlag(FLAGS_trace_ring_buffer_mb) << 20);
+  const std::string metrics_file = absl::GetFlag(FLAGS_metrics_file);
+  if (!metrics_file.empty()) {
+    error_specifications::MetricRegistry::Get().DumpPeriodically(
+        metrics_file,
+        std::chrono::seconds(absl::GetFlag(FLAGS_metrics_dump_interval_s)));
+  }
   std::string listen_address = absl::GetFlag(FLAGS_listen);
-  error_specifications::RunEesiServer(listen_address);
+  error_specifications::LlmResponseCache::Get().Open(
+      absl::GetFlag(FLAGS_llm_cache_file));
+  error_specifications::GptClientOptions gpt_client_options;
+  gpt_client_options.endpoints = absl::GetFlag(FLAGS_gpt_endpoints);
+  const std::string gpt_balancing = absl::GetFlag(FLAGS_gpt_balancing);
+  if (gpt_balancing == "round_robin") {
+    gpt_client_options.balancing =
+        error_specifications::GptBalancing::kRoundRobin;
+  } else if (gpt_balancing == "least_outstanding") {
+    gpt_client_options.balancing =
+        error_specifications::GptBalancing::kLeastOutstanding;
+  } else {
+    LOG(ERROR) << "Unknown --gpt_balancing: " << gpt_balancing;
+    return 1;
+  }
+  gpt_client_options.ejection_failures =
+      absl::GetFlag(FLAGS_gpt_ejection_failures);
+  gpt_client_options.ejection_ms = absl::GetFlag(FLAGS_gpt_ejection_ms);
+  gpt_client_options.max_in_flight = absl::GetFlag(FLAGS_llm_max_in_flight);
+  gpt_client_options.requests_per_minute =
+      absl::GetFlag(FLAGS_llm_requests_per_minute);
+  gpt_client_options.tokens_per_minute =
+      absl::GetFlag(FLAGS_llm_tokens_per_minute);
+  gpt_client_options.deadline_ms = absl::GetFlag(FLAGS_llm_deadline_ms);
+  gpt_client_options.max_attempts = absl::GetFlag(FLAGS_llm_max_attempts);
+  gpt_client_options.hedge = absl::GetFlag(FLAGS_llm_hedge);
+  error_specifications::GptAsyncClient::Get().Configure(gpt_client_options);
+  error_specifications::AdmissionOptions admission_options;
+  admission_options.memory_budget_bytes =
+      absl::GetFlag(FLAGS_memory_budget_mb) << 20;
+  admission_options.max_concurrent_tasks =
+      absl::GetFlag(FLAGS_max_concurrent_tasks);
+  admission_options.default_task_bytes =
+      absl::GetFlag(FLAGS_task_memory_estimate_mb) << 20;
+  error_specifications::RunEesiServer(listen_address, admission_options,
+                                      absl::GetFlag(FLAGS_timeline_dir));
+  if (sink == error_specifications::TraceSink::kRingBuffer) {
+    std::ofstream trace_dump(trace_dump_file, std::ios::trunc);
+    error_specifications::Tracer::Dump(trace_dump);
+  }
+  if (!metrics_file.empty()) {
+    error_specifications::MetricRegistry::Get().DumpToFile(metrics_file);
+  }
   google::FlushLogFiles(google::INFO);
   return 0;
 }
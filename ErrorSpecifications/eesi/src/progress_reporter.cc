@@ -0,0 +1,110 @@
+#include "progress_reporter.h"
+
+namespace error_specifications {
+
+constexpr std::chrono::milliseconds ProgressReporter::kDefaultMinInterval;
+
+ProgressReporter::ProgressReporter(Callback callback,
+                                   std::chrono::milliseconds min_interval)
+    : callback_(std::move(callback)),
+      min_interval_(min_interval),
+      start_time_(Clock::now()),
+      scc_start_time_(start_time_),
+      last_publish_time_(start_time_) {
+  metadata_.set_eta_seconds(-1);
+}
+
+void ProgressReporter::SetCurrentPass(const std::string &pass_name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_current_pass(pass_name);
+  MaybePublishLocked(/*force=*/true);
+}
+
+void ProgressReporter::SetSccsTotal(uint64_t sccs_total) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_sccs_total(sccs_total);
+  metadata_.set_sccs_processed(0);
+  scc_start_time_ = Clock::now();
+  MaybePublishLocked(/*force=*/true);
+}
+
+void ProgressReporter::IncrementSccsProcessed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_sccs_processed(metadata_.sccs_processed() + 1);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::IncrementFunctionsAnalyzed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_functions_analyzed(metadata_.functions_analyzed() + 1);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::IncrementLlmCallsIssued(uint64_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_llm_calls_issued(metadata_.llm_calls_issued() + count);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::IncrementLlmCallsCompleted(uint64_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_llm_calls_completed(metadata_.llm_calls_completed() + count);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::SetLlmContextTokenBudget(uint64_t budget) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_llm_context_token_budget(budget);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::AddLlmContextSelection(uint64_t kept,
+                                              uint64_t dropped) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_llm_context_specifications_kept(
+      metadata_.llm_context_specifications_kept() + kept);
+  metadata_.set_llm_context_specifications_dropped(
+      metadata_.llm_context_specifications_dropped() + dropped);
+  MaybePublishLocked(/*force=*/false);
+}
+
+void ProgressReporter::IncrementLlmQueriesSkipped(uint64_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metadata_.set_llm_queries_skipped(metadata_.llm_queries_skipped() + count);
+  MaybePublishLocked(/*force=*/false);
+}
+
+GetSpecificationsMetadata ProgressReporter::Snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  UpdateTimingLocked();
+  return metadata_;
+}
+
+void ProgressReporter::MaybePublishLocked(bool force) {
+  const Clock::time_point now = Clock::now();
+  if (!force && now - last_publish_time_ < min_interval_) return;
+  last_publish_time_ = now;
+  UpdateTimingLocked();
+  if (callback_) callback_(metadata_);
+}
+
+void ProgressReporter::UpdateTimingLocked() {
+  const Clock::time_point now = Clock::now();
+  const std::chrono::duration<double> elapsed = now - start_time_;
+  metadata_.set_elapsed_seconds(elapsed.count());
+
+  // The ETA extrapolates the mean time per SCC over the remaining SCCs. SCCs
+  // vary a lot in size, but processing is bottom-up so the average settles
+  // quickly once a few hundred leaves are done.
+  const uint64_t processed = metadata_.sccs_processed();
+  const uint64_t total = metadata_.sccs_total();
+  if (processed == 0 || total == 0) {
+    metadata_.set_eta_seconds(-1);
+    return;
+  }
+  const std::chrono::duration<double> scc_elapsed = now - scc_start_time_;
+  const uint64_t remaining = total > processed ? total - processed : 0;
+  metadata_.set_eta_seconds(scc_elapsed.count() / processed * remaining);
+}
+
+}  // namespace error_specifications
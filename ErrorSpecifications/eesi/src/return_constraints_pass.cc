@@ -6,107 +6,53 @@
 #include "llvm.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "metrics.h"
 #include "return_propagation_pass.h"
 #include "tbb/tbb.h"
 
 namespace error_specifications {
 
 bool ReturnConstraintsPass::runOnModule(llvm::Module &module) {
+  ScopedPassMetrics pass_metrics("ReturnConstraintsPass");
+  if (progress_reporter_) {
+    progress_reporter_->SetCurrentPass("ReturnConstraintsPass");
+  }
+  return_propagation_ = &getAnalysis<ReturnPropagationPass>();
+
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
   }
 
-  // Initialize program points to empty ReturnConstraintsFact.
-  // Creates a new fact at every program point.
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          for (const auto &basic_block : *function) {
-            std::shared_ptr<ReturnConstraintsFact> prev =
-                std::make_shared<ReturnConstraintsFact>();
-            for (auto &inst : basic_block) {
-              input_facts_[&inst] = prev;
-              output_facts_[&inst] = std::make_shared<ReturnConstraintsFact>();
-              prev = output_facts_[&inst];
-            }
-          }
-        }
-      });
-
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          this->RunOnFunction(*function);
-        }
-      });
+  dataflow_.Initialize(module_functions);
+  dataflow_.SolveAll(module_functions);
+  dataflow_.LogStats("ReturnConstraintsPass");
 
   return false;
 }
 
 void ReturnConstraintsPass::RunOnFunction(const llvm::Function &F) {
-  std::string fname = F.getName().str();
-
-  bool changed = true;
-  while (changed) {
-    changed = false;
-
-    for (auto bi = F.begin(), be = F.end(); bi != be; ++bi) {
-      const llvm::BasicBlock *BB = &*bi;
-      const llvm::Instruction *succ_begin = &*(BB->begin());
-      auto succ_fact = input_facts_.at(succ_begin);
-
-      // Go over predecessor blocks and apply join
-      for (auto pi = llvm::pred_begin(BB), pe = llvm::pred_end(BB); pi != pe;
-           ++pi) {
-        const llvm::Instruction *pred_term = (*pi)->getTerminator();
-        auto pred_fact = output_facts_.at(pred_term);
-        succ_fact->Join(*pred_fact);
-      }
-
-      changed = VisitBlock(*BB) || changed;
-    }
-  }
-  return;
+  dataflow_.Solve(F);
 }
 
-bool ReturnConstraintsPass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
-  for (auto ii = BB.begin(), ie = BB.end(); ii != ie; ++ii) {
-    const llvm::Instruction &I = *ii;
-
-    std::shared_ptr<ReturnConstraintsFact> input_fact = input_facts_.at(&I);
-    std::shared_ptr<ReturnConstraintsFact> output_fact = output_facts_.at(&I);
-
-    ReturnConstraintsFact prev_fact = *output_fact;
-    if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
-      VisitCallInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BranchInst *inst =
-                   llvm::dyn_cast<llvm::BranchInst>(&I)) {
-      VisitBranchInst(*inst, input_fact, output_fact);
-    } else if (const llvm::SwitchInst *inst =
-                   llvm::dyn_cast<llvm::SwitchInst>(&I)) {
-      VisitSwitchInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
-      VisitPHINode(*inst, input_fact, output_fact);
-    } else {
-      // Default is to just copy facts from previous instruction unchanged.
-      output_fact->value = input_fact->value;
-    }
-    changed = changed || (*(output_fact) != prev_fact);
-  }
+// Join the exit facts of predecessor blocks.
+void ReturnConstraintsPass::JoinEdge(const llvm::BasicBlock &BB,
+                                     const ReturnConstraintsFact &pred,
+                                     ReturnConstraintsFact &in) {
+  in.Join(pred);
+}
 
-  return changed;
+// Default is to just copy facts from previous instruction unchanged.
+void ReturnConstraintsPass::Visit(const llvm::Instruction &I,
+                                  const ReturnConstraintsFact &in,
+                                  ReturnConstraintsFact &out) {
+  out.value = in.value;
 }
 
-void ReturnConstraintsPass::VisitCallInst(
-    const llvm::CallInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
-  out->value = in->value;
+void ReturnConstraintsPass::Visit(const llvm::CallInst &I,
+                                  const ReturnConstraintsFact &in,
+                                  ReturnConstraintsFact &out) {
+  out.value = in.value;
   std::unordered_set<const llvm::Value *> gen_value({&I});
 
   std::string callee_name = GetCallee(I).source_name();
@@ -114,7 +60,7 @@ void ReturnConstraintsPass::VisitCallInst(
   Constraint c(callee_name);
   c.lattice_element = SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
 
-  out->value[callee_name] = c;
+  out.value[callee_name] = c;
 }
 
 const std::map<SignLatticeElement, SignLatticeElement>
@@ -314,10 +260,10 @@ ReturnConstraintsPass::AbstractICmp(const llvm::ICmpInst &I) {
   return result;
 }
 
-void ReturnConstraintsPass::VisitSwitchInst(
-    const llvm::SwitchInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
-  out->value = in->value;
+void ReturnConstraintsPass::Visit(const llvm::SwitchInst &I,
+                                  const ReturnConstraintsFact &in,
+                                  ReturnConstraintsFact &out) {
+  out.value = in.value;
 
   llvm::Value *condition = I.getCondition();
   if (!condition) return;
@@ -345,14 +291,10 @@ void ReturnConstraintsPass::VisitSwitchInst(
 
     // Get the set of function whose values reach either the condition or the
     // case from return-propagation.
-    ReturnPropagationPass *return_propagation =
-        &getAnalysis<ReturnPropagationPass>();
     const llvm::Value *value_reaching_case;
-    if (return_propagation->output_facts_.find(case_value) !=
-        return_propagation->output_facts_.end()) {
+    if (return_propagation_->HasFacts(case_value)) {
       value_reaching_case = case_value;
-    } else if (return_propagation->output_facts_.find(condition) !=
-               return_propagation->output_facts_.end()) {
+    } else if (return_propagation_->HasFacts(condition)) {
       value_reaching_case = condition;
     } else {
       return;
@@ -360,16 +302,16 @@ void ReturnConstraintsPass::VisitSwitchInst(
 
     // The first element of this pair is the llvm value being tested
     // The second element is the set of functions which the key value may hold.
-    auto fact = return_propagation->output_facts_.at(value_reaching_case);
+    const ReturnPropagationFact &fact =
+        return_propagation_->GetOutFact(value_reaching_case);
     std::unordered_set<const llvm::Value *> test_ret_values;
-    for (auto element : fact->value) {
+    for (const auto &element : fact.value) {
       if (element.first == value_reaching_case) {
         test_ret_values = element.second;
       }
     }
 
     const llvm::BasicBlock *case_bb = case_entry.getCaseSuccessor();
-    const llvm::Instruction *case_bb_first = GetFirstInstructionOfBB(case_bb);
     for (const llvm::Value *v : test_ret_values) {
       if (!llvm::isa<llvm::CallInst>(v)) continue;
 
@@ -385,7 +327,7 @@ void ReturnConstraintsPass::VisitSwitchInst(
       Constraint kill_constraint(fname);
       kill_constraint.lattice_element =
           SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-      out->value[fname] = kill_constraint;
+      out.value[fname] = kill_constraint;
 
       Constraint case_c(fname);
       case_c.lattice_element = case_abstract_value;
@@ -393,8 +335,8 @@ void ReturnConstraintsPass::VisitSwitchInst(
       // Insert fname's constraint into the temporary case fact. We use
       // the input fact because we killed fname's entry in the output fact.
       ReturnConstraintsFact case_fact;
-      auto it = in->value.find(fname);
-      if (it != in->value.end()) {
+      auto it = in.value.find(fname);
+      if (it != in.value.end()) {
         // fname has a pre-existing constraint
         case_fact.value[fname] = case_c.Meet(it->second);
       } else {
@@ -404,16 +346,15 @@ void ReturnConstraintsPass::VisitSwitchInst(
       // We perform a join here to simulate predecessor join for fname.  The
       // original predecessor join in RunOnFunction won't work on fname because
       // we killed fname's entry in the out fact.
-      auto existing_case_fact = input_facts_.at(case_bb_first);
-      existing_case_fact->Join(case_fact);
+      dataflow_.JoinIntoBlock(*case_bb, case_fact);
     }
   }
 }
 
-void ReturnConstraintsPass::VisitBranchInst(
-    const llvm::BranchInst &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
-  out->value = in->value;
+void ReturnConstraintsPass::Visit(const llvm::BranchInst &I,
+                                  const ReturnConstraintsFact &in,
+                                  ReturnConstraintsFact &out) {
+  out.value = in.value;
 
   if (I.isUnconditional()) {
     return;
@@ -426,9 +367,6 @@ void ReturnConstraintsPass::VisitBranchInst(
     return;
   }
 
-  ReturnPropagationPass *return_propagation =
-      &getAnalysis<ReturnPropagationPass>();
-
   llvm::BasicBlock *true_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(2));
   assert(true_bb);
   llvm::BasicBlock *false_bb =
@@ -440,22 +378,21 @@ void ReturnConstraintsPass::VisitBranchInst(
   // Get the set of function whose values reach icmp operand from
   // return-propagation.
   llvm::Value *icmp_value = nullptr;
-  if (return_propagation->output_facts_.find(icmp->getOperand(0)) !=
-      return_propagation->output_facts_.end()) {
+  if (return_propagation_->HasFacts(icmp->getOperand(0))) {
     icmp_value = icmp->getOperand(0);
-  } else if (return_propagation->output_facts_.find(icmp->getOperand(1)) !=
-             return_propagation->output_facts_.end()) {
+  } else if (return_propagation_->HasFacts(icmp->getOperand(1))) {
     icmp_value = icmp->getOperand(1);
   } else {
     return;
   }
 
-  auto fact = return_propagation->output_facts_.at(icmp_value);
+  const ReturnPropagationFact &fact =
+      return_propagation_->GetOutFact(icmp_value);
 
   // The first element of this pair is the llvm value being tested
   // The second element is the set of functions which the key value may hold.
   std::unordered_set<const llvm::Value *> test_ret_values;
-  for (auto element : fact->value) {
+  for (const auto &element : fact.value) {
     if (element.first == icmp_value) {
       test_ret_values = element.second;
     }
@@ -479,7 +416,7 @@ void ReturnConstraintsPass::VisitBranchInst(
     Constraint kill_constraint(fname);
     kill_constraint.lattice_element =
         SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
-    out->value[fname] = kill_constraint;
+    out.value[fname] = kill_constraint;
 
     Constraint true_c(fname);
     true_c.lattice_element = true_abstract_value;
@@ -488,8 +425,8 @@ void ReturnConstraintsPass::VisitBranchInst(
 
     // Insert fname's constraint into the temporary true/false facts.  We use
     // the input fact because we killed fname's entry in the output fact.
-    auto it = in->value.find(fname);
-    if (it != in->value.end()) {
+    auto it = in.value.find(fname);
+    if (it != in.value.end()) {
       // fname has a pre-existing constraint
       true_fact.value[fname] = true_c.Meet(it->second);
       false_fact.value[fname] = false_c.Meet(it->second);
@@ -501,32 +438,27 @@ void ReturnConstraintsPass::VisitBranchInst(
     // We perform a join here to simulate predecessor join for fname.  The
     // original predecessor join in RunOnFunction won't work on fname because we
     // killed fname's entry in the out fact.
-    const llvm::Instruction *true_first = GetFirstInstructionOfBB(true_bb);
-    auto existing_true_fact = input_facts_.at(true_first);
-    existing_true_fact->Join(true_fact);
-
-    const llvm::Instruction *false_first = GetFirstInstructionOfBB(false_bb);
-    auto existing_false_fact = input_facts_.at(false_first);
-    existing_false_fact->Join(false_fact);
+    dataflow_.JoinIntoBlock(*true_bb, true_fact);
+    dataflow_.JoinIntoBlock(*false_bb, false_fact);
   }
 }
 
 // If the PHI result can be returned, then add incoming values
 // to the exit of each incoming basic block.
-void ReturnConstraintsPass::VisitPHINode(
-    const llvm::PHINode &I, std::shared_ptr<const ReturnConstraintsFact> in,
-    std::shared_ptr<ReturnConstraintsFact> out) {
-  out->value = in->value;
+void ReturnConstraintsPass::Visit(const llvm::PHINode &I,
+                                  const ReturnConstraintsFact &in,
+                                  ReturnConstraintsFact &out) {
+  out.value = in.value;
 }
 
-ReturnConstraintsFact ReturnConstraintsPass::GetInFact(
+const ReturnConstraintsFact &ReturnConstraintsPass::GetInFact(
     const llvm::Value *v) const {
-  return *(input_facts_.at(v));
+  return dataflow_.GetInFact(v);
 }
 
-ReturnConstraintsFact ReturnConstraintsPass::GetOutFact(
+const ReturnConstraintsFact &ReturnConstraintsPass::GetOutFact(
     const llvm::Value *v) const {
-  return *(output_facts_.at(v));
+  return dataflow_.GetOutFact(v);
 }
 
 std::set<SignLatticeElement> ReturnConstraintsPass::GetConstraints(
@@ -541,8 +473,9 @@ std::set<SignLatticeElement> ReturnConstraintsPass::GetConstraints(
 
     for (auto &basic_block : function) {
       const llvm::Instruction *inst = GetFirstInstructionOfBB(&basic_block);
-      auto return_constraints_fact = input_facts_.at(inst);
-      for (const auto &kv : return_constraints_fact->value) {
+      const ReturnConstraintsFact &return_constraints_fact =
+          dataflow_.GetInFact(inst);
+      for (const auto &kv : return_constraints_fact.value) {
         if (kv.first == called_function.source_name()) {
           ret.insert(kv.second.lattice_element);
         }
@@ -14,203 +14,149 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include "metrics.h"
 
 namespace error_specifications {
 
 bool ReturnPropagationPass::runOnModule(llvm::Module &module) {
   if (finished) return false;
+  ScopedPassMetrics pass_metrics("ReturnPropagationPass");
+  if (progress_reporter_) {
+    progress_reporter_->SetCurrentPass("ReturnPropagationPass");
+  }
 
   std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &fn : module) {
     module_functions.push_back(&fn);
   }
 
-  // Initialize program points to empty ReturnConstraintsFact.
-  // Creates a new fact at every program point.
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          for (const auto &basic_block : *function) {
-            std::shared_ptr<ReturnPropagationFact> prev =
-                std::make_shared<ReturnPropagationFact>();
-            for (auto &inst : basic_block) {
-              input_facts_[&inst] = prev;
-              output_facts_[&inst] = std::make_shared<ReturnPropagationFact>();
-              prev = output_facts_[&inst];
-            }
-          }
-        }
-      });
-
-  tbb::parallel_for(
-      tbb::blocked_range<std::vector<const llvm::Function *>::iterator>(
-          module_functions.begin(), module_functions.end()),
-      [&](auto thread_functions) {
-        for (const auto *function : thread_functions) {
-          this->RunOnFunction(*function);
-        }
-      });
+  dataflow_.Initialize(module_functions);
+  dataflow_.SolveAll(module_functions);
+  dataflow_.LogStats("ReturnPropagationPass");
 
   finished = true;
 
   return false;
 }
 
-bool ReturnPropagationPass::RunOnFunction(const llvm::Function &F) {
-  std::string fname = F.getName().str();
-
-  bool changed = true;
-  while (changed) {
-    changed = false;
-
-    for (auto bi = F.begin(), be = F.end(); bi != be; ++bi) {
-      const llvm::BasicBlock *BB = &*bi;
-      const llvm::Instruction *succ_begin = &*(BB->begin());
-      auto succ_fact = input_facts_.at(succ_begin);
-
-      // Go over predecessor blocks and apply join.
-      for (auto pi = pred_begin(BB), pe = pred_end(BB); pi != pe; ++pi) {
-        const llvm::Instruction *pred_term = (*pi)->getTerminator();
-        auto pred_fact = output_facts_.at(pred_term);
-        succ_fact->Join(*pred_fact);
-      }
+void ReturnPropagationPass::RunOnFunction(const llvm::Function &F) {
+  dataflow_.Solve(F);
+}
 
-      changed = VisitBlock(*BB) || changed;
-    }
-  }
+bool ReturnPropagationPass::HasFacts(const llvm::Value *v) const {
+  return dataflow_.HasFacts(v);
+}
 
-  return false;
+const ReturnPropagationFact &ReturnPropagationPass::GetInFact(
+    const llvm::Value *v) const {
+  return dataflow_.GetInFact(v);
 }
 
-bool ReturnPropagationPass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
-  for (auto ii = BB.begin(), ie = BB.end(); ii != ie; ++ii) {
-    const llvm::Instruction &I = *ii;
-
-    std::shared_ptr<ReturnPropagationFact> input_fact = input_facts_.at(&I);
-    std::shared_ptr<ReturnPropagationFact> output_fact = output_facts_.at(&I);
-    ReturnPropagationFact prev_fact = *output_fact;
-
-    if (const llvm::CallInst *inst = llvm::dyn_cast<llvm::CallInst>(&I)) {
-      VisitCallInst(*inst, input_fact, output_fact);
-    } else if (const llvm::LoadInst *inst =
-                   llvm::dyn_cast<llvm::LoadInst>(&I)) {
-      VisitLoadInst(*inst, input_fact, output_fact);
-    } else if (const llvm::StoreInst *inst =
-                   llvm::dyn_cast<llvm::StoreInst>(&I)) {
-      VisitStoreInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BitCastInst *inst =
-                   llvm::dyn_cast<llvm::BitCastInst>(&I)) {
-      VisitBitCastInst(*inst, input_fact, output_fact);
-    } else if (const llvm::PtrToIntInst *inst =
-                   llvm::dyn_cast<llvm::PtrToIntInst>(&I)) {
-      VisitPtrToIntInst(*inst, input_fact, output_fact);
-    } else if (const llvm::BinaryOperator *inst =
-                   llvm::dyn_cast<llvm::BinaryOperator>(&I)) {
-      VisitBinaryOperator(*inst, input_fact, output_fact);
-    } else if (const llvm::PHINode *inst = llvm::dyn_cast<llvm::PHINode>(&I)) {
-      VisitPHINode(*inst, input_fact, output_fact);
-    } else {
-      // Default is to just copy facts from previous instruction unchanged.
-      output_fact->value = input_fact->value;
-    }
+const ReturnPropagationFact &ReturnPropagationPass::GetOutFact(
+    const llvm::Value *v) const {
+  return dataflow_.GetOutFact(v);
+}
 
-    changed = changed || (*output_fact != prev_fact);
-  }
+// Join the exit facts of predecessor blocks.
+void ReturnPropagationPass::JoinEdge(const llvm::BasicBlock &BB,
+                                     const ReturnPropagationFact &pred,
+                                     ReturnPropagationFact &in) {
+  in.Join(pred);
+}
 
-  return changed;
+// Default is to just copy facts from previous instruction unchanged.
+void ReturnPropagationPass::Visit(const llvm::Instruction &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
+  out.value = in.value;
 }
 
-void ReturnPropagationPass::VisitCallInst(
-    const llvm::CallInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
-  out->value = in->value;
+void ReturnPropagationPass::Visit(const llvm::CallInst &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
+  out.value = in.value;
 
-  if (out->value.find(&I) == out->value.end()) {
-    out->value[&I] = std::unordered_set<const llvm::Value *>();
+  if (out.value.find(&I) == out.value.end()) {
+    out.value[&I] = std::unordered_set<const llvm::Value *>();
   }
-  out->value.at(&I).insert(&I);
+  out.value.at(&I).insert(&I);
 }
 
 // Copy the return facts into a new value.
-void ReturnPropagationPass::VisitLoadInst(
-    const llvm::LoadInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
-  out->value = in->value;
+void ReturnPropagationPass::Visit(const llvm::LoadInst &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
+  out.value = in.value;
   llvm::Value *load_from = I.getOperand(0);
 
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  if (in.value.find(load_from) != in.value.end()) {
+    out.value[&I] = in.value.at(load_from);
   }
 }
 
 // Copy the return facts into a new value.
-void ReturnPropagationPass::VisitStoreInst(
-    const llvm::StoreInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+void ReturnPropagationPass::Visit(const llvm::StoreInst &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
   llvm::Value *sender = I.getOperand(0);
   llvm::Value *receiver = I.getOperand(1);
 
-  out->value = in->value;
+  out.value = in.value;
 
   if (llvm::isa<llvm::ConstantInt>(sender)) {
-    if (out->value.find(receiver) == out->value.end()) {
-      out->value[receiver] = std::unordered_set<const llvm::Value *>();
+    if (out.value.find(receiver) == out.value.end()) {
+      out.value[receiver] = std::unordered_set<const llvm::Value *>();
     }
-    out->value.at(receiver).insert(sender);
+    out.value.at(receiver).insert(sender);
   }
 
-  if (in->value.find(sender) != in->value.end()) {
-    out->value[receiver] = in->value.at(sender);
+  if (in.value.find(sender) != in.value.end()) {
+    out.value[receiver] = in.value.at(sender);
   }
 }
 
-void ReturnPropagationPass::VisitBitCastInst(
-    const llvm::BitCastInst &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+void ReturnPropagationPass::Visit(const llvm::BitCastInst &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
   // Identical to load.
-  out->value = in->value;
+  out.value = in.value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  if (in.value.find(load_from) != in.value.end()) {
+    out.value[&I] = in.value.at(load_from);
   }
 }
 
-void ReturnPropagationPass::VisitPtrToIntInst(
-    const llvm::PtrToIntInst &I,
-    std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+void ReturnPropagationPass::Visit(const llvm::PtrToIntInst &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
   // Identical to load.
-  out->value = in->value;
+  out.value = in.value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  if (in.value.find(load_from) != in.value.end()) {
+    out.value[&I] = in.value.at(load_from);
   }
 }
 
-void ReturnPropagationPass::VisitBinaryOperator(
-    const llvm::BinaryOperator &I,
-    std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+void ReturnPropagationPass::Visit(const llvm::BinaryOperator &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
   // Identical to load.
-  out->value = in->value;
+  out.value = in.value;
   llvm::Value *load_from = I.getOperand(0);
-  if (in->value.find(load_from) != in->value.end()) {
-    out->value[&I] = in->value.at(load_from);
+  if (in.value.find(load_from) != in.value.end()) {
+    out.value[&I] = in.value.at(load_from);
   }
 }
 
-void ReturnPropagationPass::VisitPHINode(
-    const llvm::PHINode &I, std::shared_ptr<const ReturnPropagationFact> in,
-    std::shared_ptr<ReturnPropagationFact> out) {
+void ReturnPropagationPass::Visit(const llvm::PHINode &I,
+                                  const ReturnPropagationFact &in,
+                                  ReturnPropagationFact &out) {
   // Union all of the sets together for phi incoming values.
   for (unsigned i = 0, e = I.getNumIncomingValues(); i != e; ++i) {
     llvm::Value *v = I.getIncomingValue(i);
-    if (in->value.find(v) != in->value.end()) {
-      for (const llvm::Value *from : in->value.at(v)) {
-        out->value[&I].insert(from);
+    if (in.value.find(v) != in.value.end()) {
+      for (const llvm::Value *from : in.value.at(v)) {
+        out.value[&I].insert(from);
       }
     }
   }
@@ -1,11 +1,13 @@
 #include "return_range_pass.h"
 
-#include "call_graph_underapproximation.h"
+#include "call_graph_pass.h"
 #include "eesi_common.h"
-#include "llvm/ADT/SCCIterator.h"
 #include "llvm/IR/CFG.h"
+#include "metrics.h"
 #include "return_constraints_pass.h"
 #include "returned_values_pass.h"
+#include "tbb/tbb.h"
+#include "timeline.h"
 
 namespace error_specifications {
 
@@ -76,75 +78,82 @@ bool ReturnRangeFact::Contains(const llvm::Value *v) const {
 }
 
 bool ReturnRangePass::runOnModule(llvm::Module &module) {
+  ScopedPassMetrics pass_metrics("ReturnRangePass");
+  if (progress_reporter_) progress_reporter_->SetCurrentPass("ReturnRangePass");
+  returned_values_ = &getAnalysis<ReturnedValuesPass>();
+
   // Initialize program points to empty ReturnRangeFact.
   // Creates a new fact at every relevant program point.
+  std::vector<const llvm::Function *> module_functions;
   for (const llvm::Function &func : module) {
-    if (!ShouldIgnore(&func)) {
-      for (const llvm::BasicBlock &basic_block : func) {
-        std::shared_ptr<ReturnRangeFact> prev =
-            std::make_shared<ReturnRangeFact>();
-        for (const llvm::Instruction &inst : basic_block) {
-          input_facts_[&inst] = prev;
-          output_facts_[&inst] = std::make_shared<ReturnRangeFact>();
-          prev = output_facts_[&inst];
-        }
-      }
-    }
+    if (!ShouldIgnore(&func)) module_functions.push_back(&func);
   }
-
-  llvm::CallGraph call_graph = CallGraphUnderapproximation(module);
-
-  for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
-       ++scc_it) {
-    const bool has_loop = scc_it.hasLoop();
-    bool changed;
-
-    do {
-      changed = false;
-      for (auto node : *scc_it) {
-        const llvm::Function *func = node->getFunction();
-
-        if (!ShouldIgnore(func)) {
-          auto orig_range = GetReturnRange(
-              *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
-
-          RunOnFunction(*func);
-
-          auto new_range = GetReturnRange(
-              *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
-          changed = changed || orig_range != new_range;
-        }
-      }
-    } while (has_loop && changed);
+  dataflow_.Initialize(module_functions);
+
+  // SCCs on the same level do not call each other, and the return range of
+  // a function only depends on the ranges of the functions it calls, so the
+  // SCCs of a level are analyzed in parallel once the levels below are done.
+  const CallGraphPass &call_graph = getAnalysis<CallGraphPass>();
+  Timeline *timeline = Timeline::Current();
+  for (uint32_t level = 0; level < call_graph.NumLevels(); ++level) {
+    const llvm::ArrayRef<SccId> sccs = call_graph.GetLevelSccs(level);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, sccs.size()),
+        [this, &call_graph, &sccs,
+         timeline](const tbb::blocked_range<size_t> &range) {
+          Timeline::Scope timeline_scope(timeline);
+          for (size_t i = range.begin(); i != range.end(); ++i) {
+            RunOnScc(call_graph, sccs[i]);
+          }
+        });
   }
+  dataflow_.LogStats("ReturnRangePass");
 
   return false;
 }
 
-void ReturnRangePass::RunOnFunction(const llvm::Function &func) {
+void ReturnRangePass::RunOnScc(const CallGraphPass &call_graph, SccId scc) {
+  static Counter &scc_iterations = GetSccIterationsCounter("ReturnRangePass");
+  const bool has_loop = call_graph.SccHasLoop(scc);
+  TimelineSpan scc_span(kTimelineScc, "Scc");
+  scc_span.Arg("scc", scc)
+      .Arg("functions", call_graph.GetSccFunctions(scc).size());
   bool changed;
 
   do {
     changed = false;
+    scc_iterations.Increment();
+    for (FunctionId function : call_graph.GetSccFunctions(scc)) {
+      const llvm::Function *func = call_graph.GetFunction(function);
 
-    for (const llvm::BasicBlock &BB : func) {
-      const llvm::Instruction *bb_first = GetFirstInstructionOfBB(&BB);
-      auto bb_first_fact = input_facts_.at(bb_first);
+      if (!ShouldIgnore(func)) {
+        auto orig_range = GetReturnRange(
+            *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
 
-      const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-      const auto bb_first_rvf = returned_values_pass.GetInFact(bb_first);
+        RunOnFunction(*func);
 
-      // Predecessor join
-      for (auto pi = llvm::pred_begin(&BB), pe = llvm::pred_end(&BB); pi != pe;
-           ++pi) {
-        const llvm::Instruction *pred_last = GetLastInstructionOfBB(*pi);
-        auto &pred_last_fact = output_facts_.at(pred_last);
-        bb_first_fact->FilteredJoin(*pred_last_fact, bb_first_rvf);
+        auto new_range = GetReturnRange(
+            *func, SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
+        changed = changed || orig_range != new_range;
       }
-
-      changed = VisitBlock(BB) || changed;
     }
-  } while (changed);
+  } while (has_loop && changed);
+}
+
+void ReturnRangePass::RunOnFunction(const llvm::Function &func) {
+  TimelineSpan function_span(kTimelineFunction, "RunOnFunction");
+  if (function_span.Enabled()) {
+    function_span.Arg("function", func.getName().str());
+  }
+  dataflow_.Solve(func);
+}
+
+// Predecessor join, keeping only the values returnable at the block entry.
+void ReturnRangePass::JoinEdge(const llvm::BasicBlock &BB,
+                               const ReturnRangeFact &pred,
+                               ReturnRangeFact &in) {
+  in.FilteredJoin(pred,
+                  returned_values_->GetInFact(GetFirstInstructionOfBB(&BB)));
 }
 
 SignLatticeElement ReturnRangePass::GetReturnRange(
@@ -154,73 +163,65 @@ SignLatticeElement ReturnRangePass::GetReturnRange(
 
 SignLatticeElement ReturnRangePass::GetReturnRange(
     const llvm::Function &func, const SignLatticeElement default_return) const {
-  return return_ranges_.count(&func) > 0 ? return_ranges_.at(&func)
-                                         : default_return;
+  auto it = return_ranges_.find(&func);
+  return it != return_ranges_.end() ? it->second : default_return;
 }
 
-const std::unordered_map<const llvm::Function *, SignLatticeElement>
-    &ReturnRangePass::GetReturnRanges() const {
+const ReturnRangePass::ReturnRangeMap &ReturnRangePass::GetReturnRanges()
+    const {
   return return_ranges_;
 }
 
-ReturnRangeFact ReturnRangePass::GetInFact(
+const ReturnRangeFact &ReturnRangePass::GetInFact(
     const llvm::Instruction *inst) const {
-  return *input_facts_.at(inst);
+  return dataflow_.GetInFact(inst);
 }
 
-ReturnRangeFact ReturnRangePass::GetOutFact(
+const ReturnRangeFact &ReturnRangePass::GetOutFact(
     const llvm::Instruction *inst) const {
-  return *output_facts_.at(inst);
+  return dataflow_.GetOutFact(inst);
 }
 
 void ReturnRangePass::getAnalysisUsage(llvm::AnalysisUsage &au) const {
+  au.addRequired<CallGraphPass>();
   au.addRequired<ReturnedValuesPass>();
   au.setPreservesAll();
 }
 
-// Called for each basic block.
-bool ReturnRangePass::VisitBlock(const llvm::BasicBlock &BB) {
-  bool changed = false;
-
-  for (const llvm::Instruction &inst : BB) {
-    const auto &in_fact = input_facts_.at(&inst);
-    const auto &out_fact = output_facts_.at(&inst);
-    const auto orig_out_fact = *out_fact;
-
-    const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-    const auto out_rvf = returned_values_pass.GetOutFact(&inst);
-
-    // Resolve final values
-    if (const auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
-      VisitStoreInst(*store_inst, *in_fact, *out_fact, out_rvf);
-    } else if (llvm::isa<llvm::LoadInst>(&inst) ||
-               llvm::isa<llvm::BitCastInst>(&inst) ||
-               llvm::isa<llvm::PtrToIntInst>(&inst) ||
-               llvm::isa<llvm::TruncInst>(&inst) ||
-               llvm::isa<llvm::SExtInst>(&inst)) {
-      VisitLoadLikeInst(inst, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-      VisitPHINode(*phi, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *branch = llvm::dyn_cast<llvm::BranchInst>(&inst)) {
-      VisitBranchInst(*branch, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *sw = llvm::dyn_cast<llvm::SwitchInst>(&inst)) {
-      VisitSwitchInst(*sw, *in_fact, *out_fact, out_rvf);
-    } else if (const auto *ret = llvm::dyn_cast<llvm::ReturnInst>(&inst)) {
-      VisitReturnInst(*ret, *in_fact);
-    } else {
-      out_fact->FilteredCopy(*in_fact, out_rvf);
-    }
+// Resolve final values
+void ReturnRangePass::Visit(const llvm::Instruction &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  out.FilteredCopy(in, returned_values_->GetOutFact(&I));
+}
 
-    changed = changed || *out_fact != orig_out_fact;
-  }
+void ReturnRangePass::Visit(const llvm::LoadInst &I, const ReturnRangeFact &in,
+                            ReturnRangeFact &out) {
+  VisitLoadLikeInst(I, in, out);
+}
+
+void ReturnRangePass::Visit(const llvm::BitCastInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  VisitLoadLikeInst(I, in, out);
+}
 
-  return changed;
+void ReturnRangePass::Visit(const llvm::PtrToIntInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  VisitLoadLikeInst(I, in, out);
 }
 
-void ReturnRangePass::VisitStoreInst(const llvm::StoreInst &I,
-                                     const ReturnRangeFact &in,
-                                     ReturnRangeFact &out,
-                                     const ReturnedValuesFact &out_rvf) {
+void ReturnRangePass::Visit(const llvm::TruncInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  VisitLoadLikeInst(I, in, out);
+}
+
+void ReturnRangePass::Visit(const llvm::SExtInst &I, const ReturnRangeFact &in,
+                            ReturnRangeFact &out) {
+  VisitLoadLikeInst(I, in, out);
+}
+
+void ReturnRangePass::Visit(const llvm::StoreInst &I, const ReturnRangeFact &in,
+                            ReturnRangeFact &out) {
+  const ReturnedValuesFact &out_rvf = returned_values_->GetOutFact(&I);
   const llvm::Value *stored = I.getOperand(0);
   const llvm::Value *target = I.getOperand(1);
 
@@ -239,8 +240,8 @@ void ReturnRangePass::VisitStoreInst(const llvm::StoreInst &I,
 
 void ReturnRangePass::VisitLoadLikeInst(const llvm::Instruction &I,
                                         const ReturnRangeFact &in,
-                                        ReturnRangeFact &out,
-                                        const ReturnedValuesFact &out_rvf) {
+                                        ReturnRangeFact &out) {
+  const ReturnedValuesFact &out_rvf = returned_values_->GetOutFact(&I);
   const llvm::Value *loaded = I.getOperand(0);
 
   out.FilteredCopy(in, out_rvf);
@@ -256,10 +257,9 @@ void ReturnRangePass::VisitLoadLikeInst(const llvm::Instruction &I,
   }
 }
 
-void ReturnRangePass::VisitPHINode(const llvm::PHINode &I,
-                                   const ReturnRangeFact &in,
-                                   ReturnRangeFact &out,
-                                   const ReturnedValuesFact &out_rvf) {
+void ReturnRangePass::Visit(const llvm::PHINode &I, const ReturnRangeFact &in,
+                            ReturnRangeFact &out) {
+  const ReturnedValuesFact &out_rvf = returned_values_->GetOutFact(&I);
   out.FilteredCopy(in, out_rvf);
 
   if (!out_rvf.Contains(&I)) {  // result isn't returnable
@@ -278,10 +278,9 @@ void ReturnRangePass::VisitPHINode(const llvm::PHINode &I,
   }
 }
 
-void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
-                                      const ReturnRangeFact &in,
-                                      ReturnRangeFact &out,
-                                      const ReturnedValuesFact &out_rvf) {
+void ReturnRangePass::Visit(const llvm::BranchInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  const ReturnedValuesFact &out_rvf = returned_values_->GetOutFact(&I);
   out.FilteredCopy(in, out_rvf);
 
   if (I.isUnconditional()) {
@@ -306,17 +305,13 @@ void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
   // Similar to ReturnConstraintsPass: A returned value is being checked, so we
   // pass on the resulting ranges to the appropriate successor blocks and kill
   // its entry in the current output fact.
-  const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-
   const auto *false_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(1));
-  const auto *false_bb_first = GetFirstInstructionOfBB(false_bb);
-  auto false_in_fact = input_facts_[false_bb_first];
-  const auto false_rvf = returned_values_pass.GetInFact(false_bb_first);
+  const auto &false_rvf =
+      returned_values_->GetInFact(GetFirstInstructionOfBB(false_bb));
 
   const auto *true_bb = llvm::dyn_cast<llvm::BasicBlock>(I.getOperand(2));
-  const auto *true_bb_first = GetFirstInstructionOfBB(true_bb);
-  auto true_in_fact = input_facts_[true_bb_first];
-  const auto true_rvf = returned_values_pass.GetInFact(true_bb_first);
+  const auto &true_rvf =
+      returned_values_->GetInFact(GetFirstInstructionOfBB(true_bb));
 
   const auto abstracted_icmp = ReturnConstraintsPass::AbstractICmp(*cond);
 
@@ -324,29 +319,33 @@ void ReturnRangePass::VisitBranchInst(const llvm::BranchInst &I,
 
   if (true_rvf.Contains(checked_value)) {
     if (in.Contains(checked_value)) {
-      true_in_fact->Join(ReturnRangeFact(
-          checked_value, SignLattice::Meet(in.value.at(checked_value),
-                                           abstracted_icmp.first)));
+      dataflow_.JoinIntoBlock(
+          *true_bb,
+          ReturnRangeFact(checked_value,
+                          SignLattice::Meet(in.value.at(checked_value),
+                                            abstracted_icmp.first)));
     } else {
-      true_in_fact->Join(ReturnRangeFact(checked_value, abstracted_icmp.first));
+      dataflow_.JoinIntoBlock(
+          *true_bb, ReturnRangeFact(checked_value, abstracted_icmp.first));
     }
   }
   if (false_rvf.Contains(checked_value)) {
     if (in.Contains(checked_value)) {
-      false_in_fact->Join(ReturnRangeFact(
-          checked_value, SignLattice::Meet(in.value.at(checked_value),
-                                           abstracted_icmp.second)));
+      dataflow_.JoinIntoBlock(
+          *false_bb,
+          ReturnRangeFact(checked_value,
+                          SignLattice::Meet(in.value.at(checked_value),
+                                            abstracted_icmp.second)));
     } else {
-      false_in_fact->Join(
-          ReturnRangeFact(checked_value, abstracted_icmp.second));
+      dataflow_.JoinIntoBlock(
+          *false_bb, ReturnRangeFact(checked_value, abstracted_icmp.second));
     }
   }
 }
 
-void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
-                                      const ReturnRangeFact &in,
-                                      ReturnRangeFact &out,
-                                      const ReturnedValuesFact &out_rvf) {
+void ReturnRangePass::Visit(const llvm::SwitchInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
+  const ReturnedValuesFact &out_rvf = returned_values_->GetOutFact(&I);
   out.FilteredCopy(in, out_rvf);
 
   const llvm::Value *test_value = nullptr;
@@ -357,25 +356,25 @@ void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
 
   // Like ReturnConstraintsPass, we kill the entry in the out fact and pass on
   // the appropriate ranges to the successor blocks directly.
-  const auto &returned_values_pass = getAnalysis<ReturnedValuesPass>();
-
   out.value.erase(test_value);
 
   // Go through the non-default cases
   for (const auto &case_entry : I.cases()) {
     const llvm::ConstantInt *case_value = case_entry.getCaseValue();
     const llvm::BasicBlock *case_bb = case_entry.getCaseSuccessor();
-    const llvm::Instruction *case_bb_first = GetFirstInstructionOfBB(case_bb);
-    const auto case_rvf = returned_values_pass.GetInFact(case_bb_first);
-    auto &case_in_fact = input_facts_.at(case_bb_first);
+    const auto &case_rvf =
+        returned_values_->GetInFact(GetFirstInstructionOfBB(case_bb));
 
     if (case_rvf.Contains(test_value)) {
       if (in.Contains(test_value)) {
-        case_in_fact->Join(ReturnRangeFact(
-            test_value, SignLattice::Meet(in.value.at(test_value),
+        dataflow_.JoinIntoBlock(
+            *case_bb, ReturnRangeFact(
+                          test_value, SignLattice::Meet(
+                                          in.value.at(test_value),
                                           AbstractInteger(*case_value))));
       } else {
-        case_in_fact->Join(
+        dataflow_.JoinIntoBlock(
+            *case_bb,
             ReturnRangeFact(test_value, AbstractInteger(*case_value)));
       }
     }
@@ -383,17 +382,17 @@ void ReturnRangePass::VisitSwitchInst(const llvm::SwitchInst &I,
 
   // default case
   const llvm::BasicBlock *default_bb = I.getDefaultDest();
-  const llvm::Instruction *default_bb_first =
-      GetFirstInstructionOfBB(default_bb);
-  const auto default_rvf = returned_values_pass.GetInFact(default_bb_first);
+  const auto &default_rvf =
+      returned_values_->GetInFact(GetFirstInstructionOfBB(default_bb));
   if (default_rvf.Contains(test_value) && in.Contains(test_value)) {
-    auto &default_in_fact = input_facts_.at(default_bb_first);
-    default_in_fact->Join(ReturnRangeFact(test_value, in.value.at(test_value)));
+    dataflow_.JoinIntoBlock(
+        *default_bb, ReturnRangeFact(test_value, in.value.at(test_value)));
   }
 }
 
-void ReturnRangePass::VisitReturnInst(const llvm::ReturnInst &I,
-                                      const ReturnRangeFact &in) {
+// Leaves the output fact as it is.
+void ReturnRangePass::Visit(const llvm::ReturnInst &I,
+                            const ReturnRangeFact &in, ReturnRangeFact &out) {
   // Get the return range of this particular return instruction.  If the input
   // fact doesn't have the returned value, then we have a direct return.
   SignLatticeElement return_range = in.Contains(I.getReturnValue())
@@ -454,8 +453,10 @@ SignLatticeElement ReturnRangePass::AbstractCall(
     // The callee is either unresolved or external, so we can't determine the
     // actual return range.  Just assume that it can return anything.
     return SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
-  } else if (return_ranges_.count(callee) > 0) {
-    return return_ranges_.at(callee);
+  }
+  auto it = return_ranges_.find(callee);
+  if (it != return_ranges_.end()) {
+    return it->second;
   } else {
     // If the callee has a definition and we haven't seen it yet, we're most
     // likely in an SCC.
@@ -0,0 +1,225 @@
+// Compares the table-driven SignLattice with the previous implementation,
+// which encoded elements as std::bitset rows looked up in a std::map and
+// decoded the result through a std::unordered_map. Both are run over the
+// same pseudo-random element pairs; the results are checked to agree and
+// the time per operation is printed.
+//
+//   bazel run -c opt //eesi:sign_lattice_benchmark -- [iterations]
+
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "constraint.h"
+
+namespace error_specifications {
+namespace {
+
+// The SignLattice operations as they were implemented before the tables.
+class LegacySignLattice {
+ public:
+  static SignLatticeElement Meet(const SignLatticeElement &x,
+                                 const SignLatticeElement &y) {
+    auto x_encoding = MeetEncoding().at(x);
+    auto y_encoding = MeetEncoding().at(y);
+    return MeetDecoding().at(x_encoding &= y_encoding);
+  }
+
+  static SignLatticeElement Join(const SignLatticeElement &x,
+                                 const SignLatticeElement &y) {
+    auto x_encoding = JoinEncoding().at(x);
+    auto y_encoding = JoinEncoding().at(y);
+    return JoinDecoding().at(x_encoding &= y_encoding);
+  }
+
+  static bool IsLessThan(const SignLatticeElement &x,
+                         const SignLatticeElement &y) {
+    return JoinEncoding().at(x)[Offset().at(y)];
+  }
+
+  static SignLatticeElement Complement(const SignLatticeElement &x) {
+    static const auto *complement =
+        new std::map<SignLatticeElement, SignLatticeElement>({
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO},
+            {SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP,
+             SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM},
+        });
+    return complement->at(x);
+  }
+
+ private:
+  using Encoding = std::bitset<8>;
+  using EncodingMap = std::map<SignLatticeElement, Encoding>;
+  using DecodingMap = std::unordered_map<Encoding, SignLatticeElement>;
+
+  // Elements in the column order of the encodings below.
+  static const std::vector<SignLatticeElement> &Elements() {
+    static const auto *elements = new std::vector<SignLatticeElement>({
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO,
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP,
+    });
+    return *elements;
+  }
+
+  static EncodingMap MakeEncoding(const std::vector<const char *> &rows) {
+    EncodingMap encoding;
+    for (size_t i = 0; i < rows.size(); ++i) {
+      encoding[Elements()[i]] = Encoding(rows[i]);
+    }
+    return encoding;
+  }
+
+  static DecodingMap MakeDecoding(const EncodingMap &encoding) {
+    DecodingMap decoding;
+    for (const auto &kv : encoding) decoding[kv.second] = kv.first;
+    return decoding;
+  }
+
+  static const EncodingMap &MeetEncoding() {
+    static const auto *encoding = new EncodingMap(
+        MakeEncoding({"10000000", "11000000", "10100000", "10010000",
+                      "11011000", "10110100", "11100010", "11111111"}));
+    return *encoding;
+  }
+
+  static const EncodingMap &JoinEncoding() {
+    static const auto *encoding = new EncodingMap(
+        MakeEncoding({"11111111", "01001011", "00100111", "00011101",
+                      "00001001", "00000101", "00000011", "00000001"}));
+    return *encoding;
+  }
+
+  static const DecodingMap &MeetDecoding() {
+    static const auto *decoding =
+        new DecodingMap(MakeDecoding(MeetEncoding()));
+    return *decoding;
+  }
+
+  static const DecodingMap &JoinDecoding() {
+    static const auto *decoding =
+        new DecodingMap(MakeDecoding(JoinEncoding()));
+    return *decoding;
+  }
+
+  static const std::map<SignLatticeElement, int> &Offset() {
+    static const auto *offset = [] {
+      auto *offset = new std::map<SignLatticeElement, int>();
+      for (size_t i = 0; i < Elements().size(); ++i) {
+        (*offset)[Elements()[i]] = Elements().size() - 1 - i;
+      }
+      return offset;
+    }();
+    return *offset;
+  }
+};
+
+// Runs Meet, Join, IsLessThan and Complement of Lattice over the pairs and
+// returns a checksum of the results, so that the work is not optimized
+// away.
+template <typename Lattice>
+uint64_t RunOperations(
+    const std::vector<std::pair<SignLatticeElement, SignLatticeElement>>
+        &pairs) {
+  uint64_t checksum = 0;
+  for (const auto &pair : pairs) {
+    checksum = checksum * 31 + Lattice::Meet(pair.first, pair.second);
+    checksum = checksum * 31 + Lattice::Join(pair.first, pair.second);
+    checksum = checksum * 31 + Lattice::IsLessThan(pair.first, pair.second);
+    checksum = checksum * 31 + Lattice::Complement(pair.first);
+  }
+  return checksum;
+}
+
+// Returns the nanoseconds per lattice operation of Lattice over the pairs.
+template <typename Lattice>
+double TimeOperations(
+    const std::vector<std::pair<SignLatticeElement, SignLatticeElement>>
+        &pairs,
+    uint64_t *checksum) {
+  const auto start = std::chrono::steady_clock::now();
+  *checksum = RunOperations<Lattice>(pairs);
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (pairs.size() * 4);
+}
+
+int Run(uint64_t iterations) {
+  // Every pair must agree before timing means anything.
+  for (int x = SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+       x < kNumSignLatticeElements; ++x) {
+    for (int y = SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+         y < kNumSignLatticeElements; ++y) {
+      const auto ex = static_cast<SignLatticeElement>(x);
+      const auto ey = static_cast<SignLatticeElement>(y);
+      if (SignLattice::Meet(ex, ey) != LegacySignLattice::Meet(ex, ey) ||
+          SignLattice::Join(ex, ey) != LegacySignLattice::Join(ex, ey) ||
+          SignLattice::IsLessThan(ex, ey) !=
+              LegacySignLattice::IsLessThan(ex, ey) ||
+          SignLattice::Complement(ex) != LegacySignLattice::Complement(ex)) {
+        std::cerr << "Mismatch on " << ex << ", " << ey << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  std::mt19937_64 random(0);
+  std::uniform_int_distribution<int> element(
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP);
+  std::vector<std::pair<SignLatticeElement, SignLatticeElement>> pairs;
+  pairs.reserve(iterations);
+  for (uint64_t i = 0; i < iterations; ++i) {
+    pairs.push_back(
+        std::make_pair(static_cast<SignLatticeElement>(element(random)),
+                       static_cast<SignLatticeElement>(element(random))));
+  }
+
+  uint64_t legacy_checksum = 0;
+  uint64_t table_checksum = 0;
+  const double legacy_ns =
+      TimeOperations<LegacySignLattice>(pairs, &legacy_checksum);
+  const double table_ns = TimeOperations<SignLattice>(pairs, &table_checksum);
+  if (legacy_checksum != table_checksum) {
+    std::cerr << "Checksum mismatch" << std::endl;
+    return 1;
+  }
+  std::cout << "operations: " << pairs.size() * 4 << "\n"
+            << "legacy: " << legacy_ns << " ns/op\n"
+            << "tables: " << table_ns << " ns/op\n"
+            << "speedup: " << legacy_ns / table_ns << "x" << std::endl;
+  return 0;
+}
+
+}  // namespace
+}  // namespace error_specifications
+
+int main(int argc, char **argv) {
+  const uint64_t iterations =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+  return error_specifications::Run(iterations);
+}
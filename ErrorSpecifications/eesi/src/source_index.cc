@@ -0,0 +1,133 @@
+#include "source_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+namespace error_specifications {
+
+SourceIndex::SourceIndex(const llvm::Module &module,
+                         const std::string &fallback_directory)
+    : fallback_directory_(fallback_directory) {
+  for (const auto &func : module) {
+    const llvm::DISubprogram *subprogram = func.getSubprogram();
+    if (!subprogram || subprogram->getLine() == 0) continue;
+
+    // The subprogram gives the line of the function's name. Its last line
+    // is the one of the last instruction not inlined from elsewhere, which
+    // is usually the return at the closing brace.
+    unsigned end_line = subprogram->getLine();
+    for (const auto &basic_block : func) {
+      for (const auto &inst : basic_block) {
+        const llvm::DILocation *location = inst.getDebugLoc().get();
+        if (location && !location->getInlinedAt()) {
+          end_line = std::max(end_line, location->getLine());
+        }
+      }
+    }
+
+    llvm::SmallString<256> path;
+    const llvm::StringRef file_name = subprogram->getFilename();
+    if (!llvm::sys::path::is_absolute(file_name)) {
+      path = subprogram->getDirectory();
+    }
+    llvm::sys::path::append(path, file_name);
+
+    Location location;
+    location.file = path.str().str();
+    location.begin_line = subprogram->getLine();
+    location.end_line = end_line;
+    functions_[&func] = location;
+  }
+  LOG(INFO) << "Indexed the source locations of " << functions_.size()
+            << " functions";
+}
+
+bool SourceIndex::GetFunctionSource(const llvm::Function &func,
+                                    std::string *out_source) {
+  auto function_it = functions_.find(&func);
+  if (function_it == functions_.end()) return false;
+  const Location &location = function_it->second;
+
+  const SourceFile *file = GetFile(location.file);
+  if (!file || location.begin_line > file->line_offsets.size()) return false;
+
+  const size_t begin = file->line_offsets[location.begin_line - 1];
+  const size_t end = location.end_line < file->line_offsets.size()
+                         ? file->line_offsets[location.end_line]
+                         : file->buffer->getBufferSize();
+  out_source->assign(file->buffer->getBufferStart() + begin, end - begin);
+  return true;
+}
+
+const SourceIndex::SourceFile *SourceIndex::GetFile(const std::string &path) {
+  auto file_it = files_.find(path);
+  if (file_it != files_.end()) return file_it->second.get();
+  std::unique_ptr<SourceFile> &file = files_[path];
+
+  const std::string resolved_path = ResolvePath(path);
+  // Large files are memory mapped rather than read.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(resolved_path, /*FileSize=*/-1,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    LOG(WARNING) << "Unable to read source file " << resolved_path << ": "
+                 << buffer.getError().message();
+    return nullptr;
+  }
+
+  file.reset(new SourceFile());
+  file->buffer = std::move(buffer.get());
+  const char *start = file->buffer->getBufferStart();
+  const size_t size = file->buffer->getBufferSize();
+  file->line_offsets.push_back(0);
+  size_t offset = 0;
+  while (const void *newline =
+             std::memchr(start + offset, '\n', size - offset)) {
+    offset = static_cast<const char *>(newline) - start + 1;
+    if (offset == size) break;
+    file->line_offsets.push_back(offset);
+  }
+  return file.get();
+}
+
+std::string SourceIndex::ResolvePath(const std::string &path) {
+  if (fallback_directory_.empty() || llvm::sys::fs::exists(path)) return path;
+
+  // Sources moved as a tree keep the end of their path.
+  const llvm::StringRef relative_path = llvm::sys::path::relative_path(path);
+  std::vector<llvm::StringRef> components(llvm::sys::path::begin(relative_path),
+                                          llvm::sys::path::end(relative_path));
+  for (size_t first = 0; first < components.size(); ++first) {
+    llvm::SmallString<256> candidate(fallback_directory_);
+    for (size_t i = first; i < components.size(); ++i) {
+      llvm::sys::path::append(candidate, components[i]);
+    }
+    if (llvm::sys::fs::is_regular_file(candidate)) return candidate.str().str();
+  }
+
+  if (!fallback_files_listed_) {
+    fallback_files_listed_ = true;
+    std::error_code error;
+    for (llvm::sys::fs::recursive_directory_iterator
+             entry(fallback_directory_, error),
+         end;
+         entry != end && !error; entry.increment(error)) {
+      if (llvm::sys::fs::is_regular_file(entry->path())) {
+        fallback_files_[llvm::sys::path::filename(entry->path()).str()]
+            .push_back(entry->path());
+      }
+    }
+  }
+  auto files_it = fallback_files_.find(llvm::sys::path::filename(path).str());
+  if (files_it != fallback_files_.end() && files_it->second.size() == 1) {
+    return files_it->second.front();
+  }
+  return path;
+}
+
+}  // namespace error_specifications
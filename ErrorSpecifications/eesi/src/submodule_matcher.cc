@@ -0,0 +1,105 @@
+#include "submodule_matcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <deque>
+
+namespace error_specifications {
+
+constexpr uint32_t SubmoduleMatcher::kNoState;
+
+SubmoduleMatcher::SubmoduleMatcher() : states_(1) {}
+
+SubmoduleId SubmoduleMatcher::AddSubmodule(const std::string &submodule) {
+  assert(!compiled_);
+  return submodule_ids_.try_emplace(submodule, submodule_ids_.size())
+      .first->second;
+}
+
+void SubmoduleMatcher::Compile() {
+  states_.assign(1, State());
+  edges_.clear();
+
+  // Build the trie.
+  for (const auto &entry : submodule_ids_) {
+    uint32_t state = 0;
+    for (unsigned char c : entry.getKey()) {
+      uint32_t next = Next(state, c);
+      if (next == kNoState) {
+        next = states_.size();
+        states_.emplace_back();
+        edges_[Edge(state, c)] = next;
+      }
+      state = next;
+    }
+    states_[state].submodule = entry.getValue();
+  }
+
+  // Group the edges by source state, so that the fail links can be computed
+  // breadth-first.
+  std::vector<std::vector<std::pair<unsigned char, uint32_t>>> children(
+      states_.size());
+  for (const auto &edge : edges_) {
+    children[edge.first >> 8].push_back(
+        std::make_pair(static_cast<unsigned char>(edge.first & 0xff),
+                       edge.second));
+  }
+
+  // The fail link of a child of the root is the root; the fail link of any
+  // other state on c follows the fail links of its parent until one has a
+  // transition on c.
+  std::deque<uint32_t> queue;
+  for (const auto &child : children[0]) queue.push_back(child.second);
+  while (!queue.empty()) {
+    const uint32_t state = queue.front();
+    queue.pop_front();
+    for (const auto &child : children[state]) {
+      uint32_t fail = states_[state].fail;
+      uint32_t next;
+      while ((next = Next(fail, child.first)) == kNoState && fail != 0) {
+        fail = states_[fail].fail;
+      }
+      State &child_state = states_[child.second];
+      child_state.fail = next != kNoState ? next : 0;
+      const State &fail_state = states_[child_state.fail];
+      child_state.output = fail_state.submodule != UINT32_MAX
+                               ? child_state.fail
+                               : fail_state.output;
+      queue.push_back(child.second);
+    }
+  }
+  compiled_ = true;
+}
+
+std::vector<SubmoduleId> SubmoduleMatcher::Match(
+    llvm::StringRef file_name) const {
+  assert(compiled_ || submodule_ids_.empty());
+  std::vector<SubmoduleId> submodules;
+  if (submodule_ids_.empty()) return submodules;
+
+  // The empty submodule occurs in every file name.
+  if (states_[0].submodule != UINT32_MAX) {
+    submodules.push_back(states_[0].submodule);
+  }
+  uint32_t state = 0;
+  for (unsigned char c : file_name) {
+    uint32_t next;
+    while ((next = Next(state, c)) == kNoState && state != 0) {
+      state = states_[state].fail;
+    }
+    state = next != kNoState ? next : 0;
+    if (states_[state].submodule != UINT32_MAX) {
+      submodules.push_back(states_[state].submodule);
+    }
+    for (uint32_t output = states_[state].output; output != kNoState;
+         output = states_[output].output) {
+      submodules.push_back(states_[output].submodule);
+    }
+  }
+  std::sort(submodules.begin(), submodules.end());
+  submodules.erase(std::unique(submodules.begin(), submodules.end()),
+                   submodules.end());
+  return submodules;
+}
+
+}  // namespace error_specifications
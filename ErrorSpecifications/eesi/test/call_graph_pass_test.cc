@@ -0,0 +1,316 @@
+// Checks the SCCs and levels of CallGraphPass against those of the LLVM call
+// graph walk it replaced: an llvm::CallGraph with an edge added from each
+// call to the first function with the callee's source name, visited with
+// llvm::scc_begin.
+
+#include "eesi/include/call_graph_pass.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm.h"
+
+namespace error_specifications {
+
+namespace {
+
+// An SCC as the functions in it, with its loop flag and level.
+struct Scc {
+  std::vector<const llvm::Function *> functions;
+  bool has_loop;
+  uint32_t level;
+};
+
+std::unique_ptr<llvm::Module> ParseModule(const std::string &ir,
+                                          llvm::LLVMContext &context) {
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> module =
+      llvm::parseAssemblyString(ir, err, context);
+  if (!module) err.print("call-graph-pass-test", llvm::errs());
+  return module;
+}
+
+// The SCCs the LLVM call graph walk found, bottom-up, leaving out those of
+// its external nodes, which hold no function.
+std::vector<Scc> BaselineSccs(llvm::Module &module) {
+  llvm::CallGraph call_graph(module);
+  std::unordered_map<std::string, const llvm::Function *> canonical;
+  for (llvm::Function &function : module) {
+    llvm::CallGraphNode *node = call_graph.getOrInsertFunction(&function);
+    for (llvm::BasicBlock &basic_block : function) {
+      for (llvm::Instruction &inst : basic_block) {
+        auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+        if (!call_inst) continue;
+        const llvm::Function *callee = GetCalleeFunction(*call_inst);
+        if (!callee) continue;
+        const llvm::Function *canonical_callee =
+            canonical.emplace(GetSourceName(*callee), callee).first->second;
+        node->addCalledFunction(
+            call_inst, call_graph.getOrInsertFunction(canonical_callee));
+      }
+    }
+  }
+
+  std::vector<Scc> sccs;
+  std::unordered_map<const llvm::CallGraphNode *, size_t> node_sccs;
+  for (auto scc_it = llvm::scc_begin(&call_graph); !scc_it.isAtEnd();
+       ++scc_it) {
+    Scc scc;
+    scc.level = 0;
+    for (const llvm::CallGraphNode *node : *scc_it) {
+      if (node->getFunction()) scc.functions.push_back(node->getFunction());
+    }
+    if (scc.functions.empty()) continue;
+    scc.has_loop = scc_it.hasLoop();
+    for (const llvm::CallGraphNode *node : *scc_it) {
+      for (const auto &call_record : *node) {
+        auto callee_it = node_sccs.find(call_record.second);
+        if (callee_it != node_sccs.end()) {
+          scc.level = std::max(scc.level, sccs[callee_it->second].level + 1);
+        }
+      }
+    }
+    for (const llvm::CallGraphNode *node : *scc_it) {
+      node_sccs[node] = sccs.size();
+    }
+    sccs.push_back(std::move(scc));
+  }
+  return sccs;
+}
+
+// Expects the SCCs of call_graph to be those of the LLVM walk, in the same
+// order, and its level arrays to be consistent with them.
+void ExpectMatchesBaseline(llvm::Module &module,
+                           const CallGraphPass &call_graph) {
+  const std::vector<Scc> baseline = BaselineSccs(module);
+  ASSERT_EQ(call_graph.NumSccs(), baseline.size());
+
+  size_t num_in_sccs = 0;
+  uint32_t num_levels = 0;
+  for (SccId scc = 0; scc < call_graph.NumSccs(); ++scc) {
+    std::vector<const llvm::Function *> functions;
+    for (FunctionId function : call_graph.GetSccFunctions(scc)) {
+      functions.push_back(call_graph.GetFunction(function));
+      EXPECT_EQ(call_graph.GetScc(function), scc);
+    }
+    EXPECT_EQ(functions, baseline[scc].functions) << "SCC " << scc;
+    EXPECT_EQ(call_graph.SccHasLoop(scc), baseline[scc].has_loop)
+        << "SCC " << scc;
+    EXPECT_EQ(call_graph.GetSccLevel(scc), baseline[scc].level)
+        << "SCC " << scc;
+    num_in_sccs += functions.size();
+    num_levels = std::max(num_levels, call_graph.GetSccLevel(scc) + 1);
+  }
+
+  size_t num_with_scc = 0;
+  for (FunctionId function = 0; function < call_graph.NumFunctions();
+       ++function) {
+    if (call_graph.GetScc(function) != CallGraphPass::kNoScc) ++num_with_scc;
+  }
+  EXPECT_EQ(num_with_scc, num_in_sccs);
+
+  // Every SCC is listed once, on its level, in bottom-up order.
+  ASSERT_EQ(call_graph.NumLevels(), num_levels);
+  size_t num_listed = 0;
+  for (uint32_t level = 0; level < call_graph.NumLevels(); ++level) {
+    const llvm::ArrayRef<SccId> sccs = call_graph.GetLevelSccs(level);
+    EXPECT_TRUE(std::is_sorted(sccs.begin(), sccs.end()));
+    for (SccId scc : sccs) EXPECT_EQ(call_graph.GetSccLevel(scc), level);
+    num_listed += sccs.size();
+  }
+  EXPECT_EQ(num_listed, call_graph.NumSccs());
+}
+
+// Runs CallGraphPass on ir and checks it against the baseline. Returns the
+// pass for further checks.
+std::unique_ptr<CallGraphPass> RunAndCompare(
+    const std::string &ir, llvm::LLVMContext &context,
+    std::unique_ptr<llvm::Module> &module) {
+  module = ParseModule(ir, context);
+  if (!module) return nullptr;
+  std::unique_ptr<CallGraphPass> call_graph(new CallGraphPass());
+  call_graph->runOnModule(*module);
+  ExpectMatchesBaseline(*module, *call_graph);
+  return call_graph;
+}
+
+SccId SccOf(const CallGraphPass &call_graph, const llvm::Module &module,
+            const std::string &name) {
+  return call_graph.GetScc(
+      call_graph.GetFunctionId(*module.getFunction(name)));
+}
+
+}  // namespace
+
+TEST(CallGraphPassTest, SelfRecursive) {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module;
+  auto call_graph = RunAndCompare(R"(
+    define i32 @fact(i32 %n) {
+      %m = sub i32 %n, 1
+      %r = call i32 @fact(i32 %m)
+      ret i32 %r
+    }
+    define i32 @main() {
+      %r = call i32 @fact(i32 5)
+      ret i32 %r
+    }
+  )", context, module);
+  ASSERT_TRUE(call_graph);
+
+  const SccId fact = SccOf(*call_graph, *module, "fact");
+  const SccId main = SccOf(*call_graph, *module, "main");
+  EXPECT_TRUE(call_graph->SccHasLoop(fact));
+  EXPECT_FALSE(call_graph->SccHasLoop(main));
+  EXPECT_EQ(call_graph->GetSccLevel(fact), 0u);
+  EXPECT_EQ(call_graph->GetSccLevel(main), 1u);
+}
+
+TEST(CallGraphPassTest, MutuallyRecursive) {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module;
+  auto call_graph = RunAndCompare(R"(
+    declare i32 @puts(i8*)
+    define i32 @leaf() {
+      ret i32 0
+    }
+    define i32 @even(i32 %n) {
+      %m = sub i32 %n, 1
+      %r = call i32 @odd(i32 %m)
+      ret i32 %r
+    }
+    define i32 @odd(i32 %n) {
+      %m = sub i32 %n, 1
+      %r = call i32 @even(i32 %m)
+      %l = call i32 @leaf()
+      %p = call i32 @puts(i8* null)
+      ret i32 %r
+    }
+    define i32 @main() {
+      %r = call i32 @even(i32 5)
+      ret i32 %r
+    }
+  )", context, module);
+  ASSERT_TRUE(call_graph);
+
+  const SccId even = SccOf(*call_graph, *module, "even");
+  EXPECT_EQ(SccOf(*call_graph, *module, "odd"), even);
+  EXPECT_EQ(call_graph->GetSccFunctions(even).size(), 2u);
+  EXPECT_TRUE(call_graph->SccHasLoop(even));
+  EXPECT_EQ(call_graph->GetSccLevel(SccOf(*call_graph, *module, "leaf")), 0u);
+  EXPECT_EQ(call_graph->GetSccLevel(SccOf(*call_graph, *module, "puts")), 0u);
+  EXPECT_EQ(call_graph->GetSccLevel(even), 1u);
+  EXPECT_EQ(call_graph->GetSccLevel(SccOf(*call_graph, *module, "main")), 2u);
+}
+
+// Functions that only differ in their numeric suffix are one source
+// function, so a call to either also reaches the first one called: here a
+// call to g.1 also reaches g, which closes a cycle through f.
+TEST(CallGraphPassTest, SuffixedNames) {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module;
+  auto call_graph = RunAndCompare(R"(
+    define i32 @main() {
+      %r = call i32 @g()
+      ret i32 %r
+    }
+    define i32 @f() {
+      %r = call i32 @g.1()
+      ret i32 %r
+    }
+    define i32 @g() {
+      %r = call i32 @f()
+      ret i32 %r
+    }
+    define i32 @g.1() {
+      ret i32 0
+    }
+  )", context, module);
+  ASSERT_TRUE(call_graph);
+
+  EXPECT_EQ(SccOf(*call_graph, *module, "f"),
+            SccOf(*call_graph, *module, "g"));
+  EXPECT_TRUE(call_graph->SccHasLoop(SccOf(*call_graph, *module, "f")));
+  EXPECT_NE(SccOf(*call_graph, *module, "g.1"),
+            SccOf(*call_graph, *module, "g"));
+}
+
+// Internal functions no external function reaches, and indirect calls, are
+// left out of the SCCs.
+TEST(CallGraphPassTest, UnreachableAndIndirect) {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module;
+  auto call_graph = RunAndCompare(R"(
+    define internal i32 @unused() {
+      ret i32 0
+    }
+    define internal i32 @helper() {
+      ret i32 1
+    }
+    define i32 @indirect(i32 ()* %fp) {
+      %r = call i32 %fp()
+      %h = call i32 @helper()
+      ret i32 %r
+    }
+  )", context, module);
+  ASSERT_TRUE(call_graph);
+
+  EXPECT_EQ(SccOf(*call_graph, *module, "unused"), CallGraphPass::kNoScc);
+  EXPECT_EQ(call_graph->GetSccLevel(SccOf(*call_graph, *module, "helper")),
+            0u);
+  EXPECT_EQ(call_graph->GetSccLevel(SccOf(*call_graph, *module, "indirect")),
+            1u);
+}
+
+// Random modules with cycles, internal functions, suffixed names and
+// declarations.
+TEST(CallGraphPassTest, RandomModules) {
+  std::mt19937 rng(45);
+  for (int round = 0; round < 200; ++round) {
+    const int num_functions = std::uniform_int_distribution<int>(1, 24)(rng);
+    std::uniform_int_distribution<int> pick(0, num_functions - 1);
+    std::uniform_int_distribution<int> num_calls(0, 4);
+    std::bernoulli_distribution internal(0.3);
+    std::bernoulli_distribution declaration(0.1);
+
+    // Every third function shares its source name with the one before.
+    auto name = [](int function) {
+      return "@f" + std::to_string(function - function % 3 / 2) +
+             (function % 3 == 2 ? ".1" : "");
+    };
+    std::string ir;
+    for (int function = 0; function < num_functions; ++function) {
+      if (declaration(rng)) {
+        ir += "declare i32 " + name(function) + "()\n";
+        continue;
+      }
+      ir += std::string("define ") + (internal(rng) ? "internal " : "") +
+            "i32 " + name(function) + "() {\n";
+      for (int call = num_calls(rng); call > 0; --call) {
+        ir += "  call i32 " + name(pick(rng)) + "()\n";
+      }
+      ir += "  ret i32 0\n}\n";
+    }
+
+    SCOPED_TRACE(ir);
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module;
+    ASSERT_TRUE(RunAndCompare(ir, context, module));
+  }
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,140 @@
+// Checks the packed (SWAR) confidence lattice operations against the
+// field-by-field definitions they replaced.
+
+#include "eesi/include/confidence_lattice.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Packs four lanes without the range check of the constructor, so lanes
+// can go past kMaxConfidence, as they do in the saturation tests.
+LatticeElementConfidence Lanes(uint16_t zero, uint16_t less_than_zero,
+                               uint16_t greater_than_zero, uint16_t emptyset) {
+  return LatticeElementConfidence::FromPacked(
+      uint64_t{zero} << LatticeElementConfidence::kZeroShift |
+      uint64_t{less_than_zero} << LatticeElementConfidence::kLessThanZeroShift |
+      uint64_t{greater_than_zero}
+          << LatticeElementConfidence::kGreaterThanZeroShift |
+      uint64_t{emptyset} << LatticeElementConfidence::kEmptysetShift);
+}
+
+// The per-field join: max of ==0, <0 and >0, min of emptyset.
+LatticeElementConfidence FieldJoin(const LatticeElementConfidence &x,
+                                   const LatticeElementConfidence &y) {
+  return Lanes(std::max(x.GetConfidenceZero(), y.GetConfidenceZero()),
+               std::max(x.GetConfidenceLessThanZero(),
+                        y.GetConfidenceLessThanZero()),
+               std::max(x.GetConfidenceGreaterThanZero(),
+                        y.GetConfidenceGreaterThanZero()),
+               std::min(x.GetConfidenceEmptyset(), y.GetConfidenceEmptyset()));
+}
+
+// The per-field meet: min of ==0, <0 and >0, max of emptyset.
+LatticeElementConfidence FieldMeet(const LatticeElementConfidence &x,
+                                   const LatticeElementConfidence &y) {
+  return Lanes(std::min(x.GetConfidenceZero(), y.GetConfidenceZero()),
+               std::min(x.GetConfidenceLessThanZero(),
+                        y.GetConfidenceLessThanZero()),
+               std::min(x.GetConfidenceGreaterThanZero(),
+                        y.GetConfidenceGreaterThanZero()),
+               std::max(x.GetConfidenceEmptyset(), y.GetConfidenceEmptyset()));
+}
+
+// Every element whose confidences are drawn from values.
+std::vector<LatticeElementConfidence> AllElements(
+    const std::vector<uint16_t> &values) {
+  std::vector<LatticeElementConfidence> elements;
+  for (uint16_t zero : values) {
+    for (uint16_t less_than_zero : values) {
+      for (uint16_t greater_than_zero : values) {
+        for (uint16_t emptyset : values) {
+          elements.push_back(
+              Lanes(zero, less_than_zero, greater_than_zero, emptyset));
+        }
+      }
+    }
+  }
+  return elements;
+}
+
+void ExpectMatchesFields(const std::vector<LatticeElementConfidence> &xs,
+                         const std::vector<LatticeElementConfidence> &ys) {
+  for (const auto &x : xs) {
+    for (const auto &y : ys) {
+      ASSERT_EQ(ConfidenceLattice::Join(x, y), FieldJoin(x, y))
+          << x << " join " << y;
+      ASSERT_EQ(ConfidenceLattice::Meet(x, y), FieldMeet(x, y))
+          << x << " meet " << y;
+    }
+  }
+}
+
+}  // namespace
+
+// Every pair of elements built from the ends of the confidence range and
+// their neighbours.
+TEST(ConfidenceLatticeTest, JoinMeetBoundaries) {
+  const std::vector<LatticeElementConfidence> elements = AllElements(
+      {kMinConfidence, kMinConfidence + 1, 50, kMaxConfidence - 1,
+       kMaxConfidence});
+  ExpectMatchesFields(elements, elements);
+}
+
+// Lanes at the largest value the lane-wise compare supports, next to lanes
+// at zero, must not borrow from or carry into their neighbours.
+TEST(ConfidenceLatticeTest, JoinMeetSaturatedLanes) {
+  const std::vector<LatticeElementConfidence> elements =
+      AllElements({0, 1, kMaxConfidence, 0x7FFE, 0x7FFF});
+  ExpectMatchesFields(elements, elements);
+}
+
+TEST(ConfidenceLatticeTest, JoinMeetRandom) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<short> confidence(kMinConfidence,
+                                                  kMaxConfidence);
+  auto random_element = [&]() {
+    return LatticeElementConfidence(confidence(rng), confidence(rng),
+                                    confidence(rng), confidence(rng));
+  };
+  for (int i = 0; i < 100000; ++i) {
+    const LatticeElementConfidence x = random_element();
+    const LatticeElementConfidence y = random_element();
+    ASSERT_EQ(ConfidenceLattice::Join(x, y), FieldJoin(x, y))
+        << x << " join " << y;
+    ASSERT_EQ(ConfidenceLattice::Meet(x, y), FieldMeet(x, y))
+        << x << " meet " << y;
+  }
+}
+
+// The vector folds agree with folding the per-field operations.
+TEST(ConfidenceLatticeTest, JoinMeetOnVectorRandom) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<short> confidence(kMinConfidence,
+                                                  kMaxConfidence);
+  std::uniform_int_distribution<int> length(1, 16);
+  for (int i = 0; i < 10000; ++i) {
+    std::vector<LatticeElementConfidence> elements(length(rng));
+    for (auto &element : elements) {
+      element = LatticeElementConfidence(confidence(rng), confidence(rng),
+                                         confidence(rng), confidence(rng));
+    }
+    LatticeElementConfidence join = elements.front();
+    LatticeElementConfidence meet = elements.front();
+    for (const auto &element : elements) {
+      join = FieldJoin(join, element);
+      meet = FieldMeet(meet, element);
+    }
+    ASSERT_EQ(ConfidenceLattice::JoinOnVector(elements), join);
+    ASSERT_EQ(ConfidenceLattice::MeetOnVector(elements), meet);
+  }
+}
+
+}  // namespace error_specifications
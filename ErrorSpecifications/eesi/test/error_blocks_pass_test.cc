@@ -0,0 +1,432 @@
+// Tests how ErrorBlocksPass schedules its LLM queries: the context each
+// query carries, which functions the query budget goes to, and how the
+// third-party functions are split between queries. Also checks that the
+// violations it reports do not depend on how their search is parallelized.
+
+#include "eesi/include/error_blocks_pass.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "tbb/task_arena.h"
+
+#include "call_graph_pass.h"
+#include "return_constraints_pass.h"
+#include "return_propagation_pass.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Functions for the query budget tests, and a declaration that is never a
+// candidate.
+const char kBudgetIr[] = R"(
+define void @leaf() {
+  ret void
+}
+
+define void @helper() {
+  ret void
+}
+
+define void @mid() {
+  ret void
+}
+
+define void @top() {
+  ret void
+}
+
+define void @unused() {
+  ret void
+}
+
+declare void @ext()
+)";
+
+// The number of functions of MakeViolationsIr, enough for the checks to be
+// split between threads.
+constexpr int kNumCheckedFunctions = 300;
+
+// Returns IR where function i ignores the return value of @may_fail and
+// then of @may_also_fail if i % 3 == 0, uses that of @may_fail if
+// i % 3 == 1, and ignores that of @may_also_fail if i % 3 == 2.
+std::string MakeViolationsIr() {
+  std::string ir =
+      "declare i32 @may_fail()\n"
+      "declare i32 @may_also_fail()\n";
+  for (int i = 0; i < kNumCheckedFunctions; ++i) {
+    ir += "define i32 @f" + std::to_string(i) + "() {\n";
+    switch (i % 3) {
+      case 0:
+        ir += "  call i32 @may_fail()\n  call i32 @may_also_fail()\n";
+        ir += "  ret i32 0\n";
+        break;
+      case 1:
+        ir += "  %r = call i32 @may_fail()\n  ret i32 %r\n";
+        break;
+      default:
+        ir += "  call i32 @may_also_fail()\n  ret i32 0\n";
+    }
+    ir += "}\n";
+  }
+  return ir;
+}
+
+// Runs the passes of a GetSpecifications request without an LLM on
+// MakeViolationsIr, on num_threads threads, and returns the violations
+// reported as "parent_function callee".
+std::vector<std::string> FindViolations(int num_threads) {
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> module =
+      llvm::parseAssemblyString(MakeViolationsIr(), err, context);
+  if (!module) err.print("error-blocks-pass-test", llvm::errs());
+  EXPECT_TRUE(module);
+  if (!module) return {};
+
+  GetSpecificationsRequest request;
+  for (const char *name : {"may_fail", "may_also_fail"}) {
+    Specification *specification = request.add_initial_specifications();
+    specification->mutable_function()->set_source_name(name);
+    specification->mutable_function()->set_llvm_name(name);
+    specification->set_lattice_element(
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO);
+  }
+  ErrorBlocksPass *error_blocks = new ErrorBlocksPass();
+  error_blocks->SetSpecificationsRequest(request);
+  llvm::legacy::PassManager pass_manager;
+  pass_manager.add(new CallGraphPass());
+  pass_manager.add(new ReturnPropagationPass());
+  pass_manager.add(new ReturnConstraintsPass());
+  pass_manager.add(error_blocks);
+  tbb::task_arena arena(num_threads);
+  arena.execute([&pass_manager, &module] { pass_manager.run(*module); });
+
+  const GetSpecificationsResponse response = error_blocks->GetSpecifications();
+  std::vector<std::string> violations;
+  for (const Violation &violation : response.violations()) {
+    EXPECT_EQ(violation.violation_type(),
+              ViolationType::VIOLATION_TYPE_UNUSED_RETURN_VALUE);
+    violations.push_back(violation.parent_function().source_name() + " " +
+                         violation.specification().function().source_name());
+  }
+  return violations;
+}
+
+}  // namespace
+
+// A pass that is never run, whose LLM scheduling state the tests set up.
+class ErrorBlocksPassTest : public ::testing::Test {
+ protected:
+  // Records that caller calls callee at call_sites call sites, and whether
+  // it checks the callee's return value.
+  void AddCall(const std::string &caller, const std::string &callee,
+               uint64_t call_sites, bool constrained) {
+    ErrorBlocksPass::CalleeSignals &signals =
+        pass_.callee_signals_[caller][callee];
+    signals.call_sites += call_sites;
+    signals.constrained = signals.constrained || constrained;
+    if (call_sites > 0) pass_.callers_[callee].insert(caller);
+  }
+
+  void SetContextTokenBudget(uint64_t budget) {
+    pass_.llm_context_token_budget_ = budget;
+  }
+
+  // Returns the names of the context specifications of a query about
+  // callers, out of those of names, each costing kTokensPerSpecification
+  // tokens plus a token per four bytes of its name.
+  std::vector<std::string> SelectContext(
+      const std::unordered_set<std::string> &callers,
+      std::vector<std::string> names) {
+    std::vector<Specification> specifications;
+    for (const std::string &name : names) {
+      Specification specification;
+      specification.mutable_function()->set_source_name(name);
+      specifications.push_back(specification);
+    }
+    pass_.SelectLlmContext(callers, kTokensPerSpecification, &specifications,
+                           &names);
+    EXPECT_EQ(specifications.size(), names.size());
+    for (size_t i = 0; i < specifications.size(); ++i) {
+      EXPECT_EQ(specifications[i].function().source_name(), names[i]);
+    }
+    return names;
+  }
+
+  // Parses kBudgetIr and gives the pass a language model to estimate the
+  // tokens of queries with.
+  void ParseBudgetModule() {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(kBudgetIr, err, context_);
+    if (!module_) err.print("error-blocks-pass-test", llvm::errs());
+    ASSERT_TRUE(module_);
+    pass_.language_model_ = &language_model_;
+  }
+
+  // Returns the functions named by names.
+  std::vector<llvm::Function *> Functions(
+      const std::vector<std::string> &names) {
+    std::vector<llvm::Function *> functions;
+    for (const std::string &name : names) {
+      functions.push_back(module_->getFunction(name));
+    }
+    return functions;
+  }
+
+  // Ranks the functions of sccs, given by name in bottom-up order, and
+  // returns the names of the candidates by decreasing value.
+  std::vector<std::string> Rank(
+      const std::vector<std::vector<std::string>> &sccs) {
+    std::vector<std::vector<llvm::Function *>> scc_functions;
+    for (const auto &scc : sccs) scc_functions.push_back(Functions(scc));
+    pass_.RankLlmCandidates(scc_functions);
+    std::vector<std::string> names;
+    for (const auto &candidate : pass_.llm_candidates_) {
+      names.push_back(candidate.name);
+    }
+    return names;
+  }
+
+  double Value(const std::string &name) {
+    return pass_.llm_candidates_[Index(name)].value;
+  }
+
+  void SetEstimatedTokens(const std::string &name, uint64_t tokens) {
+    pass_.llm_candidates_[Index(name)].estimated_tokens = tokens;
+  }
+
+  void SetQueryBudget(uint64_t queries, uint64_t tokens) {
+    pass_.llm_query_budget_ = queries;
+    pass_.llm_token_budget_ = tokens;
+  }
+
+  // Returns the names of the functions of to_expand admitted once the
+  // depth of depth_funcs has been analyzed.
+  std::vector<std::string> Admit(const std::vector<std::string> &depth_funcs,
+                                 const std::vector<std::string> &to_expand) {
+    std::vector<std::string> names;
+    for (const llvm::Function *func :
+         pass_.AdmitLlmQueries(Functions(depth_funcs), Functions(to_expand))) {
+      names.push_back(func->getName().str());
+    }
+    return names;
+  }
+
+  std::set<std::string> Skipped() { return pass_.llm_skipped_functions_; }
+
+  // Returns the sizes of the chunks of num_functions third-party functions,
+  // and checks that the chunks hold the functions in order.
+  std::vector<size_t> ChunkSizes(size_t num_functions, size_t chunk_size) {
+    std::vector<std::pair<std::string, std::string>> functions;
+    for (size_t i = 0; i < num_functions; ++i) {
+      functions.emplace_back("f" + std::to_string(i), "Integer");
+    }
+    std::vector<size_t> sizes;
+    size_t next = 0;
+    for (const auto &chunk :
+         ErrorBlocksPass::ChunkThirdPartyFunctions(functions, chunk_size)) {
+      sizes.push_back(chunk.size());
+      for (const auto &function : chunk) {
+        EXPECT_EQ(function, functions[next++]);
+      }
+    }
+    EXPECT_EQ(next, num_functions);
+    return sizes;
+  }
+
+  static constexpr uint64_t kTokensPerSpecification = 4;
+
+  ErrorBlocksPass pass_;
+  GptModel language_model_{"error-blocks-pass-test", "", {}};
+  llvm::LLVMContext context_;
+  std::unique_ptr<llvm::Module> module_;
+
+ private:
+  size_t Index(const std::string &name) {
+    return pass_.llm_candidate_indices_.at(module_->getFunction(name));
+  }
+};
+
+constexpr uint64_t ErrorBlocksPassTest::kTokensPerSpecification;
+
+// Context within the budget is kept whole, in its order.
+TEST_F(ErrorBlocksPassTest, KeepsContextWithinBudget) {
+  // Each name costs 1 + 4 tokens.
+  const std::vector<std::string> names = {"dddd", "aaaa", "cccc", "bbbb"};
+  SetContextTokenBudget(20);
+  EXPECT_EQ(SelectContext({"f"}, names), names);
+
+  SetContextTokenBudget(19);
+  EXPECT_EQ(SelectContext({"f"}, names),
+            std::vector<std::string>({"aaaa", "bbbb", "cccc"}));
+
+  SetContextTokenBudget(4);
+  EXPECT_TRUE(SelectContext({"f"}, names).empty());
+}
+
+// Direct callees rank first, then checked callees, then the most called,
+// then by name.
+TEST_F(ErrorBlocksPassTest, RanksContextByRelevance) {
+  AddCall("f", "called_1", 1, false);
+  AddCall("f", "called_2", 2, false);
+  AddCall("f", "checked1", 1, true);
+  AddCall("f", "checked0", 0, true);
+  AddCall("g", "called_3", 3, true);
+  // Each name costs 2 + 4 tokens; one of them does not fit.
+  SetContextTokenBudget(5 * 6);
+  EXPECT_EQ(SelectContext({"f"}, {"unrelat", "checked0", "called_1",
+                                  "called_3", "checked1", "called_2"}),
+            std::vector<std::string>({"checked1", "called_2", "called_1",
+                                      "checked0", "called_3"}));
+}
+
+// The signals of every caller of a third-party query add up.
+TEST_F(ErrorBlocksPassTest, SumsSignalsOfCallers) {
+  AddCall("f", "called_1", 1, false);
+  AddCall("g", "called_1", 2, false);
+  AddCall("f", "called_2", 2, false);
+  AddCall("g", "checked1", 1, true);
+  SetContextTokenBudget(2 * 6);
+  EXPECT_EQ(SelectContext({"f", "g"}, {"called_2", "called_1", "checked1"}),
+            std::vector<std::string>({"checked1", "called_1"}));
+}
+
+// A name too long for the rest of the budget leaves room for shorter, less
+// relevant ones.
+TEST_F(ErrorBlocksPassTest, FillsBudgetPastLongName) {
+  AddCall("f", "aaaa", 1, false);
+  AddCall("f", "a_much_longer_name", 0, true);
+  SetContextTokenBudget(10);
+  EXPECT_EQ(SelectContext({"f"}, {"zzzz", "a_much_longer_name", "aaaa"}),
+            std::vector<std::string>({"aaaa", "zzzz"}));
+}
+
+// A function is worth its call sites and its checking callers, plus half
+// the worth of each checking caller in an earlier SCC. Ties go by name.
+TEST_F(ErrorBlocksPassTest, RanksLlmCandidatesByValue) {
+  ParseBudgetModule();
+  AddCall("top", "mid", 1, true);
+  AddCall("top", "leaf", 1, false);
+  AddCall("mid", "leaf", 2, true);
+  AddCall("mid", "helper", 3, false);
+  EXPECT_EQ(Rank({{"leaf"}, {"helper", "ext"}, {"mid"}, {"top", "unused"}}),
+            std::vector<std::string>(
+                {"leaf", "mid", "helper", "top", "unused"}));
+  EXPECT_EQ(Value("top"), 1);
+  EXPECT_EQ(Value("unused"), 1);
+  EXPECT_EQ(Value("helper"), 1 + 3);
+  EXPECT_EQ(Value("mid"), 1 + 1 + 2 + 0.5 * Value("top"));
+  EXPECT_EQ(Value("leaf"), 1 + 1 + 2 + 2 + 0.5 * Value("mid"));
+}
+
+// Callers in the same SCC pass on none of their worth.
+TEST_F(ErrorBlocksPassTest, DoesNotPropagateValueWithinScc) {
+  ParseBudgetModule();
+  AddCall("top", "mid", 1, true);
+  AddCall("mid", "top", 1, true);
+  AddCall("unused", "top", 1, true);
+  Rank({{"mid", "top"}, {"unused"}});
+  EXPECT_EQ(Value("mid"), 1 + 1 + 2);
+  EXPECT_EQ(Value("top"), 1 + 2 * (1 + 2) + 0.5 * Value("unused"));
+}
+
+// The query budget goes to the most valuable unknown functions, depth by
+// depth, and the others are skipped for good.
+TEST_F(ErrorBlocksPassTest, CutsOffQueriesAtBudget) {
+  ParseBudgetModule();
+  AddCall("top", "mid", 1, true);
+  AddCall("mid", "leaf", 2, true);
+  AddCall("mid", "helper", 1, false);
+  Rank({{"leaf", "helper"}, {"mid", "top", "unused"}});
+  SetQueryBudget(2, 0);
+
+  // Every function of the first depth was unknown, so mid, ranked between
+  // them, is held a whole query.
+  EXPECT_EQ(Admit({"leaf", "helper"}, {"leaf", "helper"}),
+            std::vector<std::string>({"leaf"}));
+  EXPECT_EQ(Skipped(), std::set<std::string>({"helper"}));
+
+  // Functions without a body cost nothing.
+  EXPECT_EQ(Admit({"mid", "top", "unused"}, {"top", "ext", "mid"}),
+            std::vector<std::string>({"ext", "mid"}));
+  EXPECT_EQ(Skipped(), std::set<std::string>({"helper", "top"}));
+}
+
+// The budget held for later candidates is the share of functions that
+// static analysis has left unknown so far.
+TEST_F(ErrorBlocksPassTest, HoldsBudgetForLaterCandidates) {
+  ParseBudgetModule();
+  AddCall("top", "mid", 1, true);
+  AddCall("mid", "leaf", 2, true);
+  AddCall("mid", "helper", 1, false);
+  Rank({{"leaf", "helper"}, {"mid", "top", "unused"}});
+  SetQueryBudget(1, 0);
+
+  // One of two functions was unknown: mid is held 2/3 of a query, which
+  // leaves too little for helper.
+  EXPECT_TRUE(Admit({"leaf", "helper"}, {"helper"}).empty());
+  EXPECT_EQ(Admit({"mid", "top", "unused"}, {"mid"}),
+            std::vector<std::string>({"mid"}));
+  EXPECT_EQ(Skipped(), std::set<std::string>({"helper"}));
+}
+
+// A candidate too expensive for the rest of the token budget leaves it to
+// cheaper, less valuable ones.
+TEST_F(ErrorBlocksPassTest, FillsTokenBudgetPastExpensiveCandidate) {
+  ParseBudgetModule();
+  AddCall("top", "mid", 1, true);
+  AddCall("mid", "leaf", 2, true);
+  AddCall("mid", "helper", 1, false);
+  const std::vector<std::string> all = {"leaf", "helper", "mid", "top",
+                                        "unused"};
+  Rank({all});
+  SetEstimatedTokens("leaf", 100);
+  SetEstimatedTokens("mid", 500);
+  SetEstimatedTokens("helper", 200);
+  SetEstimatedTokens("top", 50);
+  SetEstimatedTokens("unused", 50);
+  SetQueryBudget(0, 400);
+
+  EXPECT_EQ(Admit(all, all),
+            std::vector<std::string>({"leaf", "helper", "top", "unused"}));
+  EXPECT_EQ(Skipped(), std::set<std::string>({"mid"}));
+}
+
+// Chunks are full but for the last, which holds the rest.
+TEST_F(ErrorBlocksPassTest, ChunksThirdPartyFunctions) {
+  EXPECT_EQ(ChunkSizes(128, 64), std::vector<size_t>({64, 64}));
+  EXPECT_EQ(ChunkSizes(129, 64), std::vector<size_t>({64, 64, 1}));
+  EXPECT_EQ(ChunkSizes(127, 64), std::vector<size_t>({64, 63}));
+  EXPECT_EQ(ChunkSizes(5, 64), std::vector<size_t>({5}));
+  EXPECT_EQ(ChunkSizes(3, 1), std::vector<size_t>({1, 1, 1}));
+  EXPECT_TRUE(ChunkSizes(0, 64).empty());
+}
+
+// Violations are reported in module order, and within a function in
+// instruction order, whatever the number of threads.
+TEST(ErrorBlocksPassViolationsTest, ReportsViolationsInStableOrder) {
+  std::vector<std::string> expected;
+  for (int i = 0; i < kNumCheckedFunctions; ++i) {
+    const std::string parent = "f" + std::to_string(i);
+    if (i % 3 == 0) expected.push_back(parent + " may_fail");
+    if (i % 3 != 1) expected.push_back(parent + " may_also_fail");
+  }
+  for (int num_threads : {1, 2, 8, 1, 8}) {
+    EXPECT_EQ(FindViolations(num_threads), expected)
+        << num_threads << " threads";
+  }
+}
+
+}  // namespace error_specifications
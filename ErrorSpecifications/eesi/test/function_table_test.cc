@@ -0,0 +1,200 @@
+// Tests interning names and files in FunctionTable, and looking up the
+// functions, callees and blocks of a module in it.
+
+#include "eesi/include/function_table.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace error_specifications {
+
+namespace {
+
+// @open and @open.1 are both open, from a.c, and @open.1 calls an intrinsic
+// and a function pointer; @log_msg returns nothing, in b.c; @nodebug has no
+// debug info; @ext is only declared.
+const char kIr[] = R"(
+define i32 @open(i32 %x) !dbg !10 {
+entry:
+  %c = icmp eq i32 %x, 0, !dbg !11
+  br i1 %c, label %zero, label %other, !dbg !11
+
+zero:
+  call void @log_msg(), !dbg !12
+  ret i32 0, !dbg !12
+
+other:
+  %r = call i32 @ext(), !dbg !13
+  ret i32 %r, !dbg !13
+}
+
+define internal i32 @open.1() !dbg !20 {
+  %p = call i8* @llvm.stacksave(), !dbg !21
+  %f = load i32 ()*, i32 ()** null, !dbg !21
+  %r = call i32 %f(), !dbg !21
+  ret i32 %r, !dbg !21
+}
+
+define void @log_msg() !dbg !30 {
+  ret void, !dbg !31
+}
+
+define i32* @nodebug() {
+  ret i32* null
+}
+
+declare i32 @ext()
+
+declare i8* @llvm.stacksave()
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!1}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !2,
+                             emissionKind: FullDebug)
+!1 = !{i32 2, !"Debug Info Version", i32 3}
+!2 = !DIFile(filename: "a.c", directory: "/src")
+!3 = !DISubroutineType(types: !{})
+!4 = !DIFile(filename: "b.c", directory: "/src")
+!10 = distinct !DISubprogram(name: "open", scope: !2, file: !2, line: 1,
+                             type: !3, unit: !0, spFlags: DISPFlagDefinition)
+!11 = !DILocation(line: 2, scope: !10)
+!12 = !DILocation(line: 3, scope: !10)
+!13 = !DILocation(line: 4, scope: !10)
+!20 = distinct !DISubprogram(name: "open", scope: !2, file: !2, line: 8,
+                             type: !3, unit: !0, spFlags:
+                             DISPFlagLocalToUnit | DISPFlagDefinition)
+!21 = !DILocation(line: 9, scope: !20)
+!30 = distinct !DISubprogram(name: "log_msg", scope: !4, file: !4, line: 1,
+                             type: !3, unit: !0, spFlags: DISPFlagDefinition)
+!31 = !DILocation(line: 2, scope: !30)
+)";
+
+class FunctionTableTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(kIr, err, context_);
+    if (!module_) err.print("function-table-test", llvm::errs());
+    ASSERT_TRUE(module_);
+    call_graph_.runOnModule(*module_);
+    table_.AddFunctions(call_graph_);
+  }
+
+  const llvm::Function &Function(const std::string &llvm_name) {
+    return *module_->getFunction(llvm_name);
+  }
+
+  // Returns the calls of the function named llvm_name, in order.
+  std::vector<const llvm::CallInst *> Calls(const std::string &llvm_name) {
+    std::vector<const llvm::CallInst *> calls;
+    for (const llvm::Instruction &inst :
+         llvm::instructions(Function(llvm_name))) {
+      if (const auto *call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+        calls.push_back(call);
+      }
+    }
+    return calls;
+  }
+
+  llvm::LLVMContext context_;
+  std::unique_ptr<llvm::Module> module_;
+  CallGraphPass call_graph_;
+  FunctionTable table_;
+};
+
+}  // namespace
+
+TEST(FunctionTableInternTest, InternsNamesAndFiles) {
+  FunctionTable table;
+  EXPECT_EQ(table.InternName("f"), 0u);
+  EXPECT_EQ(table.InternName("g"), 1u);
+  EXPECT_EQ(table.InternName("f"), 0u);
+  EXPECT_EQ(table.NumNames(), 2u);
+  EXPECT_EQ(table.FindName("g"), 1u);
+  EXPECT_EQ(table.FindName("h"), FunctionTable::kNoName);
+  EXPECT_EQ(table.GetName(1), "g");
+  EXPECT_EQ(table.GetName(FunctionTable::kNoName), "");
+
+  EXPECT_EQ(table.InternFile("a.c"), 0u);
+  EXPECT_EQ(table.InternFile(""), 1u);
+  EXPECT_EQ(table.InternFile("a.c"), 0u);
+  EXPECT_EQ(table.NumFiles(), 2u);
+  EXPECT_EQ(table.GetFile(1), "");
+}
+
+// Functions of the same source name share its ID.
+TEST_F(FunctionTableTest, LooksUpFunctions) {
+  const FunctionTable::FunctionInfo &open = table_.GetInfo(Function("open"));
+  EXPECT_EQ(table_.GetName(open.name), "open");
+  EXPECT_EQ(table_.FindName("open"), open.name);
+  EXPECT_EQ(table_.GetNameId(Function("open.1")), open.name);
+  EXPECT_EQ(open.return_type, FunctionReturnType::FUNCTION_RETURN_TYPE_INTEGER);
+  EXPECT_EQ(table_.GetFile(open.file), "a.c");
+  EXPECT_FALSE(open.is_intrinsic);
+  EXPECT_EQ(table_.GetInfo(Function("open.1")).file, open.file);
+
+  EXPECT_TRUE(table_.IsVoid(Function("log_msg")));
+  EXPECT_FALSE(table_.IsVoid(Function("open")));
+  EXPECT_EQ(table_.GetFile(table_.GetInfo(Function("log_msg")).file), "b.c");
+  EXPECT_EQ(table_.GetInfo(Function("nodebug")).return_type,
+            FunctionReturnType::FUNCTION_RETURN_TYPE_POINTER);
+  EXPECT_EQ(table_.GetFile(table_.GetInfo(Function("nodebug")).file), "");
+  EXPECT_EQ(table_.GetFile(table_.GetInfo(Function("ext")).file), "");
+  EXPECT_TRUE(table_.GetInfo(Function("llvm.stacksave")).is_intrinsic);
+}
+
+// Every source name of the module has one ID, and the IDs are dense.
+TEST_F(FunctionTableTest, IteratesNames) {
+  std::set<std::string> names;
+  for (NameId name = 0; name < table_.NumNames(); ++name) {
+    EXPECT_EQ(table_.FindName(table_.GetName(name)), name);
+    names.insert(table_.GetName(name));
+  }
+  EXPECT_EQ(names, std::set<std::string>({"open", "log_msg", "nodebug", "ext",
+                                          "llvm"}));
+  EXPECT_EQ(names.size(), table_.NumNames());
+
+  // Names interned later follow those of the module.
+  const NameId later = table_.InternName("from_domain_knowledge");
+  EXPECT_EQ(later, names.size());
+  EXPECT_EQ(table_.NumNames(), names.size() + 1);
+}
+
+// Calls to intrinsics and through pointers have no callee name.
+TEST_F(FunctionTableTest, LooksUpCallees) {
+  const std::vector<const llvm::CallInst *> open_calls = Calls("open");
+  ASSERT_EQ(open_calls.size(), 2u);
+  EXPECT_EQ(table_.GetCalleeNameId(*open_calls[0]),
+            table_.FindName("log_msg"));
+  EXPECT_EQ(table_.GetCalleeNameId(*open_calls[1]), table_.FindName("ext"));
+
+  const std::vector<const llvm::CallInst *> open1_calls = Calls("open.1");
+  ASSERT_EQ(open1_calls.size(), 2u);
+  EXPECT_EQ(table_.GetCalleeNameId(*open1_calls[0]), FunctionTable::kNoName);
+  EXPECT_EQ(table_.GetCalleeNameId(*open1_calls[1]), FunctionTable::kNoName);
+}
+
+// Blocks are in the file of their first instruction.
+TEST_F(FunctionTableTest, LooksUpBlockAndInstructionFiles) {
+  const FileId a = table_.GetInfo(Function("open")).file;
+  for (const llvm::BasicBlock &basic_block : Function("open")) {
+    EXPECT_EQ(table_.GetBlockFile(basic_block), a);
+    EXPECT_EQ(table_.GetInstructionFile(basic_block.front()), a);
+  }
+  const llvm::BasicBlock &nodebug = Function("nodebug").getEntryBlock();
+  EXPECT_EQ(table_.GetFile(table_.GetBlockFile(nodebug)), "");
+  EXPECT_EQ(table_.NumFiles(), 3u);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,455 @@
+// Tests the throttled asynchronous GptService client against fake
+// GptService replicas served in process.
+
+#include "eesi/include/gpt_async_client.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/grpcpp/grpcpp.h"
+
+#include "metrics.h"
+#include "proto/gpt.grpc.pb.h"
+
+namespace error_specifications {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// A GptService replica whose answer to each attempt is decided by handler.
+// It counts the attempts it serves and the most it served at once.
+class FakeGptService : public GptService::Service {
+ public:
+  // Gets the request and the number of the attempt on this replica, from 0.
+  using Handler = std::function<grpc::Status(
+      const GetGptSpecificationRequest &request, int attempt)>;
+
+  explicit FakeGptService(Handler handler) : handler_(std::move(handler)) {}
+
+  grpc::Status GetGptSpecification(
+      grpc::ServerContext *context, const GetGptSpecificationRequest *request,
+      GetGptSpecificationResponse *response) override {
+    const int attempt = attempts_++;
+    const int running = ++running_;
+    int most = most_running_;
+    while (running > most &&
+           !most_running_.compare_exchange_weak(most, running)) {
+    }
+    const grpc::Status status = handler_(*request, attempt);
+    (*response->mutable_specifications())[request->function_name()] =
+        SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
+    --running_;
+    return status;
+  }
+
+  int attempts() const { return attempts_; }
+  int most_running() const { return most_running_; }
+
+ private:
+  Handler handler_;
+  std::atomic<int> attempts_{0};
+  std::atomic<int> running_{0};
+  std::atomic<int> most_running_{0};
+};
+
+// A fake replica listening on a free local port.
+class FakeReplica {
+ public:
+  explicit FakeReplica(FakeGptService::Handler handler)
+      : service_(std::move(handler)) {
+    grpc::ServerBuilder builder;
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+    address_ = "localhost:" + std::to_string(port);
+  }
+
+  ~FakeReplica() { server_->Shutdown(); }
+
+  const std::string &address() const { return address_; }
+  const FakeGptService &service() const { return service_; }
+
+ private:
+  FakeGptService service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::string address_;
+};
+
+grpc::Status Ok(const GetGptSpecificationRequest &, int) {
+  return grpc::Status::OK;
+}
+
+// Sleeps for milliseconds in the handler, then succeeds.
+FakeGptService::Handler Slow(int milliseconds) {
+  return [milliseconds](const GetGptSpecificationRequest &, int) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    return grpc::Status::OK;
+  };
+}
+
+// Returns a handler that fails the first failures attempts with code.
+FakeGptService::Handler FailFirst(int failures, grpc::StatusCode code) {
+  return [failures, code](const GetGptSpecificationRequest &, int attempt) {
+    if (attempt < failures) return grpc::Status(code, "injected failure");
+    return grpc::Status::OK;
+  };
+}
+
+// Returns the address of a port nothing listens on anymore.
+std::string DeadAddress() {
+  FakeReplica replica(Ok);
+  return replica.address();
+}
+
+// Holds calls for function "hold" for a while and answers others at once.
+grpc::Status HoldSome(const GetGptSpecificationRequest &request, int) {
+  if (request.function_name() == "hold") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  }
+  return grpc::Status::OK;
+}
+
+// Counters kept by the client, with their help texts.
+Counter &Attempts() {
+  return MetricRegistry::Get().GetCounter(
+      "eesi_llm_attempts_total",
+      "GptService attempts, retries and hedges included.");
+}
+
+Counter &Retries() {
+  return MetricRegistry::Get().GetCounter(
+      "eesi_llm_retries_total", "GptService attempts that were retries.");
+}
+
+Counter &Hedges() {
+  return MetricRegistry::Get().GetCounter(
+      "eesi_llm_hedges_total", "GptService attempts that were hedges.");
+}
+
+// Options for quick tests: no quotas, short backoffs, no hedging.
+GptClientOptions TestOptions(const std::vector<std::string> &endpoints) {
+  GptClientOptions options;
+  options.endpoints = endpoints;
+  options.max_in_flight = 0;
+  options.deadline_ms = 5000;
+  options.initial_backoff_ms = 10;
+  options.max_backoff_ms = 50;
+  return options;
+}
+
+// Starts a GetGptSpecification call for function_name on the configured
+// replicas.
+std::future<GptCallResult<GetGptSpecificationResponse>> StartCall(
+    const std::string &function_name,
+    const std::vector<std::string> &endpoints = {}) {
+  GetGptSpecificationRequest request;
+  request.set_function_name(function_name);
+  return GptAsyncClient::Get().Start<GetGptSpecificationResponse>(
+      endpoints,
+      [request](GptService::Stub *stub, grpc::ClientContext *context,
+                grpc::CompletionQueue *cq) {
+        return stub->PrepareAsyncGetGptSpecification(context, request, cq);
+      },
+      /*num_completions=*/1, /*estimated_tokens=*/100);
+}
+
+}  // namespace
+
+TEST(TokenBucketTest, ZeroRateNeverBlocks) {
+  TokenBucket bucket(0);
+  const Clock::time_point start = Clock::now();
+  for (int i = 0; i < 1000; ++i) bucket.Acquire(1000000);
+  EXPECT_LT(SecondsSince(start), 0.1);
+}
+
+// A full bucket holds a minute's worth of tokens.
+TEST(TokenBucketTest, FullBucketDoesNotBlock) {
+  TokenBucket bucket(6000);
+  const Clock::time_point start = Clock::now();
+  bucket.Acquire(3000);
+  bucket.Acquire(3000);
+  EXPECT_LT(SecondsSince(start), 0.1);
+}
+
+// Taking more than is available waits for the refill at the per-minute
+// rate: 6000 tokens per minute is 100 per second.
+TEST(TokenBucketTest, WaitsForRefill) {
+  TokenBucket bucket(6000);
+  bucket.Acquire(6000);
+  const Clock::time_point start = Clock::now();
+  bucket.Acquire(30);
+  const double waited = SecondsSince(start);
+  EXPECT_GT(waited, 0.2);
+  EXPECT_LT(waited, 1.0);
+}
+
+// Charge never waits, but its debt delays the next Acquire.
+TEST(TokenBucketTest, ChargeDelaysLaterAcquire) {
+  TokenBucket bucket(6000);
+  const Clock::time_point start = Clock::now();
+  bucket.Charge(6030);
+  EXPECT_LT(SecondsSince(start), 0.1);
+  bucket.Acquire(1);
+  const double waited = SecondsSince(start);
+  EXPECT_GT(waited, 0.2);
+  EXPECT_LT(waited, 1.0);
+}
+
+TEST(GptAsyncClientTest, CompletesCall) {
+  FakeReplica replica(Ok);
+  GptAsyncClient::Get().Configure(TestOptions({replica.address()}));
+
+  GptCallResult<GetGptSpecificationResponse> result = StartCall("foo").get();
+  ASSERT_TRUE(result.status.ok()) << result.status.error_message();
+  EXPECT_EQ(result.response.specifications().count("foo"), 1u);
+  EXPECT_EQ(replica.service().attempts(), 1);
+}
+
+// No more than max_in_flight calls reach the replicas at once, however
+// many are started.
+TEST(GptAsyncClientTest, LimitsCallsInFlight) {
+  FakeReplica replica(Slow(50));
+  GptClientOptions options = TestOptions({replica.address()});
+  options.max_in_flight = 2;
+  GptAsyncClient::Get().Configure(options);
+
+  std::vector<std::future<GptCallResult<GetGptSpecificationResponse>>> calls;
+  for (int i = 0; i < 8; ++i) {
+    calls.push_back(StartCall("f" + std::to_string(i)));
+  }
+  for (auto &call : calls) EXPECT_TRUE(call.get().status.ok());
+  EXPECT_EQ(replica.service().attempts(), 8);
+  EXPECT_EQ(replica.service().most_running(), 2);
+}
+
+// Calls wait for the requests-per-minute quota.
+TEST(GptAsyncClientTest, ThrottlesToRequestQuota) {
+  FakeReplica replica(Ok);
+  GptClientOptions options = TestOptions({replica.address()});
+  // A bucket of 60 requests that refills at one per second.
+  options.requests_per_minute = 60;
+  GptAsyncClient::Get().Configure(options);
+
+  std::vector<std::future<GptCallResult<GetGptSpecificationResponse>>> calls;
+  const Clock::time_point start = Clock::now();
+  for (int i = 0; i < 60; ++i) {
+    calls.push_back(StartCall("f" + std::to_string(i)));
+  }
+  EXPECT_LT(SecondsSince(start), 0.5);
+  calls.push_back(StartCall("over_quota"));
+  EXPECT_GT(SecondsSince(start), 0.5);
+  for (auto &call : calls) EXPECT_TRUE(call.get().status.ok());
+}
+
+TEST(GptAsyncClientTest, RetriesTransientFailures) {
+  FakeReplica replica(FailFirst(2, grpc::StatusCode::UNAVAILABLE));
+  GptAsyncClient::Get().Configure(TestOptions({replica.address()}));
+  const double retries = Retries().Value();
+
+  GptCallResult<GetGptSpecificationResponse> result = StartCall("foo").get();
+  ASSERT_TRUE(result.status.ok()) << result.status.error_message();
+  EXPECT_EQ(result.response.specifications().count("foo"), 1u);
+  EXPECT_EQ(replica.service().attempts(), 3);
+  EXPECT_EQ(Retries().Value() - retries, 2);
+}
+
+// The Python service reports a rate limited provider as
+// RESOURCE_EXHAUSTED.
+TEST(GptAsyncClientTest, RetriesRateLimitedCalls) {
+  FakeReplica replica(FailFirst(1, grpc::StatusCode::RESOURCE_EXHAUSTED));
+  GptAsyncClient::Get().Configure(TestOptions({replica.address()}));
+
+  EXPECT_TRUE(StartCall("foo").get().status.ok());
+  EXPECT_EQ(replica.service().attempts(), 2);
+}
+
+// UNKNOWN is what the Python service fails with when it raises, which it
+// would do again.
+TEST(GptAsyncClientTest, DoesNotRetryPermanentFailures) {
+  for (grpc::StatusCode code :
+       {grpc::StatusCode::UNKNOWN, grpc::StatusCode::ABORTED,
+        grpc::StatusCode::INVALID_ARGUMENT}) {
+    SCOPED_TRACE(code);
+    FakeReplica replica(FailFirst(1, code));
+    GptAsyncClient::Get().Configure(TestOptions({replica.address()}));
+
+    GptCallResult<GetGptSpecificationResponse> result = StartCall("foo").get();
+    EXPECT_EQ(result.status.error_code(), code);
+    EXPECT_EQ(replica.service().attempts(), 1);
+  }
+}
+
+TEST(GptAsyncClientTest, GivesUpAfterMaxAttempts) {
+  FakeReplica replica(FailFirst(100, grpc::StatusCode::RESOURCE_EXHAUSTED));
+  GptClientOptions options = TestOptions({replica.address()});
+  options.max_attempts = 3;
+  GptAsyncClient::Get().Configure(options);
+
+  GptCallResult<GetGptSpecificationResponse> result = StartCall("foo").get();
+  EXPECT_EQ(result.status.error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_EQ(replica.service().attempts(), 3);
+}
+
+// An attempt that outlives its deadline is retried.
+TEST(GptAsyncClientTest, RetriesAttemptsPastDeadline) {
+  FakeReplica replica([](const GetGptSpecificationRequest &, int attempt) {
+    if (attempt == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    return grpc::Status::OK;
+  });
+  GptClientOptions options = TestOptions({replica.address()});
+  options.deadline_ms = 100;
+  GptAsyncClient::Get().Configure(options);
+
+  const Clock::time_point start = Clock::now();
+  GptCallResult<GetGptSpecificationResponse> result = StartCall("foo").get();
+  ASSERT_TRUE(result.status.ok()) << result.status.error_message();
+  EXPECT_LT(SecondsSince(start), 0.5);
+  EXPECT_EQ(replica.service().attempts(), 2);
+}
+
+// Once the client has seen enough latencies, an attempt still running
+// after their p95 is duplicated, and the faster attempt answers the call.
+TEST(GptAsyncClientTest, HedgesSlowAttempts) {
+  std::shared_ptr<std::atomic<bool>> stall(new std::atomic<bool>(false));
+  FakeReplica replica([stall](const GetGptSpecificationRequest &, int) {
+    if (stall->exchange(false)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    }
+    return grpc::Status::OK;
+  });
+  GptClientOptions options = TestOptions({replica.address()});
+  options.hedge = true;
+  GptAsyncClient::Get().Configure(options);
+  const double hedges = Hedges().Value();
+
+  // Too few latencies are known for the first calls to be hedged.
+  for (int i = 0; i < 30; ++i) {
+    EXPECT_TRUE(StartCall("f" + std::to_string(i)).get().status.ok());
+  }
+  EXPECT_EQ(Hedges().Value(), hedges);
+
+  stall->store(true);
+  const double attempts = Attempts().Value();
+  const Clock::time_point start = Clock::now();
+  GptCallResult<GetGptSpecificationResponse> result = StartCall("slow").get();
+  ASSERT_TRUE(result.status.ok()) << result.status.error_message();
+  EXPECT_LT(SecondsSince(start), 0.5);
+  EXPECT_EQ(Hedges().Value() - hedges, 1);
+  EXPECT_EQ(Attempts().Value() - attempts, 2);
+}
+
+// A hedge counts against max_attempts.
+TEST(GptAsyncClientTest, DoesNotHedgeSingleAttemptCalls) {
+  std::shared_ptr<std::atomic<bool>> stall(new std::atomic<bool>(false));
+  FakeReplica replica([stall](const GetGptSpecificationRequest &, int) {
+    if (stall->exchange(false)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    }
+    return grpc::Status::OK;
+  });
+  GptClientOptions options = TestOptions({replica.address()});
+  options.hedge = true;
+  options.max_attempts = 1;
+  GptAsyncClient::Get().Configure(options);
+
+  for (int i = 0; i < 30; ++i) {
+    EXPECT_TRUE(StartCall("f" + std::to_string(i)).get().status.ok());
+  }
+  stall->store(true);
+  const double hedges = Hedges().Value();
+  EXPECT_TRUE(StartCall("slow").get().status.ok());
+  EXPECT_EQ(Hedges().Value(), hedges);
+  EXPECT_EQ(replica.service().attempts(), 31);
+}
+
+TEST(GptAsyncClientTest, BalancesRoundRobin) {
+  FakeReplica a(Ok);
+  FakeReplica b(Ok);
+  GptClientOptions options = TestOptions({a.address(), b.address()});
+  options.balancing = GptBalancing::kRoundRobin;
+  GptAsyncClient::Get().Configure(options);
+
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(StartCall("f" + std::to_string(i)).get().status.ok());
+  }
+  EXPECT_EQ(a.service().attempts(), 5);
+  EXPECT_EQ(b.service().attempts(), 5);
+}
+
+// While one replica holds a call, the others get the new ones.
+TEST(GptAsyncClientTest, BalancesToLeastOutstanding) {
+  FakeReplica a(HoldSome);
+  FakeReplica b(HoldSome);
+  GptClientOptions options = TestOptions({a.address(), b.address()});
+  options.balancing = GptBalancing::kLeastOutstanding;
+  GptAsyncClient::Get().Configure(options);
+
+  auto held = StartCall("hold");
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(StartCall("f" + std::to_string(i)).get().status.ok());
+  }
+  EXPECT_TRUE(held.get().status.ok());
+  EXPECT_EQ(std::min(a.service().attempts(), b.service().attempts()), 1);
+  EXPECT_EQ(std::max(a.service().attempts(), b.service().attempts()), 4);
+}
+
+// Calls that name replicas go to those instead of the configured ones.
+TEST(GptAsyncClientTest, UsesReplicasOfCall) {
+  FakeReplica configured(Ok);
+  FakeReplica named(Ok);
+  GptAsyncClient::Get().Configure(TestOptions({configured.address()}));
+
+  EXPECT_TRUE(StartCall("foo", {named.address()}).get().status.ok());
+  EXPECT_EQ(configured.service().attempts(), 0);
+  EXPECT_EQ(named.service().attempts(), 1);
+}
+
+// A replica that cannot be reached is ejected after ejection_failures
+// failures, and calls keep succeeding on the others without trying it.
+TEST(GptAsyncClientTest, EjectsUnreachableReplica) {
+  FakeReplica live(Ok);
+  GptClientOptions options = TestOptions({DeadAddress(), live.address()});
+  options.balancing = GptBalancing::kRoundRobin;
+  options.ejection_failures = 1;
+  GptAsyncClient::Get().Configure(options);
+  const double attempts = Attempts().Value();
+
+  for (int i = 0; i < 10; ++i) {
+    GptCallResult<GetGptSpecificationResponse> result =
+        StartCall("f" + std::to_string(i)).get();
+    EXPECT_TRUE(result.status.ok()) << result.status.error_message();
+  }
+  EXPECT_EQ(live.service().attempts(), 10);
+  // At most one attempt went to the unreachable replica.
+  EXPECT_LE(Attempts().Value() - attempts, 11);
+}
+
+// With every replica ejected, calls are still tried rather than failed.
+TEST(GptAsyncClientTest, TriesEjectedReplicaWhenNoneIsHealthy) {
+  FakeReplica replica(FailFirst(2, grpc::StatusCode::UNAVAILABLE));
+  GptClientOptions options = TestOptions({replica.address()});
+  options.ejection_failures = 1;
+  GptAsyncClient::Get().Configure(options);
+
+  EXPECT_TRUE(StartCall("foo").get().status.ok());
+  EXPECT_EQ(replica.service().attempts(), 3);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,257 @@
+// Tests how GptModel batches the queries of a call graph level and schedules
+// the batches, against the stub GptService served in process.
+
+#include "eesi/include/gpt_model.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/grpcpp/grpcpp.h"
+
+#include "proto/gpt.grpc.pb.h"
+#include "stub_gpt_service.h"
+
+namespace error_specifications {
+
+namespace {
+
+constexpr SignLatticeElement kLessThanZero =
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
+
+// The stub GptService, recording the size of each batch it gets and the
+// most batches it answered at once.
+class RecordingStubService : public GptService::Service {
+ public:
+  explicit RecordingStubService(const StubGptOptions &options)
+      : stub_(options) {}
+
+  grpc::Status GetGptSpecification(
+      grpc::ServerContext *context, const GetGptSpecificationRequest *request,
+      GetGptSpecificationResponse *response) override {
+    return stub_.GetGptSpecification(context, request, response);
+  }
+
+  grpc::Status GetGptSpecificationsBatch(
+      grpc::ServerContext *context,
+      const GetGptSpecificationsBatchRequest *request,
+      GetGptSpecificationsBatchResponse *response) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      batch_sizes_.push_back(request->requests_size());
+    }
+    const int running = ++running_;
+    int most = most_running_;
+    while (running > most &&
+           !most_running_.compare_exchange_weak(most, running)) {
+    }
+    const grpc::Status status =
+        stub_.GetGptSpecificationsBatch(context, request, response);
+    --running_;
+    return status;
+  }
+
+  // The sizes of the batches received, in ascending order.
+  std::vector<int> batch_sizes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> sizes = batch_sizes_;
+    std::sort(sizes.begin(), sizes.end());
+    return sizes;
+  }
+
+  int most_running() const { return most_running_; }
+
+ private:
+  StubGptServiceImpl stub_;
+  std::mutex mutex_;
+  std::vector<int> batch_sizes_;
+  std::atomic<int> running_{0};
+  std::atomic<int> most_running_{0};
+};
+
+// A stub replica listening on a free local port.
+class StubReplica {
+ public:
+  explicit StubReplica(const StubGptOptions &options) : service_(options) {
+    grpc::ServerBuilder builder;
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+    address_ = "localhost:" + std::to_string(port);
+  }
+
+  ~StubReplica() { server_->Shutdown(); }
+
+  const std::string &address() const { return address_; }
+  RecordingStubService &service() { return service_; }
+
+ private:
+  RecordingStubService service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::string address_;
+};
+
+// Returns queries for num_functions functions named prefix0, prefix1, ...,
+// and writes a transcript that answers each with LESS_THAN_ZERO.
+std::vector<GptSpecificationQuery> MakeLevel(const std::string &prefix,
+                                             int num_functions,
+                                             StubGptOptions *options) {
+  std::string dir_template = ::testing::TempDir() + "gpt_model_test_XXXXXX";
+  EXPECT_NE(mkdtemp(&dir_template[0]), nullptr);
+  options->transcript_file = dir_template + "/transcript.tsv";
+  std::ofstream transcript(options->transcript_file);
+  std::vector<GptSpecificationQuery> queries;
+  for (int i = 0; i < num_functions; ++i) {
+    GptSpecificationQuery query;
+    query.function_name = prefix + std::to_string(i);
+    query.function_definition = "int " + query.function_name + "(void);";
+    transcript << query.function_name << "\t" << query.function_name
+               << "\tSIGN_LATTICE_ELEMENT_LESS_THAN_ZERO\n";
+    queries.push_back(query);
+  }
+  return queries;
+}
+
+// Options for quick tests: no quotas, no hedging, and a single attempt so
+// that failures reach GptModel.
+GptClientOptions TestOptions(const std::string &endpoint) {
+  GptClientOptions options;
+  options.endpoints = {endpoint};
+  options.max_in_flight = 0;
+  options.deadline_ms = 5000;
+  options.max_attempts = 1;
+  return options;
+}
+
+}  // namespace
+
+// A level larger than a batch is split into batches of kMaxGptBatchSize and
+// a partial one, all in flight together, and answered in query order.
+TEST(GptModelTest, BatchesLevelConcurrently) {
+  StubGptOptions options;
+  options.latency_median_ms = 200;
+  const int num_functions = 2 * kMaxGptBatchSize + 6;
+  const std::vector<GptSpecificationQuery> queries =
+      MakeLevel("batched", num_functions, &options);
+  StubReplica replica(options);
+  GptAsyncClient::Get().Configure(TestOptions(replica.address()));
+
+  GptModel model("batches-level", "tags", {replica.address()});
+  const auto results = model.GetSpecificationsBatch(queries, {}, {});
+
+  ASSERT_EQ(results.size(), queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const std::unordered_map<std::string, SignLatticeElement> expected = {
+        {queries[i].function_name, kLessThanZero}};
+    EXPECT_EQ(results[i], expected) << queries[i].function_name;
+  }
+  EXPECT_EQ(replica.service().batch_sizes(),
+            std::vector<int>({6, static_cast<int>(kMaxGptBatchSize),
+                              static_cast<int>(kMaxGptBatchSize)}));
+  EXPECT_EQ(replica.service().most_running(), 3);
+  EXPECT_EQ(model.cache_misses(), static_cast<uint64_t>(num_functions));
+}
+
+// Queries answered by an earlier batch are not sent again.
+TEST(GptModelTest, BatchesOnlyUncachedQueries) {
+  StubGptOptions options;
+  const std::vector<GptSpecificationQuery> queries =
+      MakeLevel("cached", 10, &options);
+  StubReplica replica(options);
+  GptAsyncClient::Get().Configure(TestOptions(replica.address()));
+
+  GptModel model("batches-uncached", "tags", {replica.address()});
+  model.GetSpecificationsBatch(
+      std::vector<GptSpecificationQuery>(queries.begin(), queries.begin() + 4),
+      {}, {});
+  const auto results = model.GetSpecificationsBatch(queries, {}, {});
+
+  ASSERT_EQ(results.size(), queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    EXPECT_EQ(results[i].at(queries[i].function_name), kLessThanZero);
+  }
+  EXPECT_EQ(replica.service().batch_sizes(), std::vector<int>({4, 6}));
+  EXPECT_EQ(model.cache_hits(), 4u);
+}
+
+// A failed query leaves only its own result empty, and is asked again by
+// the next batch instead of being answered from the cache.
+TEST(GptModelTest, RetriesFailedQueriesOfBatch) {
+  StubGptOptions options;
+  options.error_rate = 0.5;
+  options.seed = 7;
+  const std::vector<GptSpecificationQuery> queries =
+      MakeLevel("failing", 20, &options);
+  StubReplica replica(options);
+  GptAsyncClient::Get().Configure(TestOptions(replica.address()));
+
+  GptModel model("retries-failed", "tags", {replica.address()});
+  const auto first = model.GetSpecificationsBatch(queries, {}, {});
+  ASSERT_EQ(first.size(), queries.size());
+  int failed = 0;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (first[i].empty()) {
+      ++failed;
+    } else {
+      EXPECT_EQ(first[i].at(queries[i].function_name), kLessThanZero);
+    }
+  }
+  ASSERT_GT(failed, 0);
+  ASSERT_LT(failed, static_cast<int>(queries.size()));
+
+  model.GetSpecificationsBatch(queries, {}, {});
+  EXPECT_EQ(model.cache_hits(), queries.size() - failed);
+  EXPECT_EQ(replica.service().batch_sizes(),
+            std::vector<int>({failed, static_cast<int>(queries.size())}));
+}
+
+// Empty answers are asked again rather than answered from the cache, by
+// single queries and by batches alike.
+TEST(GptModelTest, DoesNotCacheEmptyAnswers) {
+  StubGptOptions options;
+  // Functions missing from the transcript are answered by a rule, which
+  // leaves some of them unanswered.
+  MakeLevel("transcribed", 0, &options);
+  StubReplica replica(options);
+  GptAsyncClient::Get().Configure(TestOptions(replica.address()));
+
+  GptModel model("empty-answers", "tags", {replica.address()});
+  std::vector<GptSpecificationQuery> queries;
+  std::vector<bool> answered;
+  for (int i = 0; i < 16; ++i) {
+    GptSpecificationQuery query;
+    query.function_name = "ruled" + std::to_string(i);
+    answered.push_back(
+        !model.GetSpecificationAsync(query.function_name, {}, {}, {}, "")
+             .get()
+             .empty());
+    queries.push_back(query);
+  }
+  const int num_answered = std::count(answered.begin(), answered.end(), true);
+  ASSERT_GT(num_answered, 0);
+  ASSERT_LT(num_answered, static_cast<int>(queries.size()));
+
+  const auto results = model.GetSpecificationsBatch(queries, {}, {});
+  for (size_t i = 0; i < queries.size(); ++i) {
+    EXPECT_EQ(results[i].empty(), !answered[i]) << queries[i].function_name;
+  }
+  EXPECT_EQ(model.cache_hits(), static_cast<uint64_t>(num_answered));
+  EXPECT_EQ(replica.service().batch_sizes(),
+            std::vector<int>({static_cast<int>(queries.size()) -
+                              num_answered}));
+
+  model.GetSpecificationsBatch(queries, {}, {});
+  EXPECT_EQ(model.cache_hits(), static_cast<uint64_t>(2 * num_answered));
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,192 @@
+// Tests the cache of GptService responses and the keys it is indexed by.
+
+#include "eesi/include/llm_response_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "gpt_model.h"
+#include "proto/gpt.grpc.pb.h"
+
+namespace error_specifications {
+
+namespace {
+
+constexpr SignLatticeElement kZero =
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
+constexpr SignLatticeElement kTop =
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
+
+GetGptSpecificationResponse MakeResponse(const std::string &function_name,
+                                         SignLatticeElement element) {
+  GetGptSpecificationResponse response;
+  (*response.mutable_specifications())[function_name] = element;
+  return response;
+}
+
+GetGptSpecificationRequest MakeRequest() {
+  GetGptSpecificationRequest request;
+  request.set_llm_name("model-a");
+  request.set_ctags_file("tags");
+  request.set_function_name("foo");
+  Specification *specification = request.add_error_specifications();
+  specification->mutable_function()->set_source_name("bar");
+  specification->set_lattice_element(
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO);
+  (*request.mutable_error_code_names())["EINVAL"] =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
+  return request;
+}
+
+}  // namespace
+
+TEST(LlmResponseCacheTest, HitsAndMisses) {
+  LlmResponseCache &cache = LlmResponseCache::Get();
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+
+  GetGptSpecificationResponse response;
+  EXPECT_FALSE(cache.Lookup("hits-and-misses", &response));
+  EXPECT_EQ(cache.misses(), misses + 1);
+
+  cache.Insert("hits-and-misses", MakeResponse("foo", kZero));
+  ASSERT_TRUE(cache.Lookup("hits-and-misses", &response));
+  EXPECT_EQ(cache.hits(), hits + 1);
+  EXPECT_EQ(response.specifications().at("foo"), kZero);
+
+  // A later insert replaces the response.
+  cache.Insert("hits-and-misses", MakeResponse("foo", kTop));
+  ASSERT_TRUE(cache.Lookup("hits-and-misses", &response));
+  EXPECT_EQ(response.specifications().at("foo"), kTop);
+  EXPECT_EQ(cache.hits(), hits + 2);
+  EXPECT_EQ(cache.misses(), misses + 1);
+}
+
+// Responses are appended to the cache file, and Open loads the lines it
+// finds there, skipping any cut short.
+TEST(LlmResponseCacheTest, LoadsCacheFile) {
+  std::string dir_template = ::testing::TempDir() + "llm_cache_XXXXXX";
+  ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+  const std::string cache_file = dir_template + "/responses";
+
+  LlmResponseCache &cache = LlmResponseCache::Get();
+  cache.Open(cache_file);
+  cache.Insert("appended", MakeResponse("foo", kZero));
+  {
+    std::ifstream ifs(cache_file);
+    std::string line;
+    ASSERT_TRUE(std::getline(ifs, line));
+    EXPECT_EQ(line.substr(0, line.find('\t')), "appended");
+  }
+
+  // A response written by an earlier run, and a line cut short by a crash.
+  std::string serialized;
+  ASSERT_TRUE(MakeResponse("bar", kTop).SerializeToString(&serialized));
+  {
+    std::ofstream ofs(cache_file, std::ios::app);
+    ofs << "earlier-run\t";
+    for (unsigned char byte : serialized) {
+      ofs << "0123456789abcdef"[byte >> 4] << "0123456789abcdef"[byte & 0xf];
+    }
+    ofs << "\ncut-short\t0";
+  }
+
+  GetGptSpecificationResponse response;
+  EXPECT_FALSE(cache.Lookup("earlier-run", &response));
+  cache.Open(cache_file);
+  ASSERT_TRUE(cache.Lookup("earlier-run", &response));
+  EXPECT_EQ(response.specifications().at("bar"), kTop);
+  ASSERT_TRUE(cache.Lookup("appended", &response));
+  EXPECT_EQ(response.specifications().at("foo"), kZero);
+  EXPECT_FALSE(cache.Lookup("cut-short", &response));
+
+  cache.Open("");
+  std::remove(cache_file.c_str());
+  rmdir(dir_template.c_str());
+}
+
+TEST(LlmResponseCacheTest, KeyIsDeterministic) {
+  const std::string key = GptModel::GetCacheKey(MakeRequest());
+  EXPECT_FALSE(key.empty());
+  EXPECT_EQ(GptModel::GetCacheKey(MakeRequest()), key);
+}
+
+// Every input that shapes the prompt, the model included, changes the key.
+TEST(LlmResponseCacheTest, KeyDependsOnModelAndPrompt) {
+  const std::string key = GptModel::GetCacheKey(MakeRequest());
+
+  GetGptSpecificationRequest request = MakeRequest();
+  request.set_llm_name("model-b");
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  request = MakeRequest();
+  request.set_function_name("foo2");
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  request = MakeRequest();
+  request.set_ctags_file("other-tags");
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  request = MakeRequest();
+  request.set_function_definition("int foo(void) { return -1; }");
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  request = MakeRequest();
+  request.mutable_error_specifications(0)->set_lattice_element(
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  request = MakeRequest();
+  (*request.mutable_success_code_names())["OK"] =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+
+  // Field boundaries are part of the key.
+  request = MakeRequest();
+  request.set_llm_name("model-atags");
+  request.set_ctags_file("");
+  EXPECT_NE(GptModel::GetCacheKey(request), key);
+}
+
+// The order of the context specifications does not reach the prompt, so it
+// does not change the key.
+TEST(LlmResponseCacheTest, KeyIgnoresSpecificationOrder) {
+  GetGptSpecificationRequest request = MakeRequest();
+  Specification *specification = request.add_error_specifications();
+  specification->mutable_function()->set_source_name("baz");
+  specification->set_lattice_element(
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO);
+
+  GetGptSpecificationRequest reversed = request;
+  reversed.mutable_error_specifications()->SwapElements(0, 1);
+  EXPECT_EQ(GptModel::GetCacheKey(reversed), GptModel::GetCacheKey(request));
+}
+
+TEST(LlmResponseCacheTest, ThirdPartyKeyDependsOnModelAndFunctions) {
+  GetGptThirdPartySpecificationsRequest request;
+  request.set_llm_name("model-a");
+  (*request.mutable_function_names())["malloc"] = "libc";
+  const std::string key = GptModel::GetCacheKey(request);
+  EXPECT_FALSE(key.empty());
+
+  GetGptThirdPartySpecificationsRequest other = request;
+  other.set_llm_name("model-b");
+  EXPECT_NE(GptModel::GetCacheKey(other), key);
+
+  other = request;
+  (*other.mutable_function_names())["free"] = "libc";
+  EXPECT_NE(GptModel::GetCacheKey(other), key);
+
+  // Requests of the two kinds never share a key.
+  GetGptSpecificationRequest single;
+  single.set_llm_name("model-a");
+  EXPECT_NE(GptModel::GetCacheKey(single), key);
+}
+
+}  // namespace error_specifications
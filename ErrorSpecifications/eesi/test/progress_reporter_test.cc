@@ -0,0 +1,110 @@
+// Tests the counters, publication rate and ETA of ProgressReporter.
+
+#include "eesi/include/progress_reporter.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// An interval no test runs long enough to reach.
+constexpr std::chrono::milliseconds kNever = std::chrono::hours(1);
+
+}  // namespace
+
+TEST(ProgressReporterTest, CountsWork) {
+  ProgressReporter reporter(nullptr, kNever);
+  reporter.SetCurrentPass("ErrorBlocksPass");
+  reporter.SetSccsTotal(10);
+  reporter.IncrementSccsProcessed();
+  reporter.IncrementSccsProcessed();
+  reporter.IncrementFunctionsAnalyzed();
+  reporter.IncrementLlmCallsIssued();
+  reporter.IncrementLlmCallsIssued(4);
+  reporter.IncrementLlmCallsCompleted(3);
+  reporter.SetLlmContextTokenBudget(512);
+  reporter.AddLlmContextSelection(5, 2);
+  reporter.AddLlmContextSelection(1, 0);
+  reporter.IncrementLlmQueriesSkipped(7);
+
+  const GetSpecificationsMetadata metadata = reporter.Snapshot();
+  EXPECT_EQ(metadata.current_pass(), "ErrorBlocksPass");
+  EXPECT_EQ(metadata.sccs_total(), 10u);
+  EXPECT_EQ(metadata.sccs_processed(), 2u);
+  EXPECT_EQ(metadata.functions_analyzed(), 1u);
+  EXPECT_EQ(metadata.llm_calls_issued(), 5u);
+  EXPECT_EQ(metadata.llm_calls_completed(), 3u);
+  EXPECT_EQ(metadata.llm_context_token_budget(), 512u);
+  EXPECT_EQ(metadata.llm_context_specifications_kept(), 6u);
+  EXPECT_EQ(metadata.llm_context_specifications_dropped(), 2u);
+  EXPECT_EQ(metadata.llm_queries_skipped(), 7u);
+
+  // A new SCC total restarts the SCC count.
+  reporter.SetSccsTotal(3);
+  EXPECT_EQ(reporter.Snapshot().sccs_processed(), 0u);
+}
+
+// Counter updates are published at most once per interval, while pass
+// changes and SCC totals are always published.
+TEST(ProgressReporterTest, LimitsPublicationRate) {
+  std::vector<GetSpecificationsMetadata> published;
+  const auto record = [&published](const GetSpecificationsMetadata &m) {
+    published.push_back(m);
+  };
+
+  ProgressReporter limited(record, kNever);
+  for (int i = 0; i < 100; ++i) limited.IncrementFunctionsAnalyzed();
+  EXPECT_TRUE(published.empty());
+  limited.SetCurrentPass("ReturnRangePass");
+  limited.SetSccsTotal(1);
+  ASSERT_EQ(published.size(), 2u);
+  EXPECT_EQ(published[0].current_pass(), "ReturnRangePass");
+  EXPECT_EQ(published[0].functions_analyzed(), 100u);
+  EXPECT_EQ(published[1].sccs_total(), 1u);
+
+  published.clear();
+  ProgressReporter unlimited(record, std::chrono::milliseconds(0));
+  for (int i = 0; i < 3; ++i) unlimited.IncrementLlmCallsIssued();
+  ASSERT_EQ(published.size(), 3u);
+  EXPECT_EQ(published[2].llm_calls_issued(), 3u);
+
+  published.clear();
+  ProgressReporter periodic(record, std::chrono::milliseconds(20));
+  periodic.IncrementFunctionsAnalyzed();
+  EXPECT_TRUE(published.empty());
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  periodic.IncrementFunctionsAnalyzed();
+  periodic.IncrementFunctionsAnalyzed();
+  ASSERT_EQ(published.size(), 1u);
+  EXPECT_EQ(published[0].functions_analyzed(), 2u);
+}
+
+// The ETA extrapolates the time per SCC since the SCC total was set over
+// the SCCs left, and is negative until an SCC is done.
+TEST(ProgressReporterTest, EstimatesTimeRemaining) {
+  ProgressReporter reporter(nullptr, kNever);
+  EXPECT_LT(reporter.Snapshot().eta_seconds(), 0);
+
+  // Time before the SCC total is set only counts as elapsed.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  reporter.SetSccsTotal(4);
+  EXPECT_LT(reporter.Snapshot().eta_seconds(), 0);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  reporter.IncrementSccsProcessed();
+  const GetSpecificationsMetadata metadata = reporter.Snapshot();
+  EXPECT_GE(metadata.elapsed_seconds(), 0.07);
+  // Three SCCs left at 20ms or more each, but not the 50ms before.
+  EXPECT_GE(metadata.eta_seconds(), 0.06);
+  EXPECT_LE(metadata.eta_seconds(), 3 * (metadata.elapsed_seconds() - 0.05));
+
+  for (int i = 0; i < 3; ++i) reporter.IncrementSccsProcessed();
+  EXPECT_EQ(reporter.Snapshot().eta_seconds(), 0);
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,158 @@
+// Checks the SignLattice tables against the bitset encodings they replaced,
+// on every pair of elements.
+
+#include "eesi/include/constraint.h"
+
+#include <bitset>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// The encodings of the previous implementation, by element from bottom to
+// top. The meet of two elements is the element whose meet row is the AND of
+// theirs, and likewise for the join. Column i, counted from the left, is
+// the element i.
+const char *const kMeetRows[] = {"10000000", "11000000", "10100000",
+                                 "10010000", "11011000", "10110100",
+                                 "11100010", "11111111"};
+const char *const kJoinRows[] = {"11111111", "01001011", "00100111",
+                                 "00011101", "00001001", "00000101",
+                                 "00000011", "00000001"};
+
+std::vector<SignLatticeElement> Elements() {
+  std::vector<SignLatticeElement> elements;
+  for (int e = SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+       e <= SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP; ++e) {
+    elements.push_back(static_cast<SignLatticeElement>(e));
+  }
+  return elements;
+}
+
+std::bitset<8> Row(const char *const rows[], SignLatticeElement x) {
+  return std::bitset<8>(
+      rows[x - SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM]);
+}
+
+// Returns the element whose row in rows is row, or INVALID if none is.
+SignLatticeElement Decode(const char *const rows[], std::bitset<8> row) {
+  for (SignLatticeElement e : Elements()) {
+    if (Row(rows, e) == row) return e;
+  }
+  return SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID;
+}
+
+SignLatticeElement LegacyMeet(SignLatticeElement x, SignLatticeElement y) {
+  return Decode(kMeetRows, Row(kMeetRows, x) & Row(kMeetRows, y));
+}
+
+SignLatticeElement LegacyJoin(SignLatticeElement x, SignLatticeElement y) {
+  return Decode(kJoinRows, Row(kJoinRows, x) & Row(kJoinRows, y));
+}
+
+bool LegacyIsLessThan(SignLatticeElement x, SignLatticeElement y) {
+  // bitset indexes from the right.
+  return Row(kJoinRows, x)[SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP - y];
+}
+
+SignLatticeElement LegacyComplement(SignLatticeElement x) {
+  switch (x) {
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO;
+    case SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
+    default:
+      return SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+  }
+}
+
+}  // namespace
+
+TEST(SignLatticeTest, MatchesLegacyEncodings) {
+  for (SignLatticeElement x : Elements()) {
+    EXPECT_EQ(SignLattice::Complement(x), LegacyComplement(x)) << x;
+    for (SignLatticeElement y : Elements()) {
+      SCOPED_TRACE(SignLattice::lattice_element_to_string.at(x) + ", " +
+                   SignLattice::lattice_element_to_string.at(y));
+      // Every AND of two rows decoded to an element.
+      ASSERT_NE(LegacyMeet(x, y),
+                SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
+      ASSERT_NE(LegacyJoin(x, y),
+                SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID);
+      EXPECT_EQ(SignLattice::Meet(x, y), LegacyMeet(x, y));
+      EXPECT_EQ(SignLattice::Join(x, y), LegacyJoin(x, y));
+      EXPECT_EQ(SignLattice::IsLessThan(x, y), LegacyIsLessThan(x, y));
+      EXPECT_EQ(SignLattice::Difference(x, y),
+                LegacyMeet(x, LegacyComplement(y)));
+      EXPECT_EQ(SignLattice::Intersects(x, y),
+                LegacyMeet(x, y) !=
+                    SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM);
+    }
+  }
+}
+
+// A few results spelled out, in case both implementations are wrong the
+// same way.
+TEST(SignLatticeTest, ComputesKnownResults) {
+  const SignLatticeElement bottom =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM;
+  const SignLatticeElement less_than_zero =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO;
+  const SignLatticeElement greater_than_zero =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_ZERO;
+  const SignLatticeElement zero = SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO;
+  const SignLatticeElement less_than_equal_zero =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_EQUAL_ZERO;
+  const SignLatticeElement greater_than_equal_zero =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_GREATER_THAN_EQUAL_ZERO;
+  const SignLatticeElement not_zero =
+      SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO;
+  const SignLatticeElement top = SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP;
+
+  EXPECT_EQ(SignLattice::Meet(less_than_equal_zero, greater_than_equal_zero),
+            zero);
+  EXPECT_EQ(SignLattice::Meet(not_zero, greater_than_equal_zero),
+            greater_than_zero);
+  EXPECT_EQ(SignLattice::Meet(less_than_zero, greater_than_zero), bottom);
+  EXPECT_EQ(SignLattice::Join(less_than_zero, greater_than_zero), not_zero);
+  EXPECT_EQ(SignLattice::Join(less_than_zero, zero), less_than_equal_zero);
+  EXPECT_EQ(SignLattice::Join(zero, not_zero), top);
+  EXPECT_TRUE(SignLattice::IsLessThan(zero, less_than_equal_zero));
+  EXPECT_TRUE(SignLattice::IsLessThan(zero, zero));
+  EXPECT_FALSE(SignLattice::IsLessThan(less_than_equal_zero, zero));
+  EXPECT_FALSE(SignLattice::IsLessThan(less_than_zero, greater_than_zero));
+  EXPECT_EQ(SignLattice::Complement(less_than_zero), greater_than_equal_zero);
+  EXPECT_EQ(SignLattice::Difference(less_than_equal_zero, zero),
+            less_than_zero);
+  EXPECT_FALSE(SignLattice::Intersects(zero, not_zero));
+  EXPECT_TRUE(SignLattice::Intersects(top, greater_than_zero));
+}
+
+TEST(SignLatticeDeathTest, AbortsOnElementsOutsideLattice) {
+  EXPECT_DEATH(
+      SignLattice::Meet(SignLatticeElement::SIGN_LATTICE_ELEMENT_INVALID,
+                        SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP),
+      "");
+  EXPECT_DEATH(SignLattice::Complement(static_cast<SignLatticeElement>(9)),
+               "");
+  EXPECT_DEATH(
+      SignLattice::IsLessThan(SignLatticeElement::SIGN_LATTICE_ELEMENT_TOP,
+                              static_cast<SignLatticeElement>(-1)),
+      "");
+}
+
+}  // namespace error_specifications
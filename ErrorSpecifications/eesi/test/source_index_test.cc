@@ -0,0 +1,169 @@
+// Tests finding the source of functions through their debug info, at their
+// recorded paths and under the fallback directory.
+
+#include "eesi/include/source_index.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace error_specifications {
+
+namespace {
+
+const char kHelperA[] =
+    "/* a */\n"
+    "static int helper(void) {\n"
+    "  return -1;\n"
+    "}\n";
+const char kHelperB[] =
+    "static int helper(void) {\n"
+    "  return 0;\n"
+    "}\n";
+const char kDeep[] =
+    "int deep(void) {\n"
+    "  return 1;\n"
+    "}\n";
+
+void WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs << contents;
+}
+
+// Returns IR defining @helper from util.c in directory_a, @helper.1 from
+// util.c in directory_b, @deep from deep.c in directory_deep and @nodebug
+// without debug info. The subprograms start at the line of the function's
+// name and the returns are at the closing brace.
+std::string MakeIr(const std::string &directory_a,
+                   const std::string &directory_b,
+                   const std::string &directory_deep) {
+  return R"(
+define internal i32 @helper() !dbg !10 {
+  ret i32 -1, !dbg !11
+}
+
+define internal i32 @helper.1() !dbg !20 {
+  ret i32 0, !dbg !21
+}
+
+define i32 @deep() !dbg !30 {
+  ret i32 1, !dbg !31
+}
+
+define i32 @nodebug() {
+  ret i32 2
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!1}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !2,
+                             emissionKind: FullDebug)
+!1 = !{i32 2, !"Debug Info Version", i32 3}
+!2 = !DIFile(filename: "util.c", directory: ")" +
+         directory_a + R"(")
+!3 = !DISubroutineType(types: !{})
+!10 = distinct !DISubprogram(name: "helper", scope: !2, file: !2, line: 2,
+                             type: !3, unit: !0, spFlags:
+                             DISPFlagLocalToUnit | DISPFlagDefinition)
+!11 = !DILocation(line: 4, scope: !10)
+!12 = !DIFile(filename: "util.c", directory: ")" +
+         directory_b + R"(")
+!20 = distinct !DISubprogram(name: "helper", scope: !12, file: !12, line: 1,
+                             type: !3, unit: !0, spFlags:
+                             DISPFlagLocalToUnit | DISPFlagDefinition)
+!21 = !DILocation(line: 3, scope: !20)
+!22 = !DIFile(filename: "deep.c", directory: ")" +
+         directory_deep + R"(")
+!30 = distinct !DISubprogram(name: "deep", scope: !22, file: !22, line: 1,
+                             type: !3, unit: !0, spFlags: DISPFlagDefinition)
+!31 = !DILocation(line: 3, scope: !30)
+)";
+}
+
+class SourceIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::string dir_template = ::testing::TempDir() + "source_index_XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    dir_ = dir_template;
+    for (const char *subdirectory : {"/a", "/b", "/c", "/c/d"}) {
+      ASSERT_EQ(mkdir((dir_ + subdirectory).c_str(), 0755), 0);
+    }
+    WriteFile(dir_ + "/a/util.c", kHelperA);
+    WriteFile(dir_ + "/b/util.c", kHelperB);
+    WriteFile(dir_ + "/c/d/deep.c", kDeep);
+  }
+
+  // Parses MakeIr(directory_a, directory_b, directory_deep) into module_.
+  void ParseModule(const std::string &directory_a,
+                   const std::string &directory_b,
+                   const std::string &directory_deep) {
+    llvm::SMDiagnostic err;
+    module_ = llvm::parseAssemblyString(
+        MakeIr(directory_a, directory_b, directory_deep), err, context_);
+    if (!module_) err.print("source-index-test", llvm::errs());
+    ASSERT_TRUE(module_);
+  }
+
+  // Returns the source of the function named llvm_name, or "<none>".
+  std::string GetSource(SourceIndex &index, const std::string &llvm_name) {
+    std::string source;
+    if (!index.GetFunctionSource(*module_->getFunction(llvm_name), &source)) {
+      return "<none>";
+    }
+    return source;
+  }
+
+  std::string dir_;
+  llvm::LLVMContext context_;
+  std::unique_ptr<llvm::Module> module_;
+};
+
+}  // namespace
+
+// Static functions of the same name get the source of their own file.
+TEST_F(SourceIndexTest, TellsApartStaticFunctionsOfSameName) {
+  ParseModule(dir_ + "/a", dir_ + "/b", dir_ + "/c/d");
+  SourceIndex index(*module_, "");
+  EXPECT_EQ(GetSource(index, "helper"),
+            "static int helper(void) {\n  return -1;\n}\n");
+  EXPECT_EQ(GetSource(index, "helper.1"), kHelperB);
+  EXPECT_EQ(GetSource(index, "deep"), kDeep);
+  EXPECT_EQ(GetSource(index, "nodebug"), "<none>");
+}
+
+// Moved sources are found by the end of their path, even when several
+// have the same file name, or by their file name deeper in the tree.
+TEST_F(SourceIndexTest, FindsMovedSourcesUnderFallbackDirectory) {
+  ParseModule("/build/project/a", "/build/project/b", "/build/d");
+  SourceIndex index(*module_, dir_);
+  EXPECT_EQ(GetSource(index, "helper"),
+            "static int helper(void) {\n  return -1;\n}\n");
+  EXPECT_EQ(GetSource(index, "helper.1"), kHelperB);
+  EXPECT_EQ(GetSource(index, "deep"), kDeep);
+}
+
+// A file name shared by several files below the fallback directory does
+// not pick one of them.
+TEST_F(SourceIndexTest, DoesNotGuessBetweenFilesOfSameName) {
+  ParseModule("/build/elsewhere", "/build/elsewhere", "/build/d");
+  SourceIndex index(*module_, dir_);
+  EXPECT_EQ(GetSource(index, "helper"), "<none>");
+  EXPECT_EQ(GetSource(index, "helper.1"), "<none>");
+
+  SourceIndex without_fallback(*module_, "");
+  EXPECT_EQ(GetSource(without_fallback, "deep"), "<none>");
+}
+
+}  // namespace error_specifications
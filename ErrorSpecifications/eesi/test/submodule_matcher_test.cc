@@ -0,0 +1,118 @@
+// Checks SubmoduleMatcher against finding each submodule in the file name
+// with std::string::find, which it replaced.
+
+#include "eesi/include/submodule_matcher.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Compiles a matcher of submodules, whose IDs are their indices.
+void Compile(const std::vector<std::string> &submodules,
+             SubmoduleMatcher &matcher) {
+  for (const std::string &submodule : submodules) {
+    matcher.AddSubmodule(submodule);
+  }
+  matcher.Compile();
+}
+
+// The sorted IDs of the submodules that std::string::find finds.
+std::vector<SubmoduleId> FindEach(const std::vector<std::string> &submodules,
+                                  const std::string &file_name) {
+  std::vector<SubmoduleId> found;
+  for (SubmoduleId id = 0; id < submodules.size(); ++id) {
+    if (file_name.find(submodules[id]) != std::string::npos) {
+      found.push_back(id);
+    }
+  }
+  return found;
+}
+
+void ExpectMatchesFind(const std::vector<std::string> &submodules,
+                       const std::vector<std::string> &file_names) {
+  SubmoduleMatcher matcher;
+  Compile(submodules, matcher);
+  for (const std::string &file_name : file_names) {
+    EXPECT_EQ(matcher.Match(file_name), FindEach(submodules, file_name))
+        << file_name;
+  }
+}
+
+}  // namespace
+
+TEST(SubmoduleMatcherTest, NoSubmodules) {
+  SubmoduleMatcher matcher;
+  matcher.Compile();
+  EXPECT_TRUE(matcher.Match("drivers/net/e1000.c").empty());
+}
+
+TEST(SubmoduleMatcherTest, AddSubmoduleIsIdempotent) {
+  SubmoduleMatcher matcher;
+  EXPECT_EQ(matcher.AddSubmodule("fs"), 0u);
+  EXPECT_EQ(matcher.AddSubmodule("net"), 1u);
+  EXPECT_EQ(matcher.AddSubmodule("fs"), 0u);
+  EXPECT_EQ(matcher.NumSubmodules(), 2u);
+}
+
+// Submodules that overlap each other in the file name are all found.
+TEST(SubmoduleMatcherTest, OverlappingSubmodules) {
+  ExpectMatchesFind({"he", "she", "his", "hers"},
+                    {"ushers", "his", "she", "hershey", "h", "", "shis"});
+  ExpectMatchesFind({"ab", "bc", "abc", "b", "cab"},
+                    {"abc", "cabc", "xabcx", "bca", "acb", "ababab"});
+}
+
+// Submodules that are prefixes or suffixes of others are found on their
+// own, including through the fail links of the longer ones.
+TEST(SubmoduleMatcherTest, PrefixSubmodules) {
+  ExpectMatchesFind({"fs", "fs/ext", "fs/ext4", "ext4", "4"},
+                    {"fs/ext4/inode.c", "fs/ext2/inode.c", "fs/xfs/xfs.c",
+                     "drivers/ext4", "fs/ex", "f", "lib/fs"});
+  ExpectMatchesFind({"a", "aa", "aaa"}, {"", "a", "aa", "aaaa", "baab"});
+}
+
+// The empty submodule occurs in every file name.
+TEST(SubmoduleMatcherTest, EmptySubmodule) {
+  ExpectMatchesFind({"", "net"}, {"", "net/core.c", "fs/inode.c"});
+}
+
+TEST(SubmoduleMatcherTest, NonAsciiBytes) {
+  ExpectMatchesFind({"\xff", "\xc3\xa9t\xc3\xa9", "t\xc3"},
+                    {"\xff\xfe", "\xc3\xa9t\xc3\xa9.c", "ete", "t\xc3\xa9"});
+}
+
+// Random submodules and file names over a small alphabet, so that
+// submodules overlap and share prefixes and suffixes often.
+TEST(SubmoduleMatcherTest, RandomMatchesFind) {
+  std::mt19937 rng(47);
+  std::uniform_int_distribution<int> letter(0, 2);
+  auto random_string = [&](int max_length) {
+    std::string s(std::uniform_int_distribution<int>(0, max_length)(rng), 'a');
+    for (char &c : s) c = "ab/"[letter(rng)];
+    return s;
+  };
+  for (int round = 0; round < 500; ++round) {
+    std::vector<std::string> submodules;
+    const int num_submodules = std::uniform_int_distribution<int>(1, 12)(rng);
+    for (int i = 0; i < num_submodules; ++i) {
+      std::string submodule = random_string(5);
+      // IDs are only given to distinct submodules.
+      if (std::find(submodules.begin(), submodules.end(), submodule) ==
+          submodules.end()) {
+        submodules.push_back(submodule);
+      }
+    }
+    std::vector<std::string> file_names;
+    for (int i = 0; i < 20; ++i) file_names.push_back(random_string(24));
+    ExpectMatchesFind(submodules, file_names);
+  }
+}
+
+}  // namespace error_specifications
@@ -0,0 +1,101 @@
+// This file defines a stand-in for the Python GptService that needs no LLM
+// and no network. It answers from a recorded transcript, falling back to a
+// deterministic rule, after an artificial latency and with injected
+// failures. Each attempt's latency and failure are drawn from a generator
+// seeded with the seed, the request and the number of earlier attempts at
+// the same request, so a run is reproducible however its calls interleave.
+// This makes it possible to benchmark EESI's scheduling, batching and
+// caching end to end on one machine.
+
+#ifndef ERROR_SPECIFICATIONS_GPT_INCLUDE_STUB_GPT_SERVICE_H_
+#define ERROR_SPECIFICATIONS_GPT_INCLUDE_STUB_GPT_SERVICE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "include/grpcpp/grpcpp.h"
+#include "proto/gpt.grpc.pb.h"
+
+namespace error_specifications {
+
+struct StubGptOptions {
+  // Each line is "<queried function>\t<function>\t<lattice element>", with
+  // the lattice element spelled as in the proto, e.g.
+  // SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO. A query for a function is answered
+  // with all of its lines. Functions without lines are answered by rule.
+  std::string transcript_file;
+  // The latency of an answer is log-normal with this median and shape; a
+  // sigma of 0 makes it constant.
+  uint64_t latency_median_ms = 0;
+  double latency_sigma = 0;
+  // Fraction of the answers that fail with UNAVAILABLE instead.
+  double error_rate = 0;
+  uint64_t seed = 0;
+};
+
+class StubGptServiceImpl final : public GptService::Service {
+ public:
+  explicit StubGptServiceImpl(const StubGptOptions &options);
+
+  grpc::Status GetGptSpecification(
+      grpc::ServerContext *context, const GetGptSpecificationRequest *request,
+      GetGptSpecificationResponse *response) override;
+
+  grpc::Status GetGptThirdPartySpecifications(
+      grpc::ServerContext *context,
+      const GetGptThirdPartySpecificationsRequest *request,
+      GetGptThirdPartySpecificationsResponse *response) override;
+
+  grpc::Status GetGptSpecificationsBatch(
+      grpc::ServerContext *context,
+      const GetGptSpecificationsBatchRequest *request,
+      GetGptSpecificationsBatchResponse *response) override;
+
+ private:
+  // The fate of one attempt at answering a request.
+  struct Outcome {
+    std::chrono::milliseconds latency;
+    bool fail;
+  };
+
+  // Loads options_.transcript_file into transcript_.
+  void LoadTranscript();
+
+  // Draws the outcome of the next attempt at answering the request
+  // identified by key.
+  Outcome NextOutcome(const std::string &key);
+
+  // Sleeps for the outcome's latency, then returns its status. Returns
+  // early if the client gives up on the call.
+  grpc::Status Settle(grpc::ServerContext *context, const Outcome &outcome);
+
+  // Adds the answer for function_name to specifications.
+  void AnswerFunction(
+      const std::string &function_name,
+      google::protobuf::Map<std::string, SignLatticeElement> *specifications);
+
+  StubGptOptions options_;
+
+  // Queried function to the specifications answered for it.
+  std::unordered_map<std::string,
+                     std::vector<std::pair<std::string, SignLatticeElement>>>
+      transcript_;
+
+  // Guards attempts_.
+  std::mutex mutex_;
+  // Number of attempts at each request so far.
+  std::unordered_map<std::string, uint64_t> attempts_;
+};
+
+// Runs a StubGptServiceImpl on server_address until the server shuts down.
+void RunStubGptServer(const std::string &server_address,
+                      const StubGptOptions &options);
+
+}  // namespace error_specifications
+
+#endif  // ERROR_SPECIFICATIONS_GPT_INCLUDE_STUB_GPT_SERVICE_H_
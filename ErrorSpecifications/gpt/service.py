@@ -3,14 +3,17 @@
 
 from concurrent import futures
 from collections import defaultdict
+import contextlib
 from typing import Optional
 import os
 import re
 import sys
+import threading
 sys.path = [path for path in sys.path if "com_" not in path]
 
 import argparse
 import grpc
+import openai
 from openai import OpenAI
 from tenacity import (retry, wait_random, stop_after_attempt)
 
@@ -20,6 +23,8 @@ import proto.gpt_pb2
 import proto.gpt_pb2_grpc
 
 MAX_CONTEXT_LEN = 4096
+# Maximum number of functions of a batch that are sent to the model at once.
+MAX_BATCH_WORKERS = 8
 # This implementation is obviously very confusing as we are translating
 # BOTTOM to EMPTYSET. This is because currently the implementation doesn't
 # have a clean way to indicate that a lattice element is emptyset according
@@ -196,6 +201,21 @@ class SourceCodeInformation:
         self.end = end
 
 
+@contextlib.contextmanager
+def provider_errors_as_status(context):
+    """Aborts the RPC with a status that the client retries if the LLM
+    provider fails transiently: RESOURCE_EXHAUSTED when it rate limits us,
+    UNAVAILABLE when it is overloaded or unreachable. Other errors reach the
+    client as UNKNOWN, which it does not retry."""
+    try:
+        yield
+    except openai.RateLimitError as e:
+        context.abort(grpc.StatusCode.RESOURCE_EXHAUSTED,
+                      f"LLM provider rate limited: {e}")
+    except (openai.APIConnectionError, openai.InternalServerError) as e:
+        context.abort(grpc.StatusCode.UNAVAILABLE,
+                      f"LLM provider unavailable: {e}")
+
 class GptServicer(
         proto.gpt_pb2_grpc.GptServiceServicer):
     """Provides methods that implement functionality of LLama server."""
@@ -204,8 +224,13 @@ class GptServicer(
         self.client = OpenAI(
             api_key=os.environ.get("OPEN_API_KEY"))
         self.ctags = dict() 
+        # Batched requests read definitions from several threads; a ctags
+        # file must be fully parsed before any thread looks names up in it.
+        self.ctags_lock = threading.Lock()
 
-    @retry(wait=wait_random(min=5,max=10), stop=stop_after_attempt(3))
+    # Re-raises the provider's error, so that it can be reported by type.
+    @retry(wait=wait_random(min=5,max=10), stop=stop_after_attempt(3),
+           reraise=True)
     def completion_with_backoff(self, **kwargs):
         return self.client.chat.completions.create(**kwargs)
 
@@ -253,8 +278,9 @@ class GptServicer(
                     end=end)
 
     def read_function_definition(self, function_name, ctags_file):
-        if ctags_file not in self.ctags:
-            self.read_ctags(ctags_file)
+        with self.ctags_lock:
+            if ctags_file not in self.ctags:
+                self.read_ctags(ctags_file)
 
         definition_str = ""
         definition_file_name = self.ctags[ctags_file][function_name].file_name
@@ -284,6 +310,10 @@ class GptServicer(
         return reduction
 
     def GetGptThirdPartySpecifications(self, request, context):
+        with provider_errors_as_status(context):
+            return self.get_third_party_specifications(request)
+
+    def get_third_party_specifications(self, request):
         system_context = MODEL_THIRD_PARTY_CONTEXT
         if request.error_code_names:
             print("Supplied error codes for context...")
@@ -371,15 +401,22 @@ class GptServicer(
 
     def GetGptSpecification(self, request, context):
         """Returns an error specification from Gpt given a requested function."""
+        with provider_errors_as_status(context):
+            return self.get_specification(request)
+
+    def get_specification(self, request):
         formatted_error_specs = ""
         for specification in request.error_specifications:
             print(specification)
             formatted_error_specs += specification.function.source_name + ": " + LATTICE_ELEMENT_TO_STRING[specification.lattice_element] + "\n"
-        try:
-            function_definition = self.read_function_definition(request.function_name, request.ctags_file)
-        except KeyError as e:
-            print(f"Error reading function definition: {e}")
-            return proto.gpt_pb2.GetGptSpecificationResponse()
+        if request.function_definition:
+            function_definition = request.function_definition
+        else:
+            try:
+                function_definition = self.read_function_definition(request.function_name, request.ctags_file)
+            except KeyError as e:
+                print(f"Error reading function definition: {e}")
+                return proto.gpt_pb2.GetGptSpecificationResponse()
 
         if formatted_error_specs:
             print("====Error specifications for context====")
@@ -517,6 +554,25 @@ class GptServicer(
         return proto.gpt_pb2.GetGptSpecificationResponse(
             specifications=specifications)
 
+    def get_batched_specification(self, request):
+        """Answers one request of a batch. A failure is reported in its own
+        response so that it does not fail the rest of the batch."""
+        try:
+            return self.get_specification(request)
+        except Exception as e:
+            print(f"Error answering {request.function_name}: {e}")
+            return proto.gpt_pb2.GetGptSpecificationResponse(failed=True)
+
+    def GetGptSpecificationsBatch(self, request, context):
+        """Returns error specifications for several functions, answering the
+        requests concurrently. Responses keep the order of the requests."""
+        with futures.ThreadPoolExecutor(
+                max_workers=MAX_BATCH_WORKERS) as executor:
+            responses = list(executor.map(self.get_batched_specification,
+                                          request.requests))
+        return proto.gpt_pb2.GetGptSpecificationsBatchResponse(
+            responses=responses)
+
 def serve():
     parser = argparse.ArgumentParser()
     parser.add_argument(
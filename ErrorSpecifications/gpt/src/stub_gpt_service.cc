@@ -0,0 +1,229 @@
+#include "stub_gpt_service.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace error_specifications {
+
+namespace {
+
+// Granularity at which a sleeping answer notices that its call was
+// cancelled, e.g. because a hedged attempt won.
+constexpr std::chrono::milliseconds kCancellationPollInterval(10);
+
+// The specifications the rule picks from. Bottom means that the LLM did not
+// know, and is left out of the answer like the Python service does.
+constexpr SignLatticeElement kRuleAnswers[] = {
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM,
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_LESS_THAN_ZERO,
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_ZERO,
+    SignLatticeElement::SIGN_LATTICE_ELEMENT_NOT_ZERO,
+};
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037u;
+constexpr uint64_t kFnvPrime = 1099511628211u;
+
+// 64-bit FNV-1a. Unlike std::hash, it is the same on every platform and
+// every run.
+uint64_t Fnv1a(const std::string &data, uint64_t hash = kFnvOffsetBasis) {
+  for (const char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+}  // namespace
+
+StubGptServiceImpl::StubGptServiceImpl(const StubGptOptions &options)
+    : options_(options) {
+  if (!options_.transcript_file.empty()) LoadTranscript();
+}
+
+void StubGptServiceImpl::LoadTranscript() {
+  std::ifstream ifs(options_.transcript_file);
+  if (!ifs) {
+    LOG(WARNING) << "Unable to open transcript " << options_.transcript_file
+                 << "; answering every query by rule.";
+    return;
+  }
+
+  std::string line;
+  int num_entries = 0;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream fields(line);
+    std::string queried, function, lattice_element_name;
+    SignLatticeElement lattice_element;
+    if (!std::getline(fields, queried, '\t') ||
+        !std::getline(fields, function, '\t') ||
+        !std::getline(fields, lattice_element_name) ||
+        !SignLatticeElement_Parse(lattice_element_name, &lattice_element)) {
+      LOG(WARNING) << "Skipping malformed transcript line: " << line;
+      continue;
+    }
+    transcript_[queried].push_back(std::make_pair(function, lattice_element));
+    ++num_entries;
+  }
+  LOG(INFO) << "Loaded " << num_entries << " answers for "
+            << transcript_.size() << " functions from "
+            << options_.transcript_file;
+}
+
+StubGptServiceImpl::Outcome StubGptServiceImpl::NextOutcome(
+    const std::string &key) {
+  uint64_t attempt;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    attempt = attempts_[key]++;
+  }
+  std::mt19937_64 random(
+      Fnv1a(key, options_.seed ^ (attempt * 0x9e3779b97f4a7c15u)));
+
+  Outcome outcome;
+  double latency_ms = static_cast<double>(options_.latency_median_ms);
+  if (options_.latency_sigma > 0 && latency_ms > 0) {
+    std::lognormal_distribution<double> latency(std::log(latency_ms),
+                                                options_.latency_sigma);
+    latency_ms = latency(random);
+  }
+  outcome.latency = std::chrono::milliseconds(static_cast<int64_t>(latency_ms));
+  outcome.fail = std::uniform_real_distribution<double>(0, 1)(random) <
+                 options_.error_rate;
+  return outcome;
+}
+
+grpc::Status StubGptServiceImpl::Settle(grpc::ServerContext *context,
+                                        const Outcome &outcome) {
+  const auto done = std::chrono::steady_clock::now() + outcome.latency;
+  while (std::chrono::steady_clock::now() < done) {
+    if (context->IsCancelled()) {
+      return grpc::Status(grpc::StatusCode::CANCELLED, "Call cancelled.");
+    }
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(
+            kCancellationPollInterval,
+            done - std::chrono::steady_clock::now()));
+  }
+  if (outcome.fail) {
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Injected failure.");
+  }
+  return grpc::Status::OK;
+}
+
+void StubGptServiceImpl::AnswerFunction(
+    const std::string &function_name,
+    google::protobuf::Map<std::string, SignLatticeElement> *specifications) {
+  auto it = transcript_.find(function_name);
+  if (it != transcript_.end()) {
+    for (const auto &answer : it->second) {
+      (*specifications)[answer.first] = answer.second;
+    }
+    return;
+  }
+
+  const SignLatticeElement lattice_element =
+      kRuleAnswers[Fnv1a(function_name) %
+                   (sizeof(kRuleAnswers) / sizeof(kRuleAnswers[0]))];
+  if (lattice_element != SignLatticeElement::SIGN_LATTICE_ELEMENT_BOTTOM) {
+    (*specifications)[function_name] = lattice_element;
+  }
+}
+
+grpc::Status StubGptServiceImpl::GetGptSpecification(
+    grpc::ServerContext *context, const GetGptSpecificationRequest *request,
+    GetGptSpecificationResponse *response) {
+  grpc::Status status =
+      Settle(context, NextOutcome("GetGptSpecification\t" +
+                                  request->llm_name() + "\t" +
+                                  request->function_name()));
+  if (!status.ok()) return status;
+
+  AnswerFunction(request->function_name(), response->mutable_specifications());
+  return grpc::Status::OK;
+}
+
+grpc::Status StubGptServiceImpl::GetGptThirdPartySpecifications(
+    grpc::ServerContext *context,
+    const GetGptThirdPartySpecificationsRequest *request,
+    GetGptThirdPartySpecificationsResponse *response) {
+  // Map iteration order is unspecified, so identify the request by its
+  // sorted function names.
+  std::vector<std::string> function_names;
+  for (const auto &kv : request->function_names()) {
+    function_names.push_back(kv.first);
+  }
+  std::sort(function_names.begin(), function_names.end());
+  std::string key = "GetGptThirdPartySpecifications\t" + request->llm_name();
+  for (const auto &function_name : function_names) key += "\t" + function_name;
+
+  grpc::Status status = Settle(context, NextOutcome(key));
+  if (!status.ok()) return status;
+
+  for (const auto &function_name : function_names) {
+    google::protobuf::Map<std::string, SignLatticeElement> answer;
+    AnswerFunction(function_name, &answer);
+    // Only the function itself is a third-party answer.
+    auto it = answer.find(function_name);
+    if (it != answer.end()) {
+      (*response->mutable_specifications())[function_name] = it->second;
+    }
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status StubGptServiceImpl::GetGptSpecificationsBatch(
+    grpc::ServerContext *context,
+    const GetGptSpecificationsBatchRequest *request,
+    GetGptSpecificationsBatchResponse *response) {
+  // The Python service answers the requests of a batch concurrently and
+  // marks the responses of the requests that failed; so does the stub.
+  std::vector<Outcome> outcomes;
+  Outcome batch_outcome{std::chrono::milliseconds(0), false};
+  for (const auto &single_request : request->requests()) {
+    outcomes.push_back(NextOutcome("GetGptSpecification\t" +
+                                   single_request.llm_name() + "\t" +
+                                   single_request.function_name()));
+    batch_outcome.latency =
+        std::max(batch_outcome.latency, outcomes.back().latency);
+  }
+  grpc::Status status = Settle(context, batch_outcome);
+  if (!status.ok()) return status;
+
+  for (int i = 0; i < request->requests_size(); ++i) {
+    GetGptSpecificationResponse *single_response = response->add_responses();
+    if (outcomes[i].fail) {
+      single_response->set_failed(true);
+      continue;
+    }
+    AnswerFunction(request->requests(i).function_name(),
+                   single_response->mutable_specifications());
+  }
+  return grpc::Status::OK;
+}
+
+void RunStubGptServer(const std::string &server_address,
+                      const StubGptOptions &options) {
+  StubGptServiceImpl service(options);
+
+  grpc::ServerBuilder builder;
+  // Listen on the given address without any authentication mechanism.
+  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  std::cout << "Stub GPT server listening on " << server_address << std::endl;
+
+  // Wait for the server to shutdown. Note that some other thread must be
+  // responsible for shutting down the server for this call to ever return.
+  server->Wait();
+}
+
+}  // namespace error_specifications
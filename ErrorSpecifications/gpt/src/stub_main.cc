@@ -0,0 +1,38 @@
+#include "stub_gpt_service.h"
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include <glog/logging.h>
+
+#include <string>
+
+ABSL_FLAG(std::string, listen, "localhost:50059", "The address to listen on.");
+ABSL_FLAG(std::string, transcript_file, "",
+          "Recorded answers, one \"<queried function>\\t<function>\\t<lattice "
+          "element>\" per line. Functions without answers are answered by a "
+          "deterministic rule.");
+ABSL_FLAG(uint64_t, latency_median_ms, 0,
+          "Median latency of an answer, in milliseconds.");
+ABSL_FLAG(double, latency_sigma, 0,
+          "Shape of the log-normal latency distribution. 0 makes every "
+          "answer take --latency_median_ms; around 1 gives an LLM-like tail.");
+ABSL_FLAG(double, error_rate, 0,
+          "Fraction of answers that fail with UNAVAILABLE.");
+ABSL_FLAG(uint64_t, seed, 0,
+          "Seed of the latencies and failures. Runs with the same seed and "
+          "requests see the same latencies and failures.");
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging("stub-gpt-service");
+  absl::ParseCommandLine(argc, argv);
+  error_specifications::StubGptOptions options;
+  options.transcript_file = absl::GetFlag(FLAGS_transcript_file);
+  options.latency_median_ms = absl::GetFlag(FLAGS_latency_median_ms);
+  options.latency_sigma = absl::GetFlag(FLAGS_latency_sigma);
+  options.error_rate = absl::GetFlag(FLAGS_error_rate);
+  options.seed = absl::GetFlag(FLAGS_seed);
+  error_specifications::RunStubGptServer(absl::GetFlag(FLAGS_listen),
+                                         options);
+  google::FlushLogFiles(google::INFO);
+  return 0;
+}